@@ -0,0 +1,84 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2015, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#ifndef BUZZY_ARENA_H
+#define BUZZY_ARENA_H
+
+#include <libcork/core.h>
+
+
+/*-----------------------------------------------------------------------
+ * Arenas
+ */
+
+/* An arena owns everything that belongs to a single environment: the values in
+ * it, the maps and strings that those values are built from, and so on.  We
+ * allocate from an arena by bumping a pointer into a large block of memory, and
+ * we never free anything in an arena individually; instead, we free the entire
+ * arena (and everything in it) all at once.
+ *
+ * Some of the objects in an arena hold on to resources that don't live in the
+ * arena (hash tables, for instance).  Those objects register a cleanup
+ * function, and we call all of the cleanup functions (in the reverse of the
+ * order that they were registered) before we free the arena's memory. */
+
+struct bz_arena;
+
+struct bz_arena *
+bz_arena_new(void);
+
+void
+bz_arena_free(struct bz_arena *arena);
+
+/* If arena is NULL, we allocate from the heap instead, and you must pass the
+ * result to bz_arena_dealloc (or free) when you're done with it. */
+void *
+bz_arena_alloc(struct bz_arena *arena, size_t size);
+
+const char *
+bz_arena_strdup(struct bz_arena *arena, const char *str);
+
+/* Frees something that you allocated from arena, if it was allocated from the
+ * heap; does nothing otherwise. */
+void
+bz_arena_dealloc(struct bz_arena *arena, void *ptr);
+
+void
+bz_arena_strfree(struct bz_arena *arena, const char *str);
+
+/* Calls free_user_data(user_data) when we free the arena. */
+void
+bz_arena_add_cleanup(struct bz_arena *arena, void *user_data,
+                     cork_free_f free_user_data);
+
+/* The number of bytes that the arena has handed out so far. */
+size_t
+bz_arena_size(struct bz_arena *arena);
+
+
+/*-----------------------------------------------------------------------
+ * Current arena
+ */
+
+/* Each thread has a current arena, which new values (and their contents) are
+ * allocated from.  It starts off NULL, which means that new values are
+ * allocated from the heap.  You're responsible for making sure that anything
+ * that you allocate in an arena doesn't end up owned by something that
+ * outlives the arena. */
+
+struct bz_arena *
+bz_arena_current(void);
+
+/* Makes `arena` the current arena for the calling thread, and returns the
+ * previous one, which you should restore when you're done. */
+struct bz_arena *
+bz_arena_set_current(struct bz_arena *arena);
+
+
+#endif /* BUZZY_ARENA_H */
@@ -20,7 +20,9 @@
 
 #include "buzzy/distro.h"
 #include "buzzy/env.h"
+#include "buzzy/os.h"
 #include "buzzy/package.h"
+#include "buzzy/profile.h"
 #include "buzzy/repo.h"
 #include "buzzy/version.h"
 
@@ -123,6 +125,115 @@ general_parse_opt(int ch, struct cork_command *cmd)
 }
 
 
+/*-----------------------------------------------------------------------
+ * Common options: Parallel jobs
+ */
+
+CORK_ATTR_UNUSED
+static unsigned int  jobs = 1;
+
+#define JOBS_HELP_TEXT \
+"\n" \
+"Parallel build options:\n" \
+"  -j <count>, --jobs <count>\n" \
+"    Build up to <count> independent packages at the same time.  Packages\n" \
+"    are still installed one at a time.  (The default is 1.)\n" \
+
+#define JOBS_SHORT_OPTS  "j:"
+
+#define JOBS_LONG_OPTS \
+    { "jobs", required_argument, NULL, 'j' }
+
+CORK_ATTR_UNUSED
+static bool
+jobs_parse_opt(int ch, struct cork_command *cmd)
+{
+    if (ch == 'j') {
+        char  *end;
+        unsigned long  value = strtoul(optarg, &end, 10);
+        if (*optarg == '\0' || *end != '\0' || value == 0 || value > 1024) {
+            cork_command_show_help(cmd, "Invalid number of jobs.");
+            exit(EXIT_FAILURE);
+        }
+        jobs = value;
+        return true;
+    }
+
+    return false;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Common options: Profiling
+ */
+
+CORK_ATTR_UNUSED
+static bool  profile_text = false;
+
+CORK_ATTR_UNUSED
+static const char  *profile_json_path = NULL;
+
+#define PROFILE_HELP_TEXT \
+"\n" \
+"Profiling options:\n" \
+"  --profile\n" \
+"    Print a report of how much work it took to evaluate Buzzy's\n" \
+"    configuration variables to stderr when the command finishes.\n" \
+"  --profile-json <path>\n" \
+"    Write the same report to <path>, as JSON.\n" \
+
+/* These options don't have short versions, so we use option values that can't
+ * clash with any short option character. */
+#define PROFILE_OPT  0x100
+#define PROFILE_JSON_OPT  0x101
+
+#define PROFILE_LONG_OPTS \
+    { "profile", no_argument, NULL, PROFILE_OPT }, \
+    { "profile-json", required_argument, NULL, PROFILE_JSON_OPT }
+
+CORK_ATTR_UNUSED
+static void
+profile_finish(void)
+{
+    struct cork_buffer  buf = CORK_BUFFER_INIT();
+
+    if (profile_text) {
+        bz_profile_report(&buf);
+        fputs(buf.buf, stderr);
+    }
+
+    if (profile_json_path != NULL) {
+        cork_buffer_clear(&buf);
+        bz_profile_report_json(&buf);
+        if (CORK_UNLIKELY(bz_create_file(profile_json_path, &buf, 0644) != 0)) {
+            fprintf(stderr, "%s\n", cork_error_message());
+        }
+    }
+
+    cork_buffer_done(&buf);
+}
+
+CORK_ATTR_UNUSED
+static bool
+profile_parse_opt(int ch, struct cork_command *cmd)
+{
+    if (ch == PROFILE_OPT) {
+        profile_text = true;
+    } else if (ch == PROFILE_JSON_OPT) {
+        profile_json_path = optarg;
+    } else {
+        return false;
+    }
+
+    /* Report the profile however the command exits. */
+    if (!bz_profiling) {
+        bz_profile_start();
+        atexit(profile_finish);
+    }
+    return true;
+}
+
+
 /*-----------------------------------------------------------------------
  * Common options: Package environments
  */
@@ -194,7 +305,6 @@ bz_load_repositories(void)
 {
     struct cork_path  *cwd;
 
-    ri_check_error(bz_load_variable_definitions());
     ri_check_error(bz_pdb_discover());
     ri_check_error(bz_distro_add_env_overrides());
 
@@ -203,7 +313,7 @@ bz_load_repositories(void)
                    bz_local_filesystem_repo_find(cork_path_get(cwd)));
     cork_path_free(cwd);
 
-    ri_check_error(bz_repo_registry_load_all());
+    ri_check_error(bz_repo_registry_load_all(jobs));
 }
 
 
@@ -261,6 +371,26 @@ satisfy_dependencies(struct cork_command *cmd, int argc, char **argv)
     }
 }
 
+/* Installs everything that the packages we just satisfied depend on.  If
+ * `include_packages` is true, we install those packages, too. */
+CORK_ATTR_UNUSED
+static void
+install_dependency_graph(bool include_packages)
+{
+    size_t  i;
+    struct bz_dep_graph  *graph = bz_dep_graph_new();
+    for (i = 0; i < cork_array_size(&dep_packages); i++) {
+        struct bz_package  *package = cork_array_at(&dep_packages, i);
+        if (include_packages) {
+            ri_check_error(bz_dep_graph_add(graph, package));
+        } else {
+            ri_check_error(bz_dep_graph_add_deps(graph, package));
+        }
+    }
+    ri_check_error(bz_dep_graph_install(graph, jobs));
+    bz_dep_graph_free(graph);
+}
+
 CORK_ATTR_UNUSED
 static void
 free_dependencies(void)
@@ -53,6 +53,14 @@ bz_arch_native_version_available(const char *native_package_name);
 struct bz_version *
 bz_arch_native_version_installed(const char *native_package_name);
 
+/* When pacman's databases are available, we answer the above two functions
+ * from indexes of those databases, which we rebuild whenever the databases
+ * change.  Call this function after installing or removing a package to make
+ * sure that we also rebuild the index of installed packages before the next
+ * query. */
+void
+bz_arch_native_local_invalidate(void);
+
 
 struct bz_pdb *
 bz_arch_native_pdb(void);
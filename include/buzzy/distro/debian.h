@@ -51,6 +51,20 @@ bz_version_from_deb(const char *deb);
 struct bz_version *
 bz_apt_native_version_available(const char *native_package_name);
 
+/* Looks up several packages in the native apt-get package repositories using a
+ * single apt-cache query.  (See bz_native_detect_many_f.) */
+int
+bz_apt_native_version_available_many(size_t count,
+                                     const char **native_package_names,
+                                     struct bz_version **versions);
+
+/* When apt's package lists are available, we answer the above two functions
+ * from an index of those lists, which we rebuild (and save into the work_dir
+ * directory) whenever any of the lists change.  Call this function to force
+ * us to check the lists again before the next query. */
+void
+bz_apt_native_lists_invalidate(void);
+
 /* Returns the version of the specified package that has been installed on the
  * current machine using apt-get.  That package need not have come from the
  * default native package database; it should return a result for packages that
@@ -58,6 +72,13 @@ bz_apt_native_version_available(const char *native_package_name);
 struct bz_version *
 bz_deb_native_version_installed(const char *native_package_name);
 
+/* We answer bz_deb_native_version_installed from an index of dpkg's status
+ * database, which we rebuild whenever the database file changes.  Call this
+ * function after installing or removing a package to make sure that we also
+ * rebuild the index before the next query. */
+void
+bz_deb_native_status_invalidate(void);
+
 
 /* A package database that can install native packages that are defined in a apt
  * database. */
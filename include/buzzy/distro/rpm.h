@@ -45,6 +45,13 @@ bz_version_from_rpm(const char *rpm);
 struct bz_version *
 bz_yum_native_version_available(const char *native_package_name);
 
+/* Looks up several packages in the native RPM/Yum package repositories using a
+ * single yum query.  (See bz_native_detect_many_f.) */
+int
+bz_yum_native_version_available_many(size_t count,
+                                     const char **native_package_names,
+                                     struct bz_version **versions);
+
 /* Returns the version of the specified package that has been installed on the
  * current machine using RPM (or anything that delegates to RPM for actual
  * package installation, such as yum).  That package need not have come from the
@@ -53,6 +60,13 @@ bz_yum_native_version_available(const char *native_package_name);
 struct bz_version *
 bz_rpm_native_version_installed(const char *native_package_name);
 
+/* Checks whether several packages are installed using a single rpm query.
+ * (See bz_native_detect_many_f.) */
+int
+bz_rpm_native_version_installed_many(size_t count,
+                                     const char **native_package_names,
+                                     struct bz_version **versions);
+
 
 /* A package database that can install native packages that are defined in a yum
  * database. */
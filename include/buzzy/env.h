@@ -28,7 +28,8 @@ bz_env_get_value(struct bz_env *env, const char *name);
 
 /* All of the following return an error if the value is malformed.  If required
  * is true, they also return an error if the value is missing.  You are not
- * responsible for freeing any results. */
+ * responsible for freeing any results, which are cached in the same way as
+ * the bz_value_get_* functions in buzzy/value.h. */
 
 bool
 bz_env_get_bool(struct bz_env *env, const char *name, bool required);
@@ -45,6 +46,9 @@ bz_env_get_string(struct bz_env *env, const char *name, bool required);
 struct bz_version *
 bz_env_get_version(struct bz_env *env, const char *name, bool required);
 
+const struct bz_dependency_list *
+bz_env_get_dependencies(struct bz_env *env, const char *name, bool required);
+
 
 /*-----------------------------------------------------------------------
  * Global and package-specific environments
@@ -53,6 +57,10 @@ bz_env_get_version(struct bz_env *env, const char *name, bool required);
 struct bz_env *
 bz_global_env(void);
 
+/* Repository and package environments are layered on top of the current
+ * session's global environment, and keep it alive for as long as they are,
+ * even after the session is freed or the global environment is reset. */
+
 struct bz_env *
 bz_repo_env_new_empty(void);
 
@@ -76,10 +84,11 @@ struct bz_var_doc {
     const char  *name;
     const char  *short_desc;
     const char  *long_desc;
-    struct bz_value  *value;
 };
 
-struct bz_var_doc *
+/* Works for built-in variables and for any defaults that you've added with
+ * bz_env_set_global_default. */
+const struct bz_var_doc *
 bz_env_get_global_default(const char *name, bool required);
 
 /* Only needed for reproducible test cases */
@@ -91,12 +100,19 @@ bz_global_env_reset(void);
  * Environments
  */
 
+/* Each environment has its own arena, which holds the environment's internal
+ * maps and caches, along with any values that you create while the arena is
+ * current.  Freeing the environment frees its arena, and everything in it, all
+ * at once. */
 struct bz_env *
 bz_env_new(const char *name);
 
 void
 bz_env_free(struct bz_env *env);
 
+struct bz_arena *
+bz_env_arena(struct bz_env *env);
+
 const char *
 bz_env_name(struct bz_env *env);
 
@@ -124,6 +140,24 @@ bz_env_get_value(struct bz_env *env, const char *key);
 const char *
 bz_env_get(struct bz_env *env, const char *key);
 
+/* Looks up several variables in env in a single pass, and calls each with the
+ * name and the rendered value of every variable that we find.  Each pattern is
+ * either the name of a variable, or a glob (in fnmatch syntax) that matches the
+ * full names of any number of variables; "deb.*", for instance, matches every
+ * variable whose name starts with "deb.".  Each glob's matches are reported in
+ * order of name.
+ *
+ * We freeze env first, so that every variable is evaluated against the same
+ * snapshot, and we evaluate each variable at most once, even if several
+ * patterns match it.  It's an error if a pattern that isn't a glob doesn't
+ * name a scalar variable. */
+typedef int
+(*bz_env_get_many_f)(void *user_data, const char *name, const char *value);
+
+int
+bz_env_get_many(struct bz_env *env, size_t count, const char **patterns,
+                void *user_data, bz_env_get_many_f each);
+
 /* Every environment comes with two var_table sets for free.  The first takes
  * precedence over every other value set, the other is overridden by every other
  * value set. */
@@ -137,6 +171,21 @@ bz_env_add_backup(struct bz_env *env, const char *key,
                   struct bz_value *value);
 
 
+/* Builds a flat snapshot of every variable in env, so that each later lookup
+ * only needs a single hash probe.  Use this once you've finished loading an
+ * environment, and are about to look up lots of variables in it.  Any change
+ * to env (or to any of the sets or environments that it's layered on top of)
+ * thaws it again; you'll never see a stale value. */
+int
+bz_env_freeze(struct bz_env *env);
+
+void
+bz_env_thaw(struct bz_env *env);
+
+bool
+bz_env_is_frozen(struct bz_env *env);
+
+
 /* A value that tries to find variables in env.  This lets you "nest" env inside
  * of some other environment.  We do not take control of env; it's your
  * responsibility to make sure that it's valid whenever this set is used. */
@@ -148,40 +197,51 @@ bz_env_as_value(struct bz_env *env);
  * Documenting variables
  */
 
-int
-bz_load_variable_definitions(void);
+/* Every built-in variable is defined at file scope, using one of the
+ * bz_*_variable macros below.  Each definition creates a bz_var_def instance
+ * named bz_var__[c_name], so c_name must be unique across all of libbuzzy; by
+ * convention it's the variable's name with each "." replaced by "_".
+ *
+ * We don't build any of the default values up front.  A script
+ * (src/libbuzzy/make-var-table.py) scans the source code for these definitions
+ * at build time, and generates a perfect hash table of them, which the global
+ * environment consults the first time that you look up each variable. */
+
+typedef struct bz_value *
+(*bz_var_default_f)(void);
+
+struct bz_var_def {
+    struct bz_var_doc  doc;
+    /* NULL for prefixes.  Otherwise, returns a new copy of the default value,
+     * or NULL if the variable doesn't have one. */
+    bz_var_default_f  default_value;
+};
 
-#define bz_define_variables(prefix) \
-static void \
-bz_define_vars__##prefix(void); \
-\
-int \
-bz_vars__##prefix(void) \
+/* Returns the definition of the built-in variable called name, or NULL if there
+ * isn't one.  If name is a prefix of some built-in variables' names (like
+ * "autotools" or "autotools.configure"), we return a non-NULL pointer to an
+ * empty definition, whose default_value is NULL. */
+const struct bz_var_def *
+bz_var_def_find(const char *name);
+
+/* Every built-in variable (and prefix), sorted by name. */
+const struct bz_var_def *
+bz_var_def_get(size_t index);
+
+size_t
+bz_var_def_count(void);
+
+#define bz_global_variable(c_name, name, default_value, short_desc, long_desc) \
+static struct bz_value * \
+bz_var_default__##c_name(void) \
 { \
-    cork_error_clear(); \
-    bz_define_vars__##prefix(); \
-    if (CORK_UNLIKELY(cork_error_occurred())) { \
-        return -1; \
-    } else { \
-        return 0; \
-    } \
+    return (default_value); \
 } \
 \
-static void \
-bz_define_vars__##prefix(void) \
-
-#define bz_global_variable(c_name, name, default_value, short_desc, long_desc) \
-    do { \
-        int  __rc; \
-        struct bz_value  *__dv = default_value; \
-        if (CORK_UNLIKELY(cork_error_occurred())) { \
-            return; \
-        } \
-        __rc = bz_env_set_global_default(name, __dv, short_desc, long_desc); \
-        if (CORK_UNLIKELY(__rc != 0)) { \
-            return; \
-        } \
-    } while (0)
+const struct bz_var_def  bz_var__##c_name = { \
+    { (name), (short_desc), (long_desc) }, \
+    bz_var_default__##c_name \
+}
 
 #define bz_package_variable(c_name, name, default_value, short_desc, long_desc) \
     bz_global_variable(c_name, name, default_value, short_desc, long_desc)
@@ -11,6 +11,8 @@
 #define BUZZY_LOGGING_H
 
 #include <libcork/core.h>
+#include <libcork/ds.h>
+#include <libcork/os.h>
 
 
 /*-----------------------------------------------------------------------
@@ -27,5 +29,50 @@ bz_finalize_actions(void);
 void
 bz_reset_action_count(void);
 
+/* Passes along the output of a child process that might have logged some
+ * actions of its own, and clears out both buffers. */
+void
+bz_log_replay_output(struct cork_buffer *out, struct cork_buffer *err);
+
+
+/*-----------------------------------------------------------------------
+ * Child processes
+ */
+
+/* Runs a function in a child process, capturing everything that it prints, so
+ * that we can replay it (via bz_log_replay_output) once the child finishes. */
+struct bz_child_job {
+    cork_run_f  run;
+    void  *user_data;
+    struct cork_subprocess  *sub;
+    struct cork_buffer  out;
+    struct cork_buffer  err;
+    struct cork_stream_consumer  *out_consumer;
+    struct cork_stream_consumer  *err_consumer;
+    int  exit_code;
+};
+
+void
+bz_child_job_init(struct bz_child_job *job, cork_run_f run, void *user_data);
+
+void
+bz_child_job_done(struct bz_child_job *job);
+
+int
+bz_child_job_start(struct bz_child_job *job);
+
+/* Reads whatever output the child has produced so far.  Returns whether there
+ * was any. */
+bool
+bz_child_job_drain(struct bz_child_job *job);
+
+bool
+bz_child_job_is_finished(struct bz_child_job *job);
+
+/* Once the child has finished, replays its output and returns its exit code.
+ * You can start the job again afterwards. */
+int
+bz_child_job_finish(struct bz_child_job *job);
+
 
 #endif /* BUZZY_LOGGING_H */
@@ -19,6 +19,9 @@
  * Mocking for test cases
  */
 
+/* Mocks belong to the current session (see buzzy/session.h); any other
+ * session keeps using the real implementations.  Calling this again throws
+ * away all of the current session's existing mocks. */
 void
 bz_start_mocks(void);
 
@@ -61,6 +64,11 @@ struct bz_mock {
     (*exec)(struct cork_exec *exec, struct cork_stream_consumer *out,
             struct cork_stream_consumer *err, int *exit_code);
 
+    int
+    (*exec_first)(size_t count, struct cork_exec **execs,
+                  struct cork_stream_consumer **outs, int *exit_codes,
+                  bool *finished, size_t max_running);
+
     struct cork_file *
     (*create_dir)(struct cork_path *path, cork_file_mode mode);
 
@@ -82,26 +90,46 @@ struct bz_mock {
 
     int
     (*walk_directory)(const char *path, struct cork_dir_walker *walker);
+
+    int
+    (*file_stamp)(struct cork_path *path, struct bz_file_stamp *stamp);
+
+    int
+    (*map_file)(struct cork_path *path, const char **buf, size_t *size);
+
+    void
+    (*unmap_file)(const char *buf, size_t size);
 };
 
-extern struct bz_mock  *bz_mocks;
+/* Returns the mocked implementations if the current session has called
+ * bz_start_mocks, and the real ones otherwise. */
+struct bz_mock *
+bz_mocks_current(void);
 
 #define bz_mocked_exec(e, out, err, ec) \
-    (bz_mocks->exec((e), (out), (err), (ec)))
+    (bz_mocks_current()->exec((e), (out), (err), (ec)))
+#define bz_mocked_exec_first(c, e, out, ec, f, m) \
+    (bz_mocks_current()->exec_first((c), (e), (out), (ec), (f), (m)))
 #define bz_mocked_create_dir(p, m) \
-    (bz_mocks->create_dir((p), (m)))
+    (bz_mocks_current()->create_dir((p), (m)))
 #define bz_mocked_create_file(p, s, m) \
-    (bz_mocks->create_file((p), (s), (m)))
+    (bz_mocks_current()->create_file((p), (s), (m)))
 #define bz_mocked_copy_file(d, s, m) \
-    (bz_mocks->copy_file((d), (s), (m)))
+    (bz_mocks_current()->copy_file((d), (s), (m)))
 #define bz_mocked_file_exists(p, e) \
-    (bz_mocks->file_exists((p), (e)))
+    (bz_mocks_current()->file_exists((p), (e)))
 #define bz_mocked_load_file(p, d) \
-    (bz_mocks->load_file((p), (d)))
+    (bz_mocks_current()->load_file((p), (d)))
 #define bz_mocked_print_action(m) \
-    (bz_mocks->print_action((m)))
+    (bz_mocks_current()->print_action((m)))
 #define bz_mocked_walk_directory(p, w) \
-    (bz_mocks->walk_directory((p), (w)))
+    (bz_mocks_current()->walk_directory((p), (w)))
+#define bz_mocked_file_stamp(p, s) \
+    (bz_mocks_current()->file_stamp((p), (s)))
+#define bz_mocked_map_file(p, b, s) \
+    (bz_mocks_current()->map_file((p), (b), (s)))
+#define bz_mocked_unmap_file(b, s) \
+    (bz_mocks_current()->unmap_file((b), (s)))
 
 
 /*-----------------------------------------------------------------------
@@ -112,6 +140,11 @@ int
 bz_real__exec(struct cork_exec *exec, struct cork_stream_consumer *out,
               struct cork_stream_consumer *err, int *exit_code);
 
+int
+bz_real__exec_first(size_t count, struct cork_exec **execs,
+                    struct cork_stream_consumer **outs, int *exit_codes,
+                    bool *finished, size_t max_running);
+
 struct cork_file *
 bz_real__create_dir(struct cork_path *path, cork_file_mode mode);
 
@@ -134,5 +167,14 @@ bz_real__print_action(const char *message);
 int
 bz_real__walk_directory(const char *path, struct cork_dir_walker *walker);
 
+int
+bz_real__file_stamp(struct cork_path *path, struct bz_file_stamp *stamp);
+
+int
+bz_real__map_file(struct cork_path *path, const char **buf, size_t *size);
+
+void
+bz_real__unmap_file(const char *buf, size_t size);
+
 
 #endif /* BUZZY_MOCK_H */
@@ -23,13 +23,52 @@
 typedef struct bz_version *
 (*bz_native_detect_f)(const char *native_package_name);
 
+/* Looks up several native packages at once.  Fills in each element of versions
+ * with the version of the corresponding package in native_package_names, or
+ * with NULL if that package isn't available.  You're responsible for freeing
+ * any versions that we return. */
+typedef int
+(*bz_native_detect_many_f)(size_t count, const char **native_package_names,
+                           struct bz_version **versions);
+
+/* Fills in *dest with a command that checks whether a single native package
+ * is available.  The command must exit successfully if and only if the package
+ * is available.  You can set *dest to NULL if there's a better way to answer
+ * the question than running a subprocess. */
+typedef int
+(*bz_native_probe_f)(const char *native_package_name, struct cork_exec **dest);
+
+/* Parses the available version out of the output of a successful probe. */
+typedef struct bz_version *
+(*bz_native_parse_probe_f)(const char *native_package_name,
+                           struct cork_buffer *out);
+
 typedef int
 (*bz_native_install_f)(const char *native_package_name,
                        struct bz_version *version);
 
+/* Installs several native packages with a single transaction. */
+typedef int
+(*bz_native_install_many_f)(size_t count, const char **native_package_names,
+                            struct bz_version **versions);
+
 typedef int
 (*bz_native_uninstall_f)(const char *native_package_name);
 
+/* Fills in dest with a description of the native package database's files
+ * (typically including their sizes and modification times) that will change
+ * whenever the set of available packages might have changed.  If you leave
+ * dest empty, we won't reuse any query results from earlier runs. */
+typedef int
+(*bz_native_fingerprint_f)(struct cork_buffer *dest);
+
+/* Tells every native package database that the set of installed packages
+ * might have changed, so that they don't reuse any installed versions that
+ * they've cached.  Packagers call this after installing or uninstalling
+ * anything. */
+void
+bz_native_installed_changed(void);
+
 /* Takes control of version */
 struct bz_package *
 bz_native_package_new(const char *short_distro_name,
@@ -44,17 +83,116 @@ bz_native_package_new(const char *short_distro_name,
  * Native package databases
  */
 
-/* Each pattern is a printf format that must contain exactly one %s.  Each
- * pattern will be used to convert Buzzy package names into candidate native
- * package names. */
-CORK_ATTR_SENTINEL
+/* The operations that a native package database uses to talk to the
+ * distribution's package manager.  version_available, version_installed,
+ * install, and uninstall are required; the rest can be NULL.  Fill this in
+ * with designated initializers, so that you only have to mention the ones
+ * that you provide.
+ *
+ * If version_available_many is non-NULL, we'll use it to check all of the
+ * candidate names for a set of dependencies with a single query; otherwise
+ * we'll call version_available for each candidate name in turn.  (If you
+ * provide probe_available and parse_available, we'll at least check the
+ * candidate names at the same time, using a separate subprocess for each one.)
+ * Similarly, if version_installed_many is non-NULL, we'll use it to check
+ * whether all of the native packages that we've created are installed with a
+ * single query.  And if install_many is non-NULL, we'll use it to install all
+ * of the native packages that a package list needs with a single transaction.
+ * (See bz_pdb_install_many_f.)
+ *
+ * If fingerprint is non-NULL (and the native_cache variable is true), we save
+ * the results of our availability queries in the work_dir directory, and reuse
+ * them in later runs for as long as the fingerprint doesn't change.
+ *
+ * patterns is a NULL-terminated array of printf formats, each of which must
+ * contain exactly one %s.  Each pattern will be used to convert Buzzy package
+ * names into candidate native package names. */
+struct bz_native_pdb_ops {
+    bz_native_detect_f  version_available;
+    bz_native_detect_many_f  version_available_many;
+    bz_native_probe_f  probe_available;
+    bz_native_parse_probe_f  parse_available;
+    bz_native_detect_f  version_installed;
+    bz_native_detect_many_f  version_installed_many;
+    bz_native_install_f  install;
+    bz_native_install_many_f  install_many;
+    bz_native_uninstall_f  uninstall;
+    bz_native_fingerprint_f  fingerprint;
+    const char * const  *patterns;
+};
+
+/* We make our own copy of ops. */
 struct bz_pdb *
 bz_native_pdb_new(const char *short_distro_name, const char *slug,
-                  bz_native_detect_f version_available,
-                  bz_native_detect_f version_installed,
-                  bz_native_install_f install,
-                  bz_native_uninstall_f uninstall,
-                  /* const char *pattern */ ...);
+                  const struct bz_native_pdb_ops *ops);
+
+
+/*-----------------------------------------------------------------------
+ * Native package indexes
+ */
+
+/* Several native package databases can answer version queries by reading the
+ * package manager's own database files, instead of running a subprocess for
+ * each package.  A native index maps package names to the version strings that
+ * we found in those files.
+ *
+ * Each index has a key, which describes the files that it was built from
+ * (typically including their sizes and modification times); we only rebuild
+ * the index when its key changes.  If you give the index a cache name, we'll
+ * also save a copy of it in the work_dir directory, which later runs can reuse
+ * for as long as the key doesn't change. */
+
+struct bz_native_index;
+
+/* Return true if new_version should replace old_version. */
+typedef bool
+(*bz_native_index_prefer_f)(const char *new_version, const char *old_version);
+
+typedef int
+(*bz_native_index_build_f)(void *user_data, struct bz_native_index *index);
+
+/* If prefer is NULL, the first version that we see for each package wins. */
+struct bz_native_index *
+bz_native_index_new(const char *cache_name, bz_native_index_prefer_f prefer);
+
+void
+bz_native_index_free(struct bz_native_index *index);
+
+void
+bz_native_index_add(struct bz_native_index *index,
+                    const char *name, size_t name_length,
+                    const char *version, size_t version_length);
+
+/* Returns NULL if the package isn't in the index. */
+const char *
+bz_native_index_get(struct bz_native_index *index, const char *name);
+
+/* Makes sure that the index matches key, loading it from the saved copy or
+ * calling build to fill it in if needed.  If build is NULL, and there isn't an
+ * up-to-date saved copy, the index starts out empty; you can fill it in
+ * yourself and then call bz_native_index_save. */
+int
+bz_native_index_update(struct bz_native_index *index, struct cork_buffer *key,
+                       bz_native_index_build_f build, void *user_data);
+
+/* Saves the current contents of the index.  The index must have a cache
+ * name. */
+int
+bz_native_index_save(struct bz_native_index *index);
+
+/* Forces the next call to bz_native_index_update to reload the index. */
+void
+bz_native_index_invalidate(struct bz_native_index *index);
+
+/* Helpers for building index keys and fingerprints.  The first appends a line
+ * describing the size and modification time of path, if it exists.  The second
+ * does the same for every file named base_name anywhere under dir. */
+int
+bz_native_fingerprint_add_file(struct cork_buffer *dest, const char *path);
+
+int
+bz_native_fingerprint_add_files(struct cork_buffer *dest, const char *dir,
+                                const char *base_name);
 
 
 #endif /* BUZZY_NATIVE_H */
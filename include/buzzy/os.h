@@ -39,6 +39,21 @@ int
 bz_subprocess_get_output_exec(struct cork_buffer *out, struct cork_buffer *err,
                               bool *successful, struct cork_exec *exec);
 
+/* Execute several subprocesses, with at most max_running of them running at
+ * the same time, until we know which is the first one (in the order given)
+ * that exits successfully.  Once we know, we abort any subprocesses that are
+ * still running, and don't start any of the others.  We take control of all of
+ * the execs.
+ *
+ * Each subprocess's stdout is captured into the corresponding element of outs.
+ * We fill in finished[i] with whether the subprocess ran to completion, and if
+ * so, successful[i] with whether its exit code was 0. */
+
+int
+bz_subprocess_get_first_output(size_t count, struct cork_exec **execs,
+                               size_t max_running, struct cork_buffer *outs,
+                               bool *finished, bool *successful);
+
 
 /* Execute the subprocess and wait for it to finish.
  *
@@ -60,6 +75,18 @@ int
 bz_subprocess_run_exec(bool verbose, bool *successful, struct cork_exec *exec);
 
 
+/* A scalar value whose content is the stdout of a subprocess, without its
+ * trailing newline.  We run the subprocess the first time that someone asks
+ * for the value, and never again: later requests reuse its output, or report
+ * the same error if it failed. */
+
+struct bz_value;
+
+CORK_ATTR_SENTINEL
+struct bz_value *
+bz_subprocess_output_value_new(const char *program, ...);
+
+
 /*-----------------------------------------------------------------------
  * Creating files and directories
  */
@@ -83,4 +110,37 @@ int
 bz_walk_directory(const char *path, struct cork_dir_walker *walker);
 
 
+/*-----------------------------------------------------------------------
+ * Reading files in place
+ */
+
+/* Enough information about a file to tell whether it has changed since the
+ * last time we looked at it. */
+struct bz_file_stamp {
+    bool  exists;
+    size_t  size;
+    int64_t  mtime_sec;
+    int64_t  mtime_nsec;
+};
+
+#define bz_file_stamp_eq(s1, s2) \
+    ((s1)->exists == (s2)->exists && \
+     (s1)->size == (s2)->size && \
+     (s1)->mtime_sec == (s2)->mtime_sec && \
+     (s1)->mtime_nsec == (s2)->mtime_nsec)
+
+/* It's not an error for the file not to exist; we'll set the stamp's exists
+ * field to false. */
+int
+bz_file_stamp(const char *path, struct bz_file_stamp *stamp);
+
+/* Maps the contents of a file into memory.  You must pass the result to
+ * bz_unmap_file when you're done with it. */
+int
+bz_map_file(const char *path, const char **buf, size_t *size);
+
+void
+bz_unmap_file(const char *buf, size_t size);
+
+
 #endif /* BUZZY_OS_H */
@@ -120,6 +120,18 @@ bz_packager_free(struct bz_packager *packager);
 void
 bz_packager_set_package(struct bz_packager *packager, struct bz_package *pkg);
 
+/* A packager can record which object created it (for instance, a native
+ * package database), so that its creator can recognize it later on and get
+ * back at its user_data. */
+void
+bz_packager_set_owner(struct bz_packager *packager, void *owner);
+
+void *
+bz_packager_owner(struct bz_packager *packager);
+
+void *
+bz_packager_user_data(struct bz_packager *packager);
+
 int
 bz_packager_package(struct bz_packager *packager);
 
@@ -129,6 +141,15 @@ bz_packager_install(struct bz_packager *packager);
 int
 bz_packager_uninstall(struct bz_packager *packager);
 
+/* Returns whether bz_packager_package would have to do anything. */
+int
+bz_packager_package_is_needed(struct bz_packager *packager, bool *is_needed);
+
+/* Records that the package step has already been performed somewhere else
+ * (for instance, in a child process), so that we don't perform it again. */
+void
+bz_packager_mark_packaged(struct bz_packager *packager);
+
 
 struct bz_packager *
 bz_package_packager_new(struct bz_env *env);
@@ -148,6 +169,9 @@ bz_package_free(struct bz_package *package);
 struct bz_env *
 bz_package_env(struct bz_package *package);
 
+struct bz_packager *
+bz_package_packager(struct bz_package *package);
+
 const char *
 bz_package_name(struct bz_package *package);
 
@@ -184,6 +208,12 @@ bz_package_install(struct bz_package *package);
 int
 bz_package_uninstall(struct bz_package *package);
 
+int
+bz_package_package_is_needed(struct bz_package *package, bool *is_needed);
+
+void
+bz_package_mark_packaged(struct bz_package *package);
+
 
 /*-----------------------------------------------------------------------
  * Built packages
@@ -247,6 +277,45 @@ int
 bz_package_list_install(struct bz_package_list *list);
 
 
+/*-----------------------------------------------------------------------
+ * Dependency graphs
+ */
+
+/* A dependency graph contains a set of packages, along with everything that
+ * they depend on (both at runtime and at build time), so that we can work out
+ * which packages can be built independently of each other. */
+struct bz_dep_graph;
+
+struct bz_dep_graph *
+bz_dep_graph_new(void);
+
+void
+bz_dep_graph_free(struct bz_dep_graph *graph);
+
+/* Adds a package, and everything that it transitively depends on, to the graph.
+ * Returns an error if the dependencies are circular, in which case you should
+ * only free the graph. */
+int
+bz_dep_graph_add(struct bz_dep_graph *graph, struct bz_package *package);
+
+/* Adds everything that a package transitively depends on to the graph, but not
+ * the package itself. */
+int
+bz_dep_graph_add_deps(struct bz_dep_graph *graph, struct bz_package *package);
+
+size_t
+bz_dep_graph_count(struct bz_dep_graph *graph);
+
+/* Installs every package in the graph, making sure that each package's
+ * dependencies are installed before we build it.  We build, stage, and package
+ * up to `jobs` independent packages at the same time, each in its own child
+ * process.  Installation always happens one package at a time in the current
+ * process, since most package managers only allow one installation at a time
+ * anyway. */
+int
+bz_dep_graph_install(struct bz_dep_graph *graph, unsigned int jobs);
+
+
 /*-----------------------------------------------------------------------
  * Package databases
  */
@@ -258,11 +327,32 @@ typedef struct bz_package *
 (*bz_pdb_satisfy_f)(void *user_data, struct bz_dependency *dep,
                     struct bz_value *ctx);
 
+/* Gives the pdb a chance to look up several dependencies at once, before we
+ * ask it to satisfy each of them in turn.  This is purely an optimization; the
+ * pdb must still be able to satisfy dependencies that it wasn't told about
+ * ahead of time.  You won't be told about any dependencies that an earlier pdb
+ * (one without a prefetch method) already satisfies. */
+typedef int
+(*bz_pdb_prefetch_f)(void *user_data, size_t count,
+                     struct bz_dependency **deps, struct bz_value *ctx);
+
+/* Gives the pdb a chance to install several of the packages that we're about
+ * to install at the same time, instead of one at a time.  The list can include
+ * packages that were created by other pdbs, which you should ignore.  Any
+ * packages that you don't install will be installed individually
+ * afterwards. */
+typedef int
+(*bz_pdb_install_many_f)(void *user_data, size_t count,
+                         struct bz_package **packages);
+
 
+/* prefetch and install_many can be NULL */
 struct bz_pdb *
 bz_pdb_new(const char *pdb_name,
            void *user_data, cork_free_f free_user_data,
-           bz_pdb_satisfy_f satisfy);
+           bz_pdb_satisfy_f satisfy,
+           bz_pdb_prefetch_f prefetch,
+           bz_pdb_install_many_f install_many);
 
 void
 bz_pdb_free(struct bz_pdb *pdb);
@@ -274,6 +364,15 @@ struct bz_package *
 bz_pdb_satisfy_dependency(struct bz_pdb *pdb, struct bz_dependency *dep,
                           struct bz_value *ctx);
 
+int
+bz_pdb_prefetch_dependencies(struct bz_pdb *pdb, size_t count,
+                             struct bz_dependency **deps,
+                             struct bz_value *ctx);
+
+int
+bz_pdb_install_many(struct bz_pdb *pdb, size_t count,
+                    struct bz_package **packages);
+
 
 /*-----------------------------------------------------------------------
  * Single-package databases
@@ -292,11 +391,15 @@ bz_single_package_pdb_new(const char *pdb_name, struct bz_package *package);
  * provide a satsify method that just blindly creates a package for a
  * dependency.  The cache helper translates that into a satisfy method that will
  * check if we've already created a package for a particular dependency, and if
- * so, return it. */
+ * so, return it.  Your prefetch method (if any) will only be told about the
+ * dependencies that aren't already in the cache, and your install_many method
+ * (if any) will only be told about packages that you created. */
 struct bz_pdb *
 bz_cached_pdb_new(const char *pdb_name,
                   void *user_data, cork_free_f free_user_data,
-                  bz_pdb_satisfy_f satisfy);
+                  bz_pdb_satisfy_f satisfy,
+                  bz_pdb_prefetch_f prefetch,
+                  bz_pdb_install_many_f install_many);
 
 
 /*-----------------------------------------------------------------------
@@ -313,6 +416,19 @@ bz_pdb_registry_clear(void);
 struct bz_package *
 bz_satisfy_dependency(struct bz_dependency *dep, struct bz_value *ctx);
 
+/* Lets each registered pdb prefetch a set of dependencies that we're about to
+ * satisfy.  (See bz_pdb_prefetch_f.)  Any registered pdb without a prefetch
+ * method will try to satisfy the dependencies right away, so that we only
+ * prefetch the ones that it can't. */
+int
+bz_prefetch_dependencies(size_t count, struct bz_dependency **deps,
+                         struct bz_value *ctx);
+
+/* Lets each registered pdb install its share of a set of packages that we're
+ * about to install.  (See bz_pdb_install_many_f.) */
+int
+bz_install_many(size_t count, struct bz_package **packages);
+
 int
 bz_install_dependency(struct bz_dependency *dep, struct bz_value *ctx);
 
@@ -0,0 +1,98 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2015, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#ifndef BUZZY_PROFILE_H
+#define BUZZY_PROFILE_H
+
+#include <libcork/core.h>
+#include <libcork/ds.h>
+#include <libcork/os.h>
+
+
+/*-----------------------------------------------------------------------
+ * Profiling variable evaluation
+ */
+
+/* While profiling is turned on, we record how many times we evaluate each
+ * variable (and how long it takes), how often each environment's lookup cache
+ * has the answer, how long we spend running subprocesses to compute variable
+ * values, and the longest chains of variables that refer to each other.
+ * Profiling is off by default; while it's off, each of the hooks below costs a
+ * single test of bz_profiling. */
+
+extern bool  bz_profiling;
+
+/* Clears any previous results, and starts recording. */
+void
+bz_profile_start(void);
+
+void
+bz_profile_stop(void);
+
+/* Appends a human-readable report to dest. */
+void
+bz_profile_report(struct cork_buffer *dest);
+
+/* Appends the same report to dest, as a JSON object. */
+void
+bz_profile_report_json(struct cork_buffer *dest);
+
+
+/*-----------------------------------------------------------------------
+ * Hooks
+ */
+
+/* A variable that we're in the middle of evaluating.  Frames live on the
+ * stack of the function that's evaluating the variable. */
+struct bz_profile_frame {
+    struct bz_profile_frame  *parent;
+    const char  *name;
+    size_t  depth;
+    uint64_t  start;
+    uint64_t  child_time;
+    bool  has_children;
+};
+
+void
+bz_profile_eval_begin(struct bz_profile_frame *frame, const char *name);
+
+void
+bz_profile_eval_end(struct bz_profile_frame *frame);
+
+/* Records that we rendered a template for the variable that we're currently
+ * evaluating, or that we found a cached rendering. */
+void
+bz_profile_render(bool cached);
+
+enum bz_profile_lookup {
+    BZ_PROFILE_CACHE_HIT,
+    BZ_PROFILE_CACHE_MISS,
+    BZ_PROFILE_FROZEN_HIT
+};
+
+void
+bz_profile_union_lookup(const char *union_name, enum bz_profile_lookup kind);
+
+struct bz_profile_command {
+    struct cork_buffer  description;
+    uint64_t  start;
+};
+
+/* Call these around each subprocess that we run to compute the value of a
+ * variable.  (We grab a description of exec in _begin, since running it might
+ * free it.) */
+void
+bz_profile_command_begin(struct bz_profile_command *command,
+                         struct cork_exec *exec);
+
+void
+bz_profile_command_end(struct bz_profile_command *command);
+
+
+#endif /* BUZZY_PROFILE_H */
@@ -23,16 +23,24 @@
 
 struct bz_repo;
 
+/* Makes sure that the repository's files are available locally, without loading
+ * anything from them.  This might run in a child process, so it must not
+ * change any of our in-memory state. */
+typedef int
+(*bz_repo_fetch_f)(void *user_data, struct bz_env *env);
+
 typedef int
 (*bz_repo_load_f)(void *user_data, struct bz_env *env);
 
 typedef int
 (*bz_repo_update_f)(void *user_data, struct bz_env *env);
 
-/* Takes control of env */
+/* Takes control of env.  fetch can be NULL if the repository's files are always
+ * available locally. */
 struct bz_repo *
 bz_repo_new(struct bz_env *env,
             void *user_data, cork_free_f free_user_data,
+            bz_repo_fetch_f fetch,
             bz_repo_load_f load,
             bz_repo_update_f update);
 
@@ -80,11 +88,18 @@ bz_repo_registry_get(size_t index);
 void
 bz_repo_registry_reset(void);
 
+/* Loads every repository, along with every repository that they link to.  We
+ * load the link graph one level at a time; with more than one job, we fetch up
+ * to `jobs` of the repositories in each level at the same time, each in its own
+ * child process. */
 int
-bz_repo_registry_load_all(void);
+bz_repo_registry_load_all(unsigned int jobs);
 
+/* With more than one job, we update up to `jobs` repositories at the same time,
+ * each in its own child process.  Their output is replayed in registry order,
+ * and any failures are reported together once every update has finished. */
 int
-bz_repo_registry_update_all(void);
+bz_repo_registry_update_all(unsigned int jobs);
 
 
 int
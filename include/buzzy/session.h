@@ -0,0 +1,96 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2015, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#ifndef BUZZY_SESSION_H
+#define BUZZY_SESSION_H
+
+#include <libcork/core.h>
+
+
+/*-----------------------------------------------------------------------
+ * Sessions
+ */
+
+/* A session owns all of the registries and caches that used to be process
+ * globals: the global environment and its variable definitions, the package
+ * database registry, the repository registry, the URL repository cache, the
+ * action counter, the native package indexes, and the mocks in buzzy/mock.h.
+ *
+ * Each thread has a current session, which is the process-wide default
+ * session unless you've called bz_session_set_current.  All of the existing
+ * functions that use one of these registries (bz_global_env,
+ * bz_satisfy_dependency, bz_repo_register, etc.) operate on the current
+ * session.
+ *
+ * Several threads can share a session.  The registry functions lock the
+ * session while they run, so you can (for instance) satisfy dependencies from
+ * several threads at once.  Environments and values themselves are not locked,
+ * though, since looking up a variable can update caches inside of them.  If
+ * you want to look up variables in an environment that another thread might be
+ * using at the same time, hold the session lock while you do so. */
+
+struct bz_session;
+
+struct bz_session *
+bz_session_new(void);
+
+/* You can't free the default session, or a session that is current in any
+ * thread. */
+void
+bz_session_free(struct bz_session *session);
+
+struct bz_session *
+bz_session_default(void);
+
+struct bz_session *
+bz_session_current(void);
+
+/* Makes `session` the current session for the calling thread, and returns the
+ * previous one.  Pass in NULL to switch back to the default session. */
+struct bz_session *
+bz_session_set_current(struct bz_session *session);
+
+/* The lock is recursive, so it's safe to lock a session that you've already
+ * locked. */
+void
+bz_session_lock(struct bz_session *session);
+
+void
+bz_session_unlock(struct bz_session *session);
+
+
+/*-----------------------------------------------------------------------
+ * Session-owned state
+ */
+
+/* Each module that keeps session-specific state stores it in one of these
+ * slots.  When we free a session, we free its slots in reverse order, so a
+ * slot can depend on anything in the slots before it. */
+enum bz_session_slot {
+    BZ_SESSION_MOCKS,
+    BZ_SESSION_DEBIAN,
+    BZ_SESSION_ARCH,
+    BZ_SESSION_ENV,
+    BZ_SESSION_REPOS,
+    BZ_SESSION_URL_REPOS,
+    BZ_SESSION_PDBS,
+    BZ_SESSION_ACTIONS,
+    BZ_SESSION_SLOT_COUNT
+};
+
+void *
+bz_session_get_slot(struct bz_session *session, enum bz_session_slot slot);
+
+/* Frees the slot's previous contents (if any). */
+void
+bz_session_set_slot(struct bz_session *session, enum bz_session_slot slot,
+                    void *data, cork_free_f free_data);
+
+
+#endif /* BUZZY_SESSION_H */
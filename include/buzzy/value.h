@@ -31,6 +31,12 @@ bz_scalar_value_new(void *user_data, cork_free_f free_user_data,
 const char *
 bz_scalar_value_get(struct bz_value *value, struct bz_value *ctx);
 
+/* Like bz_scalar_value_get, but also tells the profiler (see buzzy/profile.h)
+ * which variable we're evaluating. */
+const char *
+bz_scalar_value_get_named(struct bz_value *value, struct bz_value *ctx,
+                          const char *name);
+
 
 /*-----------------------------------------------------------------------
  * Array values
@@ -94,6 +100,42 @@ int
 bz_map_value_add(struct bz_value *value, const char *key,
                  struct bz_value *element, bool overwrite);
 
+/* To freeze an environment, we need to be able to list the contents of each
+ * map in it.  Maps that don't provide an iterate function can't be frozen. */
+typedef int
+(*bz_map_iterate_f)(void *user_data, const char *key, struct bz_value *element);
+
+typedef int
+(*bz_map_value_iterate_f)(void *user_data, void *iterate_user_data,
+                          bz_map_iterate_f iterate);
+
+void
+bz_map_value_set_iterate(struct bz_value *value,
+                         bz_map_value_iterate_f iterate);
+
+int
+bz_map_value_iterate(struct bz_value *value, void *user_data,
+                     bz_map_iterate_f iterate);
+
+
+/*-----------------------------------------------------------------------
+ * Keys
+ */
+
+/* An interned variable name.  We split the name at each "." and hash each
+ * segment once, when the key is interned, so that looking up a key doesn't
+ * have to do either.  There's a single intern table that's shared by every
+ * environment and session (and every thread), and interned keys are never
+ * freed, so you can hold on to a key for as long as you want. */
+
+struct bz_key;
+
+const struct bz_key *
+bz_key_intern(const char *name);
+
+const char *
+bz_key_name(const struct bz_key *key);
+
 
 /*-----------------------------------------------------------------------
  * Values
@@ -105,6 +147,12 @@ enum bz_value_kind {
     BZ_VALUE_MAP
 };
 
+/* Values are reference counted; bz_value_free releases one reference, and we
+ * only free the value once every reference has been released.  Each
+ * constructor returns a new value with a single reference. */
+struct bz_value *
+bz_value_ref(struct bz_value *value);
+
 void
 bz_value_free(struct bz_value *value);
 
@@ -118,6 +166,10 @@ bz_value_kind_string(enum bz_value_kind kind);
 struct bz_value *
 bz_value_get_nested(struct bz_value *value, const char *key);
 
+/* Like bz_value_get_nested, but with a key that you've already interned. */
+struct bz_value *
+bz_value_get_key(struct bz_value *value, const struct bz_key *key);
+
 int
 bz_value_set_nested(struct bz_value *value, const char *key,
                     struct bz_value *element, bool overwrite);
@@ -125,7 +177,13 @@ bz_value_set_nested(struct bz_value *value, const char *key,
 
 /* All of the following return an error if the value is malformed.  If required
  * is true, they also return an error if the value is missing.  You are not
- * responsible for freeing any results. */
+ * responsible for freeing any results.
+ *
+ * Except for strings, we cache the parsed results in value, so that looking up
+ * the same variable again is cheap.  Any change to any variable invalidates
+ * the cache, so that we never return a stale result; each result remains valid
+ * until the next time that you look up the same variable (as the same type)
+ * after such a change. */
 
 bool
 bz_value_get_bool(struct bz_value *value, const char *name, bool required);
@@ -142,6 +200,18 @@ bz_value_get_string(struct bz_value *value, const char *name, bool required);
 struct bz_version *
 bz_value_get_version(struct bz_value *value, const char *name, bool required);
 
+/* An array of dependency strings (or a single one), parsed. */
+struct bz_dependency;
+
+struct bz_dependency_list {
+    size_t  count;
+    struct bz_dependency  **deps;
+};
+
+const struct bz_dependency_list *
+bz_value_get_dependencies(struct bz_value *value, const char *name,
+                          bool required);
+
 
 /* Any relative paths in this value will be interpreted relative to this base
  * path.  Base path defaults to the current working directory. */
@@ -156,6 +226,61 @@ bz_value_set_base_path(struct bz_value *value, const char *base_path);
 struct bz_value *
 bz_value_copy(struct bz_value *other);
 
+/* A number that uniquely identifies this value for the lifetime of the
+ * process.  (Unlike the value's address, we never reuse an ID after freeing
+ * the value.)  Copies get their own ID. */
+size_t
+bz_value_id(struct bz_value *value);
+
+
+/*-----------------------------------------------------------------------
+ * Tracking changes
+ */
+
+/* Every time we add a key to a map (including via bz_value_set_nested and
+ * bz_env_add_override), we update a change stamp for that key.  Keys are
+ * hashed into a fixed number of buckets, so a change to one key might look like
+ * a change to a few others; that only means that we'll recompute something that
+ * we didn't need to.
+ *
+ * A bz_value_reads instance records which keys are looked up (via
+ * bz_value_get_nested and everything built on top of it) while it's active, so
+ * that you can cache something computed from those keys, and later check
+ * whether any of them have changed.  Adding a map to a union (for instance,
+ * via bz_env_add_set) can change the value of any key, so that counts as a
+ * change to everything. */
+
+#define BZ_VALUE_READS_BUCKETS  256
+
+struct bz_value_reads {
+    uint64_t  buckets[BZ_VALUE_READS_BUCKETS / 64];
+    unsigned int  stamp;
+    unsigned int  layout;
+};
+
+/* Starts recording the current thread's reads into `reads`.  Recorders nest;
+ * you must pass `saved` to the matching call to bz_value_reads_end. */
+void
+bz_value_reads_begin(struct bz_value_reads *reads,
+                     struct bz_value_reads **saved);
+
+/* Stops recording into `reads`.  If another recorder was active, it inherits
+ * everything that `reads` recorded. */
+void
+bz_value_reads_end(struct bz_value_reads *reads,
+                   struct bz_value_reads *saved);
+
+/* Adds everything that `reads` recorded to the current thread's active
+ * recorder, if any.  Use this when you return a cached result, so that anyone
+ * caching something computed from your result knows what it depends on. */
+void
+bz_value_reads_replay(struct bz_value_reads *reads);
+
+/* Returns whether any of the keys in `reads` (or the layout of any union) have
+ * changed since we started recording it. */
+bool
+bz_value_reads_changed(struct bz_value_reads *reads);
+
 
 /*-----------------------------------------------------------------------
  * Built-in value types
@@ -168,10 +293,17 @@ bz_path_value_new(struct cork_path *path);
 struct bz_value *
 bz_string_value_new(const char *value);
 
-/* ${var} is substituted with the value of another variable */
+/* ${var} is substituted with the value of another variable.  We cache the
+ * rendered result for each context that the value is evaluated in, and only
+ * render it again when one of the variables that it read has changed. */
 struct bz_value *
 bz_interpolated_value_new(const char *template_value);
 
+/* The number of times that we've rendered an interpolated value's template
+ * (instead of returning a cached result). */
+size_t
+bz_interpolated_value_render_count(void);
+
 
 /*-----------------------------------------------------------------------
  * Editable arrays
@@ -205,13 +337,41 @@ bz_map_new(void);
 struct bz_union_map *
 bz_union_map_new(void);
 
+/* The name is only used to label the union's lookups in profiling reports.  We
+ * don't make a copy of it, so it has to live at least as long as the union. */
+void
+bz_union_map_set_name(struct bz_union_map *map, const char *name);
+
 /* Takes control of element */
 void
 bz_union_map_add(struct bz_union_map *map, struct bz_value *element);
 
+/* Takes control of element.  Inserts element before the map that's currently
+ * at position `index` in the union, so that it takes precedence over that map
+ * and every one after it. */
+void
+bz_union_map_insert(struct bz_union_map *map, size_t index,
+                    struct bz_value *element);
+
 struct bz_value *
 bz_union_map_as_value(struct bz_union_map *map);
 
+/* Freezing a union builds a flat snapshot of every key in it (including nested
+ * keys, using their full dotted names), so that looking up any of them only
+ * takes a single hash probe, instead of a search through each of the maps in
+ * the union.  The snapshot only holds on to the values that it finds, so it
+ * never changes what a lookup returns: if any map in the union changes after
+ * you freeze it (or you add another map to the union), we automatically thaw
+ * it the next time you look up a key that might be affected. */
+int
+bz_union_map_freeze(struct bz_union_map *map);
+
+void
+bz_union_map_thaw(struct bz_union_map *map);
+
+bool
+bz_union_map_is_frozen(struct bz_union_map *map);
+
 
 /*-----------------------------------------------------------------------
  * YAML file of values
@@ -227,5 +387,15 @@ bz_yaml_value_new_from_file(const char *path);
 struct bz_value *
 bz_yaml_value_new_from_string(const char *content);
 
+/* bz_yaml_value_new_from_file saves a compiled copy of each file that it
+ * parses, and reuses it (without running the YAML parser) until the file
+ * changes.  The copies live in buzzy/yaml within the user's cache directory,
+ * unless you give some other directory, either here or in
+ * $BUZZY_YAML_CACHE_DIR.  Pass in NULL (or set the environment variable to an
+ * empty string) to turn the cache off.  We only keep the most recently saved
+ * few hundred files. */
+void
+bz_yaml_set_cache_dir(const char *dir);
+
 
 #endif /* BUZZY_VALUE_H */
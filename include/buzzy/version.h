@@ -118,6 +118,9 @@ bz_dependency_new(const char *package_name, struct bz_version *min_version);
 struct bz_dependency *
 bz_dependency_from_string(const char *string);
 
+struct bz_dependency *
+bz_dependency_copy(const struct bz_dependency *other);
+
 void
 bz_dependency_free(struct bz_dependency *dep);
 
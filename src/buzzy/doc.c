@@ -65,7 +65,7 @@ static void
 execute(int argc, char **argv)
 {
     struct bz_env  *env;
-    struct bz_var_doc  *doc;
+    const struct bz_var_doc  *doc;
     struct bz_value  *value;
 
     if (argc != 1) {
@@ -7,6 +7,7 @@
  * ----------------------------------------------------------------------
  */
 
+#include <ctype.h>
 #include <getopt.h>
 #include <string.h>
 
@@ -21,13 +22,25 @@
  */
 
 #define SHORT_DESC \
-    "Get the value of a Buzzy configuration variable"
+    "Get the values of Buzzy configuration variables"
 
 #define USAGE_SUFFIX \
-    "<variable name>"
+    "<variable name>..."
 
 #define HELP_TEXT \
-"Prints out the value of a Buzzy configuration variable.\n" \
+"Prints out the values of Buzzy configuration variables.  Each argument can\n" \
+"be the name of a variable, or a glob (such as \"deb.*\") that matches the\n" \
+"names of any number of variables.  We evaluate every variable in a single\n" \
+"pass, and only once, even if several arguments match it.\n" \
+"\n" \
+"Options:\n" \
+"  -s, --shell\n" \
+"    Print each variable as a shell assignment (name=value), replacing any\n" \
+"    characters in the variable name that can't appear in a shell variable\n" \
+"    name with underscores.\n" \
+"  --json\n" \
+"    Print all of the variables as a single JSON object.\n" \
+PROFILE_HELP_TEXT \
 
 static int
 parse_options(int argc, char **argv);
@@ -39,9 +52,24 @@ CORK_LOCAL struct cork_command  buzzy_get =
     cork_leaf_command("get", SHORT_DESC, USAGE_SUFFIX, HELP_TEXT,
                       parse_options, execute);
 
-#define SHORT_OPTS  "+"
+enum get_format {
+    GET_VALUES,
+    GET_SHELL,
+    GET_JSON
+};
+
+static enum get_format  format = GET_VALUES;
+
+#define SHORT_OPTS  "+s"
+
+/* In other commands, -j is short for --jobs, so --json doesn't have a short
+ * version. */
+#define JSON_OPT  0x200
 
 static struct option  opts[] = {
+    { "shell", no_argument, NULL, 's' },
+    { "json", no_argument, NULL, JSON_OPT },
+    PROFILE_LONG_OPTS,
     { NULL, 0, NULL, 0 }
 };
 
@@ -51,9 +79,21 @@ parse_options(int argc, char **argv)
     int  ch;
     getopt_reset();
     while ((ch = getopt_long(argc, argv, SHORT_OPTS, opts, NULL)) != -1) {
+        if (profile_parse_opt(ch, &buzzy_get)) {
+            continue;
+        }
+
         switch (ch) {
+            case 's':
+                format = GET_SHELL;
+                break;
+
+            case JSON_OPT:
+                format = GET_JSON;
+                break;
+
             default:
-                cork_command_show_help(&buzzy_doc, NULL);
+                cork_command_show_help(&buzzy_get, NULL);
                 exit(EXIT_FAILURE);
         }
 
@@ -61,14 +101,94 @@ parse_options(int argc, char **argv)
     return optind;
 }
 
+
+/*-----------------------------------------------------------------------
+ * Output formats
+ */
+
+static void
+append_json_string(struct cork_buffer *dest, const char *str)
+{
+    cork_buffer_append(dest, "\"", 1);
+    for (; *str != '\0'; str++) {
+        unsigned char  ch = *str;
+        if (ch == '"' || ch == '\\') {
+            cork_buffer_append_printf(dest, "\\%c", ch);
+        } else if (ch < 0x20) {
+            cork_buffer_append_printf(dest, "\\u%04x", ch);
+        } else {
+            cork_buffer_append(dest, str, 1);
+        }
+    }
+    cork_buffer_append(dest, "\"", 1);
+}
+
+static void
+append_shell_name(struct cork_buffer *dest, const char *name)
+{
+    for (; *name != '\0'; name++) {
+        char  ch = *name;
+        if (isalnum((unsigned char) ch) || ch == '_') {
+            cork_buffer_append(dest, &ch, 1);
+        } else {
+            cork_buffer_append(dest, "_", 1);
+        }
+    }
+}
+
+/* Wraps str in single quotes; the only character that we have to worry about
+ * is a single quote itself. */
+static void
+append_shell_string(struct cork_buffer *dest, const char *str)
+{
+    cork_buffer_append(dest, "'", 1);
+    for (; *str != '\0'; str++) {
+        if (*str == '\'') {
+            cork_buffer_append_string(dest, "'\\''");
+        } else {
+            cork_buffer_append(dest, str, 1);
+        }
+    }
+    cork_buffer_append(dest, "'", 1);
+}
+
+static int
+print_variable(void *user_data, const char *name, const char *value)
+{
+    struct cork_buffer  *out = user_data;
+    switch (format) {
+        case GET_VALUES:
+            cork_buffer_append_printf(out, "%s\n", value);
+            break;
+
+        case GET_SHELL:
+            append_shell_name(out, name);
+            cork_buffer_append(out, "=", 1);
+            append_shell_string(out, value);
+            cork_buffer_append(out, "\n", 1);
+            break;
+
+        case GET_JSON:
+            cork_buffer_append_string(out, (out->size == 1)? "\n  ": ",\n  ");
+            append_json_string(out, name);
+            cork_buffer_append(out, ": ", 2);
+            append_json_string(out, value);
+            break;
+
+        default:
+            cork_unreachable();
+    }
+    return 0;
+}
+
 static void
 execute(int argc, char **argv)
 {
     struct bz_env  *env;
-    struct bz_value  *value;
+    struct cork_buffer  out = CORK_BUFFER_INIT();
 
-    if (argc != 1) {
-        cork_command_show_help(&buzzy_doc, "Must provide a variable name.");
+    if (argc == 0) {
+        cork_command_show_help(&buzzy_get, "Must provide a variable name.");
         exit(EXIT_FAILURE);
     }
 
@@ -84,21 +204,19 @@ execute(int argc, char **argv)
         }
     }
 
-    re_check_error(value = bz_env_get_value(env, argv[0]));
-    if (value == NULL) {
-        fprintf(stderr, "No variable named %s\n", argv[0]);
-        exit(EXIT_FAILURE);
+    /* Collect everything before printing anything, so that an error in one
+     * variable doesn't leave a partial set of assignments behind. */
+    if (format == GET_JSON) {
+        cork_buffer_set(&out, "{", 1);
     } else {
-        if (bz_value_kind(value) == BZ_VALUE_SCALAR) {
-            const char  *content;
-            re_check_error(content = bz_scalar_value_get
-                           (value, bz_env_as_value(env)));
-            puts(content);
-        } else {
-            fprintf(stderr, "Cannot print non-scalar variables\n");
-            exit(EXIT_FAILURE);
-        }
+        cork_buffer_set(&out, "", 0);
     }
-
+    ri_check_error(bz_env_get_many
+                   (env, argc, (const char **) argv, &out, print_variable));
+    if (format == GET_JSON) {
+        cork_buffer_append_string(&out, (out.size == 1)? "}\n": "\n}\n");
+    }
+    fwrite(out.buf, 1, out.size, stdout);
+    cork_buffer_done(&out);
     exit(EXIT_SUCCESS);
 }
@@ -32,6 +32,7 @@
 #define HELP_TEXT \
 "Prints out information about the current Buzzy repository, and any\n" \
 "packages that it defines.\n" \
+PROFILE_HELP_TEXT \
 
 static int
 parse_options(int argc, char **argv);
@@ -46,6 +47,7 @@ CORK_LOCAL struct cork_command  buzzy_info =
 #define SHORT_OPTS  "+"
 
 static struct option  opts[] = {
+    PROFILE_LONG_OPTS,
     { NULL, 0, NULL, 0 }
 };
 
@@ -55,6 +57,10 @@ parse_options(int argc, char **argv)
     int  ch;
     getopt_reset();
     while ((ch = getopt_long(argc, argv, SHORT_OPTS, opts, NULL)) != -1) {
+        if (profile_parse_opt(ch, &buzzy_info)) {
+            continue;
+        }
+
         switch (ch) {
             default:
                 cork_command_show_help(&buzzy_info, NULL);
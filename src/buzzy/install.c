@@ -34,6 +34,7 @@
 "Finds a set of packages that satisfies all of the dependencies that you\n" \
 "provide, and then installs them all.  If necessary, we build the packages\n" \
 "first, but we don't test them.\n" \
+JOBS_HELP_TEXT \
 GENERAL_HELP_TEXT \
 
 static int
@@ -47,9 +48,11 @@ CORK_LOCAL struct cork_command  buzzy_install =
                       parse_options, execute);
 
 #define SHORT_OPTS  "+" \
+    JOBS_SHORT_OPTS \
     GENERAL_SHORT_OPTS \
 
 static struct option  opts[] = {
+    JOBS_LONG_OPTS,
     GENERAL_LONG_OPTS,
     { NULL, 0, NULL, 0 }
 };
@@ -60,6 +63,10 @@ parse_options(int argc, char **argv)
     int  ch;
     getopt_reset();
     while ((ch = getopt_long(argc, argv, SHORT_OPTS, opts, NULL)) != -1) {
+        if (jobs_parse_opt(ch, &buzzy_install)) {
+            continue;
+        }
+
         if (general_parse_opt(ch, &buzzy_raw_pkg)) {
             continue;
         }
@@ -77,15 +84,9 @@ parse_options(int argc, char **argv)
 static void
 execute(int argc, char **argv)
 {
-    size_t  i;
-
     bz_load_repositories();
     satisfy_dependencies(&buzzy_install, argc, argv);
-
-    for (i = 0; i < cork_array_size(&dep_packages); i++) {
-        struct bz_package  *package = cork_array_at(&dep_packages, i);
-        ri_check_error(bz_package_install(package));
-    }
+    install_dependency_graph(true);
 
     free_dependencies();
     bz_finalize_actions();
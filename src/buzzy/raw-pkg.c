@@ -107,7 +107,6 @@ execute(int argc, char **argv)
         exit(EXIT_FAILURE);
     }
 
-    ri_check_error(bz_load_variable_definitions());
     ri_check_error(bz_pdb_discover());
     package_env_init();
 
@@ -34,6 +34,10 @@
 "If the current repository, or any of the repositories that it depends on,\n" \
 "come from a remote source, we will contact the remote source to make sure\n" \
 "that our local copies are up-to-date.\n" \
+"\n" \
+"Parallel update options:\n" \
+"  -j <count>, --jobs <count>\n" \
+"    Update up to <count> repositories at the same time.  (The default is 1.)\n" \
 GENERAL_HELP_TEXT \
 
 static int
@@ -48,9 +52,11 @@ CORK_LOCAL struct cork_command  buzzy_update =
 
 #define SHORT_OPTS  "+" \
     GENERAL_SHORT_OPTS \
+    JOBS_SHORT_OPTS \
 
 static struct option  opts[] = {
     GENERAL_LONG_OPTS,
+    JOBS_LONG_OPTS,
     { NULL, 0, NULL, 0 }
 };
 
@@ -64,6 +70,10 @@ parse_options(int argc, char **argv)
             continue;
         }
 
+        if (jobs_parse_opt(ch, &buzzy_update)) {
+            continue;
+        }
+
         switch (ch) {
             default:
                 cork_command_show_help(&buzzy_update, NULL);
@@ -77,7 +87,6 @@ parse_options(int argc, char **argv)
 static void
 execute(int argc, char **argv)
 {
-    size_t  i;
     size_t  repo_count;
 
     bz_load_repositories();
@@ -87,10 +96,7 @@ execute(int argc, char **argv)
         exit(EXIT_SUCCESS);
     }
 
-    for (i = 0; i < repo_count; i++) {
-        struct bz_repo  *repo = bz_repo_registry_get(i);
-        ri_check_error(bz_repo_update(repo));
-    }
+    ri_check_error(bz_repo_registry_update_all(jobs));
 
     bz_finalize_actions();
     exit(EXIT_SUCCESS);
@@ -0,0 +1,203 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2015, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <string.h>
+
+#include <libcork/core.h>
+#include <libcork/threads.h>
+
+#include "buzzy/arena.h"
+
+
+/*-----------------------------------------------------------------------
+ * Arenas
+ */
+
+/* Most of what we put into an arena is small (values, map entries, short
+ * strings), and lots of environments only hold a few kilobytes of them, so we
+ * use small blocks to keep the unused tail of each arena's last block small.
+ * Anything larger than a quarter of a block gets a block of its own, so that
+ * we don't waste the rest of the current one.  Nothing that we put into an
+ * arena needs more than 8-byte alignment. */
+#define BZ_ARENA_BLOCK_SIZE  1024
+#define BZ_ARENA_LARGE_SIZE  (BZ_ARENA_BLOCK_SIZE / 4)
+#define BZ_ARENA_ALIGNMENT  8
+
+#define bz_arena_align(size) \
+    (((size) + BZ_ARENA_ALIGNMENT - 1) & ~((size_t) BZ_ARENA_ALIGNMENT - 1))
+
+struct bz_arena_block {
+    struct bz_arena_block  *next;
+    size_t  size;
+};
+
+#define bz_arena_block_header_size  bz_arena_align(sizeof(struct bz_arena_block))
+
+struct bz_arena_cleanup {
+    struct bz_arena_cleanup  *next;
+    void  *user_data;
+    cork_free_f  free_user_data;
+};
+
+struct bz_arena {
+    /* The unused part of the current block */
+    char  *next;
+    char  *end;
+    struct bz_arena_block  *blocks;
+    /* In the reverse of the order that they were registered */
+    struct bz_arena_cleanup  *cleanups;
+    size_t  size;
+};
+
+struct bz_arena *
+bz_arena_new(void)
+{
+    struct bz_arena  *arena = cork_new(struct bz_arena);
+    arena->next = NULL;
+    arena->end = NULL;
+    arena->blocks = NULL;
+    arena->cleanups = NULL;
+    arena->size = 0;
+    return arena;
+}
+
+void
+bz_arena_free(struct bz_arena *arena)
+{
+    struct bz_arena_cleanup  *cleanup;
+    struct bz_arena_block  *block;
+    struct bz_arena_block  *next;
+
+    /* The cleanup functions can still refer to anything in the arena, so we
+     * have to call all of them before freeing any blocks. */
+    for (cleanup = arena->cleanups; cleanup != NULL; cleanup = cleanup->next) {
+        cleanup->free_user_data(cleanup->user_data);
+    }
+
+    for (block = arena->blocks; block != NULL; block = next) {
+        next = block->next;
+        cork_free(block, block->size);
+    }
+    free(arena);
+}
+
+static void *
+bz_arena_new_block(struct bz_arena *arena, size_t size)
+{
+    struct bz_arena_block  *block;
+    block = cork_malloc(bz_arena_block_header_size + size);
+    block->size = bz_arena_block_header_size + size;
+    block->next = arena->blocks;
+    arena->blocks = block;
+    return ((char *) block) + bz_arena_block_header_size;
+}
+
+void *
+bz_arena_alloc(struct bz_arena *arena, size_t size)
+{
+    void  *result;
+
+    if (arena == NULL) {
+        return cork_malloc(size);
+    }
+
+    size = bz_arena_align(size);
+    arena->size += size;
+    if (CORK_LIKELY(size <= (size_t) (arena->end - arena->next))) {
+        result = arena->next;
+        arena->next += size;
+        return result;
+    }
+
+    if (size > BZ_ARENA_LARGE_SIZE) {
+        return bz_arena_new_block(arena, size);
+    }
+
+    result = bz_arena_new_block(arena, BZ_ARENA_BLOCK_SIZE);
+    arena->next = ((char *) result) + size;
+    arena->end = ((char *) result) + BZ_ARENA_BLOCK_SIZE;
+    return result;
+}
+
+const char *
+bz_arena_strdup(struct bz_arena *arena, const char *str)
+{
+    size_t  size;
+    char  *result;
+
+    if (arena == NULL) {
+        return cork_strdup(str);
+    }
+
+    size = strlen(str) + 1;
+    result = bz_arena_alloc(arena, size);
+    memcpy(result, str, size);
+    return result;
+}
+
+void
+bz_arena_dealloc(struct bz_arena *arena, void *ptr)
+{
+    if (arena == NULL) {
+        free(ptr);
+    }
+}
+
+void
+bz_arena_strfree(struct bz_arena *arena, const char *str)
+{
+    if (arena == NULL) {
+        cork_strfree(str);
+    }
+}
+
+void
+bz_arena_add_cleanup(struct bz_arena *arena, void *user_data,
+                     cork_free_f free_user_data)
+{
+    struct bz_arena_cleanup  *cleanup;
+    cleanup = bz_arena_alloc(arena, sizeof(struct bz_arena_cleanup));
+    cleanup->user_data = user_data;
+    cleanup->free_user_data = free_user_data;
+    cleanup->next = arena->cleanups;
+    arena->cleanups = cleanup;
+}
+
+size_t
+bz_arena_size(struct bz_arena *arena)
+{
+    return arena->size;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Current arena
+ */
+
+struct bz_arena_tls {
+    struct bz_arena  *current;
+};
+
+cork_tls(struct bz_arena_tls, bz_arena_tls);
+
+struct bz_arena *
+bz_arena_current(void)
+{
+    struct bz_arena_tls  *tls = bz_arena_tls_get();
+    return tls->current;
+}
+
+struct bz_arena *
+bz_arena_set_current(struct bz_arena *arena)
+{
+    struct bz_arena_tls  *tls = bz_arena_tls_get();
+    struct bz_arena  *previous = tls->current;
+    tls->current = arena;
+    return previous;
+}
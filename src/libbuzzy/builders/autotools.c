@@ -24,29 +24,26 @@
  * Builtin Autotools variables
  */
 
-bz_define_variables(autotools)
-{
-    bz_package_variable(
-        configure_in, "autotools.configure.configure_in",
-        bz_interpolated_value_new("${source_dir}/configure.ac"),
-        "The location of the package's configure.{ac,in} file",
-        ""
-    );
-
-    bz_package_variable(
-        configure, "autotools.configure.configure",
-        bz_interpolated_value_new("${source_dir}/configure"),
-        "The location of the package's configure script",
-        ""
-    );
-
-    bz_package_variable(
-        configure, "autotools.configure.args",
-        NULL,
-        "Additional arguments to pass in to the configure script",
-        ""
-    );
-}
+bz_package_variable(
+    autotools_configure_configure_in, "autotools.configure.configure_in",
+    bz_interpolated_value_new("${source_dir}/configure.ac"),
+    "The location of the package's configure.{ac,in} file",
+    ""
+);
+
+bz_package_variable(
+    autotools_configure_configure, "autotools.configure.configure",
+    bz_interpolated_value_new("${source_dir}/configure"),
+    "The location of the package's configure script",
+    ""
+);
+
+bz_package_variable(
+    autotools_configure_args, "autotools.configure.args",
+    NULL,
+    "Additional arguments to pass in to the configure script",
+    ""
+);
 
 
 /*-----------------------------------------------------------------------
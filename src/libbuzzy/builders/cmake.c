@@ -23,22 +23,19 @@
  * Builtin CMake variables
  */
 
-bz_define_variables(cmake)
-{
-    bz_package_variable(
-        build_type, "cmake.build_type",
-        bz_string_value_new("RelWithDebInfo"),
-        "The CMake build type for this package",
-        ""
-    );
-
-    bz_package_variable(
-        cmakelists, "cmake.cmakelists",
-        bz_interpolated_value_new("${source_dir}/CMakeLists.txt"),
-        "The location of the top-level CMake build script",
-        ""
-    );
-}
+bz_package_variable(
+    cmake_build_type, "cmake.build_type",
+    bz_string_value_new("RelWithDebInfo"),
+    "The CMake build type for this package",
+    ""
+);
+
+bz_package_variable(
+    cmake_cmakelists, "cmake.cmakelists",
+    bz_interpolated_value_new("${source_dir}/CMakeLists.txt"),
+    "The location of the top-level CMake build script",
+    ""
+);
 
 
 /*-----------------------------------------------------------------------
@@ -0,0 +1,412 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2015, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <clogger.h>
+#include <libcork/core.h>
+#include <libcork/ds.h>
+#include <libcork/os.h>
+#include <libcork/helpers/errors.h>
+
+#include "buzzy/error.h"
+#include "buzzy/logging.h"
+#include "buzzy/package.h"
+
+#define CLOG_CHANNEL  "dep-graph"
+
+
+/*-----------------------------------------------------------------------
+ * Graph nodes
+ */
+
+struct bz_dep_node {
+    struct bz_package  *package;
+    /* The nodes that can't be built until this one is installed */
+    cork_array(struct bz_dep_node *)  dependents;
+    /* The number of this node's dependencies that aren't installed yet */
+    size_t  pending;
+    /* Whether we're still adding this node's dependencies to the graph */
+    bool  visiting;
+
+    /* For packaging this node in a child process */
+    struct bz_child_job  job;
+};
+
+static int
+bz_dep_node__run(void *user_data);
+
+static struct bz_dep_node *
+bz_dep_node_new(struct bz_package *package)
+{
+    struct bz_dep_node  *node = cork_new(struct bz_dep_node);
+    node->package = package;
+    cork_array_init(&node->dependents);
+    node->pending = 0;
+    node->visiting = false;
+    bz_child_job_init(&node->job, bz_dep_node__run, node);
+    return node;
+}
+
+static void
+bz_dep_node_free(void *vnode)
+{
+    struct bz_dep_node  *node = vnode;
+    bz_child_job_done(&node->job);
+    cork_array_done(&node->dependents);
+    free(node);
+}
+
+static void
+bz_dep_node_add_dependent(struct bz_dep_node *node,
+                          struct bz_dep_node *dependent)
+{
+    size_t  i;
+    /* A package can appear in both of a package's dependency lists. */
+    for (i = 0; i < cork_array_size(&node->dependents); i++) {
+        if (cork_array_at(&node->dependents, i) == dependent) {
+            return;
+        }
+    }
+    cork_array_append(&node->dependents, dependent);
+    dependent->pending++;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Dependency graphs
+ */
+
+struct bz_dep_graph {
+    /* Maps each bz_package to its bz_dep_node */
+    struct cork_hash_table  *nodes;
+    /* Every node, with each node's dependencies appearing before it */
+    cork_array(struct bz_dep_node *)  order;
+};
+
+struct bz_dep_graph *
+bz_dep_graph_new(void)
+{
+    struct bz_dep_graph  *graph = cork_new(struct bz_dep_graph);
+    graph->nodes = cork_pointer_hash_table_new(0, 0);
+    cork_hash_table_set_free_value(graph->nodes, bz_dep_node_free);
+    cork_array_init(&graph->order);
+    return graph;
+}
+
+void
+bz_dep_graph_free(struct bz_dep_graph *graph)
+{
+    cork_hash_table_free(graph->nodes);
+    cork_array_done(&graph->order);
+    free(graph);
+}
+
+size_t
+bz_dep_graph_count(struct bz_dep_graph *graph)
+{
+    return cork_array_size(&graph->order);
+}
+
+static int
+bz_dep_graph_add_node(struct bz_dep_graph *graph, struct bz_package *package,
+                      struct bz_dep_node **dest);
+
+static int
+bz_dep_graph_add_list(struct bz_dep_graph *graph,
+                      struct bz_package_list *list,
+                      struct bz_dep_node *dependent)
+{
+    size_t  i;
+    for (i = 0; i < bz_package_list_count(list); i++) {
+        struct bz_package  *dep = bz_package_list_get(list, i);
+        struct bz_dep_node  *dep_node;
+        rii_check(bz_dep_graph_add_node(graph, dep, &dep_node));
+        if (dependent != NULL) {
+            bz_dep_node_add_dependent(dep_node, dependent);
+        }
+    }
+    return 0;
+}
+
+static int
+bz_dep_graph_add_all_deps(struct bz_dep_graph *graph,
+                          struct bz_package *package,
+                          struct bz_dep_node *dependent)
+{
+    struct bz_package_list  *deps;
+    struct bz_package_list  *build_deps;
+    rip_check(deps = bz_package_deps(package));
+    rip_check(build_deps = bz_package_build_deps(package));
+    rii_check(bz_dep_graph_add_list(graph, deps, dependent));
+    return bz_dep_graph_add_list(graph, build_deps, dependent);
+}
+
+static int
+bz_dep_graph_add_node(struct bz_dep_graph *graph, struct bz_package *package,
+                      struct bz_dep_node **dest)
+{
+    bool  is_new;
+    struct cork_hash_table_entry  *entry;
+    struct bz_dep_node  *node;
+
+    entry = cork_hash_table_get_or_create(graph->nodes, package, &is_new);
+    if (!is_new) {
+        node = entry->value;
+        if (CORK_UNLIKELY(node->visiting)) {
+            bz_circular_actions
+                ("Circular dependency involving %s",
+                 bz_package_name(package));
+            return -1;
+        }
+        *dest = node;
+        return 0;
+    }
+
+    node = bz_dep_node_new(package);
+    entry->value = node;
+    node->visiting = true;
+    rii_check(bz_dep_graph_add_all_deps(graph, package, node));
+    node->visiting = false;
+    cork_array_append(&graph->order, node);
+    *dest = node;
+    return 0;
+}
+
+int
+bz_dep_graph_add(struct bz_dep_graph *graph, struct bz_package *package)
+{
+    struct bz_dep_node  *node;
+    return bz_dep_graph_add_node(graph, package, &node);
+}
+
+int
+bz_dep_graph_add_deps(struct bz_dep_graph *graph, struct bz_package *package)
+{
+    return bz_dep_graph_add_all_deps(graph, package, NULL);
+}
+
+
+/*-----------------------------------------------------------------------
+ * Child processes
+ */
+
+/* Runs in a child process */
+static int
+bz_dep_node__run(void *user_data)
+{
+    struct bz_dep_node  *node = user_data;
+    return bz_package_package(node->package);
+}
+
+static int
+bz_dep_node_start(struct bz_dep_node *node)
+{
+    clog_debug("Start packaging %s", bz_package_name(node->package));
+    return bz_child_job_start(&node->job);
+}
+
+
+/*-----------------------------------------------------------------------
+ * Scheduler
+ */
+
+struct bz_dep_scheduler {
+    unsigned int  jobs;
+    /* Nodes whose dependencies have all been installed */
+    cork_array(struct bz_dep_node *)  ready;
+    size_t  next_ready;
+    /* Nodes that are being packaged in a child process */
+    cork_array(struct bz_dep_node *)  running;
+    size_t  remaining;
+};
+
+/* Installs a node (in the current process), which might let us start building
+ * some of the nodes that depend on it. */
+static int
+bz_dep_scheduler_install(struct bz_dep_scheduler *sched,
+                         struct bz_dep_node *node)
+{
+    size_t  i;
+    rii_check(bz_package_install(node->package));
+    sched->remaining--;
+    for (i = 0; i < cork_array_size(&node->dependents); i++) {
+        struct bz_dep_node  *dependent = cork_array_at(&node->dependents, i);
+        if (--dependent->pending == 0) {
+            cork_array_append(&sched->ready, dependent);
+        }
+    }
+    return 0;
+}
+
+static int
+bz_dep_scheduler_start(struct bz_dep_scheduler *sched,
+                       struct bz_dep_node *node)
+{
+    bool  is_needed;
+    rii_check(bz_package_package_is_needed(node->package, &is_needed));
+    if (!is_needed) {
+        /* Native and preinstalled packages (and built packages whose binary
+         * packages already exist) can be installed straightaway. */
+        return bz_dep_scheduler_install(sched, node);
+    }
+    rii_check(bz_dep_node_start(node));
+    cork_array_append(&sched->running, node);
+    return 0;
+}
+
+/* Checks on each of the running child processes.  If `install` is false, we've
+ * already run into an error, and are only waiting for the other children to
+ * finish what they're doing. */
+static int
+bz_dep_scheduler_poll(struct bz_dep_scheduler *sched, bool install,
+                      bool *progress)
+{
+    size_t  i = 0;
+    int  rc = 0;
+    while (i < cork_array_size(&sched->running)) {
+        struct bz_dep_node  *node = cork_array_at(&sched->running, i);
+        size_t  j;
+
+        if (bz_child_job_drain(&node->job)) {
+            *progress = true;
+        }
+        if (!bz_child_job_is_finished(&node->job)) {
+            i++;
+            continue;
+        }
+
+        *progress = true;
+        for (j = i + 1; j < cork_array_size(&sched->running); j++) {
+            cork_array_at(&sched->running, j - 1) =
+                cork_array_at(&sched->running, j);
+        }
+        sched->running.size--;
+
+        if (bz_child_job_finish(&node->job) != 0) {
+            if (install) {
+                bz_subprocess_error
+                    ("Couldn't package %s", bz_package_name(node->package));
+            }
+            rc = -1;
+            install = false;
+        } else {
+            bz_package_mark_packaged(node->package);
+            if (install && bz_dep_scheduler_install(sched, node) != 0) {
+                rc = -1;
+                install = false;
+            }
+        }
+    }
+    return rc;
+}
+
+static int
+bz_dep_graph_install_parallel(struct bz_dep_graph *graph, unsigned int jobs)
+{
+    size_t  i;
+    int  rc = 0;
+    struct bz_dep_scheduler  sched;
+
+    sched.jobs = jobs;
+    cork_array_init(&sched.ready);
+    sched.next_ready = 0;
+    cork_array_init(&sched.running);
+    sched.remaining = cork_array_size(&graph->order);
+    for (i = 0; i < cork_array_size(&graph->order); i++) {
+        struct bz_dep_node  *node = cork_array_at(&graph->order, i);
+        if (node->pending == 0) {
+            cork_array_append(&sched.ready, node);
+        }
+    }
+
+    while (sched.remaining > 0) {
+        bool  progress = false;
+        while (rc == 0 && cork_array_size(&sched.running) < sched.jobs &&
+               sched.next_ready < cork_array_size(&sched.ready)) {
+            struct bz_dep_node  *node =
+                cork_array_at(&sched.ready, sched.next_ready++);
+            rc = bz_dep_scheduler_start(&sched, node);
+        }
+
+        /* If nothing is running, then either we've run into an error, or
+         * there's nothing left that we can build. */
+        if (cork_array_size(&sched.running) == 0) {
+            break;
+        }
+
+        if (bz_dep_scheduler_poll(&sched, rc == 0, &progress) != 0) {
+            rc = -1;
+        }
+        if (!progress) {
+            usleep(1000);
+        }
+    }
+
+    /* If we ran out of things to do without an error, some packages must still
+     * be waiting on dependencies that were never installed.  Don't report
+     * success without installing them. */
+    if (rc == 0 && sched.remaining > 0) {
+        const char  *stuck = NULL;
+        for (i = 0; stuck == NULL && i < cork_array_size(&graph->order); i++) {
+            struct bz_dep_node  *node = cork_array_at(&graph->order, i);
+            if (node->pending > 0) {
+                stuck = bz_package_name(node->package);
+            }
+        }
+        bz_cannot_satisfy
+            ("Couldn't install %zu packages (including %s), since their "
+             "dependencies were never installed",
+             sched.remaining, (stuck == NULL)? "unknown": stuck);
+        rc = -1;
+    }
+
+    cork_array_done(&sched.ready);
+    cork_array_done(&sched.running);
+    return rc;
+}
+
+int
+bz_dep_graph_install(struct bz_dep_graph *graph, unsigned int jobs)
+{
+    size_t  i;
+    int  rc;
+    cork_array(struct bz_package *)  packages;
+
+    assert(jobs > 0);
+    if (cork_array_size(&graph->order) == 0) {
+        return 0;
+    }
+
+    /* Give the package databases a chance to install all of their packages at
+     * once, before we start building anything. */
+    cork_array_init(&packages);
+    for (i = 0; i < cork_array_size(&graph->order); i++) {
+        struct bz_dep_node  *node = cork_array_at(&graph->order, i);
+        cork_array_append(&packages, node->package);
+    }
+    rc = bz_install_many
+        (cork_array_size(&packages), cork_array_elements(&packages));
+    cork_array_done(&packages);
+    rii_check(rc);
+
+    if (jobs == 1) {
+        /* With only one job, we don't need any child processes; installing the
+         * packages in order takes care of everything. */
+        for (i = 0; i < cork_array_size(&graph->order); i++) {
+            struct bz_dep_node  *node = cork_array_at(&graph->order, i);
+            rii_check(bz_package_install(node->package));
+        }
+        return 0;
+    } else {
+        return bz_dep_graph_install_parallel(graph, jobs);
+    }
+}
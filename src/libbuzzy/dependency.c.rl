@@ -60,6 +60,15 @@ bz_dependency_new(const char *package_name, struct bz_version *min_version)
     return dep;
 }
 
+struct bz_dependency *
+bz_dependency_copy(const struct bz_dependency *other)
+{
+    return bz_dependency_new
+        (other->package_name,
+         (other->min_version == NULL)?
+             NULL: bz_version_copy(other->min_version));
+}
+
 
 static struct bz_dependency *
 bz_dependency_from_string_parts(const char *string,
@@ -10,6 +10,7 @@
 #include <assert.h>
 #include <ctype.h>
 #include <errno.h>
+#include <inttypes.h>
 #include <string.h>
 #include <unistd.h>
 #include <sys/stat.h>
@@ -26,6 +27,7 @@
 #include "buzzy/native.h"
 #include "buzzy/os.h"
 #include "buzzy/package.h"
+#include "buzzy/session.h"
 #include "buzzy/version.h"
 #include "buzzy/distro/arch.h"
 
@@ -343,33 +345,373 @@ bz_version_from_arch(const char *arch_version)
 }
 
 
+/*-----------------------------------------------------------------------
+ * pacman databases
+ */
+
+/* Rather than running pacman for each package that we check, we read its
+ * databases directly.  Installed packages are described by the desc files in
+ * /var/lib/pacman/local, and available packages by the desc files inside the
+ * sync database tarballs in /var/lib/pacman/sync.  We use a single tar process
+ * to stream all of the desc files out of each sync database, and save the
+ * resulting index in Buzzy's work directory.  (See bz_native_index_update.) */
+
+#define BZ_PACMAN_CONF_PATH  "/etc/pacman.conf"
+#define BZ_PACMAN_LOCAL_PATH  "/var/lib/pacman/local"
+#define BZ_PACMAN_SYNC_PATH  "/var/lib/pacman/sync"
+
+/* Each session has its own copy of the indexes, so separate sessions can use
+ * them from separate threads.  You must hold the session lock while using
+ * them. */
+
+struct bz_pacman_indexes {
+    struct bz_native_index  *local;
+    struct bz_native_index  *sync;
+};
+
+static void
+bz_pacman_indexes_free(void *user_data)
+{
+    struct bz_pacman_indexes  *indexes = user_data;
+    bz_native_index_free(indexes->local);
+    bz_native_index_free(indexes->sync);
+    free(indexes);
+}
+
+/* Returns the current session's indexes, creating them if necessary.  The
+ * caller must hold the session lock. */
+static struct bz_pacman_indexes *
+bz_pacman_indexes_get(struct bz_session *session)
+{
+    struct bz_pacman_indexes  *indexes =
+        bz_session_get_slot(session, BZ_SESSION_ARCH);
+    if (indexes == NULL) {
+        indexes = cork_new(struct bz_pacman_indexes);
+        indexes->local = bz_native_index_new(NULL, NULL);
+        indexes->sync = bz_native_index_new("pacman-sync.index", NULL);
+        bz_session_set_slot
+            (session, BZ_SESSION_ARCH, indexes, bz_pacman_indexes_free);
+    }
+    return indexes;
+}
+
+void
+bz_arch_native_local_invalidate(void)
+{
+    struct bz_session  *session = bz_session_current();
+    struct bz_pacman_indexes  *indexes;
+    bz_session_lock(session);
+    indexes = bz_session_get_slot(session, BZ_SESSION_ARCH);
+    if (indexes != NULL) {
+        bz_native_index_invalidate(indexes->local);
+    }
+    bz_session_unlock(session);
+}
+
+#define bz_pacman_line_is(line, line_end, str) \
+    ((size_t) ((line_end) - (line)) == sizeof(str) - 1 && \
+     memcmp((line), (str), sizeof(str) - 1) == 0)
+
+/* Adds the name and version from each of a sequence of (possibly
+ * concatenated) desc files to index. */
+static void
+bz_pacman_desc_parse(struct bz_native_index *index,
+                     const char *buf, size_t size)
+{
+    const char  *curr = buf;
+    const char  *end = buf + size;
+    const char  *name = NULL;
+    size_t  name_len = 0;
+    enum { BZ_PACMAN_NONE, BZ_PACMAN_NAME, BZ_PACMAN_VERSION }  next =
+        BZ_PACMAN_NONE;
+
+    while (curr < end) {
+        const char  *line_end = memchr(curr, '\n', end - curr);
+        if (line_end == NULL) {
+            line_end = end;
+        }
+
+        if (next == BZ_PACMAN_NAME) {
+            name = curr;
+            name_len = line_end - curr;
+            next = BZ_PACMAN_NONE;
+        } else if (next == BZ_PACMAN_VERSION) {
+            if (name != NULL) {
+                bz_native_index_add
+                    (index, name, name_len, curr, line_end - curr);
+                name = NULL;
+            }
+            next = BZ_PACMAN_NONE;
+        } else if (bz_pacman_line_is(curr, line_end, "%NAME%")) {
+            next = BZ_PACMAN_NAME;
+        } else if (bz_pacman_line_is(curr, line_end, "%VERSION%")) {
+            next = BZ_PACMAN_VERSION;
+        }
+
+        curr = line_end + 1;
+    }
+}
+
+
+/* Installed packages */
+
+struct bz_pacman_local {
+    struct cork_dir_walker  parent;
+    struct bz_native_index  *index;
+    struct cork_buffer  buf;
+};
+
+static int
+bz_pacman_local__file(struct cork_dir_walker *walker, const char *full_path,
+                      const char *rel_path, const char *base_name)
+{
+    struct bz_pacman_local  *local =
+        cork_container_of(walker, struct bz_pacman_local, parent);
+    const char  *slash = strchr(rel_path, '/');
+    /* Each package has its own directory, which contains a desc file. */
+    if (slash != NULL && strchr(slash + 1, '/') == NULL &&
+        strcmp(base_name, "desc") == 0) {
+        cork_buffer_clear(&local->buf);
+        rii_check(bz_load_file(full_path, &local->buf));
+        bz_pacman_desc_parse(local->index, local->buf.buf, local->buf.size);
+    }
+    return 0;
+}
+
+static int
+bz_pacman_local__directory(struct cork_dir_walker *walker,
+                           const char *full_path, const char *rel_path,
+                           const char *base_name)
+{
+    return 0;
+}
+
+static int
+bz_pacman_local_build(void *user_data, struct bz_native_index *index)
+{
+    int  rc;
+    struct bz_pacman_local  local;
+    clog_debug("Read pacman local database");
+    local.parent.enter_directory = bz_pacman_local__directory;
+    local.parent.file = bz_pacman_local__file;
+    local.parent.leave_directory = bz_pacman_local__directory;
+    local.index = index;
+    cork_buffer_init(&local.buf);
+    rc = bz_walk_directory(BZ_PACMAN_LOCAL_PATH, &local.parent);
+    cork_buffer_done(&local.buf);
+    return rc;
+}
+
+/* Makes sure that the local index is up to date.  Sets *available to false if
+ * there isn't a local database that we can read.  Installing or removing a
+ * package adds or removes a directory, which changes the modification time of
+ * the local database directory. */
+static int
+bz_pacman_local_load(struct bz_pacman_indexes *indexes, bool *available)
+{
+    struct bz_file_stamp  stamp;
+    struct cork_buffer  key = CORK_BUFFER_INIT();
+
+    rii_check(bz_file_stamp(BZ_PACMAN_LOCAL_PATH, &stamp));
+    *available = stamp.exists;
+    if (!stamp.exists) {
+        return 0;
+    }
+
+    cork_buffer_printf
+        (&key, "local %zu %" PRId64 " %" PRId64 "\n",
+         stamp.size, stamp.mtime_sec, stamp.mtime_nsec);
+    ei_check(bz_native_index_update
+             (indexes->local, &key, bz_pacman_local_build, NULL));
+    cork_buffer_done(&key);
+    return 0;
+
+error:
+    cork_buffer_done(&key);
+    return -1;
+}
+
+
+/* Available packages */
+
+struct bz_pacman_sync {
+    cork_array(const char *)  repos;
+};
+
+static void
+bz_pacman_sync_done(struct bz_pacman_sync *sync)
+{
+    size_t  i;
+    for (i = 0; i < cork_array_size(&sync->repos); i++) {
+        cork_strfree(cork_array_at(&sync->repos, i));
+    }
+    cork_array_done(&sync->repos);
+}
+
+/* Finds the sync databases for each of the repositories listed in pacman.conf,
+ * in the order that pacman searches them, and fills in key with a description
+ * of them that will change whenever any of them do. */
+static int
+bz_pacman_sync_find(struct bz_pacman_sync *sync, struct cork_buffer *key)
+{
+    struct bz_file_stamp  stamp;
+    struct cork_buffer  conf = CORK_BUFFER_INIT();
+    struct cork_buffer  path = CORK_BUFFER_INIT();
+    const char  *curr;
+    const char  *end;
+
+    cork_array_init(&sync->repos);
+    ei_check(bz_file_stamp(BZ_PACMAN_CONF_PATH, &stamp));
+    if (!stamp.exists) {
+        goto done;
+    }
+
+    cork_buffer_append_printf
+        (key, "conf %zu %" PRId64 " %" PRId64 "\n",
+         stamp.size, stamp.mtime_sec, stamp.mtime_nsec);
+    ei_check(bz_load_file(BZ_PACMAN_CONF_PATH, &conf));
+    curr = conf.buf;
+    end = curr + conf.size;
+    while (curr < end) {
+        const char  *line_end = memchr(curr, '\n', end - curr);
+        const char  *close;
+        if (line_end == NULL) {
+            line_end = end;
+        }
+        while (curr < line_end && isspace((unsigned char) *curr)) {
+            curr++;
+        }
+
+        /* Every section other than [options] names a repository. */
+        if (curr < line_end && *curr == '[' &&
+            (close = memchr(curr, ']', line_end - curr)) != NULL &&
+            !bz_pacman_line_is(curr + 1, close, "options")) {
+            cork_buffer_printf
+                (&path, "%s/%.*s.db", BZ_PACMAN_SYNC_PATH,
+                 (int) (close - curr - 1), curr + 1);
+            ei_check(bz_file_stamp(path.buf, &stamp));
+            if (stamp.exists) {
+                cork_array_append(&sync->repos, cork_strdup(path.buf));
+                cork_buffer_append_printf
+                    (key, "sync %s %zu %" PRId64 " %" PRId64 "\n",
+                     (char *) path.buf, stamp.size,
+                     stamp.mtime_sec, stamp.mtime_nsec);
+            }
+        }
+
+        curr = line_end + 1;
+    }
+
+done:
+    cork_buffer_done(&conf);
+    cork_buffer_done(&path);
+    return 0;
+
+error:
+    cork_buffer_done(&conf);
+    cork_buffer_done(&path);
+    return -1;
+}
+
+static int
+bz_pacman_sync_build(void *user_data, struct bz_native_index *index)
+{
+    struct bz_pacman_sync  *sync = user_data;
+    size_t  i;
+    struct cork_buffer  out = CORK_BUFFER_INIT();
+
+    /* pacman uses the first repository that contains a package, and
+     * bz_native_index_add keeps the first version it sees, so we just have to
+     * read the databases in order. */
+    for (i = 0; i < cork_array_size(&sync->repos); i++) {
+        const char  *path = cork_array_at(&sync->repos, i);
+        bool  successful;
+        clog_debug("Read pacman sync database %s", path);
+        cork_buffer_clear(&out);
+        ei_check(bz_subprocess_get_output
+                 (&out, NULL, &successful,
+                  "tar", "-xOf", path, "--wildcards", "*/desc", NULL));
+        if (CORK_UNLIKELY(!successful)) {
+            bz_subprocess_error("Cannot read pacman database %s", path);
+            goto error;
+        }
+        bz_pacman_desc_parse(index, out.buf, out.size);
+    }
+
+    cork_buffer_done(&out);
+    return 0;
+
+error:
+    cork_buffer_done(&out);
+    return -1;
+}
+
+/* Makes sure that the sync index is up to date.  Sets *available to false if
+ * there aren't any sync databases that we can read. */
+static int
+bz_pacman_sync_load(struct bz_pacman_indexes *indexes, bool *available)
+{
+    struct bz_pacman_sync  sync;
+    struct cork_buffer  key = CORK_BUFFER_INIT();
+
+    ei_check(bz_pacman_sync_find(&sync, &key));
+    *available = (cork_array_size(&sync.repos) > 0);
+    if (*available) {
+        ei_check(bz_native_index_update
+                 (indexes->sync, &key, bz_pacman_sync_build, &sync));
+    }
+
+    bz_pacman_sync_done(&sync);
+    cork_buffer_done(&key);
+    return 0;
+
+error:
+    bz_pacman_sync_done(&sync);
+    cork_buffer_done(&key);
+    return -1;
+}
+
+static struct bz_version *
+bz_pacman_index_version(struct bz_native_index *index,
+                        const char *native_package_name)
+{
+    const char  *version = bz_native_index_get(index, native_package_name);
+    if (version == NULL) {
+        return NULL;
+    }
+    return bz_version_from_arch(version);
+}
+
+
 /*-----------------------------------------------------------------------
  * Native package database
  */
 
-struct bz_version *
-bz_arch_native_version_available(const char *native_package_name)
+static struct cork_exec *
+bz_pacman_query_available_exec(const char *native_package_name)
+{
+    struct cork_exec  *exec = cork_exec_new("pacman");
+    cork_exec_add_param(exec, "pacman");
+    cork_exec_add_param(exec, "-Sddp");
+    cork_exec_add_param(exec, "--print-format");
+    cork_exec_add_param(exec, "%v");
+    cork_exec_add_param(exec, native_package_name);
+    return exec;
+}
+
+/* Parses the output of a successful `pacman -Sddp` command. */
+static struct bz_version *
+bz_pacman_parse_version_available(const char *native_package_name,
+                                  struct cork_buffer *out)
 {
     int  cs;
     char  *p;
     char  *pe;
     char  *start = NULL;
     char  *end = NULL;
-    bool  successful;
-    struct cork_buffer  out = CORK_BUFFER_INIT();
-    struct bz_version  *result;
 
-    rpi_check(bz_subprocess_get_output
-              (&out, NULL, &successful,
-               "pacman", "-Sddp", "--print-format", "%v",
-               native_package_name, NULL));
-    if (!successful) {
-        cork_buffer_done(&out);
-        return NULL;
-    }
-
-    p = out.buf;
-    pe = out.buf + out.size;
+    p = out->buf;
+    pe = out->buf + out->size;
 
     %%{
         machine arch_version_available;
@@ -387,18 +729,35 @@ bz_arch_native_version_available(const char *native_package_name)
 
     if (CORK_UNLIKELY(cs < %%{ write first_final; }%%)) {
         bz_invalid_version("Unexpected output from pacman");
-        cork_buffer_done(&out);
         return NULL;
     }
 
     *end = '\0';
-    result = bz_version_from_arch(start);
+    return bz_version_from_arch(start);
+}
+
+static struct bz_version *
+bz_pacman_query_version_available(const char *native_package_name)
+{
+    bool  successful;
+    struct cork_buffer  out = CORK_BUFFER_INIT();
+    struct bz_version  *result;
+
+    rpi_check(bz_subprocess_get_output_exec
+              (&out, NULL, &successful,
+               bz_pacman_query_available_exec(native_package_name)));
+    if (!successful) {
+        cork_buffer_done(&out);
+        return NULL;
+    }
+
+    result = bz_pacman_parse_version_available(native_package_name, &out);
     cork_buffer_done(&out);
     return result;
 }
 
-struct bz_version *
-bz_arch_native_version_installed(const char *native_package_name)
+static struct bz_version *
+bz_pacman_query_version_installed(const char *native_package_name)
 {
     int  cs;
     char  *p;
@@ -449,6 +808,71 @@ bz_arch_native_version_installed(const char *native_package_name)
     return result;
 }
 
+struct bz_version *
+bz_arch_native_version_available(const char *native_package_name)
+{
+    int  rc;
+    bool  available;
+    struct bz_session  *session = bz_session_current();
+    struct bz_pacman_indexes  *indexes;
+    struct bz_version  *result = NULL;
+
+    bz_session_lock(session);
+    indexes = bz_pacman_indexes_get(session);
+    rc = bz_pacman_sync_load(indexes, &available);
+    if (rc == 0 && available) {
+        result = bz_pacman_index_version(indexes->sync, native_package_name);
+    }
+    bz_session_unlock(session);
+
+    if (rc == 0 && !available) {
+        return bz_pacman_query_version_available(native_package_name);
+    }
+    return result;
+}
+
+/* We only need a subprocess to check whether a package is available if we
+ * can't read pacman's sync databases ourselves. */
+static int
+bz_arch_native_probe_available(const char *native_package_name,
+                               struct cork_exec **dest)
+{
+    int  rc;
+    bool  available;
+    struct bz_session  *session = bz_session_current();
+
+    bz_session_lock(session);
+    rc = bz_pacman_sync_load(bz_pacman_indexes_get(session), &available);
+    bz_session_unlock(session);
+    rii_check(rc);
+    *dest = available? NULL:
+        bz_pacman_query_available_exec(native_package_name);
+    return 0;
+}
+
+struct bz_version *
+bz_arch_native_version_installed(const char *native_package_name)
+{
+    int  rc;
+    bool  available;
+    struct bz_session  *session = bz_session_current();
+    struct bz_pacman_indexes  *indexes;
+    struct bz_version  *result = NULL;
+
+    bz_session_lock(session);
+    indexes = bz_pacman_indexes_get(session);
+    rc = bz_pacman_local_load(indexes, &available);
+    if (rc == 0 && available) {
+        result = bz_pacman_index_version(indexes->local, native_package_name);
+    }
+    bz_session_unlock(session);
+
+    if (rc == 0 && !available) {
+        return bz_pacman_query_version_installed(native_package_name);
+    }
+    return result;
+}
+
 
 static int
 bz_arch_native__install(const char *native_package_name,
@@ -457,32 +881,81 @@ bz_arch_native__install(const char *native_package_name,
     /* We don't pass the --needed flag to pacman since our is_needed method
      * should have already verified that the desired version isn't installed
      * yet. */
+    bz_arch_native_local_invalidate();
     return bz_subprocess_run
         (false, NULL,
          "sudo", "pacman", "-S", "--noconfirm", native_package_name,
          NULL);
 }
 
+static int
+bz_arch_native__install_many(size_t count, const char **native_package_names,
+                             struct bz_version **versions)
+{
+    size_t  i;
+    struct cork_exec  *exec;
+    bz_arch_native_local_invalidate();
+    exec = cork_exec_new("sudo");
+    cork_exec_add_param(exec, "sudo");
+    cork_exec_add_param(exec, "pacman");
+    cork_exec_add_param(exec, "-S");
+    cork_exec_add_param(exec, "--noconfirm");
+    for (i = 0; i < count; i++) {
+        cork_exec_add_param(exec, native_package_names[i]);
+    }
+    return bz_subprocess_run_exec(false, NULL, exec);
+}
+
 static int
 bz_arch_native__uninstall(const char *native_package_name)
 {
     /* We don't pass the --needed flag to pacman since our is_needed method
      * should have already verified that the desired version isn't installed
      * yet. */
+    bz_arch_native_local_invalidate();
     return bz_subprocess_run
         (false, NULL,
          "sudo", "pacman", "-R", "--noconfirm", native_package_name,
          NULL);
 }
 
+/* The packages that pacman can install depend on its sync databases.  We also
+ * include the local database, since installing a package changes it. */
+static int
+bz_arch_native__fingerprint(struct cork_buffer *dest)
+{
+    struct bz_pacman_sync  sync;
+    ei_check(bz_pacman_sync_find(&sync, dest));
+    bz_pacman_sync_done(&sync);
+    if (dest->size == 0) {
+        return 0;
+    }
+    return bz_native_fingerprint_add_file(dest, BZ_PACMAN_LOCAL_PATH);
+
+error:
+    bz_pacman_sync_done(&sync);
+    return -1;
+}
+
+static const char * const  bz_arch_native_patterns[] = {
+    "%s", "lib%s", NULL
+};
+
+static const struct bz_native_pdb_ops  bz_arch_native_pdb_ops = {
+    .version_available = bz_arch_native_version_available,
+    .probe_available = bz_arch_native_probe_available,
+    .parse_available = bz_pacman_parse_version_available,
+    .version_installed = bz_arch_native_version_installed,
+    .install = bz_arch_native__install,
+    .install_many = bz_arch_native__install_many,
+    .uninstall = bz_arch_native__uninstall,
+    .fingerprint = bz_arch_native__fingerprint,
+    .patterns = bz_arch_native_patterns
+};
+
 struct bz_pdb *
 bz_arch_native_pdb(void)
 {
     return bz_native_pdb_new
-        ("Arch", "arch",
-         bz_arch_native_version_available,
-         bz_arch_native_version_installed,
-         bz_arch_native__install,
-         bz_arch_native__uninstall,
-         "%s", "lib%s", NULL);
+        ("Arch", "arch", &bz_arch_native_pdb_ops);
 }
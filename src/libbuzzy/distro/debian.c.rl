@@ -10,6 +10,8 @@
 #include <assert.h>
 #include <ctype.h>
 #include <errno.h>
+#include <inttypes.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <sys/stat.h>
@@ -26,6 +28,7 @@
 #include "buzzy/native.h"
 #include "buzzy/os.h"
 #include "buzzy/package.h"
+#include "buzzy/session.h"
 #include "buzzy/version.h"
 #include "buzzy/distro/debian.h"
 
@@ -331,32 +334,541 @@ bz_version_from_deb(const char *deb)
 
 
 /*-----------------------------------------------------------------------
- * Native package database
+ * Debian control files
  */
 
-struct bz_version *
-bz_apt_native_version_available(const char *native_package_name)
+/* dpkg's status database and apt's package lists are both sequences of
+ * stanzas, separated by blank lines, each of which contains "Field: value"
+ * lines.  We only need a handful of the fields from each stanza. */
+
+struct bz_deb_stanza {
+    const char  *package;
+    size_t  package_len;
+    const char  *architecture;
+    size_t  architecture_len;
+    const char  *status;
+    size_t  status_len;
+    const char  *version;
+    size_t  version_len;
+};
+
+typedef void
+(*bz_deb_stanza_f)(void *user_data, struct bz_deb_stanza *stanza);
+
+/* Stores the value of a "Field: value" line into *value, if the line is for
+ * the given field. */
+static void
+bz_deb_control_field(const char *line, const char *line_end,
+                     const char *field, size_t field_len,
+                     const char **value, size_t *value_len)
 {
-    int  cs;
-    char  *p;
-    char  *pe;
-    char  *start = NULL;
-    char  *end = NULL;
-    bool  successful;
-    struct cork_buffer  out = CORK_BUFFER_INIT();
-    struct bz_version  *result;
+    if ((size_t) (line_end - line) < field_len ||
+        memcmp(line, field, field_len) != 0) {
+        return;
+    }
 
-    rpi_check(bz_subprocess_get_output
-              (&out, NULL, &successful,
-               "apt-cache", "show", "--no-all-versions",
-               native_package_name, NULL));
-    if (!successful) {
-        cork_buffer_done(&out);
+    line += field_len;
+    while (line < line_end && (*line == ' ' || *line == '\t')) {
+        line++;
+    }
+    while (line_end > line && (line_end[-1] == ' ' || line_end[-1] == '\t')) {
+        line_end--;
+    }
+    *value = line;
+    *value_len = line_end - line;
+}
+
+/* Calls callback for each stanza that has a Package field. */
+static void
+bz_deb_control_parse(const char *buf, size_t size,
+                     bz_deb_stanza_f callback, void *user_data)
+{
+    const char  *curr = buf;
+    const char  *end = buf + size;
+    struct bz_deb_stanza  stanza;
+
+    memset(&stanza, 0, sizeof(struct bz_deb_stanza));
+    while (curr < end) {
+        const char  *line_end = memchr(curr, '\n', end - curr);
+        if (line_end == NULL) {
+            line_end = end;
+        }
+
+        if (line_end == curr) {
+            /* A blank line ends the current stanza. */
+            if (stanza.package != NULL) {
+                callback(user_data, &stanza);
+            }
+            memset(&stanza, 0, sizeof(struct bz_deb_stanza));
+        } else if (*curr != ' ' && *curr != '\t') {
+            bz_deb_control_field
+                (curr, line_end, "Package:", 8,
+                 &stanza.package, &stanza.package_len);
+            bz_deb_control_field
+                (curr, line_end, "Architecture:", 13,
+                 &stanza.architecture, &stanza.architecture_len);
+            bz_deb_control_field
+                (curr, line_end, "Status:", 7,
+                 &stanza.status, &stanza.status_len);
+            bz_deb_control_field
+                (curr, line_end, "Version:", 8,
+                 &stanza.version, &stanza.version_len);
+        }
+
+        curr = line_end + 1;
+    }
+
+    if (stanza.package != NULL) {
+        callback(user_data, &stanza);
+    }
+}
+
+/* Compares two Debian version strings using the same rules as dpkg.  We use
+ * this to choose between the versions of a package in different package
+ * lists, which don't necessarily use our own version scheme, so we can't
+ * rely on bz_version_cmp. */
+
+static int
+bz_deb_char_order(int ch)
+{
+    if (isdigit(ch)) {
+        return 0;
+    } else if (isalpha(ch)) {
+        return ch;
+    } else if (ch == '~') {
+        return -1;
+    } else if (ch != '\0') {
+        return ch + 256;
+    } else {
+        return 0;
+    }
+}
+
+static int
+bz_deb_version_part_cmp(const char *a, const char *a_end,
+                        const char *b, const char *b_end)
+{
+    while (a < a_end || b < b_end) {
+        int  first_diff = 0;
+
+        while ((a < a_end && !isdigit((unsigned char) *a)) ||
+               (b < b_end && !isdigit((unsigned char) *b))) {
+            int  a_order =
+                (a < a_end)? bz_deb_char_order((unsigned char) *a): 0;
+            int  b_order =
+                (b < b_end)? bz_deb_char_order((unsigned char) *b): 0;
+            if (a_order != b_order) {
+                return a_order - b_order;
+            }
+            a++;
+            b++;
+        }
+
+        while (a < a_end && *a == '0') {
+            a++;
+        }
+        while (b < b_end && *b == '0') {
+            b++;
+        }
+        while (a < a_end && isdigit((unsigned char) *a) &&
+               b < b_end && isdigit((unsigned char) *b)) {
+            if (first_diff == 0) {
+                first_diff = *a - *b;
+            }
+            a++;
+            b++;
+        }
+
+        if (a < a_end && isdigit((unsigned char) *a)) {
+            return 1;
+        }
+        if (b < b_end && isdigit((unsigned char) *b)) {
+            return -1;
+        }
+        if (first_diff != 0) {
+            return first_diff;
+        }
+    }
+    return 0;
+}
+
+static int
+bz_deb_version_cmp(const char *a, const char *b)
+{
+    const char  *a_colon = strchr(a, ':');
+    const char  *b_colon = strchr(b, ':');
+    long  a_epoch = (a_colon == NULL)? 0: strtol(a, NULL, 10);
+    long  b_epoch = (b_colon == NULL)? 0: strtol(b, NULL, 10);
+    const char  *a_end;
+    const char  *b_end;
+    const char  *a_hyphen;
+    const char  *b_hyphen;
+    int  rc;
+
+    if (a_epoch != b_epoch) {
+        return (a_epoch < b_epoch)? -1: 1;
+    }
+
+    a = (a_colon == NULL)? a: a_colon + 1;
+    b = (b_colon == NULL)? b: b_colon + 1;
+    a_end = strchr(a, '\0');
+    b_end = strchr(b, '\0');
+    a_hyphen = strrchr(a, '-');
+    b_hyphen = strrchr(b, '-');
+    a_hyphen = (a_hyphen == NULL)? a_end: a_hyphen;
+    b_hyphen = (b_hyphen == NULL)? b_end: b_hyphen;
+
+    rc = bz_deb_version_part_cmp(a, a_hyphen, b, b_hyphen);
+    if (rc != 0) {
+        return rc;
+    }
+
+    a = (a_hyphen == a_end)? a_end: a_hyphen + 1;
+    b = (b_hyphen == b_end)? b_end: b_hyphen + 1;
+    return bz_deb_version_part_cmp(a, a_end, b, b_end);
+}
+
+
+/*-----------------------------------------------------------------------
+ * apt package lists
+ */
+
+/* Rather than running apt-cache to see which version of a package is
+ * available, we read apt's package lists directly, and build an index of the
+ * newest version of each package that they describe for the native
+ * architecture.  Since the lists are large, we also save a copy of the index
+ * in Buzzy's work directory.  (See bz_native_index_update.)
+ *
+ * The index is only a shortcut.  If apt has stored any of its lists
+ * compressed, or if there are any apt preferences that could pin a package
+ * to some other version, we don't use the index at all.  And if a package
+ * isn't in the index, we still ask apt-cache about it, since apt knows about
+ * more ways to name a package than we do. */
+
+#define BZ_APT_LISTS_PATH  "/var/lib/apt/lists"
+#define BZ_APT_PREFERENCES_PATH  "/etc/apt/preferences"
+#define BZ_APT_PREFERENCES_D_PATH  "/etc/apt/preferences.d"
+
+/* Each session has its own copy of the apt index and the dpkg status index
+ * (see below), so separate sessions can use them from separate threads.  You
+ * must hold the session lock while using either of them. */
+
+struct bz_deb_session {
+    struct bz_native_index  *apt_index;
+    struct cork_buffer  apt_architecture;
+    struct cork_hash_table  *dpkg_status;
+    struct bz_file_stamp  dpkg_status_stamp;
+    bool  dpkg_status_valid;
+};
+
+static void
+bz_deb_session_free(void *user_data)
+{
+    struct bz_deb_session  *deb = user_data;
+    if (deb->apt_index != NULL) {
+        bz_native_index_free(deb->apt_index);
+    }
+    cork_buffer_done(&deb->apt_architecture);
+    if (deb->dpkg_status != NULL) {
+        cork_hash_table_free(deb->dpkg_status);
+    }
+    free(deb);
+}
+
+/* Returns the current session's indexes, creating them if necessary.  The
+ * caller must hold the session lock. */
+static struct bz_deb_session *
+bz_deb_session_get(struct bz_session *session)
+{
+    struct bz_deb_session  *deb =
+        bz_session_get_slot(session, BZ_SESSION_DEBIAN);
+    if (deb == NULL) {
+        deb = cork_new(struct bz_deb_session);
+        deb->apt_index = NULL;
+        cork_buffer_init(&deb->apt_architecture);
+        deb->dpkg_status = NULL;
+        deb->dpkg_status_valid = false;
+        bz_session_set_slot
+            (session, BZ_SESSION_DEBIAN, deb, bz_deb_session_free);
+    }
+    return deb;
+}
+
+void
+bz_apt_native_lists_invalidate(void)
+{
+    struct bz_session  *session = bz_session_current();
+    struct bz_deb_session  *deb;
+    bz_session_lock(session);
+    deb = bz_session_get_slot(session, BZ_SESSION_DEBIAN);
+    if (deb != NULL && deb->apt_index != NULL) {
+        bz_native_index_invalidate(deb->apt_index);
+    }
+    bz_session_unlock(session);
+}
+
+static bool
+bz_apt_index_prefer(const char *new_version, const char *old_version)
+{
+    return bz_deb_version_cmp(new_version, old_version) > 0;
+}
+
+/* Returns the architecture that apt installs packages for, as reported by
+ * `dpkg --print-architecture`.  The caller must hold the session lock. */
+static const char *
+bz_apt_architecture(struct bz_deb_session *deb)
+{
+    if (deb->apt_architecture.size == 0) {
+        struct cork_buffer  *buf = &deb->apt_architecture;
+        rpi_check(bz_subprocess_get_output
+                  (buf, NULL, NULL, "dpkg", "--print-architecture", NULL));
+        /* Chomp the trailing newline */
+        while (buf->size > 0 &&
+               isspace(((unsigned char *) buf->buf)[buf->size - 1])) {
+            ((char *) buf->buf)[--buf->size] = '\0';
+        }
+        if (buf->size == 0) {
+            bz_invalid_version("Unexpected output from dpkg");
+            return NULL;
+        }
+    }
+    return deb->apt_architecture.buf;
+}
+
+struct bz_apt_lists {
+    struct cork_dir_walker  parent;
+    cork_array(const char *)  paths;
+    /* Set if any of the package lists are compressed, or if there are other
+     * files that would cause apt to choose different versions than the ones
+     * that we'd put in the index. */
+    bool  unindexable;
+};
+
+static int
+bz_apt_lists__file(struct cork_dir_walker *walker, const char *full_path,
+                   const char *rel_path, const char *base_name)
+{
+    struct bz_apt_lists  *lists =
+        cork_container_of(walker, struct bz_apt_lists, parent);
+    size_t  base_len = strlen(base_name);
+    if (strchr(rel_path, '/') != NULL) {
+        return 0;
+    }
+    if (base_len > 9 &&
+        strcmp(base_name + base_len - 9, "_Packages") == 0) {
+        cork_array_append(&lists->paths, cork_strdup(full_path));
+    } else if (strstr(base_name, "_Packages.") != NULL) {
+        /* A compressed list (_Packages.gz, _Packages.lz4, etc), which apt
+         * creates when Acquire::GzipIndexes is set. */
+        clog_debug("Found compressed apt package list %s", full_path);
+        lists->unindexable = true;
+    }
+    return 0;
+}
+
+static int
+bz_apt_preferences__file(struct cork_dir_walker *walker, const char *full_path,
+                         const char *rel_path, const char *base_name)
+{
+    struct bz_apt_lists  *lists =
+        cork_container_of(walker, struct bz_apt_lists, parent);
+    clog_debug("Found apt preferences file %s", full_path);
+    lists->unindexable = true;
+    return 0;
+}
+
+static int
+bz_apt_lists__directory(struct cork_dir_walker *walker, const char *full_path,
+                        const char *rel_path, const char *base_name)
+{
+    return 0;
+}
+
+static int
+bz_apt_lists_path_cmp(const void *vp1, const void *vp2)
+{
+    const char * const  *p1 = vp1;
+    const char * const  *p2 = vp2;
+    return strcmp(*p1, *p2);
+}
+
+static void
+bz_apt_lists_done(struct bz_apt_lists *lists)
+{
+    size_t  i;
+    for (i = 0; i < cork_array_size(&lists->paths); i++) {
+        cork_strfree(cork_array_at(&lists->paths, i));
+    }
+    cork_array_done(&lists->paths);
+}
+
+/* Finds all of apt's package lists, and fills in key with a description of
+ * them that will change whenever any of the lists do. */
+static int
+bz_apt_lists_find(struct bz_apt_lists *lists, struct cork_buffer *key)
+{
+    size_t  i;
+    struct bz_file_stamp  stamp;
+
+    lists->parent.enter_directory = bz_apt_lists__directory;
+    lists->parent.leave_directory = bz_apt_lists__directory;
+    cork_array_init(&lists->paths);
+    lists->unindexable = false;
+
+    /* Any apt preferences could pin a package to something other than the
+     * newest version, so don't bother looking at the lists if there are
+     * any. */
+    rii_check(bz_file_stamp(BZ_APT_PREFERENCES_PATH, &stamp));
+    if (stamp.exists) {
+        clog_debug("Found apt preferences file %s", BZ_APT_PREFERENCES_PATH);
+        lists->unindexable = true;
+        return 0;
+    }
+    rii_check(bz_file_stamp(BZ_APT_PREFERENCES_D_PATH, &stamp));
+    if (stamp.exists) {
+        lists->parent.file = bz_apt_preferences__file;
+        rii_check(bz_walk_directory
+                  (BZ_APT_PREFERENCES_D_PATH, &lists->parent));
+        if (lists->unindexable) {
+            return 0;
+        }
+    }
+
+    rii_check(bz_file_stamp(BZ_APT_LISTS_PATH, &stamp));
+    if (!stamp.exists) {
+        return 0;
+    }
+
+    lists->parent.file = bz_apt_lists__file;
+    rii_check(bz_walk_directory(BZ_APT_LISTS_PATH, &lists->parent));
+    if (lists->unindexable) {
+        return 0;
+    }
+    qsort(cork_array_elements(&lists->paths), cork_array_size(&lists->paths),
+          sizeof(const char *), bz_apt_lists_path_cmp);
+
+    for (i = 0; i < cork_array_size(&lists->paths); i++) {
+        const char  *path = cork_array_at(&lists->paths, i);
+        rii_check(bz_file_stamp(path, &stamp));
+        cork_buffer_append_printf
+            (key, "list %s %zu %" PRId64 " %" PRId64 "\n",
+             path, stamp.size, stamp.mtime_sec, stamp.mtime_nsec);
+    }
+    return 0;
+}
+
+struct bz_apt_index_build {
+    struct bz_apt_lists  *lists;
+    struct bz_native_index  *index;
+    const char  *architecture;
+    size_t  architecture_len;
+};
+
+static void
+bz_apt_index_add_stanza(void *user_data, struct bz_deb_stanza *stanza)
+{
+    struct bz_apt_index_build  *build = user_data;
+    if (stanza->version == NULL) {
+        return;
+    }
+
+    /* A list can include packages for other architectures (when multiarch is
+     * enabled, for instance), which apt won't install by default.  Skip
+     * those. */
+    if (stanza->architecture != NULL &&
+        !(stanza->architecture_len == 3 &&
+          memcmp(stanza->architecture, "all", 3) == 0) &&
+        !(stanza->architecture_len == build->architecture_len &&
+          memcmp(stanza->architecture, build->architecture,
+                 build->architecture_len) == 0)) {
+        return;
+    }
+
+    bz_native_index_add
+        (build->index, stanza->package, stanza->package_len,
+         stanza->version, stanza->version_len);
+}
+
+static int
+bz_apt_index_build(void *user_data, struct bz_native_index *index)
+{
+    struct bz_apt_index_build  *build = user_data;
+    size_t  i;
+    clog_debug("Build apt package index for %s", build->architecture);
+    build->index = index;
+    for (i = 0; i < cork_array_size(&build->lists->paths); i++) {
+        const char  *path = cork_array_at(&build->lists->paths, i);
+        const char  *buf;
+        size_t  size;
+        clog_debug("Read apt package list %s", path);
+        rii_check(bz_map_file(path, &buf, &size));
+        bz_deb_control_parse(buf, size, bz_apt_index_add_stanza, build);
+        bz_unmap_file(buf, size);
+    }
+    return 0;
+}
+
+/* Makes sure that the apt index is up to date.  Sets *available to false if
+ * there aren't any package lists that we can read, or if the index wouldn't
+ * give the same answers as apt. */
+static int
+bz_apt_index_load(struct bz_deb_session *deb, bool *available)
+{
+    struct bz_apt_lists  lists;
+    struct bz_apt_index_build  build;
+    struct cork_buffer  key = CORK_BUFFER_INIT();
+
+    ei_check(bz_apt_lists_find(&lists, &key));
+    *available =
+        !lists.unindexable && (cork_array_size(&lists.paths) > 0);
+    if (*available) {
+        ep_check(build.architecture = bz_apt_architecture(deb));
+        build.architecture_len = strlen(build.architecture);
+        build.lists = &lists;
+        cork_buffer_append_printf(&key, "arch %s\n", build.architecture);
+        if (deb->apt_index == NULL) {
+            deb->apt_index = bz_native_index_new
+                ("apt-packages.index", bz_apt_index_prefer);
+        }
+        ei_check(bz_native_index_update
+                 (deb->apt_index, &key, bz_apt_index_build, &build));
+    }
+
+    bz_apt_lists_done(&lists);
+    cork_buffer_done(&key);
+    return 0;
+
+error:
+    bz_apt_lists_done(&lists);
+    cork_buffer_done(&key);
+    return -1;
+}
+
+static struct bz_version *
+bz_apt_index_version_available(struct bz_deb_session *deb,
+                               const char *native_package_name)
+{
+    const char  *version =
+        bz_native_index_get(deb->apt_index, native_package_name);
+    if (version == NULL) {
         return NULL;
     }
+    return bz_version_from_deb(version);
+}
 
-    p = out.buf;
-    pe = out.buf + out.size;
+
+/*-----------------------------------------------------------------------
+ * Native package database
+ */
+
+/* Parses the version out of the output of `apt-cache show`.  We only look at
+ * the first Version: line that we find. */
+static struct bz_version *
+bz_apt_parse_available_version(char *p, char *pe)
+{
+    int  cs;
+    char  *start = NULL;
+    char  *end = NULL;
 
     %%{
         machine debian_version_available;
@@ -381,24 +893,205 @@ bz_apt_native_version_available(const char *native_package_name)
 
     if (CORK_UNLIKELY(cs < %%{ write first_final; }%%)) {
         bz_invalid_version("Unexpected output from apt-cache");
-        cork_buffer_done(&out);
         return NULL;
     }
 
     if (start == NULL || end == NULL) {
         bz_invalid_version("Unexpected output from apt-cache");
-        cork_buffer_done(&out);
         return NULL;
     }
 
     *end = '\0';
-    result = bz_version_from_deb(start);
+    return bz_version_from_deb(start);
+}
+
+struct bz_version *
+bz_apt_native_version_available(const char *native_package_name)
+{
+    int  rc;
+    bool  indexed;
+    bool  successful;
+    struct bz_session  *session = bz_session_current();
+    struct bz_deb_session  *deb;
+    struct cork_buffer  out = CORK_BUFFER_INIT();
+    struct bz_version  *result = NULL;
+
+    bz_session_lock(session);
+    deb = bz_deb_session_get(session);
+    rc = bz_apt_index_load(deb, &indexed);
+    if (rc == 0 && indexed) {
+        result = bz_apt_index_version_available(deb, native_package_name);
+        if (cork_error_occurred()) {
+            rc = -1;
+        }
+    }
+    bz_session_unlock(session);
+    if (rc != 0 || result != NULL) {
+        return result;
+    }
+
+    /* The package isn't in the index, but apt might still know about it
+     * under some other name. */
+
+    rpi_check(bz_subprocess_get_output
+              (&out, NULL, &successful,
+               "apt-cache", "show", "--no-all-versions",
+               native_package_name, NULL));
+    if (!successful) {
+        cork_buffer_done(&out);
+        return NULL;
+    }
+
+    result = bz_apt_parse_available_version(out.buf, out.buf + out.size);
     cork_buffer_done(&out);
     return result;
 }
 
-struct bz_version *
-bz_deb_native_version_installed(const char *native_package_name)
+/* Extracts the package name from the "Package:" line of an apt-cache stanza.
+ * Returns false if there isn't one. */
+static bool
+bz_apt_stanza_package(struct cork_buffer *dest, const char *stanza,
+                      const char *stanza_end)
+{
+    const char  *line = stanza;
+    while (line < stanza_end) {
+        const char  *line_end = memchr(line, '\n', stanza_end - line);
+        if (line_end == NULL) {
+            line_end = stanza_end;
+        }
+        if (strncmp(line, "Package:", 8) == 0) {
+            const char  *name = line + 8;
+            while (name < line_end && (*name == ' ' || *name == '\t')) {
+                name++;
+            }
+            cork_buffer_set(dest, name, line_end - name);
+            return true;
+        }
+        line = line_end + 1;
+    }
+    return false;
+}
+
+/* apt-cache prints a stanza (separated by blank lines) for each of the
+ * packages that it can find, and a notice on stderr for each one that it
+ * can't.  It only exits with an error if it can't find *any* of them, so we
+ * ignore the exit status and look at which stanzas come back.  We only ask
+ * apt-cache about the packages that aren't in the apt index. */
+int
+bz_apt_native_version_available_many(size_t count,
+                                     const char **native_package_names,
+                                     struct bz_version **versions)
+{
+    size_t  i;
+    size_t  missing;
+    int  rc;
+    bool  indexed;
+    bool  successful;
+    char  *stanza;
+    char  *buf_end;
+    struct bz_session  *session = bz_session_current();
+    struct bz_deb_session  *deb;
+    struct cork_exec  *exec;
+    struct cork_buffer  out = CORK_BUFFER_INIT();
+    struct cork_buffer  package = CORK_BUFFER_INIT();
+
+    for (i = 0; i < count; i++) {
+        versions[i] = NULL;
+    }
+    if (count == 0) {
+        return 0;
+    }
+
+    bz_session_lock(session);
+    deb = bz_deb_session_get(session);
+    rc = bz_apt_index_load(deb, &indexed);
+    for (i = 0; rc == 0 && indexed && i < count; i++) {
+        versions[i] = bz_apt_index_version_available
+            (deb, native_package_names[i]);
+        if (cork_error_occurred()) {
+            rc = -1;
+        }
+    }
+    bz_session_unlock(session);
+    if (rc != 0) {
+        goto error;
+    }
+
+    missing = 0;
+    for (i = 0; i < count; i++) {
+        if (versions[i] == NULL) {
+            missing++;
+        }
+    }
+    if (missing == 0) {
+        return 0;
+    }
+
+    exec = cork_exec_new("apt-cache");
+    cork_exec_add_param(exec, "apt-cache");
+    cork_exec_add_param(exec, "show");
+    cork_exec_add_param(exec, "--no-all-versions");
+    for (i = 0; i < count; i++) {
+        if (versions[i] == NULL) {
+            cork_exec_add_param(exec, native_package_names[i]);
+        }
+    }
+    ei_check(bz_subprocess_get_output_exec(&out, NULL, &successful, exec));
+
+    stanza = out.buf;
+    buf_end = stanza + out.size;
+    while (stanza < buf_end) {
+        char  *stanza_end;
+        struct bz_version  *version;
+        bool  used = false;
+
+        /* Skip over the blank lines between stanzas. */
+        if (*stanza == '\n') {
+            stanza++;
+            continue;
+        }
+
+        stanza_end = strstr(stanza, "\n\n");
+        stanza_end = (stanza_end == NULL)? buf_end: stanza_end + 1;
+
+        if (!bz_apt_stanza_package(&package, stanza, stanza_end)) {
+            bz_invalid_version("Unexpected output from apt-cache");
+            goto error;
+        }
+
+        ep_check(version = bz_apt_parse_available_version(stanza, stanza_end));
+        for (i = 0; i < count; i++) {
+            if (versions[i] == NULL &&
+                strcmp(native_package_names[i], package.buf) == 0) {
+                versions[i] = used? bz_version_copy(version): version;
+                used = true;
+            }
+        }
+        if (!used) {
+            bz_version_free(version);
+        }
+
+        stanza = stanza_end;
+    }
+
+    cork_buffer_done(&out);
+    cork_buffer_done(&package);
+    return 0;
+
+error:
+    for (i = 0; i < count; i++) {
+        if (versions[i] != NULL) {
+            bz_version_free(versions[i]);
+            versions[i] = NULL;
+        }
+    }
+    cork_buffer_done(&out);
+    cork_buffer_done(&package);
+    return -1;
+}
+
+static struct bz_version *
+bz_dpkg_query_version_installed(const char *native_package_name)
 {
     int  cs;
     char  *p;
@@ -465,6 +1158,165 @@ bz_deb_native_version_installed(const char *native_package_name)
 }
 
 
+/* Rather than running dpkg-query for each package that we check, we read
+ * dpkg's status database directly, and build an index of the packages that it
+ * describes.  We rebuild the index whenever the status file changes, and
+ * whenever we install or remove a package ourselves. */
+
+#define BZ_DPKG_STATUS_PATH  "/var/lib/dpkg/status"
+
+struct bz_dpkg_status_entry {
+    bool  installed;
+    const char  *version;
+};
+
+static void
+bz_dpkg_status_entry_free(void *vself)
+{
+    struct bz_dpkg_status_entry  *self = vself;
+    if (self->version != NULL) {
+        cork_strfree(self->version);
+    }
+    free(self);
+}
+
+void
+bz_deb_native_status_invalidate(void)
+{
+    struct bz_session  *session = bz_session_current();
+    struct bz_deb_session  *deb;
+    bz_session_lock(session);
+    deb = bz_session_get_slot(session, BZ_SESSION_DEBIAN);
+    if (deb != NULL) {
+        deb->dpkg_status_valid = false;
+    }
+    bz_session_unlock(session);
+}
+
+struct bz_dpkg_status_parse {
+    struct cork_hash_table  *dpkg_status;
+    struct cork_buffer  name;
+};
+
+static void
+bz_dpkg_status_add(void *user_data, struct bz_deb_stanza *stanza)
+{
+    struct bz_dpkg_status_parse  *parse = user_data;
+    struct cork_buffer  *name = &parse->name;
+    bool  is_new;
+    bool  installed;
+    struct cork_hash_table_entry  *entry;
+    struct bz_dpkg_status_entry  *self;
+
+    installed =
+        (stanza->status != NULL && stanza->status_len >= 10 &&
+         memcmp(stanza->status + stanza->status_len - 10,
+                " installed", 10) == 0);
+
+    /* A package can appear more than once (for instance, for each of several
+     * architectures).  If any of them is installed, that's the one we want. */
+    cork_buffer_set(name, stanza->package, stanza->package_len);
+    entry = cork_hash_table_get_or_create
+        (parse->dpkg_status, name->buf, &is_new);
+    if (is_new) {
+        entry->key = (void *) cork_strdup(name->buf);
+        entry->value = self = cork_new(struct bz_dpkg_status_entry);
+        self->installed = false;
+        self->version = NULL;
+    } else {
+        self = entry->value;
+        if (self->installed) {
+            return;
+        }
+    }
+
+    self->installed = installed;
+    if (self->version != NULL) {
+        cork_strfree(self->version);
+        self->version = NULL;
+    }
+    if (stanza->version != NULL) {
+        self->version = cork_strndup(stanza->version, stanza->version_len);
+    }
+}
+
+/* Makes sure that the status index is up to date.  Sets *available to false if
+ * there isn't a status database that we can read. */
+static int
+bz_dpkg_status_load(struct bz_deb_session *deb, bool *available)
+{
+    struct bz_file_stamp  stamp;
+    const char  *buf;
+    size_t  size;
+    struct bz_dpkg_status_parse  parse;
+
+    rii_check(bz_file_stamp(BZ_DPKG_STATUS_PATH, &stamp));
+    if (!stamp.exists) {
+        *available = false;
+        return 0;
+    }
+
+    *available = true;
+    if (deb->dpkg_status_valid &&
+        bz_file_stamp_eq(&stamp, &deb->dpkg_status_stamp)) {
+        return 0;
+    }
+
+    clog_debug("Read dpkg status database");
+    if (deb->dpkg_status == NULL) {
+        deb->dpkg_status = cork_string_hash_table_new(0, 0);
+        cork_hash_table_set_free_key
+            (deb->dpkg_status, (cork_free_f) cork_strfree);
+        cork_hash_table_set_free_value
+            (deb->dpkg_status, bz_dpkg_status_entry_free);
+    } else {
+        cork_hash_table_clear(deb->dpkg_status);
+    }
+
+    rii_check(bz_map_file(BZ_DPKG_STATUS_PATH, &buf, &size));
+    parse.dpkg_status = deb->dpkg_status;
+    cork_buffer_init(&parse.name);
+    bz_deb_control_parse(buf, size, bz_dpkg_status_add, &parse);
+    bz_unmap_file(buf, size);
+    cork_buffer_done(&parse.name);
+    deb->dpkg_status_stamp = stamp;
+    deb->dpkg_status_valid = true;
+    return 0;
+}
+
+struct bz_version *
+bz_deb_native_version_installed(const char *native_package_name)
+{
+    int  rc;
+    bool  available;
+    struct bz_session  *session = bz_session_current();
+    struct bz_deb_session  *deb;
+    struct bz_dpkg_status_entry  *entry;
+    struct bz_version  *result = NULL;
+
+    bz_session_lock(session);
+    deb = bz_deb_session_get(session);
+    rc = bz_dpkg_status_load(deb, &available);
+    if (rc == 0 && available) {
+        entry = cork_hash_table_get
+            (deb->dpkg_status, (void *) native_package_name);
+        if (entry != NULL && entry->installed) {
+            if (CORK_UNLIKELY(entry->version == NULL)) {
+                bz_invalid_version("Missing version in dpkg status database");
+            } else {
+                result = bz_version_from_deb(entry->version);
+            }
+        }
+    }
+    bz_session_unlock(session);
+
+    if (rc == 0 && !available) {
+        return bz_dpkg_query_version_installed(native_package_name);
+    }
+    return result;
+}
+
+
 static int
 bz_apt_native__install(const char *native_package_name,
                        struct bz_version *version)
@@ -472,32 +1324,78 @@ bz_apt_native__install(const char *native_package_name,
     /* We don't pass the --needed flag to pacman since our is_needed method
      * should have already verified that the desired version isn't installed
      * yet. */
+    bz_deb_native_status_invalidate();
     return bz_subprocess_run
         (false, NULL,
          "sudo", "apt-get", "install", "-y", native_package_name,
          NULL);
 }
 
+static int
+bz_apt_native__install_many(size_t count, const char **native_package_names,
+                            struct bz_version **versions)
+{
+    size_t  i;
+    struct cork_exec  *exec;
+    bz_deb_native_status_invalidate();
+    exec = cork_exec_new("sudo");
+    cork_exec_add_param(exec, "sudo");
+    cork_exec_add_param(exec, "apt-get");
+    cork_exec_add_param(exec, "install");
+    cork_exec_add_param(exec, "-y");
+    for (i = 0; i < count; i++) {
+        cork_exec_add_param(exec, native_package_names[i]);
+    }
+    return bz_subprocess_run_exec(false, NULL, exec);
+}
+
 static int
 bz_apt_native__uninstall(const char *native_package_name)
 {
     /* We don't pass the --needed flag to pacman since our is_needed method
      * should have already verified that the desired version isn't installed
      * yet. */
+    bz_deb_native_status_invalidate();
     return bz_subprocess_run
         (false, NULL,
          "sudo", "apt-get", "remove", "-y", native_package_name,
          NULL);
 }
 
+/* The packages that apt can install depend on apt's package lists.  We also
+ * include dpkg's status database, since installing a package can change what
+ * apt-cache tells us about it. */
+static int
+bz_apt_native__fingerprint(struct cork_buffer *dest)
+{
+    struct bz_apt_lists  lists;
+    ei_check(bz_apt_lists_find(&lists, dest));
+    bz_apt_lists_done(&lists);
+    return bz_native_fingerprint_add_file(dest, BZ_DPKG_STATUS_PATH);
+
+error:
+    bz_apt_lists_done(&lists);
+    return -1;
+}
+
+static const char * const  bz_apt_native_patterns[] = {
+    "%s-dev", "lib%s-dev", "%s", "lib%s", NULL
+};
+
+static const struct bz_native_pdb_ops  bz_apt_native_pdb_ops = {
+    .version_available = bz_apt_native_version_available,
+    .version_available_many = bz_apt_native_version_available_many,
+    .version_installed = bz_deb_native_version_installed,
+    .install = bz_apt_native__install,
+    .install_many = bz_apt_native__install_many,
+    .uninstall = bz_apt_native__uninstall,
+    .fingerprint = bz_apt_native__fingerprint,
+    .patterns = bz_apt_native_patterns
+};
+
 struct bz_pdb *
 bz_apt_native_pdb(void)
 {
     return bz_native_pdb_new
-        ("Debian", "debian",
-         bz_apt_native_version_available,
-         bz_deb_native_version_installed,
-         bz_apt_native__install,
-         bz_apt_native__uninstall,
-         "%s-dev", "lib%s-dev", "%s", "lib%s", NULL);
+        ("Debian", "debian", &bz_apt_native_pdb_ops);
 }
@@ -52,8 +52,21 @@ bz_homebrew_is_present(bool *dest)
  * Native package database
  */
 
-struct bz_version *
-bz_homebrew_native_version_available(const char *native_package_name)
+static int
+bz_homebrew_native_probe_available(const char *native_package_name,
+                                   struct cork_exec **dest)
+{
+    *dest = cork_exec_new("brew");
+    cork_exec_add_param(*dest, "brew");
+    cork_exec_add_param(*dest, "info");
+    cork_exec_add_param(*dest, native_package_name);
+    return 0;
+}
+
+/* Parses the output of a successful `brew info` command. */
+static struct bz_version *
+bz_homebrew_native_parse_available(const char *native_package_name,
+                                   struct cork_buffer *out)
 {
     int  cs;
     char  *p;
@@ -61,22 +74,9 @@ bz_homebrew_native_version_available(const char *native_package_name)
     char  *eof;
     char  *start = NULL;
     char  *end = NULL;
-    bool  successful;
-    struct cork_buffer  out = CORK_BUFFER_INIT();
-    struct bz_version  *result;
-
-    assert(native_package_name != NULL);
 
-    rpi_check(bz_subprocess_get_output
-              (&out, NULL, &successful,
-               "brew", "info", native_package_name, NULL));
-    if (!successful) {
-        cork_buffer_done(&out);
-        return NULL;
-    }
-
-    p = out.buf;
-    pe = out.buf + out.size;
+    p = out->buf;
+    pe = out->buf + out->size;
     eof = pe;
 
     %%{
@@ -99,12 +99,30 @@ bz_homebrew_native_version_available(const char *native_package_name)
     if (CORK_UNLIKELY(cs < %%{ write first_final; }%%)) {
         bz_invalid_version
             ("Unexpected output from brew for package %s", native_package_name);
-        cork_buffer_done(&out);
         return NULL;
     }
 
     *end = '\0';
-    result = bz_version_from_string(start);
+    return bz_version_from_string(start);
+}
+
+struct bz_version *
+bz_homebrew_native_version_available(const char *native_package_name)
+{
+    bool  successful;
+    struct cork_exec  *exec;
+    struct cork_buffer  out = CORK_BUFFER_INIT();
+    struct bz_version  *result;
+
+    assert(native_package_name != NULL);
+    rpi_check(bz_homebrew_native_probe_available(native_package_name, &exec));
+    rpi_check(bz_subprocess_get_output_exec(&out, NULL, &successful, exec));
+    if (!successful) {
+        cork_buffer_done(&out);
+        return NULL;
+    }
+
+    result = bz_homebrew_native_parse_available(native_package_name, &out);
     cork_buffer_done(&out);
     return result;
 }
@@ -188,6 +206,21 @@ bz_homebrew_native__install(const char *native_package_name,
          NULL);
 }
 
+static int
+bz_homebrew_native__install_many(size_t count, const char **native_package_names,
+                                 struct bz_version **versions)
+{
+    size_t  i;
+    struct cork_exec  *exec;
+    exec = cork_exec_new("brew");
+    cork_exec_add_param(exec, "brew");
+    cork_exec_add_param(exec, "install");
+    for (i = 0; i < count; i++) {
+        cork_exec_add_param(exec, native_package_names[i]);
+    }
+    return bz_subprocess_run_exec(false, NULL, exec);
+}
+
 static int
 bz_homebrew_native__uninstall(const char *native_package_name)
 {
@@ -200,14 +233,24 @@ bz_homebrew_native__uninstall(const char *native_package_name)
          NULL);
 }
 
+static const char * const  bz_homebrew_native_patterns[] = {
+    "%s", "lib%s", NULL
+};
+
+static const struct bz_native_pdb_ops  bz_homebrew_native_pdb_ops = {
+    .version_available = bz_homebrew_native_version_available,
+    .probe_available = bz_homebrew_native_probe_available,
+    .parse_available = bz_homebrew_native_parse_available,
+    .version_installed = bz_homebrew_native_version_installed,
+    .install = bz_homebrew_native__install,
+    .install_many = bz_homebrew_native__install_many,
+    .uninstall = bz_homebrew_native__uninstall,
+    .patterns = bz_homebrew_native_patterns
+};
+
 struct bz_pdb *
 bz_homebrew_native_pdb(void)
 {
     return bz_native_pdb_new
-        ("Homebrew", "homebrew",
-         bz_homebrew_native_version_available,
-         bz_homebrew_native_version_installed,
-         bz_homebrew_native__install,
-         bz_homebrew_native__uninstall,
-         "%s", "lib%s", NULL);
+        ("Homebrew", "homebrew", &bz_homebrew_native_pdb_ops);
 }
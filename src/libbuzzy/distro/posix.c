@@ -48,20 +48,8 @@ bz_posix_current_architecture(void)
 }
 
 
-static const char *
-bz_posix_architecture_value__get(void *user_data, struct bz_value *ctx)
-{
-    struct cork_buffer  *buf = user_data;
-    if (buf->size == 0) {
-        cork_buffer_set_string(buf, bz_posix_current_architecture());
-    }
-    return buf->buf;
-}
-
 struct bz_value *
 bz_posix_architecture_value_new(void)
 {
-    struct cork_buffer  *buf = cork_buffer_new();
-    return bz_scalar_value_new
-        (buf, (cork_free_f) cork_buffer_free, bz_posix_architecture_value__get);
+    return bz_subprocess_output_value_new("uname", "-m", NULL);
 }
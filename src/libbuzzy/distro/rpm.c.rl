@@ -371,32 +371,19 @@ bz_version_from_rpm(const char *rpm_version)
  * Native package database
  */
 
-struct bz_version *
-bz_yum_native_version_available(const char *native_package_name)
+/* Parses the version and release of a package from the output of `yum info`.
+ * If the output describes more than one package, we use the last one. */
+static struct bz_version *
+bz_yum_parse_available_version(char *p, char *pe)
 {
     int  cs;
-    char  *p;
-    char  *pe;
     char  *v_start = NULL;
     char  *v_end = NULL;
     char  *r_start = NULL;
     char  *r_end = NULL;
-    bool  successful;
-    struct cork_buffer  out = CORK_BUFFER_INIT();
-    struct cork_buffer  buf;
+    struct cork_buffer  buf = CORK_BUFFER_INIT();
     struct bz_version  *result;
 
-    rpi_check(bz_subprocess_get_output
-              (&out, NULL, &successful,
-               "sudo", "yum", "info", "-C", native_package_name, NULL));
-    if (!successful) {
-        cork_buffer_done(&out);
-        return NULL;
-    }
-
-    p = out.buf;
-    pe = out.buf + out.size;
-
     %%{
         machine rpm_version_available;
 
@@ -424,26 +411,157 @@ bz_yum_native_version_available(const char *native_package_name)
 
     if (CORK_UNLIKELY(cs < %%{ write first_final; }%%)) {
         bz_invalid_version("Unexpected output from yum");
-        cork_buffer_done(&out);
         return NULL;
     }
 
     if (v_start == NULL || v_end == NULL || r_start == NULL || r_end == NULL) {
         bz_invalid_version("Unexpected output from yum");
-        cork_buffer_done(&out);
         return NULL;
     }
 
-    cork_buffer_init(&buf);
     cork_buffer_append(&buf, v_start, v_end - v_start);
     cork_buffer_append(&buf, "-", 1);
     cork_buffer_append(&buf, r_start, r_end - r_start);
     result = bz_version_from_rpm(buf.buf);
-    cork_buffer_done(&out);
     cork_buffer_done(&buf);
     return result;
 }
 
+struct bz_version *
+bz_yum_native_version_available(const char *native_package_name)
+{
+    bool  successful;
+    struct cork_buffer  out = CORK_BUFFER_INIT();
+    struct bz_version  *result;
+
+    rpi_check(bz_subprocess_get_output
+              (&out, NULL, &successful,
+               "sudo", "yum", "info", "-C", native_package_name, NULL));
+    if (!successful) {
+        cork_buffer_done(&out);
+        return NULL;
+    }
+
+    result = bz_yum_parse_available_version(out.buf, out.buf + out.size);
+    cork_buffer_done(&out);
+    return result;
+}
+
+/* Extracts the package name from the "Name" line of a `yum info` record.
+ * Returns false if there isn't one. */
+static bool
+bz_yum_record_name(struct cork_buffer *dest, const char *record,
+                   const char *record_end)
+{
+    const char  *line = record;
+    while (line < record_end) {
+        const char  *line_end = memchr(line, '\n', record_end - line);
+        const char  *curr;
+        if (line_end == NULL) {
+            line_end = record_end;
+        }
+        if (line_end - line > 4 && memcmp(line, "Name", 4) == 0) {
+            curr = line + 4;
+            while (curr < line_end && *curr == ' ') {
+                curr++;
+            }
+            if (curr < line_end && *curr == ':') {
+                curr++;
+                while (curr < line_end && isspace((unsigned char) *curr)) {
+                    curr++;
+                }
+                cork_buffer_set(dest, curr, line_end - curr);
+                return dest->size > 0;
+            }
+        }
+        line = line_end + 1;
+    }
+    return false;
+}
+
+int
+bz_yum_native_version_available_many(size_t count,
+                                     const char **native_package_names,
+                                     struct bz_version **versions)
+{
+    size_t  i;
+    bool  successful;
+    char  *record;
+    char  *buf_end;
+    struct cork_exec  *exec;
+    struct cork_buffer  out = CORK_BUFFER_INIT();
+    struct cork_buffer  package = CORK_BUFFER_INIT();
+
+    for (i = 0; i < count; i++) {
+        versions[i] = NULL;
+    }
+    if (count == 0) {
+        return 0;
+    }
+
+    /* yum exits with an error if none of the packages exist, but not if only
+     * some of them do, so we ignore the exit code and just look for each
+     * package's record in the output. */
+    exec = cork_exec_new("sudo");
+    cork_exec_add_param(exec, "sudo");
+    cork_exec_add_param(exec, "yum");
+    cork_exec_add_param(exec, "info");
+    cork_exec_add_param(exec, "-C");
+    for (i = 0; i < count; i++) {
+        cork_exec_add_param(exec, native_package_names[i]);
+    }
+    ei_check(bz_subprocess_get_output_exec(&out, NULL, &successful, exec));
+
+    record = out.buf;
+    buf_end = record + out.size;
+    while (record < buf_end) {
+        char  *record_end;
+
+        /* Skip over the blank lines between records. */
+        if (*record == '\n') {
+            record++;
+            continue;
+        }
+
+        record_end = strstr(record, "\n\n");
+        record_end = (record_end == NULL)? buf_end: record_end + 1;
+
+        /* Skip over anything (like yum's "Loaded plugins" banner) that doesn't
+         * describe a package.  If a package appears more than once (for
+         * instance, if it's installed and there's a newer version available),
+         * we use its last record, just like bz_yum_native_version_available
+         * does. */
+        if (bz_yum_record_name(&package, record, record_end)) {
+            for (i = 0; i < count; i++) {
+                if (strcmp(native_package_names[i], package.buf) == 0) {
+                    if (versions[i] != NULL) {
+                        bz_version_free(versions[i]);
+                    }
+                    ep_check(versions[i] = bz_yum_parse_available_version
+                             (record, record_end));
+                }
+            }
+        }
+
+        record = record_end;
+    }
+
+    cork_buffer_done(&out);
+    cork_buffer_done(&package);
+    return 0;
+
+error:
+    for (i = 0; i < count; i++) {
+        if (versions[i] != NULL) {
+            bz_version_free(versions[i]);
+            versions[i] = NULL;
+        }
+    }
+    cork_buffer_done(&out);
+    cork_buffer_done(&package);
+    return -1;
+}
+
 struct bz_version *
 bz_rpm_native_version_installed(const char *native_package_name)
 {
@@ -480,6 +598,79 @@ error:
     return NULL;
 }
 
+int
+bz_rpm_native_version_installed_many(size_t count,
+                                     const char **native_package_names,
+                                     struct bz_version **versions)
+{
+    size_t  i;
+    bool  successful;
+    char  *line;
+    char  *buf_end;
+    struct cork_exec  *exec;
+    struct cork_buffer  out = CORK_BUFFER_INIT();
+
+    for (i = 0; i < count; i++) {
+        versions[i] = NULL;
+    }
+    if (count == 0) {
+        return 0;
+    }
+
+    /* rpm's exit code is the number of packages that aren't installed, so we
+     * ignore it.  It prints out a "package foo is not installed" line for each
+     * of those packages, which we skip since it doesn't match our format. */
+    exec = cork_exec_new("rpm");
+    cork_exec_add_param(exec, "rpm");
+    cork_exec_add_param(exec, "--qf");
+    cork_exec_add_param(exec, "%{NAME} %{V}-%{R}\\n");
+    cork_exec_add_param(exec, "-q");
+    for (i = 0; i < count; i++) {
+        cork_exec_add_param(exec, native_package_names[i]);
+    }
+    ei_check(bz_subprocess_get_output_exec(&out, NULL, &successful, exec));
+
+    line = out.buf;
+    buf_end = line + out.size;
+    while (line < buf_end) {
+        char  *line_end = memchr(line, '\n', buf_end - line);
+        char  *space;
+        if (line_end == NULL) {
+            line_end = buf_end;
+        }
+        *line_end = '\0';
+
+        /* There might be multiple versions of a package, if there are multiple
+         * copies of the package installed for different architectures.  Use the
+         * first version present. */
+        space = strchr(line, ' ');
+        if (space != NULL && strchr(space + 1, ' ') == NULL) {
+            *space = '\0';
+            for (i = 0; i < count; i++) {
+                if (versions[i] == NULL &&
+                    strcmp(native_package_names[i], line) == 0) {
+                    ep_check(versions[i] = bz_version_from_rpm(space + 1));
+                }
+            }
+        }
+
+        line = line_end + 1;
+    }
+
+    cork_buffer_done(&out);
+    return 0;
+
+error:
+    for (i = 0; i < count; i++) {
+        if (versions[i] != NULL) {
+            bz_version_free(versions[i]);
+            versions[i] = NULL;
+        }
+    }
+    cork_buffer_done(&out);
+    return -1;
+}
+
 
 static int
 bz_yum_native__install(const char *native_package_name,
@@ -494,6 +685,23 @@ bz_yum_native__install(const char *native_package_name,
          NULL);
 }
 
+static int
+bz_yum_native__install_many(size_t count, const char **native_package_names,
+                            struct bz_version **versions)
+{
+    size_t  i;
+    struct cork_exec  *exec;
+    exec = cork_exec_new("sudo");
+    cork_exec_add_param(exec, "sudo");
+    cork_exec_add_param(exec, "yum");
+    cork_exec_add_param(exec, "install");
+    cork_exec_add_param(exec, "-y");
+    for (i = 0; i < count; i++) {
+        cork_exec_add_param(exec, native_package_names[i]);
+    }
+    return bz_subprocess_run_exec(false, NULL, exec);
+}
+
 static int
 bz_yum_native__uninstall(const char *native_package_name)
 {
@@ -506,14 +714,43 @@ bz_yum_native__uninstall(const char *native_package_name)
          NULL);
 }
 
+/* The packages that yum can install depend on the repository metadata that
+ * it has downloaded.  If we can't find that metadata, we can't tell when it
+ * changes, so we don't save any results.  We also include the rpm database,
+ * since installing a package can change what yum tells us about it. */
+static int
+bz_yum_native__fingerprint(struct cork_buffer *dest)
+{
+    rii_check(bz_native_fingerprint_add_files
+              (dest, "/var/cache/yum", "repomd.xml"));
+    rii_check(bz_native_fingerprint_add_files
+              (dest, "/var/cache/dnf", "repomd.xml"));
+    if (dest->size == 0) {
+        return 0;
+    }
+    rii_check(bz_native_fingerprint_add_file(dest, "/var/lib/rpm/Packages"));
+    return bz_native_fingerprint_add_file(dest, "/var/lib/rpm/rpmdb.sqlite");
+}
+
+static const char * const  bz_yum_native_patterns[] = {
+    "%s-devel", "lib%s-devel", "%s", "lib%s", NULL
+};
+
+static const struct bz_native_pdb_ops  bz_yum_native_pdb_ops = {
+    .version_available = bz_yum_native_version_available,
+    .version_available_many = bz_yum_native_version_available_many,
+    .version_installed = bz_rpm_native_version_installed,
+    .version_installed_many = bz_rpm_native_version_installed_many,
+    .install = bz_yum_native__install,
+    .install_many = bz_yum_native__install_many,
+    .uninstall = bz_yum_native__uninstall,
+    .fingerprint = bz_yum_native__fingerprint,
+    .patterns = bz_yum_native_patterns
+};
+
 struct bz_pdb *
 bz_yum_native_pdb(void)
 {
     return bz_native_pdb_new
-        ("RPM", "rpm",
-         bz_yum_native_version_available,
-         bz_rpm_native_version_installed,
-         bz_yum_native__install,
-         bz_yum_native__uninstall,
-         "%s-devel", "lib%s-devel", "%s", "lib%s", NULL);
+        ("RPM", "rpm", &bz_yum_native_pdb_ops);
 }
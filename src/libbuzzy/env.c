@@ -7,13 +7,19 @@
  * ----------------------------------------------------------------------
  */
 
+#include <fnmatch.h>
+#include <stdlib.h>
+#include <string.h>
+
 #include <clogger.h>
 #include <libcork/core.h>
 #include <libcork/ds.h>
 #include <libcork/helpers/errors.h>
 
+#include "buzzy/arena.h"
 #include "buzzy/env.h"
 #include "buzzy/error.h"
+#include "buzzy/session.h"
 #include "buzzy/value.h"
 #include "buzzy/version.h"
 
@@ -24,27 +30,44 @@
  * Environments
  */
 
+/* All of an environment's sets live in a single union map: first the sets
+ * added with bz_env_add_set, and then the ones added with
+ * bz_env_add_backup_set.  (That way each environment only has one lookup cache
+ * of its own.)  set_count is the number of non-backup sets.
+ *
+ * The env itself, its name, and its union and maps all live in its arena. */
+
+struct bz_env_globals;
+
 struct bz_env {
+    struct bz_arena  *arena;
     const char  *name;
     struct bz_union_map  *env_map;
     struct bz_value  *value;
-    struct bz_union_map  *sets_map;
-    struct bz_value  *sets;
-    struct bz_union_map  *backup_sets_map;
-    struct bz_value  *backup_sets;
+    size_t  set_count;
     struct bz_value  *override_map;
     struct bz_value  *backup_map;
+    /* The global environment that this environment is layered on top of, if
+     * any.  We hold a reference to it. */
+    struct bz_env_globals  *globals;
 };
 
+static void
+globals_unref(struct bz_env_globals *globals);
+
 struct bz_env *
 bz_env_new(const char *name)
 {
-    struct bz_env  *env = cork_new(struct bz_env);
-    env->name = cork_strdup(name);
-    env->sets_map = bz_union_map_new();
-    env->sets = bz_union_map_as_value(env->sets_map);
-    env->backup_sets_map = bz_union_map_new();
-    env->backup_sets = bz_union_map_as_value(env->backup_sets_map);
+    struct bz_arena  *arena = bz_arena_new();
+    struct bz_arena  *saved = bz_arena_set_current(arena);
+    struct bz_env  *env = bz_arena_alloc(arena, sizeof(struct bz_env));
+    env->arena = arena;
+    env->name = bz_arena_strdup(arena, name);
+    env->env_map = bz_union_map_new();
+    bz_union_map_set_name(env->env_map, env->name);
+    env->value = bz_union_map_as_value(env->env_map);
+    env->set_count = 0;
+    env->globals = NULL;
 
     /* Every environment comes with two map sets for free.  The first
      * takes precedence over every other value set, the other is overridden by
@@ -55,20 +78,26 @@ bz_env_new(const char *name)
 
     env->backup_map = bz_map_new();
     bz_env_add_backup_set(env, env->backup_map);
-
-    env->env_map = bz_union_map_new();
-    bz_union_map_add(env->env_map, env->sets);
-    bz_union_map_add(env->env_map, env->backup_sets);
-    env->value = bz_union_map_as_value(env->env_map);
+    bz_arena_set_current(saved);
     return env;
 }
 
 void
 bz_env_free(struct bz_env *env)
 {
-    bz_value_free(env->value);
-    cork_strfree(env->name);
-    free(env);
+    struct bz_env_globals  *globals = env->globals;
+    /* Freeing the arena releases this environment's reference to the global
+     * layer, which has to happen before the layer itself might be freed. */
+    bz_arena_free(env->arena);
+    if (globals != NULL) {
+        globals_unref(globals);
+    }
+}
+
+struct bz_arena *
+bz_env_arena(struct bz_env *env)
+{
+    return env->arena;
 }
 
 const char *
@@ -92,27 +121,50 @@ bz_env_set_base_path(struct bz_env *env, const char *base_path)
 void
 bz_env_add_set(struct bz_env *env, struct bz_value *set)
 {
-    bz_union_map_add(env->sets_map, set);
+    bz_env_thaw(env);
+    bz_union_map_insert(env->env_map, env->set_count++, set);
 }
 
 void
 bz_env_add_backup_set(struct bz_env *env, struct bz_value *set)
 {
-    bz_union_map_add(env->backup_sets_map, set);
+    bz_env_thaw(env);
+    bz_union_map_add(env->env_map, set);
 }
 
 void
 bz_env_add_override(struct bz_env *env, const char *key, struct bz_value *value)
 {
+    bz_env_thaw(env);
     bz_value_set_nested(env->override_map, key, value, true);
 }
 
 void
 bz_env_add_backup(struct bz_env *env, const char *key, struct bz_value *value)
 {
+    bz_env_thaw(env);
     bz_value_set_nested(env->backup_map, key, value, true);
 }
 
+int
+bz_env_freeze(struct bz_env *env)
+{
+    clog_debug("Freeze %s environment", env->name);
+    return bz_union_map_freeze(env->env_map);
+}
+
+void
+bz_env_thaw(struct bz_env *env)
+{
+    bz_union_map_thaw(env->env_map);
+}
+
+bool
+bz_env_is_frozen(struct bz_env *env)
+{
+    return bz_union_map_is_frozen(env->env_map);
+}
+
 struct bz_value *
 bz_env_as_value(struct bz_env *env)
 {
@@ -160,18 +212,203 @@ bz_env_get_version(struct bz_env *env, const char *name, bool required)
     return bz_value_get_version(env->value, name, required);
 }
 
+const struct bz_dependency_list *
+bz_env_get_dependencies(struct bz_env *env, const char *name, bool required)
+{
+    return bz_value_get_dependencies(env->value, name, required);
+}
+
+
+/*-----------------------------------------------------------------------
+ * Retrieving many variables at once
+ */
+
+static bool
+bz_env_is_glob(const char *pattern)
+{
+    return strpbrk(pattern, "*?[") != NULL;
+}
+
+struct bz_env_glob {
+    const char  *pattern;
+    struct bz_value  *map;
+    struct cork_buffer  prefix;
+    /* The full name of every variable that we've visited, as interned keys.
+     * Several maps in a union can define the same key, but we only want to
+     * visit it once. */
+    struct cork_hash_table  *seen;
+    cork_array(const struct bz_key *)  matches;
+};
+
+static int
+bz_env_glob_key(void *user_data, const char *key, struct bz_value *element)
+{
+    struct bz_env_glob  *glob = user_data;
+    size_t  prefix_size = glob->prefix.size;
+    const struct bz_key  *full_key;
+    struct bz_value  *value;
+    bool  is_new;
+    int  rc = 0;
+
+    if (prefix_size == 0) {
+        cork_buffer_set_string(&glob->prefix, key);
+    } else {
+        cork_buffer_append_printf(&glob->prefix, ".%s", key);
+    }
+    full_key = bz_key_intern(glob->prefix.buf);
+    cork_hash_table_get_or_create(glob->seen, (void *) full_key, &is_new);
+    if (is_new) {
+        /* Look up the key in the map, rather than using element, so that we
+         * see the same value that an ordinary lookup would. */
+        value = bz_map_value_get(glob->map, key);
+        if (value == NULL) {
+            rc = cork_error_occurred()? -1: 0;
+        } else if (bz_value_kind(value) == BZ_VALUE_MAP) {
+            struct bz_value  *parent = glob->map;
+            glob->map = value;
+            rc = bz_map_value_iterate(value, glob, bz_env_glob_key);
+            glob->map = parent;
+        } else if (bz_value_kind(value) == BZ_VALUE_SCALAR &&
+                   fnmatch(glob->pattern, glob->prefix.buf, 0) == 0) {
+            cork_array_append(&glob->matches, full_key);
+        }
+    }
+    cork_buffer_truncate(&glob->prefix, prefix_size);
+    return rc;
+}
+
+static int
+bz_env_glob_compare(const void *vk1, const void *vk2)
+{
+    const struct bz_key  *const *k1 = vk1;
+    const struct bz_key  *const *k2 = vk2;
+    return strcmp(bz_key_name(*k1), bz_key_name(*k2));
+}
+
+/* Fills in glob->matches with every scalar variable in env whose full name
+ * matches the glob, sorted by name.  We only walk the part of the environment
+ * that can match: for "deb.*", we start at the "deb" map. */
+static int
+bz_env_glob_find(struct bz_env *env, struct bz_env_glob *glob)
+{
+    const char  *wildcard = strpbrk(glob->pattern, "*?[");
+    const char  *last_dot = NULL;
+    const char  *curr;
+
+    for (curr = glob->pattern; curr < wildcard; curr++) {
+        if (*curr == '.') {
+            last_dot = curr;
+        }
+    }
+
+    if (last_dot == NULL) {
+        glob->map = env->value;
+    } else {
+        cork_buffer_set(&glob->prefix, glob->pattern, last_dot - glob->pattern);
+        glob->map = bz_env_get_value(env, glob->prefix.buf);
+        if (glob->map == NULL) {
+            return cork_error_occurred()? -1: 0;
+        } else if (bz_value_kind(glob->map) != BZ_VALUE_MAP) {
+            return 0;
+        }
+    }
+
+    rii_check(bz_map_value_iterate(glob->map, glob, bz_env_glob_key));
+    qsort(cork_array_elements(&glob->matches),
+          cork_array_size(&glob->matches),
+          cork_array_element_size(&glob->matches), bz_env_glob_compare);
+    return 0;
+}
+
+static int
+bz_env_get_one(struct bz_env *env, const struct bz_key *key,
+               void *user_data, bz_env_get_many_f each)
+{
+    const char  *name = bz_key_name(key);
+    struct bz_value  *value;
+    const char  *content;
+
+    rie_check(value = bz_value_get_key(env->value, key));
+    if (CORK_UNLIKELY(value == NULL)) {
+        bz_bad_config("No variable named %s", name);
+        return -1;
+    } else if (CORK_UNLIKELY(bz_value_kind(value) != BZ_VALUE_SCALAR)) {
+        bz_bad_config("Cannot print non-scalar variable %s", name);
+        return -1;
+    }
+
+    rip_check(content = bz_scalar_value_get_named(value, env->value, name));
+    return each(user_data, name, content);
+}
+
+int
+bz_env_get_many(struct bz_env *env, size_t count, const char **patterns,
+                void *user_data, bz_env_get_many_f each)
+{
+    size_t  i;
+    size_t  j;
+    struct cork_hash_table  *done;
+    struct bz_env_glob  glob;
+
+    rii_check(bz_env_freeze(env));
+    done = cork_pointer_hash_table_new(0, 0);
+    cork_buffer_init(&glob.prefix);
+    glob.seen = cork_pointer_hash_table_new(0, 0);
+    cork_array_init(&glob.matches);
+
+    for (i = 0; i < count; i++) {
+        bool  is_new;
+
+        if (!bz_env_is_glob(patterns[i])) {
+            const struct bz_key  *key = bz_key_intern(patterns[i]);
+            cork_hash_table_get_or_create(done, (void *) key, &is_new);
+            if (is_new) {
+                ei_check(bz_env_get_one(env, key, user_data, each));
+            }
+            continue;
+        }
+
+        glob.pattern = patterns[i];
+        cork_buffer_clear(&glob.prefix);
+        cork_hash_table_clear(glob.seen);
+        cork_array_clear(&glob.matches);
+        ei_check(bz_env_glob_find(env, &glob));
+        for (j = 0; j < cork_array_size(&glob.matches); j++) {
+            const struct bz_key  *key = cork_array_at(&glob.matches, j);
+            cork_hash_table_get_or_create(done, (void *) key, &is_new);
+            if (is_new) {
+                ei_check(bz_env_get_one(env, key, user_data, each));
+            }
+        }
+    }
+
+    cork_hash_table_free(done);
+    cork_buffer_done(&glob.prefix);
+    cork_hash_table_free(glob.seen);
+    cork_array_done(&glob.matches);
+    return 0;
+
+error:
+    cork_hash_table_free(done);
+    cork_buffer_done(&glob.prefix);
+    cork_hash_table_free(glob.seen);
+    cork_array_done(&glob.matches);
+    return -1;
+}
+
 
 /*-----------------------------------------------------------------------
  * Global and package-specific environments
  */
 
+/* Documentation for any variables that are defined at runtime (via
+ * bz_env_set_global_default), rather than in the table of built-in variables. */
+
 static struct bz_var_doc *
-bz_var_doc_new(const char *name, struct bz_value *value,
-               const char *short_desc, const char *long_desc)
+bz_var_doc_new(const char *name, const char *short_desc, const char *long_desc)
 {
     struct bz_var_doc  *doc = cork_new(struct bz_var_doc);
     doc->name = cork_strdup(name);
-    doc->value = value;
     if (short_desc == NULL) {
         short_desc = "";
     }
@@ -187,20 +424,186 @@ static void
 bz_var_doc_free(struct bz_var_doc *doc)
 {
     cork_strfree(doc->name);
-    if (doc->value != NULL) {
-        bz_value_free(doc->value);
-    }
     cork_strfree(doc->short_desc);
     cork_strfree(doc->long_desc);
     free(doc);
 }
 
-static struct cork_hash_table  *global_docs;
-static struct bz_value  *global_values = NULL;
-static struct bz_env  *global = NULL;
+
+/* The global environment's default values.  We don't construct the default
+ * value of a built-in variable until the first time that someone looks it up;
+ * after that, we hold on to it for as long as the global environment is alive.
+ * Each nested map (like "autotools.configure") is another one of these maps,
+ * with the prefix of the names that it contains.  Defaults that are defined at
+ * runtime go into a regular map, and take precedence over the built-in ones.
+ *
+ * We never report a built-in default as a change (like we do when you add
+ * something to a regular map), since as far as everyone else is concerned, the
+ * value was always there. */
+
+struct bz_default_map {
+    struct bz_arena  *arena;
+    /* Either empty, or ends with a "." */
+    const char  *prefix;
+    size_t  prefix_length;
+    struct bz_value  *added;
+    /* The built-in defaults (and nested maps) that we've already constructed,
+     * keyed by their names relative to prefix. */
+    struct cork_hash_table  *built;
+    struct cork_buffer  scratch;
+};
+
+static void
+bz_default_map__free(void *user_data)
+{
+    struct bz_default_map  *map = user_data;
+    bz_value_free(map->added);
+    cork_hash_table_free(map->built);
+    cork_buffer_done(&map->scratch);
+    if (map->prefix_length > 0) {
+        bz_arena_strfree(map->arena, map->prefix);
+    }
+    bz_arena_dealloc(map->arena, map);
+}
+
+static struct bz_value *
+bz_default_map_new(const char *prefix);
+
+static struct bz_value *
+bz_default_map_build(struct bz_default_map *map, const struct bz_var_def *def)
+{
+    struct bz_value  *value;
+    struct bz_arena  *saved = bz_arena_set_current(map->arena);
+    if (def->default_value == NULL) {
+        /* A prefix of some other variables' names */
+        value = bz_default_map_new(def->doc.name);
+    } else {
+        value = def->default_value();
+    }
+    bz_arena_set_current(saved);
+    if (value != NULL) {
+        /* The definition's name is static, so we can use it as the key. */
+        cork_hash_table_put
+            (map->built, (void *) (def->doc.name + map->prefix_length), value,
+             NULL, NULL, NULL);
+    }
+    return value;
+}
+
+static struct bz_value *
+bz_default_map__get(void *user_data, const char *key)
+{
+    struct bz_default_map  *map = user_data;
+    struct bz_value  *value;
+    const struct bz_var_def  *def;
+
+    value = bz_map_value_get(map->added, key);
+    if (value != NULL) {
+        return value;
+    }
+    value = cork_hash_table_get(map->built, (void *) key);
+    if (value != NULL) {
+        return value;
+    }
+
+    if (map->prefix_length == 0) {
+        def = bz_var_def_find(key);
+    } else {
+        cork_buffer_set(&map->scratch, map->prefix, map->prefix_length);
+        cork_buffer_append_string(&map->scratch, key);
+        def = bz_var_def_find(map->scratch.buf);
+    }
+    if (def == NULL) {
+        return NULL;
+    }
+    return bz_default_map_build(map, def);
+}
 
 static int
-load_config_path_list(struct cork_path_list *paths, const char *rel_path)
+bz_default_map__add(void *user_data, const char *key,
+                    struct bz_value *element, bool overwrite)
+{
+    struct bz_default_map  *map = user_data;
+    return bz_map_value_add(map->added, key, element, overwrite);
+}
+
+static int
+bz_default_map__iterate(void *user_data, void *iterate_user_data,
+                        bz_map_iterate_f iterate)
+{
+    struct bz_default_map  *map = user_data;
+    size_t  i;
+    size_t  count = bz_var_def_count();
+
+    for (i = 0; i < count; i++) {
+        const struct bz_var_def  *def = bz_var_def_get(i);
+        const char  *key = def->doc.name + map->prefix_length;
+        struct bz_value  *value;
+        if (strncmp(def->doc.name, map->prefix, map->prefix_length) != 0 ||
+            strchr(key, '.') != NULL) {
+            continue;
+        }
+        value = cork_hash_table_get(map->built, (void *) key);
+        if (value == NULL) {
+            value = bz_default_map_build(map, def);
+            if (value == NULL) {
+                if (CORK_UNLIKELY(cork_error_occurred())) {
+                    return -1;
+                }
+                continue;
+            }
+        }
+        rii_check(iterate(iterate_user_data, key, value));
+    }
+
+    return bz_map_value_iterate(map->added, iterate_user_data, iterate);
+}
+
+static struct bz_value *
+bz_default_map_new(const char *prefix)
+{
+    struct bz_arena  *arena = bz_arena_current();
+    struct bz_default_map  *map =
+        bz_arena_alloc(arena, sizeof(struct bz_default_map));
+    struct bz_value  *value;
+    map->arena = arena;
+    map->added = bz_map_new();
+    map->built = cork_string_hash_table_new(0, 0);
+    cork_hash_table_set_free_value(map->built, (cork_free_f) bz_value_free);
+    cork_buffer_init(&map->scratch);
+    if (prefix == NULL) {
+        map->prefix = "";
+        map->prefix_length = 0;
+    } else {
+        cork_buffer_printf(&map->scratch, "%s.", prefix);
+        map->prefix = bz_arena_strdup(arena, map->scratch.buf);
+        map->prefix_length = map->scratch.size;
+    }
+    value = bz_map_value_new
+        (map, bz_default_map__free, bz_default_map__get, bz_default_map__add);
+    bz_map_value_set_iterate(value, bz_default_map__iterate);
+    return value;
+}
+
+
+/* The global environment lives in the current session.  The session holds a
+ * reference to it, and so does every repository and package environment that
+ * is layered on top of it, so it stays alive until all of them are freed, even
+ * if that's after the session (or bz_global_env_reset) has let go of it. */
+struct bz_env_globals {
+    unsigned int  ref_count;
+    /* Only for the variables that are defined at runtime */
+    struct cork_hash_table  *docs;
+    struct bz_value  *values;
+    struct bz_env  *env;
+    /* A read-only view of the global environment, which is shared by every
+     * repository and package environment. */
+    struct bz_value  *layer;
+};
+
+static int
+load_config_path_list(struct bz_env *global, struct cork_path_list *paths,
+                      const char *rel_path)
 {
     struct cork_file_list  *files = NULL;
     size_t  i;
@@ -230,80 +633,123 @@ error:
 }
 
 static int
-load_config_files(void)
+load_config_files(struct bz_env *global)
 {
     struct cork_path_list  *paths;
     /* Configuration directories first (e.g., $HOME/.config) */
     rip_check(paths = cork_path_config_paths());
-    rii_check(load_config_path_list(paths, "buzzy.yaml"));
+    rii_check(load_config_path_list(global, paths, "buzzy.yaml"));
     /* Then data directories (e.g., $PREFIX/share) */
     rip_check(paths = cork_path_data_paths());
-    rii_check(load_config_path_list(paths, "buzzy/config.yaml"));
+    rii_check(load_config_path_list(global, paths, "buzzy/config.yaml"));
     return 0;
 }
 
-static void
+static struct bz_env_globals *
 global_new(void)
 {
-    global = bz_env_new("global");
-    global_docs = cork_string_hash_table_new(0, 0);
-    cork_hash_table_set_free_value(global_docs, (cork_free_f) bz_var_doc_free);
+    struct bz_arena  *saved;
+    struct bz_env_globals  *globals = cork_new(struct bz_env_globals);
+    globals->ref_count = 1;
+    globals->env = bz_env_new("global");
+    globals->docs = cork_string_hash_table_new(0, 0);
+    cork_hash_table_set_free_value
+        (globals->docs, (cork_free_f) bz_var_doc_free);
 
     /* Check for buzzy.yaml files in a bunch of configuration directories. */
-    if (CORK_UNLIKELY(load_config_files() != 0)) {
+    saved = bz_arena_set_current(bz_env_arena(globals->env));
+    if (CORK_UNLIKELY(load_config_files(globals->env) != 0)) {
         fprintf(stderr, "%s\n", cork_error_message());
         exit(EXIT_FAILURE);
     }
 
-    /* The precompiled default values */
-    global_values = bz_map_new();
-    bz_env_add_backup_set(global, global_values);
+    /* The default values */
+    globals->values = bz_default_map_new(NULL);
+    bz_env_add_backup_set(globals->env, globals->values);
+
+    /* Each repository and package environment releases its reference to the
+     * layer when its arena is freed, and only then releases its reference to
+     * the globals.  The layer doesn't live in the global environment's
+     * arena, so that it can outlive whichever of them is freed last. */
+    bz_arena_set_current(NULL);
+    globals->layer = bz_value_copy(bz_env_as_value(globals->env));
+    bz_arena_set_current(saved);
+    return globals;
 }
 
 static void
-global_free(void)
+globals_unref(struct bz_env_globals *globals)
 {
-    cork_hash_table_free(global_docs);
-    bz_env_free(global);
-    global = NULL;
-    global_values = NULL;
+    if (cork_uint_atomic_sub(&globals->ref_count, 1) > 0) {
+        return;
+    }
+    cork_hash_table_free(globals->docs);
+    bz_value_free(globals->layer);
+    bz_env_free(globals->env);
+    free(globals);
 }
 
 static void
-ensure_global_created(void)
+global_free(void *user_data)
 {
-    if (CORK_UNLIKELY(global == NULL)) {
-        global_new();
-        cork_cleanup_at_exit(0, global_free);
+    globals_unref(user_data);
+}
+
+static struct bz_env_globals *
+get_globals(void)
+{
+    struct bz_session  *session = bz_session_current();
+    struct bz_env_globals  *globals;
+    bz_session_lock(session);
+    globals = bz_session_get_slot(session, BZ_SESSION_ENV);
+    if (CORK_UNLIKELY(globals == NULL)) {
+        globals = global_new();
+        bz_session_set_slot(session, BZ_SESSION_ENV, globals, global_free);
     }
+    bz_session_unlock(session);
+    return globals;
 }
 
 void
 bz_global_env_reset(void)
 {
-    if (global != NULL) {
-        global_free();
-        global_new();
+    struct bz_session  *session = bz_session_current();
+    bz_session_lock(session);
+    if (bz_session_get_slot(session, BZ_SESSION_ENV) != NULL) {
+        bz_session_set_slot
+            (session, BZ_SESSION_ENV, global_new(), global_free);
     }
+    bz_session_unlock(session);
 }
 
 
 struct bz_env *
 bz_global_env(void)
 {
-    ensure_global_created();
-    return global;
+    return get_globals()->env;
+}
+
+/* Every repository and package environment shares the same read-only view of
+ * the global environment (and therefore the global environment's lookup
+ * caches).  Anything that an environment adds to itself goes into its own
+ * override or backup maps, so there's never any need to copy the global layer
+ * itself.  The environment also pins the global environment, so that the
+ * layer stays usable for as long as the environment is. */
+static void
+add_global_layer(struct bz_env *env)
+{
+    struct bz_env_globals  *globals = get_globals();
+    cork_uint_atomic_add(&globals->ref_count, 1);
+    env->globals = globals;
+    bz_env_add_backup_set(env, bz_value_ref(globals->layer));
 }
 
 struct bz_env *
 bz_repo_env_new_empty(void)
 {
     struct bz_env  *env;
-    struct bz_value  *global_default_set;
-    ensure_global_created();
     env = bz_env_new("repository");
-    global_default_set = bz_value_copy(bz_env_as_value(global));
-    bz_env_add_backup_set(env, global_default_set);
+    add_global_layer(env);
     return env;
 }
 
@@ -311,15 +757,14 @@ struct bz_env *
 bz_package_env_new_empty(struct bz_env *repo_env, const char *env_name)
 {
     struct bz_env  *env;
-    struct bz_value  *global_default_set;
-    ensure_global_created();
     env = bz_env_new(env_name);
     if (repo_env != NULL) {
         struct bz_value  *repo_set = bz_env_as_value(repo_env);
+        struct bz_arena  *saved = bz_arena_set_current(env->arena);
         bz_env_add_backup_set(env, bz_value_copy(repo_set));
+        bz_arena_set_current(saved);
     }
-    global_default_set = bz_value_copy(bz_env_as_value(global));
-    bz_env_add_backup_set(env, global_default_set);
+    add_global_layer(env);
     return env;
 }
 
@@ -329,8 +774,10 @@ bz_package_env_new(struct bz_env *repo_env, const char *package_name,
 {
     const char  *version_string = bz_version_to_string(version);
     struct bz_env  *env = bz_package_env_new_empty(repo_env, package_name);
+    struct bz_arena  *saved = bz_arena_set_current(env->arena);
     bz_env_add_override(env, "name", bz_string_value_new(package_name));
     bz_env_add_override(env, "version", bz_string_value_new(version_string));
+    bz_arena_set_current(saved);
     bz_version_free(version);
     return env;
 }
@@ -340,66 +787,60 @@ bz_env_set_global_default(const char *key, struct bz_value *value,
                           const char *short_desc, const char *long_desc)
 {
     bool  is_new;
+    int  rc = 0;
     struct cork_hash_table_entry  *entry;
+    struct bz_session  *session = bz_session_current();
+    struct bz_env_globals  *globals = get_globals();
 
-    ensure_global_created();
-    entry = cork_hash_table_get_or_create(global_docs, (void *) key, &is_new);
+    bz_session_lock(session);
+    if (CORK_UNLIKELY(bz_var_def_find(key) != NULL)) {
+        is_new = false;
+    } else {
+        entry = cork_hash_table_get_or_create
+            (globals->docs, (void *) key, &is_new);
+    }
     if (is_new) {
-        struct bz_var_doc  *doc =
-            bz_var_doc_new(key, value, short_desc, long_desc);
+        struct bz_var_doc  *doc = bz_var_doc_new(key, short_desc, long_desc);
         entry->key = (void *) doc->name;
         entry->value = doc;
-        if (value == NULL) {
-            return 0;
-        } else {
+        if (value != NULL) {
+            /* The copy lives in the global environment's arena, and refers to
+             * the original's contents, so the original has to live for as long
+             * as the arena does. */
+            struct bz_arena  *arena = bz_env_arena(globals->env);
+            struct bz_arena  *saved = bz_arena_set_current(arena);
             struct bz_value  *copy = bz_value_copy(value);
-            return bz_value_set_nested(global_values, key, copy, false);
+            bz_arena_set_current(saved);
+            bz_arena_add_cleanup(arena, value, (cork_free_f) bz_value_free);
+            rc = bz_value_set_nested(globals->values, key, copy, false);
         }
     } else {
-        bz_value_free(value);
+        if (value != NULL) {
+            bz_value_free(value);
+        }
         bz_bad_config("Variable %s defined twice", key);
-        return -1;
+        rc = -1;
     }
+    bz_session_unlock(session);
+    return rc;
 }
 
-struct bz_var_doc *
+const struct bz_var_doc *
 bz_env_get_global_default(const char *name, bool required)
 {
-    struct bz_var_doc  *doc =
-        cork_hash_table_get(global_docs, (void *) name);
+    const struct bz_var_def  *def = bz_var_def_find(name);
+    const struct bz_var_doc  *doc;
+    if (def != NULL && def->default_value != NULL) {
+        doc = &def->doc;
+    } else {
+        struct bz_session  *session = bz_session_current();
+        struct bz_env_globals  *globals = get_globals();
+        bz_session_lock(session);
+        doc = cork_hash_table_get(globals->docs, (void *) name);
+        bz_session_unlock(session);
+    }
     if (required && CORK_UNLIKELY(doc == NULL)) {
         bz_bad_config("No variable named %s", name);
     }
     return doc;
 }
-
-
-/*-----------------------------------------------------------------------
- * Documenting variables
- */
-
-#define bz_load_variables(prefix) \
-    do { \
-        extern int \
-        bz_vars__##prefix(void); \
-        rii_check(bz_vars__##prefix()); \
-    } while (0)
-
-int
-bz_load_variable_definitions(void)
-{
-    bz_load_variables(global);
-    bz_load_variables(package);
-    bz_load_variables(repo);
-
-    /* builders */
-    bz_load_variables(autotools);
-    bz_load_variables(cmake);
-
-    /* packagers */
-    bz_load_variables(deb);
-    bz_load_variables(homebrew);
-    bz_load_variables(pacman);
-    bz_load_variables(rpm);
-    return 0;
-}
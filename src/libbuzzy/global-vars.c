@@ -13,36 +13,38 @@
 #include "buzzy/distro/posix.h"
 
 
-bz_define_variables(global)
-{
-    bz_global_variable(
-        architecture, "arch",
-        bz_posix_architecture_value_new(),
-        "The architecture of the current machine",
-        ""
-    );
+bz_global_variable(
+    arch, "arch",
+    bz_posix_architecture_value_new(),
+    "The architecture of the current machine",
+    ""
+);
 
-    bz_global_variable(
-        cache_dir, "cache_dir",
-        bz_path_value_new(cork_path_user_cache_path()),
-        "A directory for user-specific nonessential data files",
-        "On POSIX systems, this defaults to the value of the $XDG_CACHE_HOME "
-        "environment variable, or $HOME/.cache if that's not defined.  Note "
-        "that this is not a Buzzy-specific directory; this should refer to the "
-        "root of the current user's cache directory."
-    );
+bz_global_variable(
+    cache_dir, "cache_dir",
+    bz_path_value_new(cork_path_user_cache_path()),
+    "A directory for user-specific nonessential data files",
+    "On POSIX systems, this defaults to the value of the $XDG_CACHE_HOME "
+    "environment variable, or $HOME/.cache if that's not defined.  Note "
+    "that this is not a Buzzy-specific directory; this should refer to the "
+    "root of the current user's cache directory.  Buzzy saves compiled "
+    "copies of the YAML files that it reads in the buzzy/yaml subdirectory "
+    "of the default cache directory.  It needs those before it reads any "
+    "configuration files, so setting this variable won't move them; set "
+    "the $BUZZY_YAML_CACHE_DIR environment variable to use a different "
+    "directory, or to an empty string to turn off the YAML cache."
+);
 
-    bz_global_variable(
-        work_dir, "work_dir",
-        bz_interpolated_value_new("${cache_dir}/buzzy"),
-        "A directory for Buzzy's intermediate build products",
-        ""
-    );
+bz_global_variable(
+    work_dir, "work_dir",
+    bz_interpolated_value_new("${cache_dir}/buzzy"),
+    "A directory for Buzzy's intermediate build products",
+    ""
+);
 
-    bz_global_variable(
-        binary_package_dir, "binary_package_dir",
-        bz_interpolated_value_new("${work_dir}/packages"),
-        "Where new binary packages should be placed",
-        ""
-    );
-}
+bz_global_variable(
+    binary_package_dir, "binary_package_dir",
+    bz_interpolated_value_new("${work_dir}/packages"),
+    "Where new binary packages should be placed",
+    ""
+);
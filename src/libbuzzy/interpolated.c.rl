@@ -9,157 +9,286 @@
 
 #include <libcork/core.h>
 #include <libcork/ds.h>
+#include <libcork/threads.h>
 #include <libcork/helpers/errors.h>
 
+#include "buzzy/arena.h"
 #include "buzzy/error.h"
+#include "buzzy/profile.h"
 #include "buzzy/value.h"
 
 
 /*-----------------------------------------------------------------------
- * Interpolated elements
+ * Compiled templates
  */
 
-typedef int
-(*bz_render_element_f)(void *user_data, struct bz_value *ctx,
-                       struct cork_buffer *dest);
+/* We compile each template into a single buffer of instructions, so that
+ * creating an interpolated value only needs a couple of allocations, and
+ * rendering one is a simple loop over that buffer.  Each instruction starts
+ * with an opcode byte:
+ *
+ *   BZ_OP_LITERAL  a uint32 length, and then that many bytes of literal
+ *                  content, followed by a NUL terminator
+ *
+ *   BZ_OP_VAR      a pointer to the variable's interned bz_key
+ *
+ *   BZ_OP_END      the end of the template
+ *
+ * The lengths and pointers aren't aligned, so we always copy them in and out
+ * with memcpy. */
 
-struct bz_interpolated_element {
-    void  *user_data;
-    cork_free_f  free_user_data;
-    bz_render_element_f  render;
+enum bz_interpolated_op {
+    BZ_OP_END = 0,
+    BZ_OP_LITERAL,
+    BZ_OP_VAR
 };
 
-static struct bz_interpolated_element *
-bz_interpolated_element_new(void *user_data, cork_free_f free_user_data,
-                            bz_render_element_f render)
-{
-    struct bz_interpolated_element  *element =
-        cork_new(struct bz_interpolated_element);
-    element->user_data = user_data;
-    element->free_user_data = free_user_data;
-    element->render = render;
-    return element;
-}
+#define BZ_NO_LITERAL  ((size_t) -1)
 
 static void
-bz_interpolated_element_free(struct bz_interpolated_element *element)
+bz_program_add_op(struct cork_buffer *program, enum bz_interpolated_op op)
 {
-    cork_free_user_data(element);
-    free(element);
+    char  op_byte = op;
+    cork_buffer_append(program, &op_byte, 1);
 }
 
-static int
-bz_interpolated_element_render(struct bz_interpolated_element *element,
-                               struct bz_value *ctx, struct cork_buffer *dest)
+static void
+bz_program_add_length(struct cork_buffer *program, size_t length)
 {
-    return element->render(element->user_data, ctx, dest);
+    uint32_t  length32 = length;
+    cork_buffer_append(program, &length32, sizeof(uint32_t));
 }
 
-
-/*-----------------------------------------------------------------------
- * Strings
- */
-
 static void
-bz_string_element__free(void *user_data)
+bz_program_add_string(struct cork_buffer *program,
+                      const char *content, size_t length)
 {
-    const char  *content = user_data;
-    cork_strfree(content);
+    cork_buffer_append(program, content, length);
+    cork_buffer_append(program, "", 1);
 }
 
-static int
-bz_string_element__render(void *user_data, struct bz_value *ctx,
-                          struct cork_buffer *dest)
+static uint32_t
+bz_program_get_length(const char **p)
 {
-    const char  *content = user_data;
-    cork_buffer_append_string(dest, content);
-    return 0;
-}
-
-static struct bz_interpolated_element *
-bz_string_element_new(const char *content, size_t length)
-{
-    const char  *copy = cork_strndup(content, length);
-    return bz_interpolated_element_new
-        ((void *) copy, bz_string_element__free, bz_string_element__render);
+    uint32_t  length;
+    memcpy(&length, *p, sizeof(uint32_t));
+    *p += sizeof(uint32_t);
+    return length;
 }
 
 
 /*-----------------------------------------------------------------------
- * Variable references
+ * Interpolated values
  */
 
-static void
-bz_var_ref_element__free(void *user_data)
-{
-    const char  *var_name = user_data;
-    cork_strfree(var_name);
-}
+/* A single interpolated value can be evaluated in several contexts (for
+ * instance, a global default is copied into each package's environment), so we
+ * cache a separate rendered result for each one.  Each result remembers which
+ * variables we read while rendering it, so that we can tell when we need to
+ * render it again. */
 
-static int
-bz_var_ref_element__render(void *user_data, struct bz_value *ctx,
-                           struct cork_buffer *dest)
+struct bz_interpolated_result {
+    bool  valid;
+    struct bz_value_reads  reads;
+    struct cork_buffer  value;
+};
+
+static struct bz_interpolated_result *
+bz_interpolated_result_new(void)
 {
-    const char  *var_name = user_data;
-    const char  *value;
-    rie_check(value = bz_value_get_string(ctx, var_name, false));
-    if (CORK_UNLIKELY(value == NULL)) {
-        bz_bad_config("No variable named \"%s\"", var_name);
-        return -1;
-    } else {
-        cork_buffer_append_string(dest, value);
-        return 0;
-    }
+    struct bz_interpolated_result  *result =
+        cork_new(struct bz_interpolated_result);
+    result->valid = false;
+    cork_buffer_init(&result->value);
+    return result;
 }
 
-static struct bz_interpolated_element *
-bz_var_ref_element_new(const char *var_name, size_t length)
+static void
+bz_interpolated_result_free(struct bz_interpolated_result *result)
 {
-    const char  *copy = cork_strndup(var_name, length);
-    return bz_interpolated_element_new
-        ((void *) copy, bz_var_ref_element__free, bz_var_ref_element__render);
+    cork_buffer_done(&result->value);
+    free(result);
 }
 
-
-/*-----------------------------------------------------------------------
- * Interpolated values
- */
+/* If the value lives in an arena, we copy its compiled program into the arena
+ * once we've finished compiling it, and only ask the arena to clean up after
+ * the value if we end up creating a results table. */
 
 struct bz_interpolated_value {
-    cork_array(struct bz_interpolated_element *)  elements;
-    struct cork_buffer  value;
+    struct bz_arena  *arena;
+    struct cork_buffer  program;
+    size_t  var_count;
+    /* The offset of the last instruction in program, if it's a literal, so
+     * that we can merge adjacent literals together. */
+    size_t  last_literal;
+    /* size_t ctx ID → bz_interpolated_result.  We don't create this until
+     * the first time we render a template that contains a variable. */
+    struct cork_hash_table  *results;
 };
 
+static size_t  render_count = 0;
+
+size_t
+bz_interpolated_value_render_count(void)
+{
+    return render_count;
+}
+
 static void
 bz_interpolated_value__free(void *user_data)
 {
     struct bz_interpolated_value  *value = user_data;
-    cork_array_done(&value->elements);
-    cork_buffer_done(&value->value);
-    free(value);
+    if (value->program.allocated_size > 0) {
+        cork_buffer_done(&value->program);
+    }
+    if (value->results != NULL) {
+        cork_hash_table_free(value->results);
+    }
+    bz_arena_dealloc(value->arena, value);
+}
+
+static int
+bz_interpolated_value_render(struct bz_interpolated_value *value,
+                             struct bz_value *ctx, struct cork_buffer *dest)
+{
+    const char  *p = value->program.buf;
+    cork_size_atomic_add(&render_count, 1);
+    cork_buffer_clear(dest);
+    cork_buffer_append(dest, "", 0);
+    while (true) {
+        switch (*p++) {
+            case BZ_OP_LITERAL:
+            {
+                uint32_t  length = bz_program_get_length(&p);
+                cork_buffer_append(dest, p, length);
+                p += length + 1;
+                break;
+            }
+
+            case BZ_OP_VAR:
+            {
+                const struct bz_key  *key;
+                struct bz_value  *var;
+                const char  *content;
+                memcpy(&key, p, sizeof(key));
+                p += sizeof(key);
+                rie_check(var = bz_value_get_key(ctx, key));
+                if (CORK_UNLIKELY(var == NULL)) {
+                    bz_bad_config
+                        ("No variable named \"%s\"", bz_key_name(key));
+                    return -1;
+                }
+                rip_check(content = bz_scalar_value_get_named
+                          (var, ctx, bz_key_name(key)));
+                cork_buffer_append_string(dest, content);
+                break;
+            }
+
+            case BZ_OP_END:
+                return 0;
+
+            default:
+                cork_unreachable();
+        }
+    }
 }
 
 static const char *
 bz_interpolated_value__get(void *user_data, struct bz_value *ctx)
 {
-    size_t  i;
+    int  rc;
     struct bz_interpolated_value  *value = user_data;
-    struct cork_buffer  *dest = &value->value;
+    struct bz_interpolated_result  *result;
+    struct bz_value_reads  *saved;
+    size_t  ctx_id;
+    struct cork_hash_table_entry  *entry;
+    bool  is_new;
+
+    /* A template without any variables is a single literal (or nothing at
+     * all), which we can return directly. */
+    if (value->var_count == 0) {
+        if (value->last_literal == BZ_NO_LITERAL) {
+            return "";
+        } else {
+            return (char *) value->program.buf + 1 + sizeof(uint32_t);
+        }
+    }
 
-    cork_buffer_clear(dest);
-    for (i = 0; i < cork_array_size(&value->elements); i++) {
-        struct bz_interpolated_element  *element =
-            cork_array_at(&value->elements, i);
-        rpi_check(bz_interpolated_element_render(element, ctx, dest));
+    if (CORK_UNLIKELY(value->results == NULL)) {
+        value->results = cork_pointer_hash_table_new(0, 0);
+        cork_hash_table_set_free_value
+            (value->results, (cork_free_f) bz_interpolated_result_free);
+        if (value->arena != NULL) {
+            bz_arena_add_cleanup
+                (value->arena, value, bz_interpolated_value__free);
+        }
+    }
+
+    ctx_id = (ctx == NULL)? 0: bz_value_id(ctx);
+    entry = cork_hash_table_get_or_create
+        (value->results, (void *) (uintptr_t) ctx_id, &is_new);
+    if (is_new) {
+        entry->value = bz_interpolated_result_new();
+    }
+    result = entry->value;
+
+    if (result->valid && !bz_value_reads_changed(&result->reads)) {
+        if (CORK_UNLIKELY(bz_profiling)) {
+            bz_profile_render(true);
+        }
+        bz_value_reads_replay(&result->reads);
+        return result->value.buf;
     }
-    return value->value.buf;
+
+    if (CORK_UNLIKELY(bz_profiling)) {
+        bz_profile_render(false);
+    }
+
+    result->valid = false;
+    bz_value_reads_begin(&result->reads, &saved);
+    rc = bz_interpolated_value_render(value, ctx, &result->value);
+    bz_value_reads_end(&result->reads, saved);
+    rpi_check(rc);
+    result->valid = true;
+    return result->value.buf;
 }
 
 static void
-bz_interpolated_value_add(struct bz_interpolated_value *value,
-                          struct bz_interpolated_element *element)
+bz_interpolated_value_add_literal(struct bz_interpolated_value *value,
+                                  const char *content, size_t length)
 {
-    cork_array_append(&value->elements, element);
+    struct cork_buffer  *program = &value->program;
+    if (value->last_literal == BZ_NO_LITERAL) {
+        value->last_literal = program->size;
+        bz_program_add_op(program, BZ_OP_LITERAL);
+        bz_program_add_length(program, length);
+    } else {
+        /* Extend the previous literal, overwriting its NUL terminator. */
+        char  *length_ptr = (char *) program->buf + value->last_literal + 1;
+        uint32_t  new_length;
+        memcpy(&new_length, length_ptr, sizeof(uint32_t));
+        new_length += length;
+        memcpy(length_ptr, &new_length, sizeof(uint32_t));
+        program->size--;
+    }
+    bz_program_add_string(program, content, length);
+}
+
+static void
+bz_interpolated_value_add_var(struct bz_interpolated_value *value,
+                              const char *var_name, size_t length)
+{
+    struct cork_buffer  *program = &value->program;
+    struct cork_buffer  name = CORK_BUFFER_INIT();
+    const struct bz_key  *key;
+    cork_buffer_set(&name, var_name, length);
+    key = bz_key_intern(name.buf);
+    cork_buffer_done(&name);
+
+    value->var_count++;
+    value->last_literal = BZ_NO_LITERAL;
+    bz_program_add_op(program, BZ_OP_VAR);
+    cork_buffer_append(program, &key, sizeof(key));
 }
 
 static int
@@ -174,7 +303,6 @@ bz_interpolated_value_parse(struct bz_interpolated_value *value,
     const char  *send = NULL;
     const char  *vstart = NULL;
     const char  *vend = NULL;
-    struct bz_interpolated_element  *element;
 
     %%{
         machine interpolated_value;
@@ -186,14 +314,12 @@ bz_interpolated_value_parse(struct bz_interpolated_value *value,
 
         var_ref = '${' var_name '}'
                   %{
-                      element = bz_var_ref_element_new(vstart, vend - vstart);
-                      bz_interpolated_value_add(value, element);
+                      bz_interpolated_value_add_var(value, vstart, vend - vstart);
                   };
 
         dollar = "$$"
                %{
-                   element = bz_string_element_new("$", 1);
-                   bz_interpolated_value_add(value, element);
+                   bz_interpolated_value_add_literal(value, "$", 1);
                };
 
         string_char    = any - '$';
@@ -203,8 +329,7 @@ bz_interpolated_value_parse(struct bz_interpolated_value *value,
 
         string = string_content
                  %{
-                     element = bz_string_element_new(sstart, send - sstart);
-                     bz_interpolated_value_add(value, element);
+                     bz_interpolated_value_add_literal(value, sstart, send - sstart);
                  };
 
         element = string | var_ref | dollar;
@@ -230,14 +355,29 @@ bz_interpolated_value_parse(struct bz_interpolated_value *value,
 struct bz_value *
 bz_interpolated_value_new(const char *template_value)
 {
+    struct bz_arena  *arena = bz_arena_current();
     struct bz_interpolated_value  *value;
-
-    value = cork_new(struct bz_interpolated_value);
-    cork_pointer_array_init
-        (&value->elements, (cork_free_f) bz_interpolated_element_free);
-    cork_buffer_init(&value->value);
-    cork_buffer_append(&value->value, "", 0);
+    size_t  template_length = strlen(template_value);
+
+    value = bz_arena_alloc(arena, sizeof(struct bz_interpolated_value));
+    value->arena = arena;
+    cork_buffer_init(&value->program);
+    /* The compiled program is never much bigger than the template itself. */
+    cork_buffer_ensure_size(&value->program, template_length + 16);
+    value->var_count = 0;
+    value->last_literal = BZ_NO_LITERAL;
+    value->results = NULL;
     ei_check(bz_interpolated_value_parse(value, template_value));
+    bz_program_add_op(&value->program, BZ_OP_END);
+    if (arena != NULL) {
+        size_t  size = value->program.size;
+        void  *program = bz_arena_alloc(arena, size);
+        memcpy(program, value->program.buf, size);
+        cork_buffer_done(&value->program);
+        value->program.buf = program;
+        value->program.size = size;
+        return bz_scalar_value_new(value, NULL, bz_interpolated_value__get);
+    }
     return bz_scalar_value_new
         (value, bz_interpolated_value__free, bz_interpolated_value__get);
 
@@ -7,13 +7,17 @@
  * ----------------------------------------------------------------------
  */
 
+#include <ctype.h>
 #include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
 
 #include <libcork/core.h>
 #include <libcork/helpers/errors.h>
 
 #include "buzzy/logging.h"
 #include "buzzy/mock.h"
+#include "buzzy/session.h"
 
 
 void
@@ -23,31 +27,185 @@ bz_real__print_action(const char *message)
 }
 
 
-static size_t  action_count = 0;
+/* Each session numbers its actions separately.  The caller must hold the
+ * session lock. */
+static size_t *
+get_action_count(struct bz_session *session)
+{
+    size_t  *action_count = bz_session_get_slot(session, BZ_SESSION_ACTIONS);
+    if (CORK_UNLIKELY(action_count == NULL)) {
+        action_count = cork_new(size_t);
+        *action_count = 0;
+        bz_session_set_slot(session, BZ_SESSION_ACTIONS, action_count, free);
+    }
+    return action_count;
+}
 
 void
 bz_log_action(const char *fmt, ...)
 {
     struct cork_buffer  message = CORK_BUFFER_INIT();
     va_list  args;
-    cork_buffer_printf(&message, "[%zu] ", ++action_count);
+    struct bz_session  *session = bz_session_current();
+    bz_session_lock(session);
+    cork_buffer_printf(&message, "[%zu] ", ++*get_action_count(session));
     va_start(args, fmt);
     cork_buffer_append_vprintf(&message, fmt, args);
     va_end(args);
     bz_mocked_print_action(message.buf);
+    bz_session_unlock(session);
     cork_buffer_done(&message);
 }
 
 void
 bz_finalize_actions(void)
 {
+    size_t  action_count;
+    struct bz_session  *session = bz_session_current();
+    bz_session_lock(session);
+    action_count = *get_action_count(session);
+    bz_session_unlock(session);
     if (action_count == 0) {
         bz_mocked_print_action("Nothing to do!");
     }
 }
 
+/* The child numbers its actions starting from wherever we were when it started,
+ * so we renumber them to fit in with all of the other actions that we've logged
+ * since. */
+void
+bz_log_replay_output(struct cork_buffer *out, struct cork_buffer *err)
+{
+    char  *line = out->buf;
+    char  *end = line + out->size;
+    while (line < end) {
+        char  *eol = memchr(line, '\n', end - line);
+        char  *curr = line;
+        size_t  length = (eol == NULL)? (size_t) (end - line): eol - line;
+        if (curr < end && *curr == '[') {
+            do {
+                curr++;
+            } while (curr < end && isdigit(*curr));
+        }
+        if (curr > line + 1 && curr + 1 < end &&
+            curr[0] == ']' && curr[1] == ' ') {
+            curr += 2;
+            bz_log_action("%.*s", (int) (length - (curr - line)), curr);
+        } else {
+            printf("%.*s\n", (int) length, line);
+        }
+        line += length + 1;
+    }
+    if (err->size > 0) {
+        /* Keep the child's error output after what it printed before it. */
+        fflush(stdout);
+        fwrite(err->buf, 1, err->size, stderr);
+    }
+    cork_buffer_clear(out);
+    cork_buffer_clear(err);
+}
+
+
+/*-----------------------------------------------------------------------
+ * Child processes
+ */
+
+void
+bz_child_job_init(struct bz_child_job *job, cork_run_f run, void *user_data)
+{
+    job->run = run;
+    job->user_data = user_data;
+    job->sub = NULL;
+    cork_buffer_init(&job->out);
+    cork_buffer_init(&job->err);
+    job->out_consumer = NULL;
+    job->err_consumer = NULL;
+    job->exit_code = 0;
+}
+
+static void
+bz_child_job_done_sub(struct bz_child_job *job)
+{
+    if (job->sub != NULL) {
+        cork_subprocess_free(job->sub);
+        job->sub = NULL;
+    }
+    if (job->out_consumer != NULL) {
+        cork_stream_consumer_free(job->out_consumer);
+        job->out_consumer = NULL;
+    }
+    if (job->err_consumer != NULL) {
+        cork_stream_consumer_free(job->err_consumer);
+        job->err_consumer = NULL;
+    }
+}
+
+void
+bz_child_job_done(struct bz_child_job *job)
+{
+    bz_child_job_done_sub(job);
+    cork_buffer_done(&job->out);
+    cork_buffer_done(&job->err);
+}
+
+/* Runs in the child process */
+static int
+bz_child_job__run(void *user_data)
+{
+    struct bz_child_job  *job = user_data;
+    int  rc = job->run(job->user_data);
+    /* The child process exits without flushing stdio for us. */
+    fflush(stdout);
+    return rc;
+}
+
+int
+bz_child_job_start(struct bz_child_job *job)
+{
+    cork_buffer_clear(&job->out);
+    cork_buffer_clear(&job->err);
+    job->exit_code = 0;
+    job->out_consumer = cork_buffer_to_stream_consumer(&job->out);
+    job->err_consumer = cork_buffer_to_stream_consumer(&job->err);
+    job->sub = cork_subprocess_new
+        (job, NULL, bz_child_job__run,
+         job->out_consumer, job->err_consumer, &job->exit_code);
+    /* Otherwise the child would print out anything that we've buffered but not
+     * printed yet, too. */
+    fflush(stdout);
+    ei_check(cork_subprocess_start(job->sub));
+    return 0;
+
+error:
+    bz_child_job_done_sub(job);
+    return -1;
+}
+
+bool
+bz_child_job_drain(struct bz_child_job *job)
+{
+    return cork_subprocess_drain(job->sub);
+}
+
+bool
+bz_child_job_is_finished(struct bz_child_job *job)
+{
+    return cork_subprocess_is_finished(job->sub);
+}
+
+int
+bz_child_job_finish(struct bz_child_job *job)
+{
+    bz_child_job_done_sub(job);
+    bz_log_replay_output(&job->out, &job->err);
+    return job->exit_code;
+}
+
 void
 bz_reset_action_count(void)
 {
-    action_count = 0;
+    struct bz_session  *session = bz_session_current();
+    bz_session_lock(session);
+    *get_action_count(session) = 0;
+    bz_session_unlock(session);
 }
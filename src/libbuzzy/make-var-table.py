@@ -0,0 +1,231 @@
+# -*- coding: utf-8 -*-
+# ----------------------------------------------------------------------
+# Copyright © 2015, RedJack, LLC.
+# All rights reserved.
+#
+# Please see the COPYING file in this distribution for license details.
+# ----------------------------------------------------------------------
+
+# Generates the table of built-in variables (var-table.c).
+#
+# Usage: make-var-table.py [output file] [source files...]
+#
+# We scan each source file for definitions that use the bz_global_variable,
+# bz_package_variable, or bz_repo_variable macros, and generate a perfect hash
+# table of them, using the "hash and displace" algorithm.  Every
+# key first hashes into one of a small number of buckets.  We then find a
+# displacement for each bucket, such that each key's second hash (which mixes
+# in its bucket's displacement) lands in a distinct slot of the table.  Looking
+# up a name takes two hashes and a single string comparison.
+#
+# We also add an entry for each prefix of a variable name (e.g., "autotools"
+# and "autotools.configure" for "autotools.configure.args"), so that the
+# global environment can look up nested names one segment at a time.
+
+from __future__ import print_function
+
+import re
+import sys
+
+DEFINITION = re.compile(
+    r'\bbz_(?:global|package|repo)_variable\(\s*(\w+)\s*,\s*"([^"]+)"')
+
+# Must match var_hash in the generated code.
+def var_hash(seed, name):
+    h = (2166136261 ^ seed) & 0xffffffff
+    for ch in bytearray(name.encode("utf-8")):
+        h ^= ch
+        h = (h * 16777619) & 0xffffffff
+    h ^= h >> 16
+    h = (h * 0x7feb352d) & 0xffffffff
+    h ^= h >> 15
+    return h
+
+def fail(message):
+    print("make-var-table.py: %s" % message, file=sys.stderr)
+    sys.exit(1)
+
+def find_definitions(paths):
+    c_names = {}
+    names = {}
+    for path in paths:
+        with open(path) as f:
+            content = f.read()
+        for match in DEFINITION.finditer(content):
+            c_name, name = match.groups()
+            if c_name in c_names:
+                fail("%s: %s is also defined in %s" %
+                     (path, c_name, c_names[c_name]))
+            if name in names:
+                fail("%s: Variable %s is also defined in %s" %
+                     (path, name, names[name]))
+            c_names[c_name] = path
+            names[name] = c_name
+    return names
+
+def find_prefixes(names):
+    prefixes = set()
+    for name in names:
+        segments = name.split(".")
+        for i in range(1, len(segments)):
+            prefix = ".".join(segments[:i])
+            if prefix in names:
+                fail("%s is a variable, and a prefix of %s" % (prefix, name))
+            prefixes.add(prefix)
+    return prefixes
+
+def next_power_of_two(n):
+    result = 1
+    while result < n:
+        result *= 2
+    return result
+
+def build_table(keys):
+    slot_count = next_power_of_two(len(keys))
+    bucket_count = max(1, slot_count // 4)
+    buckets = [[] for i in range(bucket_count)]
+    for key in keys:
+        buckets[var_hash(0, key) & (bucket_count - 1)].append(key)
+
+    slots = [None] * slot_count
+    displacements = [0] * bucket_count
+    order = sorted(range(bucket_count), key=lambda b: (-len(buckets[b]), b))
+    for b in order:
+        if not buckets[b]:
+            continue
+        for d in range(1, 0x10000):
+            positions = [var_hash(d, key) & (slot_count - 1)
+                         for key in buckets[b]]
+            if len(set(positions)) != len(positions):
+                continue
+            if any(slots[p] is not None for p in positions):
+                continue
+            for key, p in zip(buckets[b], positions):
+                slots[p] = key
+            displacements[b] = d
+            break
+        else:
+            fail("Cannot find a perfect hash for bucket %d" % b)
+    return slots, displacements
+
+HEADER = """\
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2015, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+/* Generated by make-var-table.py from the variable definitions in libbuzzy's
+ * source files.  Do not edit! */
+
+#include <string.h>
+
+#include <libcork/core.h>
+
+#include "buzzy/env.h"
+"""
+
+LOOKUP = """
+static uint32_t
+var_hash(uint32_t seed, const char *name)
+{
+    uint32_t  h = UINT32_C(2166136261) ^ seed;
+    for (; *name != '\\0'; name++) {
+        h ^= (uint8_t) *name;
+        h *= UINT32_C(16777619);
+    }
+    h ^= h >> 16;
+    h *= UINT32_C(0x7feb352d);
+    h ^= h >> 15;
+    return h;
+}
+
+const struct bz_var_def *
+bz_var_def_find(const char *name)
+{
+    uint32_t  bucket = var_hash(0, name) & (BZ_VAR_BUCKET_COUNT - 1);
+    uint32_t  slot =
+        var_hash(displacements[bucket], name) & (BZ_VAR_SLOT_COUNT - 1);
+    const struct bz_var_def  *def = slots[slot];
+    if (def != NULL && strcmp(def->doc.name, name) == 0) {
+        return def;
+    } else {
+        return NULL;
+    }
+}
+
+const struct bz_var_def *
+bz_var_def_get(size_t index)
+{
+    return defs[index];
+}
+
+size_t
+bz_var_def_count(void)
+{
+    return BZ_VAR_DEF_COUNT;
+}
+"""
+
+def c_string(s):
+    return '"%s"' % s.replace("\\", "\\\\").replace('"', '\\"')
+
+def generate(names, prefixes):
+    keys = sorted(set(names) | prefixes)
+    slots, displacements = build_table(keys)
+
+    def ref(key):
+        if key in names:
+            return "&bz_var__%s" % names[key]
+        else:
+            return "&bz_var_prefix__%s" % key.replace(".", "__")
+
+    out = [HEADER]
+    out.append("")
+    for key in keys:
+        if key in names:
+            out.append("extern const struct bz_var_def  bz_var__%s;"
+                       % names[key])
+    out.append("")
+    for key in keys:
+        if key not in names:
+            out.append("static const struct bz_var_def  bz_var_prefix__%s = {"
+                       % key.replace(".", "__"))
+            out.append("    { %s, \"\", \"\" }, NULL" % c_string(key))
+            out.append("};")
+    out.append("")
+    out.append("#define BZ_VAR_DEF_COUNT  %d" % len(keys))
+    out.append("#define BZ_VAR_SLOT_COUNT  %d" % len(slots))
+    out.append("#define BZ_VAR_BUCKET_COUNT  %d" % len(displacements))
+    out.append("")
+    out.append("static const struct bz_var_def  *const defs[] = {")
+    for key in keys:
+        out.append("    %s," % ref(key))
+    out.append("};")
+    out.append("")
+    out.append("static const uint16_t  displacements[] = {")
+    for i in range(0, len(displacements), 8):
+        out.append("    %s," % ", ".join(str(d) for d in displacements[i:i+8]))
+    out.append("};")
+    out.append("")
+    out.append("static const struct bz_var_def  *const slots[] = {")
+    for key in slots:
+        out.append("    %s," % ("NULL" if key is None else ref(key)))
+    out.append("};")
+    out.append(LOOKUP)
+    return "\n".join(out)
+
+def main(argv):
+    if len(argv) < 2:
+        fail("Usage: make-var-table.py [output file] [source files...]")
+    output = argv[0]
+    names = find_definitions(argv[1:])
+    content = generate(names, find_prefixes(names))
+    with open(output, "w") as f:
+        f.write(content)
+
+if __name__ == "__main__":
+    main(sys.argv[1:])
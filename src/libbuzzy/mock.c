@@ -7,12 +7,15 @@
  * ----------------------------------------------------------------------
  */
 
+#include <string.h>
+
 #include <libcork/core.h>
 #include <libcork/helpers/errors.h>
 
 #include "buzzy/error.h"
 #include "buzzy/logging.h"
 #include "buzzy/mock.h"
+#include "buzzy/session.h"
 
 
 /*-----------------------------------------------------------------------
@@ -21,13 +24,17 @@
 
 static struct bz_mock  real_implementations = {
     bz_real__exec,
+    bz_real__exec_first,
     bz_real__create_dir,
     bz_real__create_file,
     bz_real__copy_file,
     bz_real__file_exists,
     bz_real__load_file,
     bz_real__print_action,
-    bz_real__walk_directory
+    bz_real__walk_directory,
+    bz_real__file_stamp,
+    bz_real__map_file,
+    bz_real__unmap_file
 };
 
 
@@ -35,24 +42,71 @@ static struct bz_mock  real_implementations = {
  * Mocked state
  */
 
-static bool  mocks_enabled = false;
-static struct cork_hash_table  *subprocess_mocks;
-static struct cork_hash_table  *file_contents_mocks;
-static struct cork_buffer  actions_run;
-static struct cork_buffer  commands_run;
+/* Each session has its own mocks, which it creates when you call
+ * bz_start_mocks.  Several threads can share a session, so the mocked
+ * implementations hold the session lock while they look at or update any of
+ * this. */
+struct bz_mocks {
+    struct cork_hash_table  *subprocesses;
+    struct cork_hash_table  *file_contents;
+    struct cork_buffer  actions_run;
+    struct cork_buffer  commands_run;
+};
 
 struct bz_subprocess_mock;
+struct bz_file_contents_mock;
 
 static void
-free_mocks(void)
-{
-    if (mocks_enabled) {
-        cork_hash_table_free(subprocess_mocks);
-        cork_hash_table_free(file_contents_mocks);
-        cork_buffer_done(&actions_run);
-        cork_buffer_done(&commands_run);
-        mocks_enabled = false;
-    }
+bz_subprocess_mock_free(struct bz_subprocess_mock *mock);
+
+static void
+bz_file_contents_mock_free(struct bz_file_contents_mock *mock);
+
+static struct bz_mocks *
+bz_mocks_new(void)
+{
+    struct bz_mocks  *mocks = cork_new(struct bz_mocks);
+    mocks->subprocesses = cork_string_hash_table_new(0, 0);
+    cork_hash_table_set_free_value
+        (mocks->subprocesses, (cork_free_f) bz_subprocess_mock_free);
+    mocks->file_contents = cork_string_hash_table_new(0, 0);
+    cork_hash_table_set_free_value
+        (mocks->file_contents, (cork_free_f) bz_file_contents_mock_free);
+    cork_buffer_init(&mocks->actions_run);
+    cork_buffer_append(&mocks->actions_run, "", 0);
+    cork_buffer_init(&mocks->commands_run);
+    cork_buffer_append(&mocks->commands_run, "", 0);
+    return mocks;
+}
+
+static void
+bz_mocks_free(void *user_data)
+{
+    struct bz_mocks  *mocks = user_data;
+    cork_hash_table_free(mocks->subprocesses);
+    cork_hash_table_free(mocks->file_contents);
+    cork_buffer_done(&mocks->actions_run);
+    cork_buffer_done(&mocks->commands_run);
+    free(mocks);
+}
+
+/* Locks the current session and returns its mocks.  It's an error to call
+ * this if the session hasn't started its mocks. */
+static struct bz_mocks *
+bz_mocks_lock(void)
+{
+    struct bz_session  *session = bz_session_current();
+    struct bz_mocks  *mocks;
+    bz_session_lock(session);
+    mocks = bz_session_get_slot(session, BZ_SESSION_MOCKS);
+    assert(mocks != NULL);
+    return mocks;
+}
+
+static void
+bz_mocks_unlock(void)
+{
+    bz_session_unlock(bz_session_current());
 }
 
 
@@ -98,11 +152,17 @@ static void
 bz_subprocess_add_mock(const char *cmd, const char *out, const char *err,
                        int exit_code, bool allow_execute)
 {
+    struct bz_mocks  *mocks = bz_mocks_lock();
     struct bz_subprocess_mock  *mock;
-    assert(mocks_enabled);
+    void  *old_mock = NULL;
     mock = bz_subprocess_mock_new(cmd, out, err, exit_code, allow_execute);
     cork_hash_table_put
-        (subprocess_mocks, (void *) mock->cmd, mock, NULL, NULL, NULL);
+        (mocks->subprocesses, (void *) mock->cmd, mock,
+         NULL, NULL, &old_mock);
+    if (old_mock != NULL) {
+        bz_subprocess_mock_free(old_mock);
+    }
+    bz_mocks_unlock();
 }
 
 void
@@ -128,16 +188,15 @@ bz_mock_file_exists(const char *path, bool exists)
 }
 
 
-static int
-bz_mocked__exec(struct cork_exec *exec, struct cork_stream_consumer *out,
-                struct cork_stream_consumer *err, int *exit_code)
+/* Finds the mock for exec and records that we ran it.  The caller must hold
+ * the session lock. */
+static struct bz_subprocess_mock *
+bz_mocked_find_exec(struct bz_mocks *mocks, struct cork_exec *exec)
 {
     size_t  i;
     struct bz_subprocess_mock  *mock;
     struct cork_buffer  mock_key = CORK_BUFFER_INIT();
 
-    assert(mocks_enabled);
-
     /* Construct the mock key for this subprocess. */
     for (i = 0; i < cork_exec_param_count(exec); i++) {
         const char  *param = cork_exec_param(exec, i);
@@ -148,49 +207,120 @@ bz_mocked__exec(struct cork_exec *exec, struct cork_stream_consumer *out,
     }
 
     /* Look for a mock entry for this command. */
-    mock = cork_hash_table_get(subprocess_mocks, mock_key.buf);
+    mock = cork_hash_table_get(mocks->subprocesses, mock_key.buf);
     if (CORK_UNLIKELY(mock == NULL)) {
         bz_subprocess_error
             ("No mock for command \"%s\"", (char *) mock_key.buf);
         cork_buffer_done(&mock_key);
-        return -1;
+        return NULL;
     }
-    cork_buffer_append(&commands_run, "$ ", 2);
-    cork_buffer_append(&commands_run, mock_key.buf, mock_key.size);
-    cork_buffer_append(&commands_run, "\n", 1);
+    cork_buffer_append(&mocks->commands_run, "$ ", 2);
+    cork_buffer_append(&mocks->commands_run, mock_key.buf, mock_key.size);
+    cork_buffer_append(&mocks->commands_run, "\n", 1);
     cork_buffer_done(&mock_key);
+    return mock;
+}
+
+static int
+bz_mocked__exec(struct cork_exec *exec, struct cork_stream_consumer *out,
+                struct cork_stream_consumer *err, int *exit_code)
+{
+    struct bz_mocks  *mocks = bz_mocks_lock();
+    struct bz_subprocess_mock  *mock;
+    const char  *mock_out;
+    const char  *mock_err;
+    int  mock_exit_code;
+
+    mock = bz_mocked_find_exec(mocks, exec);
+    if (CORK_UNLIKELY(mock == NULL)) {
+        bz_mocks_unlock();
+        return -1;
+    }
 
     /* "Run" the mocked command. */
     if (mock->allow_execute) {
+        bz_mocks_unlock();
         return bz_real__exec(exec, out, err, exit_code);
     }
 
+    /* Another thread might replace the mock once we unlock the session, so
+     * grab copies of what we need first. */
+    mock_out = (mock->out == NULL)? NULL: cork_strdup(mock->out);
+    mock_err = (mock->err == NULL)? NULL: cork_strdup(mock->err);
+    mock_exit_code = mock->exit_code;
+    bz_mocks_unlock();
     cork_exec_free(exec);
 
     if (out != NULL) {
-        if (mock->out == NULL) {
-            rii_check(cork_stream_consumer_data(out, NULL, 0, true));
+        if (mock_out == NULL) {
+            ei_check(cork_stream_consumer_data(out, NULL, 0, true));
         } else {
-            rii_check(cork_stream_consumer_data
-                      (out, mock->out, strlen(mock->out), true));
+            ei_check(cork_stream_consumer_data
+                     (out, mock_out, strlen(mock_out), true));
         }
-        rii_check(cork_stream_consumer_eof(out));
+        ei_check(cork_stream_consumer_eof(out));
     }
 
     if (err != NULL) {
-        if (mock->err == NULL) {
-            rii_check(cork_stream_consumer_data(err, NULL, 0, true));
+        if (mock_err == NULL) {
+            ei_check(cork_stream_consumer_data(err, NULL, 0, true));
         } else {
-            rii_check(cork_stream_consumer_data
-                      (err, mock->err, strlen(mock->err), true));
+            ei_check(cork_stream_consumer_data
+                     (err, mock_err, strlen(mock_err), true));
         }
-        rii_check(cork_stream_consumer_eof(err));
+        ei_check(cork_stream_consumer_eof(err));
     }
 
     if (exit_code != NULL) {
-        *exit_code = mock->exit_code;
+        *exit_code = mock_exit_code;
     }
 
+    if (mock_out != NULL) {
+        cork_strfree(mock_out);
+    }
+    if (mock_err != NULL) {
+        cork_strfree(mock_err);
+    }
+    return 0;
+
+error:
+    if (mock_out != NULL) {
+        cork_strfree(mock_out);
+    }
+    if (mock_err != NULL) {
+        cork_strfree(mock_err);
+    }
+    return -1;
+}
+
+static int
+bz_mocked__exec_first(size_t count, struct cork_exec **execs,
+                      struct cork_stream_consumer **outs, int *exit_codes,
+                      bool *finished, size_t max_running)
+{
+    /* To keep the list of executed commands predictable, we "run" the mocked
+     * commands one at a time, in order, and stop at the first one that
+     * succeeds. */
+    size_t  i;
+    bool  found = false;
+    for (i = 0; i < count; i++) {
+        finished[i] = false;
+    }
+    for (i = 0; i < count; i++) {
+        if (found) {
+            cork_exec_free(execs[i]);
+        } else if (bz_mocked__exec
+                   (execs[i], outs[i], NULL, &exit_codes[i]) != 0) {
+            /* Don't leak the execs that we haven't run yet. */
+            for (i = i + 1; i < count; i++) {
+                cork_exec_free(execs[i]);
+            }
+            return -1;
+        } else {
+            finished[i] = true;
+            found = (exit_codes[i] == 0);
+        }
+    }
     return 0;
 }
 
@@ -202,8 +332,15 @@ bz_mocked__exec(struct cork_exec *exec, struct cork_stream_consumer *out,
 struct bz_file_contents_mock {
     const char  *path;
     const char  *contents;
+    /* Each new mock gets a new "modification time", so that mocking a file's
+     * contents a second time looks like the file has changed. */
+    int64_t  mtime;
 };
 
+/* This is shared by every session, so that a file mocked in one test case
+ * never looks unchanged to a cache left over from an earlier one. */
+static int64_t  file_contents_mtime = 0;
+
 static struct bz_file_contents_mock *
 bz_file_contents_mock_new(const char *path, const char *contents)
 {
@@ -211,6 +348,7 @@ bz_file_contents_mock_new(const char *path, const char *contents)
         cork_new(struct bz_file_contents_mock);
     mock->path = cork_strdup(path);
     mock->contents = cork_strdup(contents);
+    mock->mtime = __atomic_add_fetch(&file_contents_mtime, 1, __ATOMIC_RELAXED);
     return mock;
 }
 
@@ -222,27 +360,37 @@ bz_file_contents_mock_free(struct bz_file_contents_mock *mock)
     free(mock);
 }
 
+/* The caller must hold the session lock. */
 static void
-bz_file_contents_add_mock(const char *path, const char *contents)
+bz_file_contents_add_mock(struct bz_mocks *mocks,
+                          const char *path, const char *contents)
 {
     struct bz_file_contents_mock  *mock;
-    assert(mocks_enabled);
+    void  *old_mock = NULL;
     mock = bz_file_contents_mock_new(path, contents);
     cork_hash_table_put
-        (file_contents_mocks, (void *) mock->path, mock, NULL, NULL, NULL);
+        (mocks->file_contents, (void *) mock->path, mock,
+         NULL, NULL, &old_mock);
+    if (old_mock != NULL) {
+        bz_file_contents_mock_free(old_mock);
+    }
 }
 
 void
 bz_mock_file_contents(const char *path, const char *contents)
 {
-    bz_file_contents_add_mock(path, contents);
+    struct bz_mocks  *mocks = bz_mocks_lock();
+    bz_file_contents_add_mock(mocks, path, contents);
+    bz_mocks_unlock();
 }
 
 static struct cork_file *
 bz_mocked__create_dir(struct cork_path *path, cork_file_mode mode)
 {
+    struct bz_mocks  *mocks = bz_mocks_lock();
     cork_buffer_append_printf
-        (&commands_run, "$ mkdir -p %s\n", cork_path_get(path));
+        (&mocks->commands_run, "$ mkdir -p %s\n", cork_path_get(path));
+    bz_mocks_unlock();
     return cork_file_new_from_path(path);
 }
 
@@ -250,24 +398,33 @@ static struct cork_file *
 bz_mocked__create_file(struct cork_path *path, struct cork_buffer *src,
                        cork_file_mode mode)
 {
-    assert(mocks_enabled);
+    struct bz_mocks  *mocks = bz_mocks_lock();
     cork_buffer_append_printf
-        (&commands_run, "$ cat > %s <<EOF\n", cork_path_get(path));
-    cork_buffer_append(&commands_run, src->buf, src->size);
-    cork_buffer_append(&commands_run, "EOF\n", 4);
+        (&mocks->commands_run, "$ cat > %s <<EOF\n", cork_path_get(path));
+    cork_buffer_append(&mocks->commands_run, src->buf, src->size);
+    cork_buffer_append(&mocks->commands_run, "EOF\n", 4);
     cork_buffer_append_printf
-        (&commands_run, "$ chmod 0%03o %s\n", mode, cork_path_get(path));
+        (&mocks->commands_run, "$ chmod 0%03o %s\n",
+         mode, cork_path_get(path));
+    /* Any later attempt to read the file should see what we just wrote. */
+    bz_file_contents_add_mock
+        (mocks, cork_path_get(path),
+         (src->buf == NULL)? "": (char *) src->buf);
+    bz_mocks_unlock();
     return cork_file_new_from_path(path);
 }
 
 static struct cork_file *
 bz_mocked__copy_file(struct cork_path *dest, struct cork_path *src, int mode)
 {
+    struct bz_mocks  *mocks = bz_mocks_lock();
     cork_buffer_append_printf
-        (&commands_run, "$ cp %s %s\n",
+        (&mocks->commands_run, "$ cp %s %s\n",
          cork_path_get(dest), cork_path_get(src));
     cork_buffer_append_printf
-        (&commands_run, "$ chmod 0%3o %s\n", mode, cork_path_get(dest));
+        (&mocks->commands_run, "$ chmod 0%3o %s\n",
+         mode, cork_path_get(dest));
+    bz_mocks_unlock();
     cork_path_free(src);
     return cork_file_new_from_path(dest);
 }
@@ -275,47 +432,159 @@ bz_mocked__copy_file(struct cork_path *dest, struct cork_path *src, int mode)
 static int
 bz_mocked__file_exists(struct cork_path *path, bool *exists)
 {
+    struct bz_mocks  *mocks = bz_mocks_lock();
     struct bz_subprocess_mock  *mock;
     struct cork_buffer  cmd = CORK_BUFFER_INIT();
 
     cork_buffer_printf(&cmd, "[ -f %s ]", cork_path_get(path));
-    mock = cork_hash_table_get(subprocess_mocks, cmd.buf);
+    mock = cork_hash_table_get(mocks->subprocesses, cmd.buf);
     if (CORK_UNLIKELY(mock == NULL)) {
         bz_subprocess_error("No mock for file \"%s\"", cork_path_get(path));
+        bz_mocks_unlock();
         cork_buffer_done(&cmd);
         return -1;
     }
 
-    cork_buffer_append_printf(&commands_run, "$ %s\n", (char *) cmd.buf);
-    cork_buffer_done(&cmd);
+    cork_buffer_append_printf
+        (&mocks->commands_run, "$ %s\n", (char *) cmd.buf);
     *exists = (mock->exit_code == 0);
+    bz_mocks_unlock();
+    cork_buffer_done(&cmd);
     return 0;
 }
 
 static int
 bz_mocked__load_file(struct cork_path *path, struct cork_buffer *dest)
 {
+    struct bz_mocks  *mocks = bz_mocks_lock();
     struct bz_file_contents_mock  *mock;
-    mock = cork_hash_table_get(file_contents_mocks, cork_path_get(path));
+    mock = cork_hash_table_get(mocks->file_contents, cork_path_get(path));
     if (CORK_UNLIKELY(mock == NULL)) {
         bz_subprocess_error
             ("No mock for contents of file \"%s\"", cork_path_get(path));
+        bz_mocks_unlock();
         return -1;
     }
 
     cork_buffer_append_string(dest, mock->contents);
+    bz_mocks_unlock();
+    return 0;
+}
+
+/* A directory "exists" if we've mocked the contents of any file inside it.
+ * Its "modification time" is the newest of those files, so that mocking a new
+ * file looks like it changes the directory.  The caller must hold the session
+ * lock. */
+static void
+bz_mocked_directory_stamp(struct bz_mocks *mocks, const char *path,
+                          struct bz_file_stamp *stamp)
+{
+    size_t  path_len = strlen(path);
+    struct cork_hash_table_iterator  iter;
+    struct cork_hash_table_entry  *entry;
+    cork_hash_table_iterator_init(mocks->file_contents, &iter);
+    while ((entry = cork_hash_table_iterator_next(&iter)) != NULL) {
+        const char  *mock_path = entry->key;
+        struct bz_file_contents_mock  *mock = entry->value;
+        if (strncmp(mock_path, path, path_len) == 0 &&
+            mock_path[path_len] == '/') {
+            stamp->exists = true;
+            stamp->size++;
+            if (mock->mtime > stamp->mtime_sec) {
+                stamp->mtime_sec = mock->mtime;
+            }
+        }
+    }
+}
+
+/* Unlike bz_mocked__file_exists, these don't need an explicit mock; any file
+ * whose contents haven't been mocked doesn't exist. */
+static int
+bz_mocked__file_stamp(struct cork_path *path, struct bz_file_stamp *stamp)
+{
+    struct bz_mocks  *mocks = bz_mocks_lock();
+    struct bz_file_contents_mock  *mock;
+    mock = cork_hash_table_get(mocks->file_contents, cork_path_get(path));
+    if (mock == NULL) {
+        memset(stamp, 0, sizeof(struct bz_file_stamp));
+        bz_mocked_directory_stamp(mocks, cork_path_get(path), stamp);
+    } else {
+        stamp->exists = true;
+        stamp->size = strlen(mock->contents);
+        stamp->mtime_sec = mock->mtime;
+        stamp->mtime_nsec = 0;
+    }
+    bz_mocks_unlock();
     return 0;
 }
 
+/* The "mapping" points straight at the mock's contents, so it's only valid
+ * until someone mocks the file's contents again. */
 static int
-bz_mocked__walk_directory(const char *path, struct cork_dir_walker *walker)
+bz_mocked__map_file(struct cork_path *path, const char **buf, size_t *size)
 {
-    /* TODO: For now in test cases, we assume that there aren't any files in the
-     * directory that we want to walk.  We'll need to add in support for
-     * non-empty mocked directories at some point. */
+    struct bz_mocks  *mocks = bz_mocks_lock();
+    struct bz_file_contents_mock  *mock;
+    mock = cork_hash_table_get(mocks->file_contents, cork_path_get(path));
+    if (CORK_UNLIKELY(mock == NULL)) {
+        bz_subprocess_error
+            ("No mock for contents of file \"%s\"", cork_path_get(path));
+        bz_mocks_unlock();
+        return -1;
+    }
+
+    *buf = mock->contents;
+    *size = strlen(mock->contents);
+    bz_mocks_unlock();
     return 0;
 }
 
+static void
+bz_mocked__unmap_file(const char *buf, size_t size)
+{
+    /* Nothing to do; the contents belong to the mock. */
+}
+
+static int
+bz_mocked__walk_directory(const char *path, struct cork_dir_walker *walker)
+{
+    /* In test cases, a directory contains whichever files we've mocked the
+     * contents of.  We don't call the enter_directory and leave_directory
+     * callbacks for any subdirectories, and the files are visited in no
+     * particular order.  The walker can mock more files as it goes, so we
+     * collect the matching paths before calling it. */
+    int  rc = 0;
+    size_t  i;
+    size_t  path_len = strlen(path);
+    struct bz_mocks  *mocks = bz_mocks_lock();
+    struct cork_hash_table_iterator  iter;
+    struct cork_hash_table_entry  *entry;
+    cork_array(const char *)  full_paths;
+
+    cork_array_init(&full_paths);
+    cork_hash_table_iterator_init(mocks->file_contents, &iter);
+    while ((entry = cork_hash_table_iterator_next(&iter)) != NULL) {
+        const char  *full_path = entry->key;
+        if (strncmp(full_path, path, path_len) == 0 &&
+            full_path[path_len] == '/') {
+            cork_array_append(&full_paths, cork_strdup(full_path));
+        }
+    }
+    bz_mocks_unlock();
+
+    for (i = 0; i < cork_array_size(&full_paths); i++) {
+        const char  *full_path = cork_array_at(&full_paths, i);
+        if (rc == 0) {
+            const char  *rel_path = full_path + path_len + 1;
+            const char  *base_name = strrchr(full_path, '/') + 1;
+            rc = cork_dir_walker_file(walker, full_path, rel_path, base_name);
+        }
+        cork_strfree(full_path);
+    }
+    cork_array_done(&full_paths);
+    return rc;
+}
+
 
 /*-----------------------------------------------------------------------
  * Mocking actions
@@ -324,8 +593,10 @@ bz_mocked__walk_directory(const char *path, struct cork_dir_walker *walker)
 static void
 bz_mocked__print_action(const char *message)
 {
-    cork_buffer_append_string(&actions_run, message);
-    cork_buffer_append(&actions_run, "\n", 1);
+    struct bz_mocks  *mocks = bz_mocks_lock();
+    cork_buffer_append_string(&mocks->actions_run, message);
+    cork_buffer_append(&mocks->actions_run, "\n", 1);
+    bz_mocks_unlock();
 }
 
 
@@ -335,13 +606,17 @@ bz_mocked__print_action(const char *message)
 
 static struct bz_mock  mocked_implementations = {
     bz_mocked__exec,
+    bz_mocked__exec_first,
     bz_mocked__create_dir,
     bz_mocked__create_file,
     bz_mocked__copy_file,
     bz_mocked__file_exists,
     bz_mocked__load_file,
     bz_mocked__print_action,
-    bz_mocked__walk_directory
+    bz_mocked__walk_directory,
+    bz_mocked__file_stamp,
+    bz_mocked__map_file,
+    bz_mocked__unmap_file
 };
 
 
@@ -349,51 +624,59 @@ static struct bz_mock  mocked_implementations = {
  * Wrappers
  */
 
-/* Start by using the "real" executor */
-struct bz_mock  *bz_mocks = &real_implementations;
+/* A session uses the "real" implementations until it starts its mocks. */
+struct bz_mock *
+bz_mocks_current(void)
+{
+    struct bz_session  *session = bz_session_current();
+    if (CORK_LIKELY(bz_session_get_slot(session, BZ_SESSION_MOCKS) == NULL)) {
+        return &real_implementations;
+    } else {
+        return &mocked_implementations;
+    }
+}
 
 void
 bz_start_mocks(void)
 {
-    if (!mocks_enabled) {
-        cork_cleanup_at_exit(0, free_mocks);
-    }
-
-    /* Free any existing mocks first. */
-    free_mocks();
-
+    /* This frees any existing mocks first. */
+    struct bz_session  *session = bz_session_current();
+    bz_session_lock(session);
     bz_reset_action_count();
-    subprocess_mocks = cork_string_hash_table_new(0, 0);
-    cork_hash_table_set_free_value
-        (subprocess_mocks, (cork_free_f) bz_subprocess_mock_free);
-    file_contents_mocks = cork_string_hash_table_new(0, 0);
-    cork_hash_table_set_free_value
-        (file_contents_mocks, (cork_free_f) bz_file_contents_mock_free);
-    cork_buffer_init(&actions_run);
-    cork_buffer_append(&actions_run, "", 0);
-    cork_buffer_init(&commands_run);
-    cork_buffer_append(&commands_run, "", 0);
-    mocks_enabled = true;
-    bz_mocks = &mocked_implementations;
+    bz_session_set_slot
+        (session, BZ_SESSION_MOCKS, bz_mocks_new(), bz_mocks_free);
+    bz_session_unlock(session);
 }
 
 void
 bz_mocked_actions_clear(void)
 {
+    struct bz_session  *session = bz_session_current();
+    struct bz_mocks  *mocks;
+    bz_session_lock(session);
     bz_reset_action_count();
-    cork_buffer_clear(&actions_run);
+    mocks = bz_session_get_slot(session, BZ_SESSION_MOCKS);
+    if (mocks != NULL) {
+        cork_buffer_clear(&mocks->actions_run);
+    }
+    bz_session_unlock(session);
 }
 
+/* These two return a pointer into the session's mocks, so you shouldn't call
+ * them while another thread might be running mocked commands. */
+
 const char *
 bz_mocked_actions_run(void)
 {
-    assert(mocks_enabled);
-    return actions_run.buf;
+    const char  *result = bz_mocks_lock()->actions_run.buf;
+    bz_mocks_unlock();
+    return result;
 }
 
 const char *
 bz_mocked_commands_run(void)
 {
-    assert(mocks_enabled);
-    return commands_run.buf;
+    const char  *result = bz_mocks_lock()->commands_run.buf;
+    bz_mocks_unlock();
+    return result;
 }
@@ -7,22 +7,44 @@
  * ----------------------------------------------------------------------
  */
 
-#include <stdarg.h>
+#include <assert.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include <clogger.h>
 #include <libcork/core.h>
 #include <libcork/ds.h>
+#include <libcork/os.h>
 #include <libcork/helpers/errors.h>
 
+#include "buzzy/env.h"
 #include "buzzy/error.h"
 #include "buzzy/logging.h"
 #include "buzzy/native.h"
+#include "buzzy/os.h"
 #include "buzzy/package.h"
 #include "buzzy/version.h"
 
 #define CLOG_CHANNEL  "native"
 
 
+/*-----------------------------------------------------------------------
+ * Builtin variables
+ */
+
+bz_global_variable(
+    native_cache, "native_cache",
+    bz_string_value_new("true"),
+    "Whether to remember native package lookups between runs",
+    "If true, we save the results of looking up which native packages are "
+    "available in the work_dir directory, and reuse them until the native "
+    "package database changes."
+);
+
+
 /*-----------------------------------------------------------------------
  * Preinstalled packages
  */
@@ -141,6 +163,14 @@ bz_preinstalled_package_new(const char *short_distro_name,
  * Native packages
  */
 
+struct bz_native_pdb;
+
+static struct bz_version *
+bz_native_pdb_version_installed(struct bz_native_pdb *pdb, const char *name);
+
+static void
+bz_native_pdb_installed_changed(struct bz_native_pdb *pdb);
+
 struct bz_native_packager {
     struct bz_env  *env;
     const char  *short_distro_name;
@@ -150,6 +180,11 @@ struct bz_native_packager {
     bz_native_detect_f  version_installed;
     bz_native_install_f  install;
     bz_native_uninstall_f  uninstall;
+    /* The native package database that created this package, if any */
+    struct bz_native_pdb  *pdb;
+    /* Whether the pdb has already installed this package as part of a larger
+     * transaction */
+    bool  installed;
 };
 
 static void
@@ -164,6 +199,17 @@ bz_native_packager__free(void *user_data)
     free(native);
 }
 
+static struct bz_version *
+bz_native_packager_version_installed(struct bz_native_packager *native)
+{
+    if (native->pdb == NULL) {
+        return native->version_installed(native->native_package_name);
+    } else {
+        return bz_native_pdb_version_installed
+            (native->pdb, native->native_package_name);
+    }
+}
+
 static int
 bz_native_packager__package__is_needed(void *user_data, bool *is_needed)
 {
@@ -184,11 +230,14 @@ bz_native_packager__install__is_needed(void *user_data, bool *is_needed)
 {
     struct bz_native_packager  *native = user_data;
     struct bz_version  *installed;
+    if (native->installed) {
+        *is_needed = false;
+        return 0;
+    }
     clog_info("(%s) Check whether %s package %s is needed",
               native->package_name,
               native->short_distro_name, native->native_package_name);
-    rie_check(installed = native->version_installed
-              (native->native_package_name));
+    rie_check(installed = bz_native_packager_version_installed(native));
     if (installed == NULL) {
         *is_needed = true;
     } else {
@@ -198,16 +247,27 @@ bz_native_packager__install__is_needed(void *user_data, bool *is_needed)
     return 0;
 }
 
-static int
-bz_native_packager__install(void *user_data)
+static void
+bz_native_packager_log_install(struct bz_native_packager *native)
 {
-    struct bz_native_packager  *native = user_data;
     bz_log_action
         ("Install native %s package %s %s",
          native->short_distro_name,
          native->native_package_name,
          bz_version_to_string(native->version));
-    return native->install(native->native_package_name, native->version);
+}
+
+static int
+bz_native_packager__install(void *user_data)
+{
+    int  rc;
+    struct bz_native_packager  *native = user_data;
+    bz_native_packager_log_install(native);
+    rc = native->install(native->native_package_name, native->version);
+    if (native->pdb != NULL) {
+        bz_native_pdb_installed_changed(native->pdb);
+    }
+    return rc;
 }
 
 
@@ -219,8 +279,7 @@ bz_native_packager__uninstall__is_needed(void *user_data, bool *is_needed)
     clog_info("(%s) Check whether %s package %s is installed",
               native->package_name,
               native->short_distro_name, native->native_package_name);
-    rie_check(installed = native->version_installed
-              (native->native_package_name));
+    rie_check(installed = bz_native_packager_version_installed(native));
     /* Uninstall any version that happens to be installed. */
     if (installed == NULL) {
         *is_needed = false;
@@ -234,13 +293,18 @@ bz_native_packager__uninstall__is_needed(void *user_data, bool *is_needed)
 static int
 bz_native_packager__uninstall(void *user_data)
 {
+    int  rc;
     struct bz_native_packager  *native = user_data;
     bz_log_action
         ("Uninstall native %s package %s %s",
          native->short_distro_name,
          native->native_package_name,
          bz_version_to_string(native->version));
-    return native->uninstall(native->native_package_name);
+    rc = native->uninstall(native->native_package_name);
+    if (native->pdb != NULL) {
+        bz_native_pdb_installed_changed(native->pdb);
+    }
+    return rc;
 }
 
 static struct bz_packager *
@@ -251,9 +315,11 @@ bz_native_packager_new(struct bz_env *env,
                        struct bz_version *version,
                        bz_native_detect_f version_installed,
                        bz_native_install_f install,
-                       bz_native_uninstall_f uninstall)
+                       bz_native_uninstall_f uninstall,
+                       struct bz_native_pdb *pdb)
 {
     struct bz_native_packager  *native;
+    struct bz_packager  *packager;
 
     native = cork_new(struct bz_native_packager);
     native->env = env;
@@ -264,8 +330,10 @@ bz_native_packager_new(struct bz_env *env,
     native->version_installed = version_installed;
     native->install = install;
     native->uninstall = uninstall;
+    native->pdb = pdb;
+    native->installed = false;
 
-    return bz_packager_new
+    packager = bz_packager_new
         (env, short_distro_name,
          native, bz_native_packager__free,
          bz_native_packager__package__is_needed,
@@ -274,15 +342,20 @@ bz_native_packager_new(struct bz_env *env,
          bz_native_packager__install,
          bz_native_packager__uninstall__is_needed,
          bz_native_packager__uninstall);
+    /* Lets the pdb find this packager again in bz_native_pdb__install_many. */
+    bz_packager_set_owner(packager, pdb);
+    return packager;
 }
 
-struct bz_package *
-bz_native_package_new(const char *short_distro_name,
-                      const char *package_name, const char *native_package_name,
-                      struct bz_version *version,
-                      bz_native_detect_f version_installed,
-                      bz_native_install_f install,
-                      bz_native_uninstall_f uninstall)
+static struct bz_package *
+bz_native_package_new_in_pdb(const char *short_distro_name,
+                             const char *package_name,
+                             const char *native_package_name,
+                             struct bz_version *version,
+                             bz_native_detect_f version_installed,
+                             bz_native_install_f install,
+                             bz_native_uninstall_f uninstall,
+                             struct bz_native_pdb *pdb)
 {
     struct bz_env  *env;
     struct bz_builder  *builder;
@@ -297,10 +370,23 @@ bz_native_package_new(const char *short_distro_name,
     builder = bz_noop_builder_new(env);
     packager = bz_native_packager_new
         (env, short_distro_name, package_name, native_package_name,
-         version, version_installed, install, uninstall);
+         version, version_installed, install, uninstall, pdb);
     return bz_package_new(package_name, version, env, builder, packager);
 }
 
+struct bz_package *
+bz_native_package_new(const char *short_distro_name,
+                      const char *package_name, const char *native_package_name,
+                      struct bz_version *version,
+                      bz_native_detect_f version_installed,
+                      bz_native_install_f install,
+                      bz_native_uninstall_f uninstall)
+{
+    return bz_native_package_new_in_pdb
+        (short_distro_name, package_name, native_package_name, version,
+         version_installed, install, uninstall, NULL);
+}
+
 
 /*-----------------------------------------------------------------------
  * Native package databases
@@ -310,13 +396,70 @@ struct bz_native_pdb {
     const char  *short_distro_name;
     const char  *slug;
     bz_native_detect_f  version_available;
+    bz_native_detect_many_f  version_available_many;
+    bz_native_probe_f  probe_available;
+    bz_native_parse_probe_f  parse_available;
     bz_native_detect_f  version_installed;
+    bz_native_detect_many_f  version_installed_many;
     bz_native_install_f  install;
+    bz_native_install_many_f  install_many;
     bz_native_uninstall_f  uninstall;
     cork_array(const char *)  patterns;
+    cork_array(const char *)  candidates;
+    /* Maps native package names to their available versions (or to NULL, if
+     * the package isn't available) */
+    struct cork_hash_table  *available;
+    /* The native names of the packages that we've created */
+    cork_array(const char *)  natives;
+    /* Maps native package names to their installed versions (or to NULL, if
+     * the package isn't installed).  We clear this whenever we install or
+     * uninstall anything. */
+    struct cork_hash_table  *installed;
+    /* The value of installed_counter when we last cleared installed */
+    unsigned int  installed_stamp;
+    /* The availability query results that we've saved across runs (or NULL if
+     * we're not saving them) */
+    bz_native_fingerprint_f  fingerprint;
+    struct bz_native_index  *saved;
+    bool  saved_loaded;
+    bool  saved_dirty;
     struct cork_buffer  buf;
 };
 
+/* Incremented whenever any packager installs or uninstalls anything, since
+ * installing a source package can change whether a native package with the
+ * same name is installed. */
+static unsigned int  installed_counter = 0;
+
+void
+bz_native_installed_changed(void)
+{
+    cork_uint_atomic_add(&installed_counter, 1);
+}
+
+/* How we record packages that aren't available in the saved results */
+#define BZ_NATIVE_NOT_AVAILABLE  "-"
+
+static void
+bz_native_pdb_free_version(void *value)
+{
+    struct bz_version  *version = value;
+    if (version != NULL) {
+        bz_version_free(version);
+    }
+}
+
+static void
+bz_native_pdb_clear_candidates(struct bz_native_pdb *pdb)
+{
+    size_t  i;
+    for (i = 0; i < cork_array_size(&pdb->candidates); i++) {
+        const char  *candidate = cork_array_at(&pdb->candidates, i);
+        cork_strfree(candidate);
+    }
+    cork_array_clear(&pdb->candidates);
+}
+
 static void
 bz_native_pdb__free(void *user_data)
 {
@@ -328,6 +471,18 @@ bz_native_pdb__free(void *user_data)
         cork_strfree(pattern);
     }
     cork_array_done(&pdb->patterns);
+    bz_native_pdb_clear_candidates(pdb);
+    cork_array_done(&pdb->candidates);
+    cork_hash_table_free(pdb->available);
+    for (i = 0; i < cork_array_size(&pdb->natives); i++) {
+        const char  *native = cork_array_at(&pdb->natives, i);
+        cork_strfree(native);
+    }
+    cork_array_done(&pdb->natives);
+    cork_hash_table_free(pdb->installed);
+    if (pdb->saved != NULL) {
+        bz_native_index_free(pdb->saved);
+    }
 
     cork_strfree(pdb->short_distro_name);
     cork_strfree(pdb->slug);
@@ -335,6 +490,416 @@ bz_native_pdb__free(void *user_data)
     free(pdb);
 }
 
+/* Loads the availability results that we saved in earlier runs, if we're
+ * allowed to use them. */
+static int
+bz_native_pdb_load_saved(struct bz_native_pdb *pdb)
+{
+    bool  enabled;
+    struct cork_buffer  key = CORK_BUFFER_INIT();
+
+    if (pdb->saved_loaded || pdb->fingerprint == NULL) {
+        return 0;
+    }
+    pdb->saved_loaded = true;
+
+    ei_check(pdb->fingerprint(&key));
+    if (key.size == 0) {
+        cork_buffer_done(&key);
+        return 0;
+    }
+
+    ee_check(enabled =
+             bz_env_get_bool(bz_global_env(), "native_cache", false));
+    if (enabled) {
+        cork_buffer_printf(&pdb->buf, "native-%s.cache", pdb->slug);
+        pdb->saved = bz_native_index_new(pdb->buf.buf, NULL);
+        ei_check(bz_native_index_update(pdb->saved, &key, NULL, NULL));
+    }
+    cork_buffer_done(&key);
+    return 0;
+
+error:
+    if (pdb->saved != NULL) {
+        bz_native_index_free(pdb->saved);
+        pdb->saved = NULL;
+    }
+    cork_buffer_done(&key);
+    return -1;
+}
+
+/* Copies the saved result for name (if there is one) into the available
+ * cache, and returns whether there was one. */
+static bool
+bz_native_pdb_use_saved(struct bz_native_pdb *pdb, const char *name)
+{
+    const char  *saved;
+    struct bz_version  *available = NULL;
+
+    if (pdb->saved == NULL) {
+        return false;
+    }
+
+    saved = bz_native_index_get(pdb->saved, name);
+    if (saved == NULL) {
+        return false;
+    }
+
+    if (strcmp(saved, BZ_NATIVE_NOT_AVAILABLE) != 0) {
+        available = bz_version_from_string(saved);
+        if (available == NULL) {
+            /* Just run the query again if the saved version is garbled. */
+            cork_error_clear();
+            return false;
+        }
+    }
+
+    cork_hash_table_put
+        (pdb->available, (void *) cork_strdup(name), available,
+         NULL, NULL, NULL);
+    return true;
+}
+
+static void
+bz_native_pdb_add_saved(struct bz_native_pdb *pdb, const char *name,
+                        struct bz_version *available)
+{
+    const char  *version;
+    if (pdb->saved == NULL) {
+        return;
+    }
+    version = (available == NULL)?
+        BZ_NATIVE_NOT_AVAILABLE: bz_version_to_string(available);
+    bz_native_index_add
+        (pdb->saved, name, strlen(name), version, strlen(version));
+    pdb->saved_dirty = true;
+}
+
+/* Saves any new availability results for later runs.  It's not an error if we
+ * can't. */
+static void
+bz_native_pdb_write_saved(struct bz_native_pdb *pdb)
+{
+    if (pdb->saved == NULL || !pdb->saved_dirty) {
+        return;
+    }
+    pdb->saved_dirty = false;
+    if (bz_native_index_save(pdb->saved) != 0) {
+        clog_warning("Cannot save native %s package lookups: %s",
+                     pdb->short_distro_name, cork_error_message());
+        cork_error_clear();
+    }
+}
+
+/* Returns the available version of a native package, consulting the results
+ * of any earlier queries first.  You're not responsible for freeing the
+ * result. */
+static struct bz_version *
+bz_native_pdb_version_available(struct bz_native_pdb *pdb, const char *name)
+{
+    struct cork_hash_table_entry  *entry;
+    struct bz_version  *available;
+
+    entry = cork_hash_table_get_entry(pdb->available, (void *) name);
+    if (entry != NULL) {
+        return entry->value;
+    }
+
+    rpi_check(bz_native_pdb_load_saved(pdb));
+    if (bz_native_pdb_use_saved(pdb, name)) {
+        return cork_hash_table_get(pdb->available, (void *) name);
+    }
+
+    rpe_check(available = pdb->version_available(name));
+    cork_hash_table_put
+        (pdb->available, (void *) cork_strdup(name), available,
+         NULL, NULL, NULL);
+    bz_native_pdb_add_saved(pdb, name, available);
+    return available;
+}
+
+/* Adds name to the list of names that we need to look up, unless we've already
+ * looked it up, or it's already in the list. */
+static void
+bz_native_pdb_add_missing(struct cork_hash_table *cache, const char *name,
+                          const char **missing, size_t *missing_count)
+{
+    size_t  i;
+    if (cork_hash_table_get_entry(cache, (void *) name) != NULL) {
+        return;
+    }
+    for (i = 0; i < *missing_count; i++) {
+        if (strcmp(missing[i], name) == 0) {
+            return;
+        }
+    }
+    missing[(*missing_count)++] = name;
+}
+
+/* Looks up several native packages with a single query, and adds the results
+ * to cache.  If there's only one package to look up, we leave it for the
+ * caller to look up with the single-package detect function. */
+static int
+bz_native_pdb_query_many(bz_native_detect_many_f detect_many,
+                         struct cork_hash_table *cache,
+                         size_t count, const char **names)
+{
+    size_t  i;
+    struct bz_version  **versions;
+
+    if (count < 2) {
+        return 0;
+    }
+
+    versions = cork_calloc(count, sizeof(struct bz_version *));
+    if (CORK_UNLIKELY(detect_many(count, names, versions) != 0)) {
+        for (i = 0; i < count; i++) {
+            bz_native_pdb_free_version(versions[i]);
+        }
+        free(versions);
+        return -1;
+    }
+
+    for (i = 0; i < count; i++) {
+        cork_hash_table_put
+            (cache, (void *) cork_strdup(names[i]), versions[i],
+             NULL, NULL, NULL);
+    }
+    free(versions);
+    return 0;
+}
+
+/* Looks up all of the candidate names that we haven't seen yet with a single
+ * query, if the package database supports that. */
+static int
+bz_native_pdb_prefetch_candidates(struct bz_native_pdb *pdb)
+{
+    int  rc;
+    size_t  i;
+    size_t  count = cork_array_size(&pdb->candidates);
+    size_t  missing_count = 0;
+    const char  **missing;
+
+    if (pdb->version_available_many == NULL || count == 0) {
+        return 0;
+    }
+
+    rii_check(bz_native_pdb_load_saved(pdb));
+    missing = cork_calloc(count, sizeof(const char *));
+    for (i = 0; i < count; i++) {
+        const char  *candidate = cork_array_at(&pdb->candidates, i);
+        if (cork_hash_table_get_entry(pdb->available, (void *) candidate)
+            == NULL) {
+            bz_native_pdb_use_saved(pdb, candidate);
+        }
+        bz_native_pdb_add_missing
+            (pdb->available, candidate, missing, &missing_count);
+    }
+    rc = bz_native_pdb_query_many
+        (pdb->version_available_many, pdb->available, missing_count, missing);
+    if (rc == 0 && missing_count > 1) {
+        for (i = 0; i < missing_count; i++) {
+            bz_native_pdb_add_saved
+                (pdb, missing[i],
+                 cork_hash_table_get(pdb->available, (void *) missing[i]));
+        }
+    }
+    free(missing);
+    return rc;
+}
+
+/* The most probe subprocesses that we'll run at the same time */
+#define BZ_NATIVE_MAX_PROBES  4
+
+/* Checks the candidate names that we haven't seen yet at the same time, each
+ * with its own subprocess, if the package database supports that.  We only
+ * need the first available candidate, so we stop as soon as we know which one
+ * that is.  Any candidates that we don't check will be checked one at a time
+ * later, if needed. */
+static int
+bz_native_pdb_probe_candidates(struct bz_native_pdb *pdb)
+{
+    size_t  i;
+    size_t  count = cork_array_size(&pdb->candidates);
+    size_t  missing_count = 0;
+    const char  **missing = NULL;
+    struct cork_exec  **execs = NULL;
+    struct cork_buffer  *outs = NULL;
+    bool  *finished = NULL;
+    bool  *successful = NULL;
+    int  rc = 0;
+
+    if (pdb->probe_available == NULL || count == 0) {
+        return 0;
+    }
+
+    /* Find the candidates that we need to check, stopping at the first one
+     * that we already know is available. */
+    rii_check(bz_native_pdb_load_saved(pdb));
+    missing = cork_calloc(count, sizeof(const char *));
+    for (i = 0; i < count; i++) {
+        const char  *candidate = cork_array_at(&pdb->candidates, i);
+        struct cork_hash_table_entry  *entry;
+        entry = cork_hash_table_get_entry(pdb->available, (void *) candidate);
+        if (entry == NULL && bz_native_pdb_use_saved(pdb, candidate)) {
+            entry = cork_hash_table_get_entry
+                (pdb->available, (void *) candidate);
+        }
+        if (entry != NULL && entry->value != NULL) {
+            break;
+        }
+        bz_native_pdb_add_missing
+            (pdb->available, candidate, missing, &missing_count);
+    }
+
+    /* If there's only one candidate to check, there's nothing to gain from
+     * checking it on its own now. */
+    if (missing_count < 2) {
+        free(missing);
+        return 0;
+    }
+
+    execs = cork_calloc(missing_count, sizeof(struct cork_exec *));
+    for (i = 0; i < missing_count; i++) {
+        ei_check(pdb->probe_available(missing[i], &execs[i]));
+        if (execs[i] == NULL) {
+            /* The package database doesn't need a subprocess to answer this
+             * query. */
+            goto done;
+        }
+    }
+
+    outs = cork_calloc(missing_count, sizeof(struct cork_buffer));
+    finished = cork_calloc(missing_count, sizeof(bool));
+    successful = cork_calloc(missing_count, sizeof(bool));
+    for (i = 0; i < missing_count; i++) {
+        cork_buffer_init(&outs[i]);
+    }
+    /* This takes control of the execs, even if it fails. */
+    rc = bz_subprocess_get_first_output
+        (missing_count, execs, BZ_NATIVE_MAX_PROBES,
+         outs, finished, successful);
+    free(execs);
+    execs = NULL;
+    ei_check(rc);
+
+    for (i = 0; i < missing_count; i++) {
+        struct bz_version  *available = NULL;
+        if (!finished[i]) {
+            continue;
+        }
+        if (successful[i]) {
+            ep_check(available =
+                     pdb->parse_available(missing[i], &outs[i]));
+        }
+        cork_hash_table_put
+            (pdb->available, (void *) cork_strdup(missing[i]), available,
+             NULL, NULL, NULL);
+        bz_native_pdb_add_saved(pdb, missing[i], available);
+    }
+
+done:
+    if (execs != NULL) {
+        for (i = 0; i < missing_count; i++) {
+            if (execs[i] != NULL) {
+                cork_exec_free(execs[i]);
+            }
+        }
+        free(execs);
+    }
+    if (outs != NULL) {
+        for (i = 0; i < missing_count; i++) {
+            cork_buffer_done(&outs[i]);
+        }
+        free(outs);
+    }
+    free(finished);
+    free(successful);
+    free(missing);
+    return rc;
+
+error:
+    rc = -1;
+    goto done;
+}
+
+/* Returns the installed version of a native package that we've created,
+ * consulting the results of any earlier queries first.  If we need to run a
+ * query, we check all of the other packages that we've created at the same
+ * time, since we'll probably be asked about them soon.  You're responsible for
+ * freeing the result. */
+static struct bz_version *
+bz_native_pdb_version_installed(struct bz_native_pdb *pdb, const char *name)
+{
+    size_t  i;
+    size_t  missing_count = 0;
+    const char  **missing;
+    struct cork_hash_table_entry  *entry;
+    struct bz_version  *installed;
+    unsigned int  current;
+
+    if (pdb->version_installed_many == NULL) {
+        return pdb->version_installed(name);
+    }
+
+    current = __atomic_load_n(&installed_counter, __ATOMIC_ACQUIRE);
+    if (current != pdb->installed_stamp) {
+        cork_hash_table_clear(pdb->installed);
+        pdb->installed_stamp = current;
+    }
+
+    entry = cork_hash_table_get_entry(pdb->installed, (void *) name);
+    if (entry == NULL) {
+        int  rc;
+        missing = cork_calloc
+            (cork_array_size(&pdb->natives) + 1, sizeof(const char *));
+        bz_native_pdb_add_missing
+            (pdb->installed, name, missing, &missing_count);
+        for (i = 0; i < cork_array_size(&pdb->natives); i++) {
+            const char  *native = cork_array_at(&pdb->natives, i);
+            bz_native_pdb_add_missing
+                (pdb->installed, native, missing, &missing_count);
+        }
+        rc = bz_native_pdb_query_many
+            (pdb->version_installed_many, pdb->installed,
+             missing_count, missing);
+        free(missing);
+        if (CORK_UNLIKELY(rc != 0)) {
+            return NULL;
+        }
+        entry = cork_hash_table_get_entry(pdb->installed, (void *) name);
+    }
+
+    if (entry == NULL) {
+        rpe_check(installed = pdb->version_installed(name));
+        cork_hash_table_put
+            (pdb->installed, (void *) cork_strdup(name), installed,
+             NULL, NULL, NULL);
+    } else {
+        installed = entry->value;
+    }
+    return (installed == NULL)? NULL: bz_version_copy(installed);
+}
+
+
+static void
+bz_native_pdb_installed_changed(struct bz_native_pdb *pdb)
+{
+    cork_hash_table_clear(pdb->installed);
+}
+
+static void
+bz_native_pdb_add_native(struct bz_native_pdb *pdb, const char *name)
+{
+    size_t  i;
+    for (i = 0; i < cork_array_size(&pdb->natives); i++) {
+        if (strcmp(cork_array_at(&pdb->natives, i), name) == 0) {
+            return;
+        }
+    }
+    cork_array_append(&pdb->natives, cork_strdup(name));
+}
+
 static struct bz_package *
 bz_native_pdb_try_package(struct bz_native_pdb *pdb, const char *name,
                           struct bz_dependency *dep)
@@ -342,7 +907,7 @@ bz_native_pdb_try_package(struct bz_native_pdb *pdb, const char *name,
     struct bz_version  *available;
     clog_info("(%s) Check whether %s package %s exists",
               dep->package_name, pdb->short_distro_name, name);
-    available = pdb->version_available(name);
+    available = bz_native_pdb_version_available(pdb, name);
     if (available == NULL) {
         return NULL;
     }
@@ -357,21 +922,155 @@ bz_native_pdb_try_package(struct bz_native_pdb *pdb, const char *name,
         }
     }
 
-    return bz_native_package_new
+    bz_native_pdb_add_native(pdb, name);
+    return bz_native_package_new_in_pdb
         (pdb->short_distro_name,
-         dep->package_name, name, available,
-         pdb->version_installed, pdb->install, pdb->uninstall);
+         dep->package_name, name, bz_version_copy(available),
+         pdb->version_installed, pdb->install, pdb->uninstall, pdb);
 }
 
-static struct bz_package *
-bz_native_pdb__satisfy(void *user_data, struct bz_dependency *dep,
-                       struct bz_value *ctx)
+/* Adds the candidate native package names for dep to the candidates list, in
+ * the order that we should try them. */
+static int
+bz_native_pdb_add_candidates(struct bz_native_pdb *pdb,
+                             struct bz_dependency *dep, struct bz_value *ctx)
 {
     size_t  i;
+    const char  *name;
+
+    /* If someone has provided an explicit native package name, that's the only
+     * candidate. */
+    cork_buffer_printf(&pdb->buf, "native.%s", dep->package_name);
+    rie_check(name = bz_value_get_string(ctx, pdb->buf.buf, false));
+    if (name == NULL) {
+        cork_buffer_printf
+            (&pdb->buf, "native.%s.%s", pdb->slug, dep->package_name);
+        rie_check(name = bz_value_get_string(ctx, pdb->buf.buf, false));
+    }
+    if (name != NULL) {
+        cork_array_append(&pdb->candidates, cork_strdup(name));
+        return 0;
+    }
+
+    /* Otherwise try each of the standard patterns for this architecture. */
+    for (i = 0; i < cork_array_size(&pdb->patterns); i++) {
+        const char  *pattern = cork_array_at(&pdb->patterns, i);
+        cork_buffer_printf(&pdb->buf, pattern, dep->package_name);
+        cork_array_append(&pdb->candidates, cork_strdup(pdb->buf.buf));
+    }
+    return 0;
+}
+
+static int
+bz_native_pdb__prefetch(void *user_data, size_t count,
+                        struct bz_dependency **deps, struct bz_value *ctx)
+{
+    size_t  i;
+    struct bz_native_pdb  *pdb = user_data;
+
+    /* Gather up the candidate names for all of the dependencies (skipping any
+     * that are preinstalled), so that we can look them all up at once. */
+    bz_native_pdb_clear_candidates(pdb);
+    for (i = 0; i < count; i++) {
+        struct bz_dependency  *dep = deps[i];
+        const char  *preinstalled;
+        cork_buffer_printf
+            (&pdb->buf, "preinstalled.%s.%s", pdb->slug, dep->package_name);
+        rie_check(preinstalled =
+                  bz_value_get_string(ctx, pdb->buf.buf, false));
+        if (preinstalled == NULL) {
+            rii_check(bz_native_pdb_add_candidates(pdb, dep, ctx));
+        }
+    }
+    rii_check(bz_native_pdb_prefetch_candidates(pdb));
+    bz_native_pdb_write_saved(pdb);
+    return 0;
+}
+
+static int
+bz_native_pdb__install_many(void *user_data, size_t count,
+                            struct bz_package **packages)
+{
+    size_t  i;
+    size_t  needed_count = 0;
     struct bz_native_pdb  *pdb = user_data;
+    struct bz_native_packager  **needed;
+    const char  **names;
+    struct bz_version  **versions;
+    int  rc;
+
+    /* Figure out which of our packages actually need to be installed. */
+    needed = cork_calloc(count, sizeof(struct bz_native_packager *));
+    for (i = 0; i < count; i++) {
+        struct bz_packager  *packager = bz_package_packager(packages[i]);
+        struct bz_native_packager  *native;
+        bool  is_needed;
+        size_t  j;
+
+        /* Skip any packages that some other pdb created. */
+        if (bz_packager_owner(packager) != pdb) {
+            continue;
+        }
+        native = bz_packager_user_data(packager);
+
+        /* Two dependencies might map to the same native package. */
+        for (j = 0; j < needed_count; j++) {
+            if (strcmp(needed[j]->native_package_name,
+                       native->native_package_name) == 0) {
+                break;
+            }
+        }
+        if (j < needed_count) {
+            continue;
+        }
+
+        ei_check(bz_native_packager__install__is_needed(native, &is_needed));
+        if (is_needed) {
+            needed[needed_count++] = native;
+        }
+    }
+
+    /* If there's only one package to install, there's nothing to gain from
+     * installing it on its own now; we'll install it later as usual. */
+    if (needed_count < 2) {
+        free(needed);
+        return 0;
+    }
+
+    names = cork_calloc(needed_count, sizeof(const char *));
+    versions = cork_calloc(needed_count, sizeof(struct bz_version *));
+    for (i = 0; i < needed_count; i++) {
+        bz_native_packager_log_install(needed[i]);
+        names[i] = needed[i]->native_package_name;
+        versions[i] = needed[i]->version;
+    }
+    rc = pdb->install_many(needed_count, names, versions);
+    bz_native_pdb_installed_changed(pdb);
+    if (rc == 0) {
+        /* Make sure that the packages' own install steps don't try to install
+         * them again.  (Any other packages that map to the same native package
+         * will see that it's now installed.) */
+        for (i = 0; i < needed_count; i++) {
+            needed[i]->installed = true;
+        }
+    }
+    free(names);
+    free(versions);
+    free(needed);
+    return rc;
+
+error:
+    free(needed);
+    return -1;
+}
+
+static struct bz_package *
+bz_native_pdb_satisfy(struct bz_native_pdb *pdb, struct bz_dependency *dep,
+                      struct bz_value *ctx)
+{
+    size_t  i;
     struct bz_package  *result;
     struct bz_version  *preinstalled_version;
-    const char  *name;
 
     /* First see if the package is preinstalled on the current platform. */
     cork_buffer_printf
@@ -383,24 +1082,16 @@ bz_native_pdb__satisfy(void *user_data, struct bz_dependency *dep,
             (pdb->short_distro_name, dep->package_name, preinstalled_version);
     }
 
-    /* Then see if someone has provided an explicit native package name. */
-    cork_buffer_printf(&pdb->buf, "native.%s", dep->package_name);
-    rpe_check(name = bz_value_get_string(ctx, pdb->buf.buf, false));
-    if (name != NULL) {
-        return bz_native_pdb_try_package(pdb, name, dep);
-    }
-
-    cork_buffer_printf(&pdb->buf, "native.%s.%s", pdb->slug, dep->package_name);
-    rpe_check(name = bz_value_get_string(ctx, pdb->buf.buf, false));
-    if (name != NULL) {
-        return bz_native_pdb_try_package(pdb, name, dep);
-    }
+    /* Otherwise look up all of the candidate names at once (if we can), and
+     * then choose the first one (in order) that's available. */
+    bz_native_pdb_clear_candidates(pdb);
+    rpi_check(bz_native_pdb_add_candidates(pdb, dep, ctx));
+    rpi_check(bz_native_pdb_prefetch_candidates(pdb));
+    rpi_check(bz_native_pdb_probe_candidates(pdb));
 
-    /* Otherwise try each of the standard patterns for this architecture. */
-    for (i = 0; i < cork_array_size(&pdb->patterns); i++) {
-        const char  *pattern = cork_array_at(&pdb->patterns, i);
-        cork_buffer_printf(&pdb->buf, pattern, dep->package_name);
-        rpe_check(result = bz_native_pdb_try_package(pdb, pdb->buf.buf, dep));
+    for (i = 0; i < cork_array_size(&pdb->candidates); i++) {
+        const char  *candidate = cork_array_at(&pdb->candidates, i);
+        rpe_check(result = bz_native_pdb_try_package(pdb, candidate, dep));
         if (result != NULL) {
             return result;
         }
@@ -408,32 +1099,471 @@ bz_native_pdb__satisfy(void *user_data, struct bz_dependency *dep,
     return NULL;
 }
 
+static struct bz_package *
+bz_native_pdb__satisfy(void *user_data, struct bz_dependency *dep,
+                       struct bz_value *ctx)
+{
+    struct bz_native_pdb  *pdb = user_data;
+    struct bz_package  *result = bz_native_pdb_satisfy(pdb, dep, ctx);
+    if (!cork_error_occurred()) {
+        bz_native_pdb_write_saved(pdb);
+    }
+    return result;
+}
+
 struct bz_pdb *
 bz_native_pdb_new(const char *short_distro_name, const char *slug,
-                  bz_native_detect_f version_available,
-                  bz_native_detect_f version_installed,
-                  bz_native_install_f install,
-                  bz_native_uninstall_f uninstall,
-                  /* const char *pattern */ ...)
-{
-    va_list  args;
-    const char  *pattern;
+                  const struct bz_native_pdb_ops *ops)
+{
+    const char * const  *pattern;
     struct bz_native_pdb  *pdb = cork_new(struct bz_native_pdb);
-    pdb->version_available = version_available;
-    pdb->version_installed = version_installed;
-    pdb->install = install;
-    pdb->uninstall = uninstall;
+    pdb->version_available = ops->version_available;
+    pdb->version_available_many = ops->version_available_many;
+    pdb->probe_available = ops->probe_available;
+    pdb->parse_available = ops->parse_available;
+    pdb->version_installed = ops->version_installed;
+    pdb->version_installed_many = ops->version_installed_many;
+    pdb->install = ops->install;
+    pdb->install_many = ops->install_many;
+    pdb->uninstall = ops->uninstall;
     pdb->short_distro_name = cork_strdup(short_distro_name);
     pdb->slug = cork_strdup(slug);
     cork_buffer_init(&pdb->buf);
     cork_array_init(&pdb->patterns);
-    va_start(args, uninstall);
-    while ((pattern = va_arg(args, const char *)) != NULL) {
-        cork_array_append(&pdb->patterns, cork_strdup(pattern));
+    cork_array_init(&pdb->candidates);
+    pdb->available = cork_string_hash_table_new(0, 0);
+    cork_hash_table_set_free_key(pdb->available, (cork_free_f) cork_strfree);
+    cork_hash_table_set_free_value
+        (pdb->available, bz_native_pdb_free_version);
+    cork_array_init(&pdb->natives);
+    pdb->installed = cork_string_hash_table_new(0, 0);
+    cork_hash_table_set_free_key(pdb->installed, (cork_free_f) cork_strfree);
+    cork_hash_table_set_free_value
+        (pdb->installed, bz_native_pdb_free_version);
+    pdb->installed_stamp =
+        __atomic_load_n(&installed_counter, __ATOMIC_ACQUIRE);
+    pdb->fingerprint = ops->fingerprint;
+    pdb->saved = NULL;
+    pdb->saved_loaded = false;
+    pdb->saved_dirty = false;
+    for (pattern = ops->patterns; *pattern != NULL; pattern++) {
+        cork_array_append(&pdb->patterns, cork_strdup(*pattern));
     }
     cork_buffer_printf(&pdb->buf, "Native %s packages", short_distro_name);
     return bz_cached_pdb_new
         (pdb->buf.buf,
          pdb, bz_native_pdb__free,
-         bz_native_pdb__satisfy);
+         bz_native_pdb__satisfy,
+         (ops->version_available_many == NULL)? NULL: bz_native_pdb__prefetch,
+         (ops->install_many == NULL)? NULL: bz_native_pdb__install_many);
+}
+
+
+/*-----------------------------------------------------------------------
+ * Native package indexes
+ */
+
+#define BZ_NATIVE_INDEX_MAGIC  "buzzy native index 1\n"
+
+struct bz_native_index {
+    const char  *cache_name;
+    bz_native_index_prefer_f  prefer;
+    /* Maps package names to version strings */
+    struct cork_hash_table  *versions;
+    /* Describes the files that the index was built from */
+    struct cork_buffer  key;
+    bool  valid;
+};
+
+struct bz_native_index *
+bz_native_index_new(const char *cache_name, bz_native_index_prefer_f prefer)
+{
+    struct bz_native_index  *index = cork_new(struct bz_native_index);
+    index->cache_name = (cache_name == NULL)? NULL: cork_strdup(cache_name);
+    index->prefer = prefer;
+    index->versions = cork_string_hash_table_new(0, 0);
+    cork_hash_table_set_free_key
+        (index->versions, (cork_free_f) cork_strfree);
+    cork_hash_table_set_free_value
+        (index->versions, (cork_free_f) cork_strfree);
+    cork_buffer_init(&index->key);
+    index->valid = false;
+    return index;
+}
+
+void
+bz_native_index_free(struct bz_native_index *index)
+{
+    if (index->cache_name != NULL) {
+        cork_strfree(index->cache_name);
+    }
+    cork_hash_table_free(index->versions);
+    cork_buffer_done(&index->key);
+    free(index);
+}
+
+void
+bz_native_index_add(struct bz_native_index *index,
+                    const char *name, size_t name_length,
+                    const char *version, size_t version_length)
+{
+    bool  is_new;
+    struct cork_hash_table_entry  *entry;
+    const char  *name_copy = cork_strndup(name, name_length);
+    const char  *version_copy = cork_strndup(version, version_length);
+
+    entry = cork_hash_table_get_or_create
+        (index->versions, (void *) name_copy, &is_new);
+    if (is_new) {
+        entry->value = (void *) version_copy;
+        return;
+    }
+
+    cork_strfree(name_copy);
+    if (index->prefer != NULL && index->prefer(version_copy, entry->value)) {
+        cork_strfree(entry->value);
+        entry->value = (void *) version_copy;
+    } else {
+        cork_strfree(version_copy);
+    }
+}
+
+const char *
+bz_native_index_get(struct bz_native_index *index, const char *name)
+{
+    return cork_hash_table_get(index->versions, name);
+}
+
+void
+bz_native_index_invalidate(struct bz_native_index *index)
+{
+    index->valid = false;
+}
+
+#define BZ_NATIVE_INDEX_COUNT  "entries "
+
+/* Parses the "entries" line of a saved index, which must lie entirely within
+ * [curr, end).  On success, *next points just past the line. */
+static bool
+bz_native_index_parse_count(const char *curr, const char *end,
+                            size_t *count, const char **next)
+{
+    size_t  prefix_size = sizeof(BZ_NATIVE_INDEX_COUNT) - 1;
+    const char  *line_end = memchr(curr, '\n', end - curr);
+    const char  *digit;
+    char  *parse_end;
+    unsigned long long  value;
+
+    if (line_end == NULL || (size_t) (line_end - curr) <= prefix_size ||
+        memcmp(curr, BZ_NATIVE_INDEX_COUNT, prefix_size) != 0) {
+        return false;
+    }
+
+    /* strtoull would happily skip over whitespace (including the newline) and
+     * a sign, so make sure the count is nothing but digits first. */
+    for (digit = curr + prefix_size; digit < line_end; digit++) {
+        if (*digit < '0' || *digit > '9') {
+            return false;
+        }
+    }
+
+    errno = 0;
+    value = strtoull(curr + prefix_size, &parse_end, 10);
+    if (errno != 0 || parse_end != line_end || value > SIZE_MAX) {
+        return false;
+    }
+
+    *count = value;
+    *next = line_end + 1;
+    return true;
+}
+
+/* The saved index consists of the key describing the files that it was built
+ * from, followed by an entry count, followed by one "name version" line per
+ * package.  Sets *loaded to false if there isn't a saved index, or if it's out
+ * of date. */
+static int
+bz_native_index_read_cache(struct bz_native_index *index, const char *path,
+                           struct cork_buffer *key, bool *loaded)
+{
+    struct bz_file_stamp  stamp;
+    const char  *buf;
+    const char  *curr;
+    const char  *end;
+    size_t  size;
+    size_t  magic_size = sizeof(BZ_NATIVE_INDEX_MAGIC) - 1;
+    size_t  expected;
+    size_t  count = 0;
+
+    *loaded = false;
+    rii_check(bz_file_stamp(path, &stamp));
+    if (!stamp.exists) {
+        return 0;
+    }
+
+    rii_check(bz_map_file(path, &buf, &size));
+    if (size < magic_size + key->size ||
+        memcmp(buf, BZ_NATIVE_INDEX_MAGIC, magic_size) != 0 ||
+        memcmp(buf + magic_size, key->buf, key->size) != 0) {
+        clog_debug("Saved index %s is out of date", path);
+        bz_unmap_file(buf, size);
+        return 0;
+    }
+
+    /* The mapping isn't NUL-terminated, so every line must be found with a
+     * bounded search before we look at its contents. */
+    curr = buf + magic_size + key->size;
+    end = buf + size;
+    if (!bz_native_index_parse_count(curr, end, &expected, &curr)) {
+        clog_debug("Saved index %s is corrupt", path);
+        bz_unmap_file(buf, size);
+        return 0;
+    }
+
+    while (curr < end && count <= expected) {
+        const char  *line_end = memchr(curr, '\n', end - curr);
+        const char  *space;
+        if (line_end == NULL) {
+            break;
+        }
+        space = memchr(curr, ' ', line_end - curr);
+        if (space == NULL || space == curr || space + 1 == line_end) {
+            break;
+        }
+        bz_native_index_add
+            (index, curr, space - curr, space + 1, line_end - space - 1);
+        count++;
+        curr = line_end + 1;
+    }
+    bz_unmap_file(buf, size);
+
+    if (count != expected || curr != end) {
+        /* The saved index was truncated or corrupt; rebuild it from scratch. */
+        clog_debug("Saved index %s is incomplete", path);
+        cork_hash_table_clear(index->versions);
+        return 0;
+    }
+
+    *loaded = true;
+    return 0;
+}
+
+static int
+bz_native_index_entry_cmp(const void *vp1, const void *vp2)
+{
+    struct cork_hash_table_entry * const  *e1 = vp1;
+    struct cork_hash_table_entry * const  *e2 = vp2;
+    return strcmp((*e1)->key, (*e2)->key);
+}
+
+static int
+bz_native_index_write_cache(struct bz_native_index *index, const char *dir,
+                            const char *path, struct cork_buffer *key)
+{
+    size_t  i;
+    size_t  count = cork_hash_table_size(index->versions);
+    struct cork_hash_table_entry  **entries;
+    struct cork_hash_table_entry  *entry;
+    struct cork_hash_table_iterator  iter;
+    struct cork_buffer  buf = CORK_BUFFER_INIT();
+
+    /* Sort the entries so that the saved index doesn't depend on the order of
+     * the hash table. */
+    entries = cork_calloc(count, sizeof(struct cork_hash_table_entry *));
+    i = 0;
+    cork_hash_table_iterator_init(index->versions, &iter);
+    while ((entry = cork_hash_table_iterator_next(&iter)) != NULL) {
+        entries[i++] = entry;
+    }
+    qsort(entries, count, sizeof(struct cork_hash_table_entry *),
+          bz_native_index_entry_cmp);
+
+    cork_buffer_set_string(&buf, BZ_NATIVE_INDEX_MAGIC);
+    cork_buffer_append_copy(&buf, key);
+    cork_buffer_append_printf(&buf, "entries %zu\n", count);
+    for (i = 0; i < count; i++) {
+        cork_buffer_append_printf
+            (&buf, "%s %s\n",
+             (const char *) entries[i]->key, (const char *) entries[i]->value);
+    }
+    free(entries);
+
+    ei_check(bz_create_directory(dir, 0750));
+    ei_check(bz_create_file(path, &buf, 0640));
+    cork_buffer_done(&buf);
+    return 0;
+
+error:
+    cork_buffer_done(&buf);
+    return -1;
+}
+
+/* Fills in dest with the path of the index's saved copy, and returns the
+ * directory that it lives in. */
+static const char *
+bz_native_index_cache_path(struct bz_native_index *index,
+                           struct cork_buffer *dest)
+{
+    struct cork_path  *work_dir;
+    rpe_check(work_dir = bz_env_get_path(bz_global_env(), "work_dir", true));
+    cork_buffer_printf
+        (dest, "%s/%s", cork_path_get(work_dir), index->cache_name);
+    return cork_path_get(work_dir);
+}
+
+int
+bz_native_index_update(struct bz_native_index *index, struct cork_buffer *key,
+                       bz_native_index_build_f build, void *user_data)
+{
+    bool  loaded = false;
+    const char  *work_dir = NULL;
+    struct cork_buffer  cache_path = CORK_BUFFER_INIT();
+
+    if (index->valid && index->key.size == key->size &&
+        memcmp(index->key.buf, key->buf, key->size) == 0) {
+        return 0;
+    }
+
+    cork_hash_table_clear(index->versions);
+    index->valid = false;
+
+    if (index->cache_name != NULL) {
+        ep_check(work_dir = bz_native_index_cache_path(index, &cache_path));
+        ei_check(bz_native_index_read_cache
+                 (index, cache_path.buf, key, &loaded));
+    }
+
+    if (!loaded && build != NULL) {
+        ei_check(build(user_data, index));
+        if (index->cache_name != NULL &&
+            bz_native_index_write_cache
+            (index, work_dir, cache_path.buf, key) != 0) {
+            clog_warning("Cannot save index %s: %s",
+                         (char *) cache_path.buf, cork_error_message());
+            cork_error_clear();
+        }
+    }
+
+    cork_buffer_copy(&index->key, key);
+    index->valid = true;
+    cork_buffer_done(&cache_path);
+    return 0;
+
+error:
+    cork_hash_table_clear(index->versions);
+    cork_buffer_done(&cache_path);
+    return -1;
+}
+
+int
+bz_native_index_save(struct bz_native_index *index)
+{
+    const char  *work_dir;
+    struct cork_buffer  cache_path = CORK_BUFFER_INIT();
+    assert(index->cache_name != NULL);
+    ep_check(work_dir = bz_native_index_cache_path(index, &cache_path));
+    ei_check(bz_native_index_write_cache
+             (index, work_dir, cache_path.buf, &index->key));
+    cork_buffer_done(&cache_path);
+    return 0;
+
+error:
+    cork_buffer_done(&cache_path);
+    return -1;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Fingerprints
+ */
+
+int
+bz_native_fingerprint_add_file(struct cork_buffer *dest, const char *path)
+{
+    struct bz_file_stamp  stamp;
+    rii_check(bz_file_stamp(path, &stamp));
+    if (stamp.exists) {
+        cork_buffer_append_printf
+            (dest, "file %s %zu %" PRId64 " %" PRId64 "\n",
+             path, stamp.size, stamp.mtime_sec, stamp.mtime_nsec);
+    }
+    return 0;
+}
+
+struct bz_native_fingerprint_walker {
+    struct cork_dir_walker  parent;
+    const char  *base_name;
+    cork_array(const char *)  paths;
+};
+
+static int
+bz_native_fingerprint__file(struct cork_dir_walker *vwalker,
+                            const char *full_path, const char *rel_path,
+                            const char *base_name)
+{
+    struct bz_native_fingerprint_walker  *walker = cork_container_of
+        (vwalker, struct bz_native_fingerprint_walker, parent);
+    if (strcmp(base_name, walker->base_name) == 0) {
+        cork_array_append(&walker->paths, cork_strdup(full_path));
+    }
+    return 0;
+}
+
+static int
+bz_native_fingerprint__directory(struct cork_dir_walker *walker,
+                                 const char *full_path, const char *rel_path,
+                                 const char *base_name)
+{
+    return 0;
+}
+
+static int
+bz_native_fingerprint_path_cmp(const void *vp1, const void *vp2)
+{
+    const char * const  *p1 = vp1;
+    const char * const  *p2 = vp2;
+    return strcmp(*p1, *p2);
+}
+
+int
+bz_native_fingerprint_add_files(struct cork_buffer *dest, const char *dir,
+                                const char *base_name)
+{
+    size_t  i;
+    struct bz_file_stamp  stamp;
+    struct bz_native_fingerprint_walker  walker;
+
+    rii_check(bz_file_stamp(dir, &stamp));
+    if (!stamp.exists) {
+        return 0;
+    }
+
+    walker.parent.enter_directory = bz_native_fingerprint__directory;
+    walker.parent.file = bz_native_fingerprint__file;
+    walker.parent.leave_directory = bz_native_fingerprint__directory;
+    walker.base_name = base_name;
+    cork_array_init(&walker.paths);
+    ei_check(bz_walk_directory(dir, &walker.parent));
+
+    /* Sort the files so that the fingerprint doesn't depend on the order that
+     * we visit them in. */
+    qsort(cork_array_elements(&walker.paths), cork_array_size(&walker.paths),
+          sizeof(const char *), bz_native_fingerprint_path_cmp);
+    for (i = 0; i < cork_array_size(&walker.paths); i++) {
+        ei_check(bz_native_fingerprint_add_file
+                 (dest, cork_array_at(&walker.paths, i)));
+    }
+
+    for (i = 0; i < cork_array_size(&walker.paths); i++) {
+        cork_strfree(cork_array_at(&walker.paths, i));
+    }
+    cork_array_done(&walker.paths);
+    return 0;
+
+error:
+    for (i = 0; i < cork_array_size(&walker.paths); i++) {
+        cork_strfree(cork_array_at(&walker.paths, i));
+    }
+    cork_array_done(&walker.paths);
+    return -1;
 }
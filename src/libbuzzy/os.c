@@ -8,10 +8,12 @@
  */
 
 #include <assert.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <stdarg.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 
 #include <clogger.h>
@@ -24,6 +26,8 @@
 #include "buzzy/error.h"
 #include "buzzy/mock.h"
 #include "buzzy/os.h"
+#include "buzzy/profile.h"
+#include "buzzy/value.h"
 
 #define CLOG_CHANNEL  "os"
 
@@ -80,7 +84,8 @@ bz_subprocess_get_output_exec(struct cork_buffer *out_buf,
 {
     int  rc;
     int  exit_code;
-    const char  *program = cork_exec_program(exec);
+    /* Running exec frees it, so we need our own copy of the program name. */
+    const char  *program = cork_strdup(cork_exec_program(exec));
     struct cork_stream_consumer  *out;
     struct cork_stream_consumer  *err;
 
@@ -88,25 +93,159 @@ bz_subprocess_get_output_exec(struct cork_buffer *out_buf,
         cork_buffer_to_stream_consumer(out_buf);
     err = (err_buf == NULL)? &drop_consumer:
         cork_buffer_to_stream_consumer(err_buf);
-    rc = bz_mocked_exec(exec, out, err, &exit_code);
+    if (CORK_UNLIKELY(bz_profiling)) {
+        struct bz_profile_command  command;
+        bz_profile_command_begin(&command, exec);
+        rc = bz_mocked_exec(exec, out, err, &exit_code);
+        bz_profile_command_end(&command);
+    } else {
+        rc = bz_mocked_exec(exec, out, err, &exit_code);
+    }
     if (out != NULL) {
         cork_stream_consumer_free(out);
     }
     if (err != NULL) {
         cork_stream_consumer_free(err);
     }
-    rii_check(rc);
+    ei_check(rc);
 
     if (successful == NULL) {
         if (CORK_UNLIKELY(exit_code != 0)) {
             bz_subprocess_error("%s failed", program);
-            return -1;
+            goto error;
         }
     } else {
         *successful = (exit_code == 0);
     }
 
+    cork_strfree(program);
+    return 0;
+
+error:
+    cork_strfree(program);
+    return -1;
+}
+
+/* Returns whether we know which subprocess is the first successful one: either
+ * one of them has succeeded and all of the ones before it have failed, or all
+ * of them have failed. */
+static bool
+bz_subprocess_first_is_known(size_t count, const bool *finished,
+                             const int *exit_codes)
+{
+    size_t  i;
+    for (i = 0; i < count; i++) {
+        if (!finished[i]) {
+            return false;
+        }
+        if (exit_codes[i] == 0) {
+            return true;
+        }
+    }
+    return true;
+}
+
+/* Runs execs[start] through execs[end-1] at the same time, aborting them as
+ * soon as we know which subprocess is the first successful one. */
+static int
+bz_real__exec_first_group(size_t count, struct cork_exec **execs,
+                          struct cork_stream_consumer **outs, int *exit_codes,
+                          bool *finished, size_t start, size_t end)
+{
+    size_t  i;
+    struct cork_subprocess  **subs;
+    struct cork_subprocess_group  *group = cork_subprocess_group_new();
+
+    subs = cork_calloc(end - start, sizeof(struct cork_subprocess *));
+    for (i = start; i < end; i++) {
+        subs[i - start] = cork_subprocess_new_exec
+            (execs[i], outs[i], &drop_consumer, &exit_codes[i]);
+        cork_subprocess_group_add(group, subs[i - start]);
+    }
+    ei_check(cork_subprocess_group_start(group));
+
+    while (!cork_subprocess_group_is_finished(group)) {
+        if (!cork_subprocess_group_drain(group)) {
+            usleep(1000);
+        }
+        for (i = start; i < end; i++) {
+            finished[i] = cork_subprocess_is_finished(subs[i - start]);
+        }
+        if (bz_subprocess_first_is_known(count, finished, exit_codes)) {
+            ei_check(cork_subprocess_group_abort(group));
+            break;
+        }
+    }
+
+    for (i = start; i < end; i++) {
+        finished[i] = cork_subprocess_is_finished(subs[i - start]);
+    }
+    cork_subprocess_group_free(group);
+    free(subs);
     return 0;
+
+error:
+    cork_subprocess_group_free(group);
+    free(subs);
+    return -1;
+}
+
+int
+bz_real__exec_first(size_t count, struct cork_exec **execs,
+                    struct cork_stream_consumer **outs, int *exit_codes,
+                    bool *finished, size_t max_running)
+{
+    size_t  i;
+    size_t  start = 0;
+    int  rc = 0;
+
+    assert(max_running > 0);
+    for (i = 0; i < count; i++) {
+        finished[i] = false;
+    }
+
+    /* We start the subprocesses in groups of max_running at a time.  We
+     * usually know the answer after the first group, in which case we never
+     * start the rest. */
+    while (rc == 0 && start < count &&
+           !bz_subprocess_first_is_known(count, finished, exit_codes)) {
+        size_t  end = (count - start > max_running)?
+            start + max_running: count;
+        rc = bz_real__exec_first_group
+            (count, execs, outs, exit_codes, finished, start, end);
+        start = end;
+    }
+
+    for (i = start; i < count; i++) {
+        cork_exec_free(execs[i]);
+    }
+    return rc;
+}
+
+int
+bz_subprocess_get_first_output(size_t count, struct cork_exec **execs,
+                               size_t max_running, struct cork_buffer *outs,
+                               bool *finished, bool *successful)
+{
+    int  rc;
+    size_t  i;
+    int  *exit_codes;
+    struct cork_stream_consumer  **out_consumers;
+
+    exit_codes = cork_calloc(count, sizeof(int));
+    out_consumers = cork_calloc(count, sizeof(struct cork_stream_consumer *));
+    for (i = 0; i < count; i++) {
+        out_consumers[i] = cork_buffer_to_stream_consumer(&outs[i]);
+    }
+    rc = bz_mocked_exec_first
+        (count, execs, out_consumers, exit_codes, finished, max_running);
+    for (i = 0; i < count; i++) {
+        cork_stream_consumer_free(out_consumers[i]);
+        successful[i] = finished[i] && (exit_codes[i] == 0);
+    }
+    free(out_consumers);
+    free(exit_codes);
+    return rc;
 }
 
 int
@@ -147,7 +286,8 @@ bz_subprocess_run_exec(bool verbose, bool *successful, struct cork_exec *exec)
 {
     int  rc;
     int  exit_code;
-    const char  *program = cork_exec_program(exec);
+    /* Running exec frees it, so we need our own copy of the program name. */
+    const char  *program = cork_strdup(cork_exec_program(exec));
     struct cork_buffer  out_buf = CORK_BUFFER_INIT();
     struct cork_buffer  err_buf = CORK_BUFFER_INIT();
     struct cork_stream_consumer  *out = NULL;
@@ -166,7 +306,7 @@ bz_subprocess_run_exec(bool verbose, bool *successful, struct cork_exec *exec)
     if (err != NULL) {
         cork_stream_consumer_free(err);
     }
-    rii_check(rc);
+    ei_check(rc);
 
     if (successful == NULL) {
         if (CORK_UNLIKELY(exit_code != 0)) {
@@ -183,11 +323,13 @@ bz_subprocess_run_exec(bool verbose, bool *successful, struct cork_exec *exec)
         *successful = (exit_code == 0);
     }
 
+    cork_strfree(program);
     cork_buffer_done(&out_buf);
     cork_buffer_done(&err_buf);
     return 0;
 
 error:
+    cork_strfree(program);
     cork_buffer_done(&out_buf);
     cork_buffer_done(&err_buf);
     return -1;
@@ -222,6 +364,88 @@ bz_subprocess_run(bool verbose, bool *successful, ...)
 }
 
 
+/*-----------------------------------------------------------------------
+ * Subprocess output values
+ */
+
+struct bz_subprocess_output {
+    /* The program name and all of its parameters */
+    struct cork_string_array  params;
+    bool  ran;
+    struct cork_buffer  out;
+    /* The error that the subprocess raised, if it failed */
+    cork_error  error_code;
+    struct cork_buffer  error;
+};
+
+static void
+bz_subprocess_output__free(void *user_data)
+{
+    struct bz_subprocess_output  *self = user_data;
+    cork_array_done(&self->params);
+    cork_buffer_done(&self->out);
+    cork_buffer_done(&self->error);
+    free(self);
+}
+
+static const char *
+bz_subprocess_output__get(void *user_data, struct bz_value *ctx)
+{
+    struct bz_subprocess_output  *self = user_data;
+
+    if (!self->ran) {
+        size_t  i;
+        struct cork_exec  *exec;
+        exec = cork_exec_new(cork_array_at(&self->params, 0));
+        for (i = 0; i < cork_array_size(&self->params); i++) {
+            cork_exec_add_param(exec, cork_array_at(&self->params, i));
+        }
+
+        self->ran = true;
+        cork_buffer_set(&self->out, "", 0);
+        if (bz_subprocess_get_output_exec(&self->out, NULL, NULL, exec) == 0) {
+            /* Chomp the trailing newline */
+            if (self->out.size > 0 &&
+                ((char *) self->out.buf)[self->out.size - 1] == '\n') {
+                cork_buffer_truncate(&self->out, self->out.size - 1);
+            }
+        } else {
+            self->error_code = cork_error_code();
+            cork_buffer_set_string(&self->error, cork_error_message());
+        }
+    }
+
+    if (CORK_UNLIKELY(self->error_code != CORK_ERROR_NONE)) {
+        cork_error_set_string(self->error_code, self->error.buf);
+        return NULL;
+    }
+    return self->out.buf;
+}
+
+struct bz_value *
+bz_subprocess_output_value_new(const char *program, ...)
+{
+    struct bz_subprocess_output  *self = cork_new(struct bz_subprocess_output);
+    va_list  args;
+    const char  *param;
+
+    cork_string_array_init(&self->params);
+    cork_string_array_append(&self->params, program);
+    va_start(args, program);
+    while ((param = va_arg(args, const char *)) != NULL) {
+        cork_string_array_append(&self->params, param);
+    }
+    va_end(args);
+
+    self->ran = false;
+    cork_buffer_init(&self->out);
+    self->error_code = CORK_ERROR_NONE;
+    cork_buffer_init(&self->error);
+    return bz_scalar_value_new
+        (self, bz_subprocess_output__free, bz_subprocess_output__get);
+}
+
+
 /*-----------------------------------------------------------------------
  * Creating files and directories
  */
@@ -417,3 +641,106 @@ bz_walk_directory(const char *path_string, struct cork_dir_walker *walker)
     clog_debug("Walk contents of %s", path_string);
     return bz_mocked_walk_directory(path_string, walker);
 }
+
+
+/*-----------------------------------------------------------------------
+ * Reading files in place
+ */
+
+/* macOS uses a different name for the nanosecond-resolution timestamps. */
+#if defined(__APPLE__)
+#define bz_stat_mtim(info)  ((info)->st_mtimespec)
+#else
+#define bz_stat_mtim(info)  ((info)->st_mtim)
+#endif
+
+int
+bz_real__file_stamp(struct cork_path *path, struct bz_file_stamp *stamp)
+{
+    struct stat  info;
+    if (stat(cork_path_get(path), &info) == -1) {
+        if (errno == ENOENT || errno == ENOTDIR) {
+            memset(stamp, 0, sizeof(struct bz_file_stamp));
+            return 0;
+        }
+        cork_system_error_set();
+        return -1;
+    }
+
+    stamp->exists = true;
+    stamp->size = info.st_size;
+    stamp->mtime_sec = bz_stat_mtim(&info).tv_sec;
+    stamp->mtime_nsec = bz_stat_mtim(&info).tv_nsec;
+    return 0;
+}
+
+int
+bz_file_stamp(const char *path_string, struct bz_file_stamp *stamp)
+{
+    int  rc;
+    struct cork_path  *path = cork_path_new(path_string);
+    clog_debug("Check modification time of %s", path_string);
+    rc = bz_mocked_file_stamp(path, stamp);
+    cork_path_free(path);
+    return rc;
+}
+
+
+int
+bz_real__map_file(struct cork_path *path, const char **buf, size_t *size)
+{
+    int  fd;
+    struct stat  info;
+    void  *mapped;
+
+    rii_check_posix(fd = open(cork_path_get(path), O_RDONLY));
+    ei_check_posix(fstat(fd, &info));
+
+    /* mmap refuses to create an empty mapping. */
+    if (info.st_size == 0) {
+        close(fd);
+        *buf = "";
+        *size = 0;
+        return 0;
+    }
+
+    mapped = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (CORK_UNLIKELY(mapped == MAP_FAILED)) {
+        cork_system_error_set();
+        goto error;
+    }
+
+    close(fd);
+    *buf = mapped;
+    *size = info.st_size;
+    return 0;
+
+error:
+    close(fd);
+    return -1;
+}
+
+int
+bz_map_file(const char *path_string, const char **buf, size_t *size)
+{
+    int  rc;
+    struct cork_path  *path = cork_path_new(path_string);
+    clog_debug("Map contents of %s", path_string);
+    rc = bz_mocked_map_file(path, buf, size);
+    cork_path_free(path);
+    return rc;
+}
+
+void
+bz_real__unmap_file(const char *buf, size_t size)
+{
+    if (size > 0) {
+        munmap((void *) buf, size);
+    }
+}
+
+void
+bz_unmap_file(const char *buf, size_t size)
+{
+    bz_mocked_unmap_file(buf, size);
+}
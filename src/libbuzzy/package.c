@@ -14,11 +14,13 @@
 #include <libcork/core.h>
 #include <libcork/ds.h>
 #include <libcork/os.h>
+#include <libcork/threads.h>
 #include <libcork/helpers/errors.h>
 
 #include "buzzy/env.h"
 #include "buzzy/error.h"
 #include "buzzy/package.h"
+#include "buzzy/session.h"
 #include "buzzy/value.h"
 #include "buzzy/version.h"
 
@@ -29,231 +31,228 @@
  * Builtin package-specific variables
  */
 
-bz_define_variables(package)
-{
-    bz_package_variable(
-        name, "name",
-        NULL,
-        "The name of the package",
-        ""
-    );
-
-    bz_package_variable(
-        native_name, "native_name",
-        bz_interpolated_value_new("${name}"),
-        "The native name of the package",
-        ""
-    );
-
-    bz_package_variable(
-        version, "version",
-        NULL,
-        "The version of the package",
-        ""
-    );
-
-    bz_package_variable(
-        package_slug, "package_slug",
-        bz_interpolated_value_new("${name}-buzzy"),
-        "A unique name for a combination of a package and its source",
-        ""
-    );
-
-    bz_package_variable(
-        package_work_dir, "package_work_dir",
-        bz_interpolated_value_new("${work_dir}/build/${package_slug}"),
-        "Location for artefacts created while building or installing a package",
-        ""
-    );
-
-    bz_package_variable(
-        license, "license",
-        bz_string_value_new("unknown"),
-        "The license that the package is released under",
-        ""
-    );
-
-    bz_package_variable(
-        dependencies, "dependencies",
-        NULL,
-        "Other packages that this package needs at runtime",
-        ""
-    );
-
-    bz_package_variable(
-        build_dependencies, "build_dependencies",
-        NULL,
-        "Other packages needed to build this package",
-        ""
-    );
-
-    bz_package_variable(
-        force, "force",
-        bz_string_value_new("false"),
-        "Whether to always rebuild and reinstall a package",
-        ""
-    );
-
-    bz_package_variable(
-        verbose, "verbose",
-        bz_string_value_new("false"),
-        "Whether to print out more information while building a package",
-        ""
-    );
-
-    /* Everything below is only needed for built packages */
-
-    bz_package_variable(
-        builder, "builder",
-        bz_builder_detector_new(),
-        "What build system is used to build the package",
-        ""
-    );
-
-    bz_package_variable(
-        packager, "packager",
-        bz_packager_detector_new(),
-        "What packager is used to create a binary package file",
-        ""
-    );
-
-    bz_package_variable(
-        relocatable, "relocatable",
-        bz_string_value_new("false"),
-        "The installation prefix for platform-agnostic files",
-        ""
-    );
-
-    bz_package_variable(
-        prefix, "prefix",
-        bz_string_value_new("/usr"),
-        "The installation prefix for platform-agnostic files",
-        ""
-    );
-
-    bz_package_variable(
-        prefix, "exec_prefix",
-        bz_interpolated_value_new("${prefix}"),
-        "The installation prefix for platform-specific files",
-        ""
-    );
-
-    bz_package_variable(
-        bin_dir, "bin_dir",
-        bz_interpolated_value_new("${exec_prefix}/bin"),
-        "The installation location for binaries",
-        ""
-    );
-
-    bz_package_variable(
-        sbin_dir, "sbin_dir",
-        bz_interpolated_value_new("${exec_prefix}/sbin"),
-        "The installation location for superuser binaries",
-        ""
-    );
-
-    bz_package_variable(
-        lib_dir, "lib_dir_name",
-        bz_interpolated_value_new("lib"),
-        "The base name of the installation location for libraries",
-        ""
-    );
-
-    bz_package_variable(
-        lib_dir, "lib_dir",
-        bz_interpolated_value_new("${exec_prefix}/${lib_dir_name}"),
-        "The installation location for libraries",
-        ""
-    );
-
-    bz_package_variable(
-        libexec_dir, "libexec_dir",
-        bz_interpolated_value_new("${exec_prefix}/lib"),
-        "The installation location for internal binaries",
-        ""
-    );
-
-    bz_package_variable(
-        share_dir, "share_dir",
-        bz_interpolated_value_new("${prefix}/share"),
-        "The installation location for data files",
-        ""
-    );
-
-    bz_package_variable(
-        doc_dir, "doc_dir",
-        bz_interpolated_value_new("${share_dir}/doc"),
-        "The installation location for documentation",
-        ""
-    );
-
-    bz_package_variable(
-        man_dir, "man_dir",
-        bz_interpolated_value_new("${share_dir}/man"),
-        "The installation location for manuals",
-        ""
-    );
-
-    bz_package_variable(
-        build_dir, "build_dir",
-        bz_interpolated_value_new("${package_work_dir}/build"),
-        "Where the package's build artefacts should be placed",
-        ""
-    );
-
-    bz_package_variable(
-        package_build_dir, "package_build_dir",
-        bz_interpolated_value_new("${package_work_dir}/pkg"),
-        "Temporary directory while building a binary package",
-        ""
-    );
-
-    bz_package_variable(
-        source_dir, "source_dir",
-        bz_interpolated_value_new("${package_work_dir}/source"),
-        "Where the package's extracted source archive should be placed",
-        ""
-    );
-
-    bz_package_variable(
-        staging_dir, "staging_dir",
-        bz_interpolated_value_new("${package_work_dir}/stage"),
-        "Where a package's staged installation should be placed",
-        ""
-    );
-
-    bz_package_variable(
-        pre_install_script, "pre_install_script",
-        NULL,
-        "A script to run before the package is installed, "
-        "relative to build_dir",
-        ""
-    );
-
-    bz_package_variable(
-        post_install_script, "post_install_script",
-        NULL,
-        "A script to run after the package is installed, "
-        "relative to build_dir",
-        ""
-    );
-
-    bz_package_variable(
-        pre_remove_script, "pre_remove_script",
-        NULL,
-        "A script to run before the package is removed, "
-        "relative to build_dir",
-        ""
-    );
-
-    bz_package_variable(
-        post_remove_script, "post_remove_script",
-        NULL,
-        "A script to run after the package is removed, "
-        "relative to build_dir",
-        ""
-    );
-}
+bz_package_variable(
+    name, "name",
+    NULL,
+    "The name of the package",
+    ""
+);
+
+bz_package_variable(
+    native_name, "native_name",
+    bz_interpolated_value_new("${name}"),
+    "The native name of the package",
+    ""
+);
+
+bz_package_variable(
+    version, "version",
+    NULL,
+    "The version of the package",
+    ""
+);
+
+bz_package_variable(
+    package_slug, "package_slug",
+    bz_interpolated_value_new("${name}-buzzy"),
+    "A unique name for a combination of a package and its source",
+    ""
+);
+
+bz_package_variable(
+    package_work_dir, "package_work_dir",
+    bz_interpolated_value_new("${work_dir}/build/${package_slug}"),
+    "Location for artefacts created while building or installing a package",
+    ""
+);
+
+bz_package_variable(
+    license, "license",
+    bz_string_value_new("unknown"),
+    "The license that the package is released under",
+    ""
+);
+
+bz_package_variable(
+    dependencies, "dependencies",
+    NULL,
+    "Other packages that this package needs at runtime",
+    ""
+);
+
+bz_package_variable(
+    build_dependencies, "build_dependencies",
+    NULL,
+    "Other packages needed to build this package",
+    ""
+);
+
+bz_package_variable(
+    force, "force",
+    bz_string_value_new("false"),
+    "Whether to always rebuild and reinstall a package",
+    ""
+);
+
+bz_package_variable(
+    verbose, "verbose",
+    bz_string_value_new("false"),
+    "Whether to print out more information while building a package",
+    ""
+);
+
+/* Everything below is only needed for built packages */
+
+bz_package_variable(
+    builder, "builder",
+    bz_builder_detector_new(),
+    "What build system is used to build the package",
+    ""
+);
+
+bz_package_variable(
+    packager, "packager",
+    bz_packager_detector_new(),
+    "What packager is used to create a binary package file",
+    ""
+);
+
+bz_package_variable(
+    relocatable, "relocatable",
+    bz_string_value_new("false"),
+    "The installation prefix for platform-agnostic files",
+    ""
+);
+
+bz_package_variable(
+    prefix, "prefix",
+    bz_string_value_new("/usr"),
+    "The installation prefix for platform-agnostic files",
+    ""
+);
+
+bz_package_variable(
+    exec_prefix, "exec_prefix",
+    bz_interpolated_value_new("${prefix}"),
+    "The installation prefix for platform-specific files",
+    ""
+);
+
+bz_package_variable(
+    bin_dir, "bin_dir",
+    bz_interpolated_value_new("${exec_prefix}/bin"),
+    "The installation location for binaries",
+    ""
+);
+
+bz_package_variable(
+    sbin_dir, "sbin_dir",
+    bz_interpolated_value_new("${exec_prefix}/sbin"),
+    "The installation location for superuser binaries",
+    ""
+);
+
+bz_package_variable(
+    lib_dir_name, "lib_dir_name",
+    bz_interpolated_value_new("lib"),
+    "The base name of the installation location for libraries",
+    ""
+);
+
+bz_package_variable(
+    lib_dir, "lib_dir",
+    bz_interpolated_value_new("${exec_prefix}/${lib_dir_name}"),
+    "The installation location for libraries",
+    ""
+);
+
+bz_package_variable(
+    libexec_dir, "libexec_dir",
+    bz_interpolated_value_new("${exec_prefix}/lib"),
+    "The installation location for internal binaries",
+    ""
+);
+
+bz_package_variable(
+    share_dir, "share_dir",
+    bz_interpolated_value_new("${prefix}/share"),
+    "The installation location for data files",
+    ""
+);
+
+bz_package_variable(
+    doc_dir, "doc_dir",
+    bz_interpolated_value_new("${share_dir}/doc"),
+    "The installation location for documentation",
+    ""
+);
+
+bz_package_variable(
+    man_dir, "man_dir",
+    bz_interpolated_value_new("${share_dir}/man"),
+    "The installation location for manuals",
+    ""
+);
+
+bz_package_variable(
+    build_dir, "build_dir",
+    bz_interpolated_value_new("${package_work_dir}/build"),
+    "Where the package's build artefacts should be placed",
+    ""
+);
+
+bz_package_variable(
+    package_build_dir, "package_build_dir",
+    bz_interpolated_value_new("${package_work_dir}/pkg"),
+    "Temporary directory while building a binary package",
+    ""
+);
+
+bz_package_variable(
+    source_dir, "source_dir",
+    bz_interpolated_value_new("${package_work_dir}/source"),
+    "Where the package's extracted source archive should be placed",
+    ""
+);
+
+bz_package_variable(
+    staging_dir, "staging_dir",
+    bz_interpolated_value_new("${package_work_dir}/stage"),
+    "Where a package's staged installation should be placed",
+    ""
+);
+
+bz_package_variable(
+    pre_install_script, "pre_install_script",
+    NULL,
+    "A script to run before the package is installed, "
+    "relative to build_dir",
+    ""
+);
+
+bz_package_variable(
+    post_install_script, "post_install_script",
+    NULL,
+    "A script to run after the package is installed, "
+    "relative to build_dir",
+    ""
+);
+
+bz_package_variable(
+    pre_remove_script, "pre_remove_script",
+    NULL,
+    "A script to run before the package is removed, "
+    "relative to build_dir",
+    ""
+);
+
+bz_package_variable(
+    post_remove_script, "post_remove_script",
+    NULL,
+    "A script to run after the package is removed, "
+    "relative to build_dir",
+    ""
+);
 
 
 /*-----------------------------------------------------------------------
@@ -262,6 +261,8 @@ bz_define_variables(package)
 
 struct bz_package_list {
     cork_array(struct bz_package *)  packages;
+    /* The dependencies that we've parsed but not yet satisfied */
+    cork_array(struct bz_dependency *)  deps;
     bool  filled;
 };
 
@@ -269,50 +270,66 @@ static void
 bz_package_list_init(struct bz_package_list *list)
 {
     cork_array_init(&list->packages);
+    cork_array_init(&list->deps);
     list->filled = false;
 }
 
+static void
+bz_package_list_clear_deps(struct bz_package_list *list)
+{
+    size_t  i;
+    for (i = 0; i < cork_array_size(&list->deps); i++) {
+        bz_dependency_free(cork_array_at(&list->deps, i));
+    }
+    cork_array_clear(&list->deps);
+}
+
 static void
 bz_package_list_done(struct bz_package_list *list)
 {
     cork_array_done(&list->packages);
+    bz_package_list_clear_deps(list);
+    cork_array_done(&list->deps);
 }
 
-struct bz_package_list_fill {
-    struct bz_package_list  *list;
-    struct bz_value  *ctx;
-};
-
 static int
-bz_package_list_fill_one(void *user_data, struct bz_value *dep_value)
-{
-    struct bz_package_list_fill  *state = user_data;
-    const char  *dep_string;
-    struct bz_package  *dep;
-    rip_check(dep_string = bz_scalar_value_get(dep_value, state->ctx));
-    rip_check(dep = bz_satisfy_dependency_string(dep_string, state->ctx));
-    cork_array_append(&state->list->packages, dep);
+bz_package_list_parse(struct bz_package_list *list, struct bz_value *ctx,
+                      const char *var_name)
+{
+    if (!list->filled) {
+        const struct bz_dependency_list  *deps;
+        size_t  i;
+        bz_package_list_clear_deps(list);
+        rie_check(deps = bz_value_get_dependencies(ctx, var_name, false));
+        if (deps != NULL) {
+            for (i = 0; i < deps->count; i++) {
+                cork_array_append
+                    (&list->deps, bz_dependency_copy(deps->deps[i]));
+            }
+        }
+    }
     return 0;
 }
 
 static int
-bz_package_list_fill(struct bz_package_list *list, struct bz_package *package,
-                     const char *var_name)
+bz_package_list_fill(struct bz_package_list *list, struct bz_value *ctx)
 {
     if (!list->filled) {
-        struct bz_env  *env = bz_package_env(package);
-        struct bz_value  *ctx = bz_env_as_value(env);
-        struct bz_value  *value;
+        size_t  i;
         list->filled = true;
-        rie_check(value = bz_map_value_get(ctx, var_name));
-        if (value != NULL) {
-            struct bz_package_list_fill  state = { list, ctx };
-            return bz_array_value_map_scalars
-                (value, &state, bz_package_list_fill_one);
+        for (i = 0; i < cork_array_size(&list->deps); i++) {
+            struct bz_dependency  *dep = cork_array_at(&list->deps, i);
+            struct bz_package  *package;
+            ep_check(package = bz_satisfy_dependency(dep, ctx));
+            cork_array_append(&list->packages, package);
         }
+        bz_package_list_clear_deps(list);
     }
-
     return 0;
+
+error:
+    bz_package_list_clear_deps(list);
+    return -1;
 }
 
 size_t
@@ -329,16 +346,72 @@ bz_package_list_get(struct bz_package_list *list, size_t index)
     return cork_array_at(&list->packages, index);
 }
 
+/* Before we install the outermost list of packages, we collect every package
+ * that installing it will (recursively) install, so that the package
+ * databases can install as many of them as possible at the same time.  (For
+ * instance, a native package database can install all of the native packages
+ * with a single transaction, instead of one transaction each.)  Each thread
+ * installs its own lists, so each thread keeps track of its own depth. */
+struct bz_install_tls {
+    unsigned int  depth;
+};
+
+cork_tls(struct bz_install_tls, bz_install_tls);
+
+static int
+bz_package_list_plan(struct bz_package_list *list,
+                     struct cork_hash_table *visited,
+                     struct bz_package_list *plan)
+{
+    size_t  i;
+    for (i = 0; i < cork_array_size(&list->packages); i++) {
+        struct bz_package  *dep = cork_array_at(&list->packages, i);
+        bool  is_new;
+        cork_hash_table_get_or_create(visited, dep, &is_new);
+        if (is_new) {
+            struct bz_package_list  *deps;
+            rip_check(deps = bz_package_deps(dep));
+            rii_check(bz_package_list_plan(deps, visited, plan));
+            cork_array_append(&plan->packages, dep);
+        }
+    }
+    return 0;
+}
+
+static int
+bz_package_list_install_many(struct bz_package_list *list)
+{
+    int  rc;
+    struct bz_package_list  plan;
+    struct cork_hash_table  *visited = cork_pointer_hash_table_new(0, 0);
+    bz_package_list_init(&plan);
+    rc = bz_package_list_plan(list, visited, &plan);
+    if (rc == 0 && cork_array_size(&plan.packages) > 0) {
+        rc = bz_install_many
+            (cork_array_size(&plan.packages),
+             cork_array_elements(&plan.packages));
+    }
+    bz_package_list_done(&plan);
+    cork_hash_table_free(visited);
+    return rc;
+}
+
 int
 bz_package_list_install(struct bz_package_list *list)
 {
     size_t  i;
+    int  rc = 0;
+    struct bz_install_tls  *tls = bz_install_tls_get();
     assert(list->filled);
-    for (i = 0; i < cork_array_size(&list->packages); i++) {
+    if (tls->depth++ == 0) {
+        rc = bz_package_list_install_many(list);
+    }
+    for (i = 0; rc == 0 && i < cork_array_size(&list->packages); i++) {
         struct bz_package  *dep = cork_array_at(&list->packages, i);
-        rii_check(bz_package_install(dep));
+        rc = bz_package_install(dep);
     }
-    return 0;
+    tls->depth--;
+    return rc;
 }
 
 
@@ -392,6 +465,12 @@ bz_package_env(struct bz_package *package)
     return package->env;
 }
 
+struct bz_packager *
+bz_package_packager(struct bz_package *package)
+{
+    return package->packager;
+}
+
 const char *
 bz_package_name(struct bz_package *package)
 {
@@ -405,16 +484,60 @@ bz_package_version(struct bz_package *package)
 }
 
 
+/* Let the package databases look up all of the package's dependencies at
+ * once, before we satisfy them one at a time. */
 static int
-bz_package_load_deps(struct bz_package *package)
+bz_package_prefetch_deps(struct bz_package *package, struct bz_value *ctx)
 {
-    rii_check(bz_package_list_fill
-              (&package->deps, package, "dependencies"));
-    rii_check(bz_package_list_fill
-              (&package->build_deps, package, "build_dependencies"));
+    int  rc;
+    size_t  i;
+    cork_array(struct bz_dependency *)  deps;
+
+    cork_array_init(&deps);
+    for (i = 0; i < cork_array_size(&package->deps.deps); i++) {
+        cork_array_append(&deps, cork_array_at(&package->deps.deps, i));
+    }
+    for (i = 0; i < cork_array_size(&package->build_deps.deps); i++) {
+        cork_array_append(&deps, cork_array_at(&package->build_deps.deps, i));
+    }
+
+    if (cork_array_size(&deps) == 0) {
+        rc = 0;
+    } else {
+        rc = bz_prefetch_dependencies
+            (cork_array_size(&deps), cork_array_elements(&deps), ctx);
+    }
+    cork_array_done(&deps);
+    return rc;
+}
+
+static int
+bz_package_load_deps_(struct bz_package *package)
+{
+    struct bz_value  *ctx = bz_env_as_value(package->env);
+    rii_check(bz_package_list_parse
+              (&package->deps, ctx, "dependencies"));
+    rii_check(bz_package_list_parse
+              (&package->build_deps, ctx, "build_dependencies"));
+    rii_check(bz_package_prefetch_deps(package, ctx));
+    rii_check(bz_package_list_fill(&package->deps, ctx));
+    rii_check(bz_package_list_fill(&package->build_deps, ctx));
     return 0;
 }
 
+/* Several threads might ask for the same package's dependencies at once, so
+ * we load them while holding the session lock. */
+static int
+bz_package_load_deps(struct bz_package *package)
+{
+    int  rc;
+    struct bz_session  *session = bz_session_current();
+    bz_session_lock(session);
+    rc = bz_package_load_deps_(package);
+    bz_session_unlock(session);
+    return rc;
+}
+
 struct bz_package_list *
 bz_package_build_deps(struct bz_package *package)
 {
@@ -482,6 +605,18 @@ bz_package_uninstall(struct bz_package *package)
     return bz_packager_uninstall(package->packager);
 }
 
+int
+bz_package_package_is_needed(struct bz_package *package, bool *is_needed)
+{
+    return bz_packager_package_is_needed(package->packager, is_needed);
+}
+
+void
+bz_package_mark_packaged(struct bz_package *package)
+{
+    bz_packager_mark_packaged(package->packager);
+}
+
 
 /*-----------------------------------------------------------------------
  * Built packages
@@ -511,6 +646,8 @@ struct bz_pdb {
     void  *user_data;
     cork_free_f  free_user_data;
     bz_pdb_satisfy_f  satisfy;
+    bz_pdb_prefetch_f  prefetch;
+    bz_pdb_install_many_f  install_many;
     struct cork_dllist_item  item;
 };
 
@@ -518,13 +655,17 @@ struct bz_pdb {
 struct bz_pdb *
 bz_pdb_new(const char *name,
            void *user_data, cork_free_f free_user_data,
-           bz_pdb_satisfy_f satisfy)
+           bz_pdb_satisfy_f satisfy,
+           bz_pdb_prefetch_f prefetch,
+           bz_pdb_install_many_f install_many)
 {
     struct bz_pdb  *pdb = cork_new(struct bz_pdb);
     pdb->name = cork_strdup(name);
     pdb->user_data = user_data;
     pdb->free_user_data = free_user_data;
     pdb->satisfy = satisfy;
+    pdb->prefetch = prefetch;
+    pdb->install_many = install_many;
     return pdb;
 }
 
@@ -547,6 +688,31 @@ bz_pdb_satisfy_dependency(struct bz_pdb *pdb, struct bz_dependency *dep,
     return pdb->satisfy(pdb->user_data, dep, ctx);
 }
 
+int
+bz_pdb_prefetch_dependencies(struct bz_pdb *pdb, size_t count,
+                             struct bz_dependency **deps,
+                             struct bz_value *ctx)
+{
+    if (pdb->prefetch == NULL || count == 0) {
+        return 0;
+    }
+    if (ctx == NULL) {
+        struct bz_env  *env = bz_global_env();
+        ctx = bz_env_as_value(env);
+    }
+    return pdb->prefetch(pdb->user_data, count, deps, ctx);
+}
+
+int
+bz_pdb_install_many(struct bz_pdb *pdb, size_t count,
+                    struct bz_package **packages)
+{
+    if (pdb->install_many == NULL || count == 0) {
+        return 0;
+    }
+    return pdb->install_many(pdb->user_data, count, packages);
+}
+
 
 /*-----------------------------------------------------------------------
  * Single-package databases
@@ -596,7 +762,7 @@ bz_single_package_pdb_new(const char *pdb_name, struct bz_package *package)
     pdb->package_version = bz_package_version(package);
     return bz_cached_pdb_new
         (pdb_name, pdb, bz_single_package_pdb__free,
-         bz_single_package_pdb__satisfy);
+         bz_single_package_pdb__satisfy, NULL, NULL);
 }
 
 
@@ -608,6 +774,8 @@ struct bz_cached_pdb {
     void  *user_data;
     cork_free_f  free_user_data;
     bz_pdb_satisfy_f  satisfy;
+    bz_pdb_prefetch_f  prefetch;
+    bz_pdb_install_many_f  install_many;
     struct cork_hash_table  *packages;
     struct cork_hash_table  *unique_packages;
 };
@@ -650,22 +818,85 @@ bz_cached_pdb__satisfy(void *user_data, struct bz_dependency *dep,
     }
 }
 
+static int
+bz_cached_pdb__prefetch(void *user_data, size_t count,
+                        struct bz_dependency **deps, struct bz_value *ctx)
+{
+    struct bz_cached_pdb  *pdb = user_data;
+    size_t  i;
+    size_t  missing_count = 0;
+    struct bz_dependency  **missing;
+    int  rc;
+
+    /* Only pass along the dependencies that aren't already cached. */
+    missing = cork_calloc(count, sizeof(struct bz_dependency *));
+    for (i = 0; i < count; i++) {
+        const char  *dep_string = bz_dependency_to_string(deps[i]);
+        if (cork_hash_table_get_entry(pdb->packages, (void *) dep_string)
+            == NULL) {
+            missing[missing_count++] = deps[i];
+        }
+    }
+
+    if (missing_count == 0) {
+        rc = 0;
+    } else {
+        rc = pdb->prefetch(pdb->user_data, missing_count, missing, ctx);
+    }
+    free(missing);
+    return rc;
+}
+
+static int
+bz_cached_pdb__install_many(void *user_data, size_t count,
+                            struct bz_package **packages)
+{
+    struct bz_cached_pdb  *pdb = user_data;
+    size_t  i;
+    size_t  ours_count = 0;
+    struct bz_package  **ours;
+    int  rc;
+
+    /* Only pass along the packages that we created. */
+    ours = cork_calloc(count, sizeof(struct bz_package *));
+    for (i = 0; i < count; i++) {
+        if (cork_hash_table_get_entry(pdb->unique_packages, packages[i])
+            != NULL) {
+            ours[ours_count++] = packages[i];
+        }
+    }
+
+    if (ours_count == 0) {
+        rc = 0;
+    } else {
+        rc = pdb->install_many(pdb->user_data, ours_count, ours);
+    }
+    free(ours);
+    return rc;
+}
+
 struct bz_pdb *
 bz_cached_pdb_new(const char *pdb_name,
                   void *user_data, cork_free_f free_user_data,
-                  bz_pdb_satisfy_f satisfy)
+                  bz_pdb_satisfy_f satisfy,
+                  bz_pdb_prefetch_f prefetch,
+                  bz_pdb_install_many_f install_many)
 {
     struct bz_cached_pdb  *pdb = cork_new(struct bz_cached_pdb);
     pdb->user_data = user_data;
     pdb->free_user_data = free_user_data;
     pdb->satisfy = satisfy;
+    pdb->prefetch = prefetch;
+    pdb->install_many = install_many;
     pdb->packages = cork_string_hash_table_new(0, 0);
     cork_hash_table_set_free_key(pdb->packages, (cork_free_f) cork_strfree);
     pdb->unique_packages = cork_pointer_hash_table_new(0, 0);
     cork_hash_table_set_free_key
         (pdb->unique_packages, (cork_free_f) bz_package_free);
     return bz_pdb_new
-        (pdb_name, pdb, bz_cached_pdb__free, bz_cached_pdb__satisfy);
+        (pdb_name, pdb, bz_cached_pdb__free, bz_cached_pdb__satisfy,
+         (prefetch == NULL)? NULL: bz_cached_pdb__prefetch,
+         (install_many == NULL)? NULL: bz_cached_pdb__install_many);
 }
 
 
@@ -673,7 +904,9 @@ bz_cached_pdb_new(const char *pdb_name,
  * Package database registry
  */
 
-static struct cork_dllist  pdbs;
+/* Each session has its own list of package databases.  We hold the session
+ * lock while we use any of them, since most package databases cache what
+ * they've already looked up. */
 
 static void
 free_pdb(struct cork_dllist_item *item, void *user_data)
@@ -683,37 +916,52 @@ free_pdb(struct cork_dllist_item *item, void *user_data)
 }
 
 static void
-free_pdbs(void)
+free_pdbs(void *user_data)
 {
-    cork_dllist_map(&pdbs, free_pdb, NULL);
+    struct cork_dllist  *pdbs = user_data;
+    cork_dllist_map(pdbs, free_pdb, NULL);
+    free(pdbs);
 }
 
-CORK_INITIALIZER(init_pdbs)
+/* The caller must hold the session lock. */
+static struct cork_dllist *
+get_pdbs(struct bz_session *session)
 {
-    cork_dllist_init(&pdbs);
-    cork_cleanup_at_exit(0, free_pdbs);
+    struct cork_dllist  *pdbs = bz_session_get_slot(session, BZ_SESSION_PDBS);
+    if (CORK_UNLIKELY(pdbs == NULL)) {
+        pdbs = cork_new(struct cork_dllist);
+        cork_dllist_init(pdbs);
+        bz_session_set_slot(session, BZ_SESSION_PDBS, pdbs, free_pdbs);
+    }
+    return pdbs;
 }
 
 void
 bz_pdb_register(struct bz_pdb *pdb)
 {
-    cork_dllist_add(&pdbs, &pdb->item);
+    struct bz_session  *session = bz_session_current();
+    bz_session_lock(session);
+    cork_dllist_add(get_pdbs(session), &pdb->item);
+    bz_session_unlock(session);
 }
 
 void
 bz_pdb_registry_clear(void)
 {
-    cork_dllist_map(&pdbs, free_pdb, NULL);
-    cork_dllist_init(&pdbs);
+    struct bz_session  *session = bz_session_current();
+    bz_session_lock(session);
+    bz_session_set_slot(session, BZ_SESSION_PDBS, NULL, NULL);
+    bz_session_unlock(session);
 }
 
-struct bz_package *
-bz_satisfy_dependency(struct bz_dependency *dep, struct bz_value *ctx)
+static struct bz_package *
+bz_satisfy_dependency_(struct cork_dllist *pdbs, struct bz_dependency *dep,
+                       struct bz_value *ctx)
 {
     struct cork_dllist_item  *curr;
     const char  *dep_string = bz_dependency_to_string(dep);
     clog_info("(%s) Satisfy dependency %s", dep->package_name, dep_string);
-    for (curr = cork_dllist_start(&pdbs); !cork_dllist_is_end(&pdbs, curr);
+    for (curr = cork_dllist_start(pdbs); !cork_dllist_is_end(pdbs, curr);
          curr = curr->next) {
         struct bz_pdb  *pdb = cork_container_of(curr, struct bz_pdb, item);
         struct bz_package  *package;
@@ -732,6 +980,85 @@ bz_satisfy_dependency(struct bz_dependency *dep, struct bz_value *ctx)
     return NULL;
 }
 
+struct bz_package *
+bz_satisfy_dependency(struct bz_dependency *dep, struct bz_value *ctx)
+{
+    struct bz_package  *package;
+    struct bz_session  *session = bz_session_current();
+    bz_session_lock(session);
+    package = bz_satisfy_dependency_(get_pdbs(session), dep, ctx);
+    bz_session_unlock(session);
+    return package;
+}
+
+int
+bz_prefetch_dependencies(size_t count, struct bz_dependency **deps,
+                         struct bz_value *ctx)
+{
+    int  rc = 0;
+    size_t  i;
+    size_t  remaining_count = count;
+    struct bz_dependency  **remaining;
+    struct cork_dllist_item  *curr;
+    struct cork_dllist  *pdbs;
+    struct bz_session  *session = bz_session_current();
+
+    /* Visit the package databases in the same order that
+     * bz_satisfy_dependency will.  A dependency that one of the databases
+     * without a prefetch method satisfies (typically a package from one of
+     * our repositories) will never reach the later databases, so we don't
+     * make them look it up.  Those databases cache what they find, so this
+     * isn't wasted work. */
+    remaining = cork_calloc(count, sizeof(struct bz_dependency *));
+    memcpy(remaining, deps, count * sizeof(struct bz_dependency *));
+    bz_session_lock(session);
+    pdbs = get_pdbs(session);
+    for (curr = cork_dllist_start(pdbs);
+         rc == 0 && remaining_count > 0 && !cork_dllist_is_end(pdbs, curr);
+         curr = curr->next) {
+        struct bz_pdb  *pdb = cork_container_of(curr, struct bz_pdb, item);
+        if (pdb->prefetch != NULL) {
+            rc = bz_pdb_prefetch_dependencies
+                (pdb, remaining_count, remaining, ctx);
+            continue;
+        }
+
+        for (i = 0; i < remaining_count; ) {
+            struct bz_package  *package;
+            package = bz_pdb_satisfy_dependency(pdb, remaining[i], ctx);
+            if (CORK_UNLIKELY(cork_error_occurred())) {
+                rc = -1;
+                break;
+            } else if (package != NULL) {
+                remaining[i] = remaining[--remaining_count];
+            } else {
+                i++;
+            }
+        }
+    }
+    bz_session_unlock(session);
+    free(remaining);
+    return rc;
+}
+
+int
+bz_install_many(size_t count, struct bz_package **packages)
+{
+    int  rc = 0;
+    struct cork_dllist_item  *curr;
+    struct cork_dllist  *pdbs;
+    struct bz_session  *session = bz_session_current();
+    bz_session_lock(session);
+    pdbs = get_pdbs(session);
+    for (curr = cork_dllist_start(pdbs);
+         rc == 0 && !cork_dllist_is_end(pdbs, curr); curr = curr->next) {
+        struct bz_pdb  *pdb = cork_container_of(curr, struct bz_pdb, item);
+        rc = bz_pdb_install_many(pdb, count, packages);
+    }
+    bz_session_unlock(session);
+    return rc;
+}
+
 int
 bz_install_dependency(struct bz_dependency *dep, struct bz_value *ctx)
 {
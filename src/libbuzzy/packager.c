@@ -16,6 +16,7 @@
 #include "buzzy/env.h"
 #include "buzzy/error.h"
 #include "buzzy/logging.h"
+#include "buzzy/native.h"
 #include "buzzy/os.h"
 #include "buzzy/package.h"
 
@@ -66,6 +67,7 @@ struct bz_packager {
     struct bz_env  *env;
     struct bz_package  *pkg;
     const char  *packager_name;
+    void  *owner;
 
     void  *user_data;
     cork_free_f  free_user_data;
@@ -95,6 +97,7 @@ bz_packager_new(struct bz_env *env, const char *packager_name,
     packager->env = env;
     packager->pkg = NULL;
     packager->packager_name = cork_strdup(packager_name);
+    packager->owner = NULL;
     packager->user_data = user_data;
     packager->free_user_data = free_user_data;
     packager->package_needed = package_needed;
@@ -123,6 +126,24 @@ bz_packager_set_package(struct bz_packager *packager, struct bz_package *pkg)
     packager->pkg = pkg;
 }
 
+void
+bz_packager_set_owner(struct bz_packager *packager, void *owner)
+{
+    packager->owner = owner;
+}
+
+void *
+bz_packager_owner(struct bz_packager *packager)
+{
+    return packager->owner;
+}
+
+void *
+bz_packager_user_data(struct bz_packager *packager)
+{
+    return packager->user_data;
+}
+
 
 int
 bz_packager_package(struct bz_packager *packager)
@@ -141,6 +162,22 @@ bz_packager_package(struct bz_packager *packager)
     return 0;
 }
 
+int
+bz_packager_package_is_needed(struct bz_packager *packager, bool *is_needed)
+{
+    if (packager->packaged) {
+        *is_needed = false;
+        return 0;
+    }
+    return packager->package_needed(packager->user_data, is_needed);
+}
+
+void
+bz_packager_mark_packaged(struct bz_packager *packager)
+{
+    packager->packaged = true;
+}
+
 int
 bz_packager_install(struct bz_packager *packager)
 {
@@ -152,8 +189,11 @@ bz_packager_install(struct bz_packager *packager)
         packager->installed = true;
         rii_check(packager->install_needed(packager->user_data, &is_needed));
         if (is_needed) {
+            int  rc;
             rii_check(bz_packager_package(packager));
-            return packager->install(packager->user_data);
+            rc = packager->install(packager->user_data);
+            bz_native_installed_changed();
+            return rc;
         }
     }
     return 0;
@@ -167,7 +207,9 @@ bz_packager_uninstall(struct bz_packager *packager)
         packager->uninstalled = true;
         rii_check(packager->uninstall_needed(packager->user_data, &is_needed));
         if (is_needed) {
-            return packager->uninstall(packager->user_data);
+            int  rc = packager->uninstall(packager->user_data);
+            bz_native_installed_changed();
+            return rc;
         }
     }
     return 0;
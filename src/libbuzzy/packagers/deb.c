@@ -108,79 +108,76 @@ bz_deb_architecture_value_new(void)
  * Builtin deb variables
  */
 
-bz_define_variables(deb)
-{
-    bz_package_variable(
-        package_file_base, "deb.package_file_base",
-        bz_interpolated_value_new("${name}_${deb.version}_${deb.arch}.deb"),
-        "The filename for any package that we create",
-        ""
-    );
-
-    bz_package_variable(
-        package_file, "deb.package_file",
-        bz_interpolated_value_new
-            ("${binary_package_dir}/${deb.package_file_base}"),
-        "The filename for any package that we create",
-        ""
-    );
-
-    bz_package_variable(
-        architecture, "deb.debian_dir",
-        bz_interpolated_value_new("${staging_dir}/DEBIAN"),
-        "The location of the DEBIAN control directory",
-        ""
-    );
-
-    bz_package_variable(
-        architecture, "deb.control_file",
-        bz_interpolated_value_new("${deb.debian_dir}/control"),
-        "The location of the Debian control file we should create",
-        ""
-    );
-
-    bz_package_variable(
-        architecture, "deb.preinst_script",
-        bz_interpolated_value_new("${deb.debian_dir}/preinst"),
-        "The location of the Debian preinst script we should create",
-        ""
-    );
-
-    bz_package_variable(
-        architecture, "deb.postinst_script",
-        bz_interpolated_value_new("${deb.debian_dir}/postinst"),
-        "The location of the Debian postinst script we should create",
-        ""
-    );
-
-    bz_package_variable(
-        architecture, "deb.prerm_script",
-        bz_interpolated_value_new("${deb.debian_dir}/prerm"),
-        "The location of the Debian prerm script we should create",
-        ""
-    );
-
-    bz_package_variable(
-        architecture, "deb.postrm_script",
-        bz_interpolated_value_new("${deb.debian_dir}/postrm"),
-        "The location of the Debian postrm script we should create",
-        ""
-    );
-
-    bz_package_variable(
-        architecture, "deb.arch",
-        bz_deb_architecture_value_new(),
-        "The architecture to build deb packages for",
-        ""
-    );
-
-    bz_package_variable(
-        version, "deb.version",
-        bz_deb_version_value_new(),
-        "The Debian equivalent of the package's version",
-        ""
-    );
-}
+bz_package_variable(
+    deb_package_file_base, "deb.package_file_base",
+    bz_interpolated_value_new("${name}_${deb.version}_${deb.arch}.deb"),
+    "The filename for any package that we create",
+    ""
+);
+
+bz_package_variable(
+    deb_package_file, "deb.package_file",
+    bz_interpolated_value_new
+        ("${binary_package_dir}/${deb.package_file_base}"),
+    "The filename for any package that we create",
+    ""
+);
+
+bz_package_variable(
+    deb_debian_dir, "deb.debian_dir",
+    bz_interpolated_value_new("${staging_dir}/DEBIAN"),
+    "The location of the DEBIAN control directory",
+    ""
+);
+
+bz_package_variable(
+    deb_control_file, "deb.control_file",
+    bz_interpolated_value_new("${deb.debian_dir}/control"),
+    "The location of the Debian control file we should create",
+    ""
+);
+
+bz_package_variable(
+    deb_preinst_script, "deb.preinst_script",
+    bz_interpolated_value_new("${deb.debian_dir}/preinst"),
+    "The location of the Debian preinst script we should create",
+    ""
+);
+
+bz_package_variable(
+    deb_postinst_script, "deb.postinst_script",
+    bz_interpolated_value_new("${deb.debian_dir}/postinst"),
+    "The location of the Debian postinst script we should create",
+    ""
+);
+
+bz_package_variable(
+    deb_prerm_script, "deb.prerm_script",
+    bz_interpolated_value_new("${deb.debian_dir}/prerm"),
+    "The location of the Debian prerm script we should create",
+    ""
+);
+
+bz_package_variable(
+    deb_postrm_script, "deb.postrm_script",
+    bz_interpolated_value_new("${deb.debian_dir}/postrm"),
+    "The location of the Debian postrm script we should create",
+    ""
+);
+
+bz_package_variable(
+    deb_arch, "deb.arch",
+    bz_deb_architecture_value_new(),
+    "The architecture to build deb packages for",
+    ""
+);
+
+bz_package_variable(
+    deb_version, "deb.version",
+    bz_deb_version_value_new(),
+    "The Debian equivalent of the package's version",
+    ""
+);
 
 
 /*-----------------------------------------------------------------------
@@ -214,38 +211,25 @@ bz_deb__package__is_needed(void *user_data, bool *is_needed)
     }
 }
 
-struct bz_deb_fill_deps {
-    struct bz_value  *ctx;
-    struct cork_buffer  dep_buf;
-    bool  first;
-};
-
 static int
-bz_deb_fill_one_dep(void *user_data, struct bz_value *dep_value)
+bz_deb_fill_one_dep(struct bz_env *env, struct cork_buffer *dep_buf,
+                    struct bz_dependency *dep)
 {
-    struct bz_deb_fill_deps  *state = user_data;
-    const char  *dep_string;
-    struct bz_dependency  *dep;
     struct bz_package  *dep_package;
     struct bz_env  *dep_env;
     const char  *dep_name;
-    rip_check(dep_string = bz_scalar_value_get(dep_value, state->ctx));
-    rip_check(dep = bz_dependency_from_string(dep_string));
-    rip_check(dep_package = bz_satisfy_dependency(dep, state->ctx));
+    rip_check(dep_package = bz_satisfy_dependency(dep, bz_env_as_value(env)));
     dep_env = bz_package_env(dep_package);
     rip_check(dep_name = bz_env_get_string(dep_env, "native_name", true));
-    if (state->first) {
-        state->first = false;
-    } else {
-        cork_buffer_append(&state->dep_buf, ", ", 2);
+    if (dep_buf->size > 0) {
+        cork_buffer_append(dep_buf, ", ", 2);
     }
-    cork_buffer_append_string(&state->dep_buf, dep_name);
+    cork_buffer_append_string(dep_buf, dep_name);
     if (dep->min_version != NULL) {
-        cork_buffer_append(&state->dep_buf, " (>= ", 5);
-        bz_version_to_deb(dep->min_version, &state->dep_buf);
-        cork_buffer_append(&state->dep_buf, ")", 1);
+        cork_buffer_append(dep_buf, " (>= ", 5);
+        bz_version_to_deb(dep->min_version, dep_buf);
+        cork_buffer_append(dep_buf, ")", 1);
     }
-    bz_dependency_free(dep);
     return 0;
 }
 
@@ -253,22 +237,20 @@ static int
 bz_deb_fill_deps(struct bz_env *env, struct cork_buffer *buf,
                  const char *control_name, const char *var_name)
 {
-    struct bz_value  *deps_value;
-    rie_check(deps_value = bz_env_get_value(env, var_name));
-    if (deps_value != NULL) {
-        int  rc;
-        struct bz_deb_fill_deps  state = {
-            bz_env_as_value(env),
-            CORK_BUFFER_INIT(),
-            true
-        };
-        rc = bz_array_value_map_scalars
-            (deps_value, &state, bz_deb_fill_one_dep);
-        if (rc == 0 && state.dep_buf.size > 0) {
+    const struct bz_dependency_list  *deps;
+    rie_check(deps = bz_env_get_dependencies(env, var_name, false));
+    if (deps != NULL) {
+        int  rc = 0;
+        size_t  i;
+        struct cork_buffer  dep_buf = CORK_BUFFER_INIT();
+        for (i = 0; rc == 0 && i < deps->count; i++) {
+            rc = bz_deb_fill_one_dep(env, &dep_buf, deps->deps[i]);
+        }
+        if (rc == 0 && dep_buf.size > 0) {
             cork_buffer_append_printf
-                (buf, "%s: %s\n", control_name, (char *) state.dep_buf.buf);
+                (buf, "%s: %s\n", control_name, (char *) dep_buf.buf);
         }
-        cork_buffer_done(&state.dep_buf);
+        cork_buffer_done(&dep_buf);
         return rc;
     }
     return 0;
@@ -474,6 +456,7 @@ bz_deb__install(void *user_data)
     rip_check(package_file = bz_env_get_path(env, "deb.package_file", true));
     clog_info("(%s) Install %s using Debian",
               package_name, cork_path_get(package_file));
+    bz_deb_native_status_invalidate();
     return bz_subprocess_run
         (false, NULL,
          "sudo", "dpkg", "-i", cork_path_get(package_file),
@@ -513,6 +496,7 @@ bz_deb__uninstall(void *user_data)
 
     rip_check(package_name = bz_env_get_string(env, "name", true));
     clog_info("(%s) Uninstall using Debian", package_name);
+    bz_deb_native_status_invalidate();
     return bz_subprocess_run
         (false, NULL,
          "sudo", "dpkg", "-r", package_name,
@@ -25,65 +25,16 @@
  * Homebrew path values
  */
 
-static void
-bz_homebrew_cellar__free(void *user_data)
-{
-    struct cork_buffer  *buf = user_data;
-    cork_buffer_free(buf);
-}
-
-static const char *
-bz_homebrew_cellar__get(void *user_data, struct bz_value *ctx)
-{
-    struct cork_buffer  *buf = user_data;
-    if (buf->size == 0) {
-        char  *value;
-        rpi_check(bz_subprocess_get_output
-                  (buf, NULL, NULL, "brew", "--cellar", NULL));
-        /* Chomp the trailing newline */
-        value = buf->buf;
-        value[--buf->size] = '\0';
-    }
-    return buf->buf;
-}
-
 static struct bz_value *
 bz_homebrew_cellar_value_new(void)
 {
-    struct cork_buffer  *buf = cork_buffer_new();
-    return bz_scalar_value_new
-        (buf, bz_homebrew_cellar__free, bz_homebrew_cellar__get);
-}
-
-
-static void
-bz_homebrew_prefix__free(void *user_data)
-{
-    struct cork_buffer  *buf = user_data;
-    cork_buffer_free(buf);
-}
-
-static const char *
-bz_homebrew_prefix__get(void *user_data, struct bz_value *ctx)
-{
-    struct cork_buffer  *buf = user_data;
-    if (buf->size == 0) {
-        char  *value;
-        rpi_check(bz_subprocess_get_output
-                  (buf, NULL, NULL, "brew", "--prefix", NULL));
-        /* Chomp the trailing newline */
-        value = buf->buf;
-        value[--buf->size] = '\0';
-    }
-    return buf->buf;
+    return bz_subprocess_output_value_new("brew", "--cellar", NULL);
 }
 
 static struct bz_value *
 bz_homebrew_prefix_value_new(void)
 {
-    struct cork_buffer  *buf = cork_buffer_new();
-    return bz_scalar_value_new
-        (buf, bz_homebrew_prefix__free, bz_homebrew_prefix__get);
+    return bz_subprocess_output_value_new("brew", "--prefix", NULL);
 }
 
 
@@ -168,35 +119,22 @@ bz_pkgconfig_construct_path(struct bz_homebrew_pkgconfig *self)
 }
 
 
-struct bz_pkgconfig_process_deps {
-    struct bz_value  *ctx;
-    struct bz_homebrew_pkgconfig  *self;
-};
-
-static int
-bz_pkgconfig_process_dep(void *user_data, struct bz_value *dep_value)
-{
-    struct bz_pkgconfig_process_deps  *state = user_data;
-    const char  *dep_string;
-    struct bz_package  *package;
-    rip_check(dep_string = bz_scalar_value_get(dep_value, state->ctx));
-    rip_check(package = bz_satisfy_dependency_string(dep_string, state->ctx));
-    return bz_pkgconfig_process_package(state->self, package);
-}
-
 static int
 bz_pkgconfig_process_deps(struct bz_homebrew_pkgconfig *self,
                           struct bz_value *ctx, const char *var_name)
 {
-    struct bz_value  *deps_value;
-    rie_check(deps_value = bz_value_get_nested(ctx, var_name));
-    if (deps_value == NULL) {
+    const struct bz_dependency_list  *deps;
+    size_t  i;
+    rie_check(deps = bz_value_get_dependencies(ctx, var_name, false));
+    if (deps == NULL) {
         return 0;
-    } else {
-        struct bz_pkgconfig_process_deps  state = { ctx, self };
-        return bz_array_value_map_scalars
-            (deps_value, &state, bz_pkgconfig_process_dep);
     }
+    for (i = 0; i < deps->count; i++) {
+        struct bz_package  *package;
+        rip_check(package = bz_satisfy_dependency(deps->deps[i], ctx));
+        rii_check(bz_pkgconfig_process_package(self, package));
+    }
+    return 0;
 }
 
 static const char *
@@ -228,43 +166,40 @@ bz_homebrew_pkgconfig_path_value_new(void)
  * Builtin homebrew variables
  */
 
-bz_define_variables(homebrew)
-{
-    bz_package_variable(
-        cellar, "homebrew.cellar",
-        bz_homebrew_cellar_value_new(),
-        "The location of the Homebrew cellar",
-        ""
-    );
-
-    bz_package_variable(
-        cellar, "homebrew.prefix",
-        bz_homebrew_prefix_value_new(),
-        "The location of the Homebrew installation prefix",
-        ""
-    );
-
-    bz_package_variable(
-        cellar, "homebrew.pkg_cellar",
-        bz_interpolated_value_new("${homebrew.cellar}/${name}"),
-        "The location of this package in the Homebrew cellar",
-        ""
-    );
-
-    bz_package_variable(
-        cellar, "homebrew.pkg_ver_cellar",
-        bz_interpolated_value_new("${homebrew.pkg_cellar}/${version}"),
-        "The location of this package in the Homebrew cellar",
-        ""
-    );
-
-    bz_package_variable(
-        cellar, "homebrew.staged_cellar",
-        bz_interpolated_value_new("${staging_dir}${prefix}"),
-        "The staged contents of the package's cellar",
-        ""
-    );
-}
+bz_package_variable(
+    homebrew_cellar, "homebrew.cellar",
+    bz_homebrew_cellar_value_new(),
+    "The location of the Homebrew cellar",
+    ""
+);
+
+bz_package_variable(
+    homebrew_prefix, "homebrew.prefix",
+    bz_homebrew_prefix_value_new(),
+    "The location of the Homebrew installation prefix",
+    ""
+);
+
+bz_package_variable(
+    homebrew_pkg_cellar, "homebrew.pkg_cellar",
+    bz_interpolated_value_new("${homebrew.cellar}/${name}"),
+    "The location of this package in the Homebrew cellar",
+    ""
+);
+
+bz_package_variable(
+    homebrew_pkg_ver_cellar, "homebrew.pkg_ver_cellar",
+    bz_interpolated_value_new("${homebrew.pkg_cellar}/${version}"),
+    "The location of this package in the Homebrew cellar",
+    ""
+);
+
+bz_package_variable(
+    homebrew_staged_cellar, "homebrew.staged_cellar",
+    bz_interpolated_value_new("${staging_dir}${prefix}"),
+    "The staged contents of the package's cellar",
+    ""
+);
 
 
 /*-----------------------------------------------------------------------
@@ -56,77 +56,74 @@ bz_pacman_version_value_new(void)
  * Builtin pacman variables
  */
 
-bz_define_variables(pacman)
-{
-    bz_package_variable(
-        package_file_base, "pacman.package_file_base",
-        bz_interpolated_value_new(
-            "${name}-${pacman.version}-${pacman.pkgrel}-"
-            "${pacman.arch}"
-            "${pacman.pkgext}"
-        ),
-        "The filename for any package that we create",
-        ""
-    );
-
-    bz_package_variable(
-        package_file, "pacman.package_file",
-        bz_interpolated_value_new
-            ("${binary_package_dir}/${pacman.package_file_base}"),
-        "The filename for any package that we create",
-        ""
-    );
-
-    bz_package_variable(
-        architecture, "pacman.pkgbuild",
-        bz_interpolated_value_new("${package_build_dir}/PKGBUILD"),
-        "The location of the PKGBUILD file we should create",
-        ""
-    );
-
-    bz_package_variable(
-        architecture, "pacman.install_base",
-        bz_interpolated_value_new("${native_name}.install"),
-        "The base name of the install script file we should create",
-        ""
-    );
-
-    bz_package_variable(
-        architecture, "pacman.install",
-        bz_interpolated_value_new
-            ("${package_build_dir}/${pacman.install_base}"),
-        "The location of the install script file we should create",
-        ""
-    );
-
-    bz_package_variable(
-        architecture, "pacman.arch",
-        bz_interpolated_value_new("${arch}"),
-        "The architecture to build pacman packages for",
-        ""
-    );
-
-    bz_package_variable(
-        pkgrel, "pacman.pkgrel",
-        bz_string_value_new("1"),
-        "The package release number to use for any packages we create",
-        ""
-    );
-
-    bz_package_variable(
-        pkgext, "pacman.pkgext",
-        bz_string_value_new(".pkg.tar.xz"),
-        "The extension for any packages we create",
-        ""
-    );
-
-    bz_package_variable(
-        version, "pacman.version",
-        bz_pacman_version_value_new(),
-        "The pacman equivalent of the package's version",
-        ""
-    );
-}
+bz_package_variable(
+    pacman_package_file_base, "pacman.package_file_base",
+    bz_interpolated_value_new(
+        "${name}-${pacman.version}-${pacman.pkgrel}-"
+        "${pacman.arch}"
+        "${pacman.pkgext}"
+    ),
+    "The filename for any package that we create",
+    ""
+);
+
+bz_package_variable(
+    pacman_package_file, "pacman.package_file",
+    bz_interpolated_value_new
+        ("${binary_package_dir}/${pacman.package_file_base}"),
+    "The filename for any package that we create",
+    ""
+);
+
+bz_package_variable(
+    pacman_pkgbuild, "pacman.pkgbuild",
+    bz_interpolated_value_new("${package_build_dir}/PKGBUILD"),
+    "The location of the PKGBUILD file we should create",
+    ""
+);
+
+bz_package_variable(
+    pacman_install_base, "pacman.install_base",
+    bz_interpolated_value_new("${native_name}.install"),
+    "The base name of the install script file we should create",
+    ""
+);
+
+bz_package_variable(
+    pacman_install, "pacman.install",
+    bz_interpolated_value_new
+        ("${package_build_dir}/${pacman.install_base}"),
+    "The location of the install script file we should create",
+    ""
+);
+
+bz_package_variable(
+    pacman_arch, "pacman.arch",
+    bz_interpolated_value_new("${arch}"),
+    "The architecture to build pacman packages for",
+    ""
+);
+
+bz_package_variable(
+    pacman_pkgrel, "pacman.pkgrel",
+    bz_string_value_new("1"),
+    "The package release number to use for any packages we create",
+    ""
+);
+
+bz_package_variable(
+    pacman_pkgext, "pacman.pkgext",
+    bz_string_value_new(".pkg.tar.xz"),
+    "The extension for any packages we create",
+    ""
+);
+
+bz_package_variable(
+    pacman_version, "pacman.version",
+    bz_pacman_version_value_new(),
+    "The pacman equivalent of the package's version",
+    ""
+);
 
 
 /*-----------------------------------------------------------------------
@@ -423,6 +420,7 @@ bz_pacman__install(void *user_data)
     rip_check(package_file = bz_env_get_path(env, "pacman.package_file", true));
     clog_info("(%s) Install %s using pacman",
               package_name, cork_path_get(package_file));
+    bz_arch_native_local_invalidate();
     return bz_subprocess_run
         (false, NULL,
          "sudo", "pacman", "-U", "--noconfirm", cork_path_get(package_file),
@@ -464,6 +462,7 @@ bz_pacman__uninstall(void *user_data)
 
     rip_check(package_name = bz_env_get_string(env, "name", true));
     clog_info("(%s) Uninstall using pacman", package_name);
+    bz_arch_native_local_invalidate();
     return bz_subprocess_run
         (false, NULL,
          "sudo", "pacman", "-R", "--noconfirm", package_name,
@@ -97,58 +97,55 @@ bz_rpm_release_value_new(void)
  * Builtin rpm variables
  */
 
-bz_define_variables(rpm)
-{
-    bz_package_variable(
-        package_file_base, "rpm.package_file_base",
-        bz_interpolated_value_new("${name}-${rpm.version}.${rpm.arch}.rpm"),
-        "The filename for any package that we create",
-        ""
-    );
-
-    bz_package_variable(
-        package_file, "rpm.package_file",
-        bz_interpolated_value_new
-            ("${binary_package_dir}/${rpm.package_file_base}"),
-        "The filename for any package that we create",
-        ""
-    );
-
-    bz_package_variable(
-        architecture, "rpm.spec_file",
-        bz_interpolated_value_new("${package_build_dir}/${name}.spec"),
-        "The location of the RPM spec file we should create",
-        ""
-    );
-
-    bz_package_variable(
-        architecture, "rpm.arch",
-        bz_interpolated_value_new("${arch}"),
-        "The architecture to build rpm packages for",
-        ""
-    );
-
-    bz_package_variable(
-        full_version, "rpm.version",
-        bz_rpm_full_version_value_new(),
-        "The RPM equivalent of the package's version",
-        ""
-    );
-
-    bz_package_variable(
-        version, "rpm.version_v",
-        bz_rpm_version_value_new(),
-        "The Version portion of the package's RPM version",
-        ""
-    );
-
-    bz_package_variable(
-        release, "rpm.version_r",
-        bz_rpm_release_value_new(),
-        "The Release portion of the package's RPM version",
-        ""
-    );
-}
+bz_package_variable(
+    rpm_package_file_base, "rpm.package_file_base",
+    bz_interpolated_value_new("${name}-${rpm.version}.${rpm.arch}.rpm"),
+    "The filename for any package that we create",
+    ""
+);
+
+bz_package_variable(
+    rpm_package_file, "rpm.package_file",
+    bz_interpolated_value_new
+        ("${binary_package_dir}/${rpm.package_file_base}"),
+    "The filename for any package that we create",
+    ""
+);
+
+bz_package_variable(
+    rpm_spec_file, "rpm.spec_file",
+    bz_interpolated_value_new("${package_build_dir}/${name}.spec"),
+    "The location of the RPM spec file we should create",
+    ""
+);
+
+bz_package_variable(
+    rpm_arch, "rpm.arch",
+    bz_interpolated_value_new("${arch}"),
+    "The architecture to build rpm packages for",
+    ""
+);
+
+bz_package_variable(
+    rpm_version, "rpm.version",
+    bz_rpm_full_version_value_new(),
+    "The RPM equivalent of the package's version",
+    ""
+);
+
+bz_package_variable(
+    rpm_version_v, "rpm.version_v",
+    bz_rpm_version_value_new(),
+    "The Version portion of the package's RPM version",
+    ""
+);
+
+bz_package_variable(
+    rpm_version_r, "rpm.version_r",
+    bz_rpm_release_value_new(),
+    "The Release portion of the package's RPM version",
+    ""
+);
 
 
 /*-----------------------------------------------------------------------
@@ -0,0 +1,635 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2015, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <libcork/core.h>
+#include <libcork/ds.h>
+#include <libcork/os.h>
+#include <libcork/threads.h>
+
+#include "buzzy/profile.h"
+
+
+/*-----------------------------------------------------------------------
+ * Results
+ */
+
+/* The number of dependency chains that we keep */
+#define BZ_PROFILE_CHAIN_COUNT  5
+
+/* The number of variables and commands that we include in a human-readable
+ * report.  (The JSON report includes all of them.) */
+#define BZ_PROFILE_REPORT_COUNT  20
+
+#define BZ_PROFILE_UNNAMED  "(unnamed)"
+
+bool  bz_profiling = false;
+
+struct bz_profile_var {
+    const char  *name;
+    size_t  evaluations;
+    size_t  renders;
+    size_t  cached_renders;
+    /* Including the time spent evaluating the variables that it refers to */
+    uint64_t  total_time;
+    uint64_t  self_time;
+};
+
+struct bz_profile_union {
+    const char  *name;
+    size_t  hits;
+    size_t  misses;
+    size_t  frozen_hits;
+};
+
+struct bz_profile_cmd {
+    const char  *description;
+    /* The variable that we were evaluating the first time we ran it */
+    const char  *variable;
+    size_t  count;
+    uint64_t  total_time;
+};
+
+struct bz_profile_chain {
+    size_t  depth;
+    const char  **names;
+};
+
+/* Profiles can be updated from several threads at once, so all of the results
+ * are protected by this lock.  (Only the frame stack is per-thread.) */
+static pthread_mutex_t  profile_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct cork_hash_table  *vars = NULL;
+static struct cork_hash_table  *unions = NULL;
+static struct cork_hash_table  *commands = NULL;
+static struct bz_profile_chain  chains[BZ_PROFILE_CHAIN_COUNT];
+static size_t  chain_count = 0;
+
+static uint64_t
+bz_profile_now(void)
+{
+    struct timespec  ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void
+bz_profile_var_free(void *vvar)
+{
+    struct bz_profile_var  *var = vvar;
+    cork_strfree(var->name);
+    free(var);
+}
+
+static void
+bz_profile_union_free(void *vunion)
+{
+    struct bz_profile_union  *un = vunion;
+    cork_strfree(un->name);
+    free(un);
+}
+
+static void
+bz_profile_cmd_free(void *vcmd)
+{
+    struct bz_profile_cmd  *cmd = vcmd;
+    cork_strfree(cmd->description);
+    cork_strfree(cmd->variable);
+    free(cmd);
+}
+
+static void
+bz_profile_chain_done(struct bz_profile_chain *chain)
+{
+    size_t  i;
+    for (i = 0; i < chain->depth; i++) {
+        cork_strfree(chain->names[i]);
+    }
+    free(chain->names);
+}
+
+static void
+bz_profile_clear(void)
+{
+    size_t  i;
+    if (vars != NULL) {
+        cork_hash_table_free(vars);
+        cork_hash_table_free(unions);
+        cork_hash_table_free(commands);
+        vars = NULL;
+        unions = NULL;
+        commands = NULL;
+    }
+    for (i = 0; i < chain_count; i++) {
+        bz_profile_chain_done(&chains[i]);
+    }
+    chain_count = 0;
+}
+
+static void
+bz_profile_done(void)
+{
+    pthread_mutex_lock(&profile_lock);
+    bz_profiling = false;
+    bz_profile_clear();
+    pthread_mutex_unlock(&profile_lock);
+}
+
+void
+bz_profile_start(void)
+{
+    static bool  registered = false;
+    pthread_mutex_lock(&profile_lock);
+    if (!registered) {
+        cork_cleanup_at_exit(0, bz_profile_done);
+        registered = true;
+    }
+    bz_profile_clear();
+    vars = cork_string_hash_table_new(0, 0);
+    cork_hash_table_set_free_value(vars, bz_profile_var_free);
+    unions = cork_string_hash_table_new(0, 0);
+    cork_hash_table_set_free_value(unions, bz_profile_union_free);
+    commands = cork_string_hash_table_new(0, 0);
+    cork_hash_table_set_free_value(commands, bz_profile_cmd_free);
+    bz_profiling = true;
+    pthread_mutex_unlock(&profile_lock);
+}
+
+void
+bz_profile_stop(void)
+{
+    bz_profiling = false;
+}
+
+/* These must be called with the lock held. */
+
+static struct bz_profile_var *
+bz_profile_get_var(const char *name)
+{
+    bool  is_new;
+    struct cork_hash_table_entry  *entry;
+    entry = cork_hash_table_get_or_create(vars, (void *) name, &is_new);
+    if (is_new) {
+        struct bz_profile_var  *var = cork_new(struct bz_profile_var);
+        var->name = cork_strdup(name);
+        var->evaluations = 0;
+        var->renders = 0;
+        var->cached_renders = 0;
+        var->total_time = 0;
+        var->self_time = 0;
+        entry->key = (void *) var->name;
+        entry->value = var;
+    }
+    return entry->value;
+}
+
+static struct bz_profile_union *
+bz_profile_get_union(const char *name)
+{
+    bool  is_new;
+    struct cork_hash_table_entry  *entry;
+    entry = cork_hash_table_get_or_create(unions, (void *) name, &is_new);
+    if (is_new) {
+        struct bz_profile_union  *un = cork_new(struct bz_profile_union);
+        un->name = cork_strdup(name);
+        un->hits = 0;
+        un->misses = 0;
+        un->frozen_hits = 0;
+        entry->key = (void *) un->name;
+        entry->value = un;
+    }
+    return entry->value;
+}
+
+static bool
+bz_profile_chain_matches(struct bz_profile_chain *chain,
+                         struct bz_profile_frame *frame)
+{
+    size_t  i;
+    if (chain->depth != frame->depth) {
+        return false;
+    }
+    for (i = chain->depth; i > 0; i--, frame = frame->parent) {
+        if (strcmp(chain->names[i - 1], frame->name) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Records the chain of variables that ends at frame, if it's one of the
+ * longest that we've seen. */
+static void
+bz_profile_add_chain(struct bz_profile_frame *frame)
+{
+    size_t  i;
+    size_t  shortest = 0;
+    struct bz_profile_chain  *chain;
+    struct bz_profile_frame  *curr;
+
+    for (i = 0; i < chain_count; i++) {
+        if (bz_profile_chain_matches(&chains[i], frame)) {
+            return;
+        }
+        if (chains[i].depth < chains[shortest].depth) {
+            shortest = i;
+        }
+    }
+
+    if (chain_count < BZ_PROFILE_CHAIN_COUNT) {
+        chain = &chains[chain_count++];
+    } else if (chains[shortest].depth < frame->depth) {
+        chain = &chains[shortest];
+        bz_profile_chain_done(chain);
+    } else {
+        return;
+    }
+
+    chain->depth = frame->depth;
+    chain->names = cork_calloc(frame->depth, sizeof(const char *));
+    for (i = frame->depth, curr = frame; i > 0; i--, curr = curr->parent) {
+        chain->names[i - 1] = cork_strdup(curr->name);
+    }
+}
+
+
+/*-----------------------------------------------------------------------
+ * Hooks
+ */
+
+struct bz_profile_tls {
+    struct bz_profile_frame  *top;
+};
+
+cork_tls(struct bz_profile_tls, bz_profile_tls);
+
+void
+bz_profile_eval_begin(struct bz_profile_frame *frame, const char *name)
+{
+    struct bz_profile_tls  *tls = bz_profile_tls_get();
+    frame->parent = tls->top;
+    frame->name = name;
+    frame->depth = (tls->top == NULL)? 1: tls->top->depth + 1;
+    frame->child_time = 0;
+    frame->has_children = false;
+    if (tls->top != NULL) {
+        tls->top->has_children = true;
+    }
+    tls->top = frame;
+    frame->start = bz_profile_now();
+}
+
+void
+bz_profile_eval_end(struct bz_profile_frame *frame)
+{
+    struct bz_profile_tls  *tls = bz_profile_tls_get();
+    struct bz_profile_var  *var;
+    uint64_t  elapsed = bz_profile_now() - frame->start;
+
+    tls->top = frame->parent;
+    if (frame->parent != NULL) {
+        frame->parent->child_time += elapsed;
+    }
+
+    pthread_mutex_lock(&profile_lock);
+    if (vars != NULL) {
+        var = bz_profile_get_var(frame->name);
+        var->evaluations++;
+        var->total_time += elapsed;
+        var->self_time += elapsed - frame->child_time;
+        if (!frame->has_children) {
+            bz_profile_add_chain(frame);
+        }
+    }
+    pthread_mutex_unlock(&profile_lock);
+}
+
+void
+bz_profile_render(bool cached)
+{
+    struct bz_profile_tls  *tls = bz_profile_tls_get();
+    struct bz_profile_var  *var;
+    const char  *name =
+        (tls->top == NULL)? BZ_PROFILE_UNNAMED: tls->top->name;
+
+    pthread_mutex_lock(&profile_lock);
+    if (vars != NULL) {
+        var = bz_profile_get_var(name);
+        if (cached) {
+            var->cached_renders++;
+        } else {
+            var->renders++;
+        }
+    }
+    pthread_mutex_unlock(&profile_lock);
+}
+
+void
+bz_profile_union_lookup(const char *union_name, enum bz_profile_lookup kind)
+{
+    struct bz_profile_union  *un;
+    pthread_mutex_lock(&profile_lock);
+    if (unions != NULL) {
+        un = bz_profile_get_union
+            ((union_name == NULL)? BZ_PROFILE_UNNAMED: union_name);
+        switch (kind) {
+            case BZ_PROFILE_CACHE_HIT:
+                un->hits++;
+                break;
+            case BZ_PROFILE_CACHE_MISS:
+                un->misses++;
+                break;
+            case BZ_PROFILE_FROZEN_HIT:
+                un->frozen_hits++;
+                break;
+            default:
+                cork_unreachable();
+        }
+    }
+    pthread_mutex_unlock(&profile_lock);
+}
+
+void
+bz_profile_command_begin(struct bz_profile_command *command,
+                         struct cork_exec *exec)
+{
+    cork_buffer_init(&command->description);
+    cork_buffer_set_string(&command->description, cork_exec_description(exec));
+    command->start = bz_profile_now();
+}
+
+void
+bz_profile_command_end(struct bz_profile_command *command)
+{
+    struct bz_profile_tls  *tls = bz_profile_tls_get();
+    uint64_t  elapsed = bz_profile_now() - command->start;
+    const char  *variable =
+        (tls->top == NULL)? BZ_PROFILE_UNNAMED: tls->top->name;
+    bool  is_new;
+    struct cork_hash_table_entry  *entry;
+
+    pthread_mutex_lock(&profile_lock);
+    if (commands != NULL) {
+        struct bz_profile_cmd  *cmd;
+        entry = cork_hash_table_get_or_create
+            (commands, command->description.buf, &is_new);
+        if (is_new) {
+            cmd = cork_new(struct bz_profile_cmd);
+            cmd->description = cork_strdup(command->description.buf);
+            cmd->variable = cork_strdup(variable);
+            cmd->count = 0;
+            cmd->total_time = 0;
+            entry->key = (void *) cmd->description;
+            entry->value = cmd;
+        }
+        cmd = entry->value;
+        cmd->count++;
+        cmd->total_time += elapsed;
+    }
+    pthread_mutex_unlock(&profile_lock);
+    cork_buffer_done(&command->description);
+}
+
+
+/*-----------------------------------------------------------------------
+ * Reports
+ */
+
+/* Copies the values of a hash table into a newly allocated array, so that we
+ * can sort them. */
+static void **
+bz_profile_values(struct cork_hash_table *table, size_t *count)
+{
+    struct cork_hash_table_iterator  iter;
+    struct cork_hash_table_entry  *entry;
+    void  **result;
+    size_t  i = 0;
+    *count = cork_hash_table_size(table);
+    result = cork_calloc(*count + 1, sizeof(void *));
+    cork_hash_table_iterator_init(table, &iter);
+    while ((entry = cork_hash_table_iterator_next(&iter)) != NULL) {
+        result[i++] = entry->value;
+    }
+    return result;
+}
+
+static int
+bz_profile_var_cmp(const void *va, const void *vb)
+{
+    const struct bz_profile_var  *a = *(void * const *) va;
+    const struct bz_profile_var  *b = *(void * const *) vb;
+    if (a->total_time != b->total_time) {
+        return (a->total_time > b->total_time)? -1: 1;
+    }
+    return strcmp(a->name, b->name);
+}
+
+static int
+bz_profile_union_cmp(const void *va, const void *vb)
+{
+    const struct bz_profile_union  *a = *(void * const *) va;
+    const struct bz_profile_union  *b = *(void * const *) vb;
+    return strcmp(a->name, b->name);
+}
+
+static int
+bz_profile_cmd_cmp(const void *va, const void *vb)
+{
+    const struct bz_profile_cmd  *a = *(void * const *) va;
+    const struct bz_profile_cmd  *b = *(void * const *) vb;
+    if (a->total_time != b->total_time) {
+        return (a->total_time > b->total_time)? -1: 1;
+    }
+    return strcmp(a->description, b->description);
+}
+
+static int
+bz_profile_chain_cmp(const void *va, const void *vb)
+{
+    const struct bz_profile_chain  *a = va;
+    const struct bz_profile_chain  *b = vb;
+    if (a->depth != b->depth) {
+        return (a->depth > b->depth)? -1: 1;
+    }
+    return 0;
+}
+
+static double
+ms(uint64_t ns)
+{
+    return ns / 1000000.0;
+}
+
+void
+bz_profile_report(struct cork_buffer *dest)
+{
+    size_t  i;
+    size_t  j;
+    size_t  count;
+    void  **values;
+
+    pthread_mutex_lock(&profile_lock);
+    if (vars == NULL) {
+        pthread_mutex_unlock(&profile_lock);
+        return;
+    }
+
+    values = bz_profile_values(vars, &count);
+    qsort(values, count, sizeof(void *), bz_profile_var_cmp);
+    cork_buffer_append_printf
+        (dest, "Variables (%zu evaluated):\n"
+         "  %-32s %8s %8s %8s %10s %10s\n", count,
+         "name", "evals", "renders", "cached", "total ms", "self ms");
+    for (i = 0; i < count && i < BZ_PROFILE_REPORT_COUNT; i++) {
+        struct bz_profile_var  *var = values[i];
+        cork_buffer_append_printf
+            (dest, "  %-32s %8zu %8zu %8zu %10.3f %10.3f\n",
+             var->name, var->evaluations, var->renders, var->cached_renders,
+             ms(var->total_time), ms(var->self_time));
+    }
+    free(values);
+
+    values = bz_profile_values(unions, &count);
+    qsort(values, count, sizeof(void *), bz_profile_union_cmp);
+    cork_buffer_append_printf
+        (dest, "\nEnvironment lookups:\n"
+         "  %-32s %8s %8s %8s\n", "environment", "hits", "misses", "frozen");
+    for (i = 0; i < count; i++) {
+        struct bz_profile_union  *un = values[i];
+        cork_buffer_append_printf
+            (dest, "  %-32s %8zu %8zu %8zu\n",
+             un->name, un->hits, un->misses, un->frozen_hits);
+    }
+    free(values);
+
+    values = bz_profile_values(commands, &count);
+    qsort(values, count, sizeof(void *), bz_profile_cmd_cmp);
+    cork_buffer_append_printf
+        (dest, "\nCommands:\n"
+         "  %10s %6s  %s\n", "total ms", "runs", "command (variable)");
+    for (i = 0; i < count && i < BZ_PROFILE_REPORT_COUNT; i++) {
+        struct bz_profile_cmd  *cmd = values[i];
+        cork_buffer_append_printf
+            (dest, "  %10.3f %6zu  %s (%s)\n",
+             ms(cmd->total_time), cmd->count, cmd->description, cmd->variable);
+    }
+    free(values);
+
+    qsort(chains, chain_count, sizeof(struct bz_profile_chain),
+          bz_profile_chain_cmp);
+    cork_buffer_append_printf(dest, "\nLongest dependency chains:\n");
+    for (i = 0; i < chain_count; i++) {
+        cork_buffer_append_printf(dest, "  %zu:", chains[i].depth);
+        for (j = 0; j < chains[i].depth; j++) {
+            cork_buffer_append_printf
+                (dest, "%s%s", (j == 0)? " ": " -> ", chains[i].names[j]);
+        }
+        cork_buffer_append(dest, "\n", 1);
+    }
+    pthread_mutex_unlock(&profile_lock);
+}
+
+static void
+json_append_string(struct cork_buffer *dest, const char *str)
+{
+    cork_buffer_append(dest, "\"", 1);
+    for (; *str != '\0'; str++) {
+        unsigned char  ch = *str;
+        if (ch == '"' || ch == '\\') {
+            cork_buffer_append_printf(dest, "\\%c", ch);
+        } else if (ch < 0x20) {
+            cork_buffer_append_printf(dest, "\\u%04x", ch);
+        } else {
+            cork_buffer_append(dest, str, 1);
+        }
+    }
+    cork_buffer_append(dest, "\"", 1);
+}
+
+void
+bz_profile_report_json(struct cork_buffer *dest)
+{
+    size_t  i;
+    size_t  j;
+    size_t  count;
+    void  **values;
+
+    pthread_mutex_lock(&profile_lock);
+    if (vars == NULL) {
+        pthread_mutex_unlock(&profile_lock);
+        cork_buffer_append_string(dest, "{}\n");
+        return;
+    }
+
+    values = bz_profile_values(vars, &count);
+    qsort(values, count, sizeof(void *), bz_profile_var_cmp);
+    cork_buffer_append_string(dest, "{\n  \"variables\": [");
+    for (i = 0; i < count; i++) {
+        struct bz_profile_var  *var = values[i];
+        cork_buffer_append_string(dest, (i == 0)? "\n    {": ",\n    {");
+        cork_buffer_append_string(dest, "\"name\": ");
+        json_append_string(dest, var->name);
+        cork_buffer_append_printf
+            (dest, ", \"evaluations\": %zu, \"renders\": %zu, "
+             "\"cached_renders\": %zu, \"total_ms\": %.3f, "
+             "\"self_ms\": %.3f}",
+             var->evaluations, var->renders, var->cached_renders,
+             ms(var->total_time), ms(var->self_time));
+    }
+    free(values);
+
+    values = bz_profile_values(unions, &count);
+    qsort(values, count, sizeof(void *), bz_profile_union_cmp);
+    cork_buffer_append_string(dest, "\n  ],\n  \"environments\": [");
+    for (i = 0; i < count; i++) {
+        struct bz_profile_union  *un = values[i];
+        cork_buffer_append_string(dest, (i == 0)? "\n    {": ",\n    {");
+        cork_buffer_append_string(dest, "\"name\": ");
+        json_append_string(dest, un->name);
+        cork_buffer_append_printf
+            (dest, ", \"hits\": %zu, \"misses\": %zu, \"frozen_hits\": %zu}",
+             un->hits, un->misses, un->frozen_hits);
+    }
+    free(values);
+
+    values = bz_profile_values(commands, &count);
+    qsort(values, count, sizeof(void *), bz_profile_cmd_cmp);
+    cork_buffer_append_string(dest, "\n  ],\n  \"commands\": [");
+    for (i = 0; i < count; i++) {
+        struct bz_profile_cmd  *cmd = values[i];
+        cork_buffer_append_string(dest, (i == 0)? "\n    {": ",\n    {");
+        cork_buffer_append_string(dest, "\"command\": ");
+        json_append_string(dest, cmd->description);
+        cork_buffer_append_string(dest, ", \"variable\": ");
+        json_append_string(dest, cmd->variable);
+        cork_buffer_append_printf
+            (dest, ", \"runs\": %zu, \"total_ms\": %.3f}",
+             cmd->count, ms(cmd->total_time));
+    }
+    free(values);
+
+    qsort(chains, chain_count, sizeof(struct bz_profile_chain),
+          bz_profile_chain_cmp);
+    cork_buffer_append_string(dest, "\n  ],\n  \"chains\": [");
+    for (i = 0; i < chain_count; i++) {
+        cork_buffer_append_string(dest, (i == 0)? "\n    [": ",\n    [");
+        for (j = 0; j < chains[i].depth; j++) {
+            if (j > 0) {
+                cork_buffer_append_string(dest, ", ");
+            }
+            json_append_string(dest, chains[i].names[j]);
+        }
+        cork_buffer_append_string(dest, "]");
+    }
+    cork_buffer_append_string(dest, "\n  ]\n}\n");
+    pthread_mutex_unlock(&profile_lock);
+}
@@ -7,13 +7,22 @@
  * ----------------------------------------------------------------------
  */
 
+#include <assert.h>
+#include <stdio.h>
+#include <unistd.h>
+
 #include <clogger.h>
 #include <libcork/core.h>
 #include <libcork/ds.h>
+#include <libcork/os.h>
 #include <libcork/helpers/errors.h>
 
+#include "buzzy/arena.h"
 #include "buzzy/env.h"
+#include "buzzy/error.h"
+#include "buzzy/logging.h"
 #include "buzzy/repo.h"
+#include "buzzy/session.h"
 
 #define CLOG_CHANNEL  "repo"
 
@@ -22,57 +31,54 @@
  * Repository variables
  */
 
-bz_define_variables(repo)
-{
-    bz_global_variable(
-        repo_dir, "repo_dir",
-        bz_interpolated_value_new("${work_dir}/repos"),
-        "Where cloned copied of remote repositories should be placed",
-        ""
-    );
-
-    bz_repo_variable(
-        repo_base_dir, "repo.base_dir",
-        NULL,
-        "The base path of the files defining the repository",
-        ""
-    );
-
-    bz_repo_variable(
-        repo_config_dir, "repo.config_dir",
-        bz_interpolated_value_new("${repo.base_dir}/.buzzy"),
-        "The base path of the files defining the repository",
-        ""
-    );
-
-    bz_repo_variable(
-        repo_yaml, "repo.repo_yaml",
-        bz_interpolated_value_new("${repo.config_dir}/repo.yaml"),
-        "The location of the YAML file defining the repository",
-        ""
-    );
-
-    bz_repo_variable(
-        repo_links_path, "repo.links_yaml",
-        bz_interpolated_value_new("${repo.config_dir}/links.yaml"),
-        "The location of the YAML file defining linked repositories",
-        ""
-    );
-
-    bz_repo_variable(
-        repo_package_yaml, "repo.package_yaml",
-        bz_interpolated_value_new("${repo.config_dir}/package.yaml"),
-        "The location of the YAML file defining the repository's package",
-        ""
-    );
-
-    bz_repo_variable(
-        repo_git_dir, "repo.git_dir",
-        bz_interpolated_value_new("${repo.base_dir}/.git"),
-        "The location of the .git directory in a git checkout",
-        ""
-    );
-}
+bz_global_variable(
+    repo_dir, "repo_dir",
+    bz_interpolated_value_new("${work_dir}/repos"),
+    "Where cloned copied of remote repositories should be placed",
+    ""
+);
+
+bz_repo_variable(
+    repo_base_dir, "repo.base_dir",
+    NULL,
+    "The base path of the files defining the repository",
+    ""
+);
+
+bz_repo_variable(
+    repo_config_dir, "repo.config_dir",
+    bz_interpolated_value_new("${repo.base_dir}/.buzzy"),
+    "The base path of the files defining the repository",
+    ""
+);
+
+bz_repo_variable(
+    repo_repo_yaml, "repo.repo_yaml",
+    bz_interpolated_value_new("${repo.config_dir}/repo.yaml"),
+    "The location of the YAML file defining the repository",
+    ""
+);
+
+bz_repo_variable(
+    repo_links_yaml, "repo.links_yaml",
+    bz_interpolated_value_new("${repo.config_dir}/links.yaml"),
+    "The location of the YAML file defining linked repositories",
+    ""
+);
+
+bz_repo_variable(
+    repo_package_yaml, "repo.package_yaml",
+    bz_interpolated_value_new("${repo.config_dir}/package.yaml"),
+    "The location of the YAML file defining the repository's package",
+    ""
+);
+
+bz_repo_variable(
+    repo_git_dir, "repo.git_dir",
+    bz_interpolated_value_new("${repo.base_dir}/.git"),
+    "The location of the .git directory in a git checkout",
+    ""
+);
 
 
 /*-----------------------------------------------------------------------
@@ -87,6 +93,7 @@ struct bz_repo {
 
     void  *user_data;
     cork_free_f  free_user_data;
+    bz_repo_fetch_f  fetch;
     bz_repo_load_f  load;
     bz_repo_update_f  update;
     bool  loaded;
@@ -96,6 +103,7 @@ struct bz_repo {
 struct bz_repo *
 bz_repo_new(struct bz_env *env,
             void *user_data, cork_free_f free_user_data,
+            bz_repo_fetch_f fetch,
             bz_repo_load_f load,
             bz_repo_update_f update)
 {
@@ -106,6 +114,7 @@ bz_repo_new(struct bz_env *env,
     cork_array_init(&repo->links);
     repo->user_data = user_data;
     repo->free_user_data = free_user_data;
+    repo->fetch = fetch;
     repo->load = load;
     repo->update = update;
     repo->loaded = false;
@@ -153,10 +162,13 @@ void
 bz_repo_add_link(struct bz_repo *repo, struct bz_repo *other)
 {
     struct bz_value  *other_value;
+    struct bz_arena  *saved;
     cork_array_append(&repo->links, other);
     /* Each child repository should be able to see any variables defined in its
      * parent repositories. */
+    saved = bz_arena_set_current(bz_env_arena(repo->env));
     other_value = bz_value_copy(bz_env_as_value(other->env));
+    bz_arena_set_current(saved);
     bz_env_add_backup_set(repo->env, other_value);
 }
 
@@ -200,85 +212,311 @@ bz_repo_set_default_package(struct bz_repo *repo, struct bz_package *package)
  * Repository registry
  */
 
-static bool  first_initialization = true;
-static bool  repos_initialized = false;
-static cork_array(struct bz_repo *)  repos;
+/* Each session has its own list of repositories. */
+
+struct bz_repo_registry {
+    cork_array(struct bz_repo *)  repos;
+};
 
 static void
-repos_free(void)
+repos_free(void *user_data)
 {
-    if (repos_initialized) {
-        size_t  i;
-        for (i = 0; i < cork_array_size(&repos); i++) {
-            struct bz_repo  *repo = cork_array_at(&repos, i);
-            bz_repo_free(repo);
-        }
-        cork_array_done(&repos);
-        repos_initialized = false;
+    struct bz_repo_registry  *registry = user_data;
+    size_t  i;
+    for (i = 0; i < cork_array_size(&registry->repos); i++) {
+        struct bz_repo  *repo = cork_array_at(&registry->repos, i);
+        bz_repo_free(repo);
     }
+    cork_array_done(&registry->repos);
+    free(registry);
 }
 
 static void
-repos_init(void)
+repos_init(struct bz_session *session)
 {
-    if (!repos_initialized) {
-        cork_array_init(&repos);
-        if (first_initialization) {
-            cork_cleanup_at_exit(0, repos_free);
-            first_initialization = false;
-        }
-        repos_initialized = true;
+    struct bz_repo_registry  *registry = cork_new(struct bz_repo_registry);
+    cork_array_init(&registry->repos);
+    bz_session_set_slot(session, BZ_SESSION_REPOS, registry, repos_free);
+}
+
+/* The caller must hold the session lock. */
+static struct bz_repo_registry *
+get_repos(struct bz_session *session)
+{
+    if (CORK_UNLIKELY
+        (bz_session_get_slot(session, BZ_SESSION_REPOS) == NULL)) {
+        repos_init(session);
     }
+    return bz_session_get_slot(session, BZ_SESSION_REPOS);
 }
 
 void
 bz_repo_registry_reset(void)
 {
-    repos_free();
-    repos_init();
+    struct bz_session  *session = bz_session_current();
+    bz_session_lock(session);
+    repos_init(session);
+    bz_session_unlock(session);
 }
 
 void
 bz_repo_register(struct bz_repo *repo)
 {
-    repos_init();
-    cork_array_append(&repos, repo);
+    struct bz_session  *session = bz_session_current();
+    bz_session_lock(session);
+    cork_array_append(&get_repos(session)->repos, repo);
+    bz_session_unlock(session);
 }
 
 size_t
 bz_repo_registry_count(void)
 {
-    repos_init();
-    return cork_array_size(&repos);
+    size_t  count;
+    struct bz_session  *session = bz_session_current();
+    bz_session_lock(session);
+    count = cork_array_size(&get_repos(session)->repos);
+    bz_session_unlock(session);
+    return count;
 }
 
 struct bz_repo *
 bz_repo_registry_get(size_t index)
 {
-    repos_init();
-    return cork_array_at(&repos, index);
+    struct bz_repo  *repo;
+    struct bz_session  *session = bz_session_current();
+    bz_session_lock(session);
+    repo = cork_array_at(&get_repos(session)->repos, index);
+    bz_session_unlock(session);
+    return repo;
 }
 
-int
-bz_repo_registry_load_all(void)
+/* Returns a copy of the registered repositories, starting with the one at
+ * `start`.  We can't hold the session lock while we're running any child
+ * processes, since a child can never acquire a lock that we held when we
+ * forked it. */
+static struct bz_repo **
+bz_repo_registry_copy(size_t start, size_t *count)
+{
+    size_t  i;
+    struct bz_repo  **repos;
+    struct bz_repo_registry  *registry;
+    struct bz_session  *session = bz_session_current();
+    bz_session_lock(session);
+    registry = get_repos(session);
+    *count = cork_array_size(&registry->repos) - start;
+    repos = cork_calloc(*count + 1, sizeof(struct bz_repo *));
+    for (i = 0; i < *count; i++) {
+        repos[i] = cork_array_at(&registry->repos, start + i);
+    }
+    bz_session_unlock(session);
+    return repos;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Running repository actions in parallel
+ */
+
+typedef int
+(*bz_repo_action_f)(void *user_data, struct bz_env *env);
+
+/* Returns the action that we should run for a repository, or NULL if there's
+ * nothing to do for it. */
+typedef bz_repo_action_f
+(*bz_repo_get_action_f)(struct bz_repo *repo);
+
+struct bz_repo_job {
+    struct bz_repo  *repo;
+    bz_repo_action_f  action;
+    struct bz_child_job  child;
+    bool  finished;
+};
+
+/* Runs in a child process */
+static int
+bz_repo_job__run(void *user_data)
+{
+    struct bz_repo_job  *job = user_data;
+    return job->action(job->repo->user_data, job->repo->env);
+}
+
+/* Returns whether we started a child process; if not, the job is already
+ * finished. */
+static bool
+bz_repo_job_start(struct bz_repo_job *job)
+{
+    if (job->action == NULL) {
+        job->finished = true;
+        return false;
+    }
+
+    clog_debug("Start child process for %s", bz_repo_name(job->repo));
+    if (CORK_UNLIKELY(bz_child_job_start(&job->child) != 0)) {
+        /* Report this along with any other failures. */
+        cork_buffer_printf(&job->child.err, "%s\n", cork_error_message());
+        cork_error_clear();
+        job->child.exit_code = -1;
+        job->finished = true;
+        return false;
+    }
+    return true;
+}
+
+/* Runs an action for up to `jobs` repositories at a time, each in its own child
+ * process.  We replay each child's output in the same order that we'd have run
+ * the actions one at a time, and keep going if any of them fail, so that we can
+ * report all of the failures at once. */
+static int
+bz_repo_run_parallel(size_t count, struct bz_repo **repos, unsigned int jobs,
+                     const char *verb, bz_repo_get_action_f get_action)
 {
     size_t  i;
-    repos_init();
-    for (i = 0; i < cork_array_size(&repos); i++) {
-        struct bz_repo  *repo = cork_array_at(&repos, i);
-        rii_check(bz_repo_load(repo));
+    size_t  next_start = 0;
+    size_t  next_replay = 0;
+    size_t  failure_count = 0;
+    unsigned int  running = 0;
+    struct bz_repo_job  *job_list;
+    struct cork_buffer  failures = CORK_BUFFER_INIT();
+
+    job_list = cork_calloc(count + 1, sizeof(struct bz_repo_job));
+    for (i = 0; i < count; i++) {
+        job_list[i].repo = repos[i];
+        job_list[i].action = get_action(repos[i]);
+        bz_child_job_init(&job_list[i].child, bz_repo_job__run, &job_list[i]);
     }
+
+    while (next_replay < count) {
+        bool  progress = false;
+
+        while (running < jobs && next_start < count) {
+            if (bz_repo_job_start(&job_list[next_start++])) {
+                running++;
+            }
+        }
+
+        for (i = next_replay; i < next_start; i++) {
+            struct bz_repo_job  *job = &job_list[i];
+            if (job->finished) {
+                continue;
+            }
+            if (bz_child_job_drain(&job->child)) {
+                progress = true;
+            }
+            if (bz_child_job_is_finished(&job->child)) {
+                job->finished = true;
+                running--;
+                progress = true;
+            }
+        }
+
+        while (next_replay < next_start && job_list[next_replay].finished) {
+            struct bz_repo_job  *job = &job_list[next_replay++];
+            if (job->action != NULL &&
+                bz_child_job_finish(&job->child) != 0) {
+                cork_buffer_append_printf
+                    (&failures, "%s%s", (failure_count++ == 0)? "": ", ",
+                     bz_repo_name(job->repo));
+            }
+        }
+
+        if (!progress) {
+            usleep(1000);
+        }
+    }
+
+    for (i = 0; i < count; i++) {
+        bz_child_job_done(&job_list[i].child);
+    }
+    free(job_list);
+
+    if (failure_count > 0) {
+        bz_subprocess_error
+            ("Couldn't %s %s", verb, (char *) failures.buf);
+        cork_buffer_done(&failures);
+        return -1;
+    }
+    cork_buffer_done(&failures);
     return 0;
 }
 
-int
-bz_repo_registry_update_all(void)
+/* With only one job, we run each action in the current process, and stop at
+ * the first one that fails. */
+static int
+bz_repo_run_actions(size_t count, struct bz_repo **repos, unsigned int jobs,
+                    const char *verb, bz_repo_get_action_f get_action)
 {
     size_t  i;
-    repos_init();
-    for (i = 0; i < cork_array_size(&repos); i++) {
-        struct bz_repo  *repo = cork_array_at(&repos, i);
-        rii_check(bz_repo_update(repo));
+    assert(jobs > 0);
+    if (jobs > 1) {
+        return bz_repo_run_parallel(count, repos, jobs, verb, get_action);
+    }
+    for (i = 0; i < count; i++) {
+        struct bz_repo  *repo = repos[i];
+        bz_repo_action_f  action = get_action(repo);
+        if (action != NULL) {
+            rii_check(action(repo->user_data, repo->env));
+        }
     }
     return 0;
 }
+
+
+/*-----------------------------------------------------------------------
+ * Loading and updating every repository
+ */
+
+static bz_repo_action_f
+bz_repo_get_fetch_action(struct bz_repo *repo)
+{
+    return repo->loaded? NULL: repo->fetch;
+}
+
+int
+bz_repo_registry_load_all(unsigned int jobs)
+{
+    size_t  start = 0;
+    size_t  count;
+    int  rc = 0;
+
+    /* Loading a repository registers the repositories that it links to, so
+     * each time through this loop we handle the next level of the link graph.
+     * We fetch every repository in the level first (at the same time, if we
+     * can), and then load them one at a time in registry order, so that we
+     * create and layer the links exactly as if we loaded each repository in
+     * turn. */
+    do {
+        size_t  i;
+        struct bz_repo  **frontier = bz_repo_registry_copy(start, &count);
+        start += count;
+        rc = bz_repo_run_actions
+            (count, frontier, jobs, "fetch", bz_repo_get_fetch_action);
+        for (i = 0; rc == 0 && i < count; i++) {
+            rc = bz_repo_load(frontier[i]);
+        }
+        free(frontier);
+    } while (rc == 0 && count > 0);
+
+    return rc;
+}
+
+static bz_repo_action_f
+bz_repo_get_update_action(struct bz_repo *repo)
+{
+    if (repo->updated) {
+        return NULL;
+    }
+    repo->updated = true;
+    return repo->update;
+}
+
+int
+bz_repo_registry_update_all(unsigned int jobs)
+{
+    int  rc;
+    size_t  count;
+    struct bz_repo  **repos = bz_repo_registry_copy(0, &count);
+    rc = bz_repo_run_actions
+        (count, repos, jobs, "update", bz_repo_get_update_action);
+    free(repos);
+    return rc;
+}
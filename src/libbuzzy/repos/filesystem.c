@@ -13,6 +13,7 @@
 #include <libcork/os.h>
 #include <libcork/helpers/errors.h>
 
+#include "buzzy/arena.h"
 #include "buzzy/env.h"
 #include "buzzy/error.h"
 #include "buzzy/os.h"
@@ -39,9 +40,13 @@ bz_filesystem_repo__load_repo_yaml(struct bz_repo *repo)
     if (exists) {
         const char  *repo_yaml_file_string = cork_path_get(repo_yaml_file);
         struct bz_value  *repo_yaml;
+        struct bz_arena  *saved;
         clog_info("Load repo.yaml file");
-        rip_check(repo_yaml = bz_yaml_value_new_from_file
-                  (repo_yaml_file_string));
+        /* Everything in repo.yaml belongs to the repository's environment. */
+        saved = bz_arena_set_current(bz_env_arena(repo_env));
+        repo_yaml = bz_yaml_value_new_from_file(repo_yaml_file_string);
+        bz_arena_set_current(saved);
+        rip_check(repo_yaml);
         bz_env_add_set(repo_env, repo_yaml);
     }
 
@@ -98,6 +103,7 @@ bz_filesystem_repo__create_default_package(struct bz_repo *repo)
     struct bz_value  *package_yaml;
     struct bz_package  *package = NULL;
     struct bz_pdb  *pdb = NULL;
+    struct bz_arena  *saved;
 
     /* See if the repository has a package.yaml file. */
     rip_check(package_file = bz_env_get_path
@@ -113,11 +119,16 @@ bz_filesystem_repo__create_default_package(struct bz_repo *repo)
     ep_check(package_env = bz_package_env_new_empty(repo_env, "package"));
     ep_check(base_dir = bz_env_get_path(repo_env, "repo.base_dir", true));
     bz_env_set_base_path(package_env, cork_path_get(base_dir));
-    ep_check(package_yaml = bz_yaml_value_new_from_file
-             (cork_path_get(package_file)));
-    bz_env_add_set(package_env, package_yaml);
-    bz_env_add_backup(package_env, "source_dir",
-                      bz_interpolated_value_new("${repo.base_dir}"));
+    /* Everything in package.yaml belongs to the package's environment. */
+    saved = bz_arena_set_current(bz_env_arena(package_env));
+    package_yaml = bz_yaml_value_new_from_file(cork_path_get(package_file));
+    if (package_yaml != NULL) {
+        bz_env_add_set(package_env, package_yaml);
+        bz_env_add_backup(package_env, "source_dir",
+                          bz_interpolated_value_new("${repo.base_dir}"));
+    }
+    bz_arena_set_current(saved);
+    ep_check(package_yaml);
     ep_check(package = bz_built_package_new(package_env));
     bz_repo_set_default_package(repo, package);
 
@@ -33,12 +33,21 @@ struct bz_git_repo {
 
 
 static int
-bz_git__load(void *user_data, struct bz_env *env)
+bz_git__fetch(void *user_data, struct bz_env *env)
 {
     struct bz_git_repo  *repo = user_data;
     struct cork_path  *repo_base_dir;
     rip_check(repo_base_dir = bz_env_get_path(env, "repo.base_dir", true));
-    rii_check(bz_git_clone(repo->url, repo->commit, repo_base_dir));
+    return bz_git_clone(repo->url, repo->commit, repo_base_dir);
+}
+
+
+static int
+bz_git__load(void *user_data, struct bz_env *env)
+{
+    struct bz_git_repo  *repo = user_data;
+    /* This is a no-op if we've already fetched the repository. */
+    rii_check(bz_git__fetch(user_data, env));
     return bz_filesystem_repo_load(repo->repo);
 }
 
@@ -127,6 +136,7 @@ bz_git_repo_new(const char *url, const char *commit)
 
     repo->repo = bz_repo_new
         (repo_env, repo, bz_git__free,
+         bz_git__fetch,
          bz_git__load,
          bz_git__update);
 
@@ -80,6 +80,7 @@ bz_local_filesystem_repo_new(const char *path)
 
     repo->repo = bz_repo_new
         (repo_env, repo, bz_local_filesystem__free,
+         NULL,
          bz_local_filesystem__load,
          bz_local_filesystem__update);
     return repo->repo;
@@ -17,6 +17,7 @@
 
 #include "buzzy/error.h"
 #include "buzzy/repo.h"
+#include "buzzy/session.h"
 #include "buzzy/yaml.h"
 
 
@@ -24,22 +25,20 @@
  * URL repository cache
  */
 
-static struct cork_hash_table  *url_repos = NULL;
-
-static void
-url_repos_done(void)
-{
-    cork_hash_table_free(url_repos);
-}
-
-static void
-url_repos_init(void)
+/* Each session has its own cache.  The caller must hold the session lock. */
+static struct cork_hash_table *
+url_repos_get(struct bz_session *session)
 {
+    struct cork_hash_table  *url_repos =
+        bz_session_get_slot(session, BZ_SESSION_URL_REPOS);
     if (CORK_UNLIKELY(url_repos == NULL)) {
         url_repos = cork_string_hash_table_new(0, 0);
         cork_hash_table_set_free_key(url_repos, (cork_free_f) cork_strfree);
-        cork_cleanup_at_exit(0, url_repos_done);
+        bz_session_set_slot
+            (session, BZ_SESSION_URL_REPOS, url_repos,
+             (cork_free_f) cork_hash_table_free);
     }
+    return url_repos;
 }
 
 
@@ -79,13 +78,13 @@ bz_url_repo_create(const char *url)
     return NULL;
 }
 
-struct bz_repo *
-bz_url_repo_new(const char *url)
+static struct bz_repo *
+bz_url_repo_new_(struct bz_session *session, const char *url)
 {
+    struct cork_hash_table  *url_repos = url_repos_get(session);
     struct cork_hash_table_entry  *entry;
     bool  is_new;
 
-    url_repos_init();
     entry = cork_hash_table_get_or_create(url_repos, (void *) url, &is_new);
 
     if (is_new) {
@@ -99,13 +98,25 @@ bz_url_repo_new(const char *url)
     return entry->value;
 }
 
+struct bz_repo *
+bz_url_repo_new(const char *url)
+{
+    struct bz_repo  *repo;
+    struct bz_session  *session = bz_session_current();
+    bz_session_lock(session);
+    repo = bz_url_repo_new_(session, url);
+    bz_session_unlock(session);
+    return repo;
+}
+
 
 /*-----------------------------------------------------------------------
  * YAML repo links
  */
 
 static struct bz_repo *
-bz_yaml_git_repo_new(yaml_document_t *doc, int node_id)
+bz_yaml_git_repo_new(struct bz_session *session, yaml_document_t *doc,
+                     int node_id)
 {
     struct bz_yaml_mapping_element  elements[] = {
         { "url", -1, true },
@@ -124,7 +135,8 @@ bz_yaml_git_repo_new(yaml_document_t *doc, int node_id)
     rpp_check(url = bz_yaml_get_string(doc, *url_id, "url"));
     rpp_check(commit = bz_yaml_get_string(doc, *commit_id, "commit"));
 
-    entry = cork_hash_table_get_or_create(url_repos, (void *) url, &is_new);
+    entry = cork_hash_table_get_or_create
+        (url_repos_get(session), (void *) url, &is_new);
 
     if (is_new) {
         struct bz_repo  *repo;
@@ -142,23 +154,30 @@ bz_yaml_repo_new(yaml_document_t *doc, int node_id)
 {
     yaml_node_t  *node = yaml_document_get_node(doc, node_id);
     const char  *tag = (const char *) node->tag;
+    struct bz_session  *session = bz_session_current();
+    struct bz_repo  *repo;
 
-    url_repos_init();
+    bz_session_lock(session);
 
     /* Simple strings are treated as URLs. */
     if (strcmp(tag, YAML_STR_TAG) == 0) {
         const char  *url = (const char *) node->data.scalar.value;
-        return bz_url_repo_new(url);
+        repo = bz_url_repo_new_(session, url);
     }
 
     /* !git and !git-env are git repositories */
-    if ((strcmp(tag, "!git") == 0) || (strcmp(tag, "!git-env") == 0)) {
-        return bz_yaml_git_repo_new(doc, node_id);
+    else if ((strcmp(tag, "!git") == 0) || (strcmp(tag, "!git-env") == 0)) {
+        repo = bz_yaml_git_repo_new(session, doc, node_id);
     }
 
     /* Otherwise we don't know what to do. */
-    bz_bad_config("Unknown repository type %s", tag);
-    return NULL;
+    else {
+        bz_bad_config("Unknown repository type %s", tag);
+        repo = NULL;
+    }
+
+    bz_session_unlock(session);
+    return repo;
 }
 
 int
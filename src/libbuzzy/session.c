@@ -0,0 +1,160 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2015, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <assert.h>
+#include <pthread.h>
+
+#include <libcork/core.h>
+#include <libcork/os.h>
+#include <libcork/threads.h>
+
+#include "buzzy/session.h"
+
+
+/*-----------------------------------------------------------------------
+ * Sessions
+ */
+
+struct bz_session_slot_data {
+    void  *data;
+    cork_free_f  free_data;
+};
+
+struct bz_session {
+    pthread_mutex_t  lock;
+    struct bz_session_slot_data  slots[BZ_SESSION_SLOT_COUNT];
+};
+
+struct bz_session *
+bz_session_new(void)
+{
+    size_t  i;
+    pthread_mutexattr_t  attr;
+    struct bz_session  *session = cork_new(struct bz_session);
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&session->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+    for (i = 0; i < BZ_SESSION_SLOT_COUNT; i++) {
+        session->slots[i].data = NULL;
+        session->slots[i].free_data = NULL;
+    }
+    return session;
+}
+
+static void
+bz_session_done_slot(struct bz_session *session, enum bz_session_slot slot)
+{
+    struct bz_session_slot_data  *slot_data = &session->slots[slot];
+    if (slot_data->data != NULL && slot_data->free_data != NULL) {
+        slot_data->free_data(slot_data->data);
+    }
+    slot_data->data = NULL;
+    slot_data->free_data = NULL;
+}
+
+static void
+bz_session_free_(struct bz_session *session)
+{
+    size_t  i;
+    for (i = BZ_SESSION_SLOT_COUNT; i > 0; i--) {
+        bz_session_done_slot(session, i - 1);
+    }
+    pthread_mutex_destroy(&session->lock);
+    free(session);
+}
+
+void
+bz_session_lock(struct bz_session *session)
+{
+    pthread_mutex_lock(&session->lock);
+}
+
+void
+bz_session_unlock(struct bz_session *session)
+{
+    pthread_mutex_unlock(&session->lock);
+}
+
+void *
+bz_session_get_slot(struct bz_session *session, enum bz_session_slot slot)
+{
+    return session->slots[slot].data;
+}
+
+void
+bz_session_set_slot(struct bz_session *session, enum bz_session_slot slot,
+                    void *data, cork_free_f free_data)
+{
+    bz_session_done_slot(session, slot);
+    session->slots[slot].data = data;
+    session->slots[slot].free_data = free_data;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Default and current sessions
+ */
+
+static struct bz_session  *default_session = NULL;
+cork_once_barrier(default_session_barrier);
+
+static void
+default_session_free(void)
+{
+    bz_session_free_(default_session);
+    default_session = NULL;
+}
+
+static void
+default_session_new(void)
+{
+    default_session = bz_session_new();
+    cork_cleanup_at_exit(0, default_session_free);
+}
+
+struct bz_session *
+bz_session_default(void)
+{
+    cork_once(default_session_barrier, default_session_new());
+    return default_session;
+}
+
+void
+bz_session_free(struct bz_session *session)
+{
+    assert(session != default_session);
+    assert(session != bz_session_current());
+    bz_session_free_(session);
+}
+
+struct bz_session_tls {
+    struct bz_session  *current;
+};
+
+cork_tls(struct bz_session_tls, bz_session_tls);
+
+struct bz_session *
+bz_session_current(void)
+{
+    struct bz_session_tls  *tls = bz_session_tls_get();
+    if (CORK_LIKELY(tls->current != NULL)) {
+        return tls->current;
+    }
+    return bz_session_default();
+}
+
+struct bz_session *
+bz_session_set_current(struct bz_session *session)
+{
+    struct bz_session_tls  *tls = bz_session_tls_get();
+    struct bz_session  *previous = bz_session_current();
+    tls->current = session;
+    return previous;
+}
@@ -9,23 +9,310 @@
 
 #include <assert.h>
 #include <ctype.h>
+#include <pthread.h>
 
 #include <libcork/core.h>
 #include <libcork/ds.h>
 #include <libcork/os.h>
+#include <libcork/threads.h>
 #include <libcork/helpers/errors.h>
 
+#include "buzzy/arena.h"
 #include "buzzy/error.h"
+#include "buzzy/profile.h"
 #include "buzzy/value.h"
 #include "buzzy/version.h"
 
 
+/*-----------------------------------------------------------------------
+ * Tracking changes
+ */
+
+/* The stamp for each bucket is the value of change_counter just after the most
+ * recent change to any key in that bucket.  Maps in different sessions can be
+ * changed from different threads, so we only touch these atomically. */
+static unsigned int  change_counter = 0;
+static unsigned int  key_stamps[BZ_VALUE_READS_BUCKETS];
+
+#define bz_stamp_load(ptr)  __atomic_load_n((ptr), __ATOMIC_ACQUIRE)
+
+static unsigned int
+bz_key_bucket(const char *key, size_t length)
+{
+    return cork_stable_hash_buffer(0, key, length) % BZ_VALUE_READS_BUCKETS;
+}
+
+/* Every change that can affect the value of any variable starts a new
+ * generation: a key changing, a union's layout changing, an array growing, or
+ * a base path changing.  The typed caches below are only valid during the
+ * generation that filled them in. */
+static unsigned int  generation = 0;
+
+static void
+bz_new_generation(void)
+{
+    cork_uint_atomic_add(&generation, 1);
+}
+
+static void
+bz_key_changed(const char *key)
+{
+    unsigned int  bucket = bz_key_bucket(key, strlen(key));
+    unsigned int  stamp = cork_uint_atomic_add(&change_counter, 1);
+    unsigned int  old_stamp;
+    bz_new_generation();
+    /* Another thread might have updated this bucket with a later stamp in the
+     * meantime; don't overwrite it with ours. */
+    do {
+        old_stamp = bz_stamp_load(&key_stamps[bucket]);
+    } while (old_stamp < stamp &&
+             cork_uint_cas(&key_stamps[bucket], old_stamp, stamp) != old_stamp);
+}
+
+static bool
+bz_bucket_changed_since(unsigned int bucket, unsigned int stamp)
+{
+    return bz_stamp_load(&key_stamps[bucket]) > stamp;
+}
+
+/* Adding a map to a union can change the value of any key, so we count those
+ * separately. */
+static unsigned int  layout_counter = 0;
+
+struct bz_value_reads_tls {
+    struct bz_value_reads  *current;
+};
+
+cork_tls(struct bz_value_reads_tls, bz_value_reads_tls);
+
+static void
+bz_value_reads_add(struct bz_value_reads *reads, unsigned int bucket)
+{
+    reads->buckets[bucket / 64] |= UINT64_C(1) << (bucket % 64);
+}
+
+static void
+bz_value_reads_record(unsigned int bucket)
+{
+    struct bz_value_reads_tls  *tls = bz_value_reads_tls_get();
+    if (tls->current != NULL) {
+        bz_value_reads_add(tls->current, bucket);
+    }
+}
+
+static void
+bz_value_reads_merge(struct bz_value_reads *dest, struct bz_value_reads *src)
+{
+    size_t  i;
+    for (i = 0; i < BZ_VALUE_READS_BUCKETS / 64; i++) {
+        dest->buckets[i] |= src->buckets[i];
+    }
+}
+
+void
+bz_value_reads_begin(struct bz_value_reads *reads,
+                     struct bz_value_reads **saved)
+{
+    struct bz_value_reads_tls  *tls = bz_value_reads_tls_get();
+    memset(reads->buckets, 0, sizeof(reads->buckets));
+    reads->stamp = bz_stamp_load(&change_counter);
+    reads->layout = bz_stamp_load(&layout_counter);
+    *saved = tls->current;
+    tls->current = reads;
+}
+
+void
+bz_value_reads_end(struct bz_value_reads *reads,
+                   struct bz_value_reads *saved)
+{
+    struct bz_value_reads_tls  *tls = bz_value_reads_tls_get();
+    tls->current = saved;
+    if (saved != NULL) {
+        bz_value_reads_merge(saved, reads);
+    }
+}
+
+void
+bz_value_reads_replay(struct bz_value_reads *reads)
+{
+    struct bz_value_reads_tls  *tls = bz_value_reads_tls_get();
+    if (tls->current != NULL) {
+        bz_value_reads_merge(tls->current, reads);
+    }
+}
+
+bool
+bz_value_reads_changed(struct bz_value_reads *reads)
+{
+    size_t  i;
+    if (bz_stamp_load(&layout_counter) != reads->layout) {
+        return true;
+    }
+    for (i = 0; i < BZ_VALUE_READS_BUCKETS / 64; i++) {
+        uint64_t  word = reads->buckets[i];
+        while (word != 0) {
+            unsigned int  bit = __builtin_ctzll(word);
+            if (bz_stamp_load(&key_stamps[i * 64 + bit]) > reads->stamp) {
+                return true;
+            }
+            word &= word - 1;
+        }
+    }
+    return false;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Keys
+ */
+
+/* Each segment's hash is the same one that cork_string_hash_table_new uses, so
+ * that map implementations backed by a string hash table can look up the
+ * segment without hashing it again. */
+
+struct bz_key_segment {
+    const char  *name;
+    cork_hash  hash;
+    unsigned int  bucket;
+};
+
+static void
+bz_key_segment_init(struct bz_key_segment *segment, const char *name,
+                    size_t length)
+{
+    segment->name = name;
+    segment->hash = cork_hash_buffer(0, name, length);
+    segment->bucket = bz_key_bucket(name, length);
+}
+
+/* We allocate each key as a single block: the key itself, then its segments,
+ * then a copy of its name, and then another copy with each "." replaced with a
+ * NUL, which the segments point into. */
+
+struct bz_key {
+    const char  *name;
+    cork_hash  hash;
+    size_t  count;
+    struct bz_key_segment  segments[];
+};
+
+static struct bz_key *
+bz_key_new(const char *name)
+{
+    struct bz_key  *key;
+    size_t  length = strlen(name);
+    size_t  count = 1;
+    size_t  i;
+    char  *name_copy;
+    char  *split;
+    const char  *segment_start;
+
+    for (i = 0; i < length; i++) {
+        if (name[i] == '.') {
+            count++;
+        }
+    }
+
+    key = cork_malloc
+        (sizeof(struct bz_key) + count * sizeof(struct bz_key_segment) +
+         2 * (length + 1));
+    name_copy = (char *) &key->segments[count];
+    split = name_copy + length + 1;
+    memcpy(name_copy, name, length + 1);
+    memcpy(split, name, length + 1);
+    key->name = name_copy;
+    key->hash = cork_hash_buffer(0, name, length);
+    key->count = 0;
+
+    segment_start = split;
+    for (i = 0; i <= length; i++) {
+        if (split[i] == '.' || split[i] == '\0') {
+            split[i] = '\0';
+            bz_key_segment_init
+                (&key->segments[key->count++], segment_start,
+                 &split[i] - segment_start);
+            segment_start = &split[i + 1];
+        }
+    }
+    return key;
+}
+
+/* The intern table is shared by every environment and every session. */
+static pthread_mutex_t  keys_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct cork_hash_table  *keys = NULL;
+
+static void
+keys_free(void)
+{
+    cork_hash_table_free(keys);
+    keys = NULL;
+}
+
+const struct bz_key *
+bz_key_intern(const char *name)
+{
+    struct cork_hash_table_entry  *entry;
+    struct bz_key  *key;
+    bool  is_new;
+
+    pthread_mutex_lock(&keys_lock);
+    if (CORK_UNLIKELY(keys == NULL)) {
+        keys = cork_string_hash_table_new(0, 0);
+        cork_hash_table_set_free_value(keys, free);
+        cork_cleanup_at_exit(0, keys_free);
+    }
+    entry = cork_hash_table_get_or_create(keys, (void *) name, &is_new);
+    if (is_new) {
+        key = bz_key_new(name);
+        entry->key = (void *) key->name;
+        entry->value = key;
+    } else {
+        key = entry->value;
+    }
+    pthread_mutex_unlock(&keys_lock);
+    return key;
+}
+
+const char *
+bz_key_name(const struct bz_key *key)
+{
+    return key->name;
+}
+
+
 /*-----------------------------------------------------------------------
  * Values
  */
 
+/* Maps can optionally provide a faster lookup function that takes a key
+ * segment, which has already been hashed. */
+typedef struct bz_value *
+(*bz_map_value_get_segment_f)(void *user_data,
+                              const struct bz_key_segment *segment);
+
+/* Maps can also provide a lookup function for an entire key.  If it returns
+ * NULL, we fall back on looking up each segment in turn.  (So it doesn't have
+ * to be able to find every key, and it can't report an error.) */
+typedef struct bz_value *
+(*bz_map_value_get_key_f)(void *user_data, const struct bz_key *key);
+
+static size_t  last_id = 0;
+
+static size_t
+bz_value_next_id(void)
+{
+    return cork_size_atomic_add(&last_id, 1);
+}
+
+/* A value (and its user data) might live in an arena, in which case we don't
+ * free it when its last reference is released; instead, the arena calls the
+ * value's free_user_data function when the arena itself is freed. */
+
 struct bz_value {
     enum bz_value_kind  kind;
+    size_t  id;
+    unsigned int  ref_count;
+    struct bz_arena  *arena;
     const char  *base_path;
 
     void  *user_data;
@@ -40,26 +327,64 @@ struct bz_value {
         } array;
         struct {
             bz_map_value_get_f  get;
+            bz_map_value_get_segment_f  get_segment;
+            bz_map_value_get_key_f  get_key;
+            bz_map_value_iterate_f  iterate;
             bz_map_value_add_f  add;
         } map;
     } _;
 
-    /* Some "clever" caching of parsing the scalar content as a particular Buzzy
-     * type. */
-    struct cork_path  *path;
-    struct bz_version  *version;
+    /* The parsed results of any typed variables that we've looked up in this
+     * value, or NULL */
+    struct cork_hash_table  *typed;
 };
 
+struct bz_value *
+bz_value_ref(struct bz_value *value)
+{
+    cork_uint_atomic_add(&value->ref_count, 1);
+    return value;
+}
+
+/* Most values never change their base path, so they all share this one. */
+static const char  default_base_path[] = "";
+
+static void
+bz_value_free_caches(void *user_data);
+
+static struct bz_value *
+bz_value_new_(struct bz_arena *arena, enum bz_value_kind kind,
+              void *user_data, cork_free_f free_user_data)
+{
+    struct bz_value  *value = bz_arena_alloc(arena, sizeof(struct bz_value));
+    value->kind = kind;
+    value->id = bz_value_next_id();
+    value->ref_count = 1;
+    value->arena = arena;
+    value->base_path = default_base_path;
+    value->user_data = user_data;
+    value->free_user_data = free_user_data;
+    value->typed = NULL;
+    if (arena != NULL && free_user_data != NULL) {
+        bz_arena_add_cleanup(arena, user_data, free_user_data);
+    }
+    return value;
+}
+
 void
 bz_value_free(struct bz_value *value)
 {
-    if (value->path != NULL) {
-        cork_path_free(value->path);
+    if (cork_uint_atomic_sub(&value->ref_count, 1) > 0) {
+        return;
+    }
+    if (value->arena != NULL) {
+        /* Everything else is freed along with the arena. */
+        return;
     }
-    if (value->version != NULL) {
-        bz_version_free(value->version);
+    bz_value_free_caches(value);
+    if (value->base_path != default_base_path) {
+        cork_strfree(value->base_path);
     }
-    cork_strfree(value->base_path);
     cork_free_user_data(value);
     free(value);
 }
@@ -70,6 +395,12 @@ bz_value_kind(struct bz_value *value)
     return value->kind;
 }
 
+size_t
+bz_value_id(struct bz_value *value)
+{
+    return value->id;
+}
+
 const char *
 bz_value_kind_string(enum bz_value_kind kind)
 {
@@ -86,37 +417,48 @@ bz_value_kind_string(enum bz_value_kind kind)
 }
 
 
+static struct bz_value *
+bz_map_value_get_segment(struct bz_value *value,
+                         const struct bz_key_segment *segment);
+
 struct bz_value *
-bz_value_get_nested(struct bz_value *value, const char *key)
+bz_value_get_key(struct bz_value *value, const struct bz_key *key)
 {
     struct bz_value  *curr = value;
-    struct cork_buffer  buf;
-    const char  *name = key;
-    const char  *next;
+    size_t  i;
 
-    if (key == NULL) {
-        return value;
+    if (value->kind == BZ_VALUE_MAP && value->_.map.get_key != NULL) {
+        curr = value->_.map.get_key(value->user_data, key);
+        if (curr != NULL) {
+            for (i = 0; i < key->count; i++) {
+                bz_value_reads_record(key->segments[i].bucket);
+            }
+            return curr;
+        }
+        curr = value;
     }
 
-    /* Find children for each name up through the last dot. */
-    cork_buffer_init(&buf);
-    while ((next = strchr(name, '.')) != NULL) {
-        ptrdiff_t  length = next - name;
-        cork_buffer_set(&buf, name, length);
-        ep_check(curr = bz_map_value_get(curr, buf.buf));
-        name = next + 1;
+    for (i = 0; i < key->count && curr != NULL; i++) {
+        const struct bz_key_segment  *segment = &key->segments[i];
+        bz_value_reads_record(segment->bucket);
+        rpe_check(curr = bz_map_value_get_segment(curr, segment));
     }
+    return curr;
+}
 
-    /* Then find the child after the last dot. */
-    cork_buffer_done(&buf);
-    return bz_map_value_get(curr, name);
-
-error:
-    cork_buffer_done(&buf);
-    return NULL;
+struct bz_value *
+bz_value_get_nested(struct bz_value *value, const char *key)
+{
+    if (key == NULL) {
+        return value;
+    }
+    return bz_value_get_key(value, bz_key_intern(key));
 }
 
 
+static struct bz_value *
+bz_map_new_(struct bz_arena *arena);
+
 int
 bz_value_set_nested(struct bz_value *value, const char *key,
                     struct bz_value *element, bool overwrite)
@@ -140,8 +482,9 @@ bz_value_set_nested(struct bz_value *value, const char *key,
         cork_buffer_set(&buf, name, length);
         ee_check(next_value = bz_map_value_get(curr, buf.buf));
         if (next_value == NULL) {
-            /* If we encounter a missing map, add an empty one and keep going */
-            next_value = bz_map_new();
+            /* If we encounter a missing map, add an empty one (in the same
+             * arena as its parent) and keep going */
+            next_value = bz_map_new_(curr->arena);
             bz_map_value_add(curr, buf.buf, next_value, false);
         }
         name = next + 1;
@@ -168,8 +511,11 @@ bz_value_base_path(struct bz_value *value)
 void
 bz_value_set_base_path(struct bz_value *value, const char *base_path)
 {
-    cork_strfree(value->base_path);
-    value->base_path = cork_strdup(base_path);
+    if (value->base_path != default_base_path) {
+        bz_arena_strfree(value->arena, value->base_path);
+    }
+    value->base_path = bz_arena_strdup(value->arena, base_path);
+    bz_new_generation();
 }
 
 
@@ -202,18 +548,164 @@ bz_verify_exists(struct bz_value *value, const char *name, bool required)
     }
 }
 
+
+/* Each value that you look up typed variables in (usually an environment)
+ * caches the parsed results, so that reading a hot variable like "verbose"
+ * doesn't have to look it up, render it, and parse it every time.  The cache
+ * is keyed by interned variable name, with a separate entry for each type.
+ * The results are allocated on the heap, even for a value that lives in an
+ * arena, so the first time we create a value's cache, we ask the arena to free
+ * it. */
+
+enum bz_typed_kind {
+    BZ_TYPED_BOOL,
+    BZ_TYPED_LONG,
+    BZ_TYPED_PATH,
+    BZ_TYPED_VERSION,
+    BZ_TYPED_DEPENDENCIES,
+    BZ_TYPED_KIND_COUNT
+};
+
+struct bz_typed_entry {
+    bool  filled;
+    unsigned int  generation;
+    union {
+        bool  b;
+        long  l;
+        struct cork_path  *path;
+        struct bz_version  *version;
+        struct {
+            cork_array(struct bz_dependency *)  array;
+            struct bz_dependency_list  list;
+        } deps;
+    } _;
+};
+
+struct bz_typed_entries {
+    struct bz_typed_entry  kinds[BZ_TYPED_KIND_COUNT];
+};
+
+static void
+bz_typed_entry_clear(struct bz_typed_entry *entry, enum bz_typed_kind kind)
+{
+    size_t  i;
+    if (!entry->filled) {
+        return;
+    }
+    switch (kind) {
+        case BZ_TYPED_PATH:
+            cork_path_free(entry->_.path);
+            break;
+        case BZ_TYPED_VERSION:
+            bz_version_free(entry->_.version);
+            break;
+        case BZ_TYPED_DEPENDENCIES:
+            for (i = 0; i < cork_array_size(&entry->_.deps.array); i++) {
+                bz_dependency_free(cork_array_at(&entry->_.deps.array, i));
+            }
+            cork_array_done(&entry->_.deps.array);
+            break;
+        default:
+            break;
+    }
+    entry->filled = false;
+}
+
+static void
+bz_value_free_caches(void *user_data)
+{
+    struct bz_value  *value = user_data;
+    struct cork_hash_table_iterator  iter;
+    struct cork_hash_table_entry  *hentry;
+
+    if (value->typed == NULL) {
+        return;
+    }
+    cork_hash_table_iterator_init(value->typed, &iter);
+    while ((hentry = cork_hash_table_iterator_next(&iter)) != NULL) {
+        struct bz_typed_entries  *entries = hentry->value;
+        size_t  kind;
+        for (kind = 0; kind < BZ_TYPED_KIND_COUNT; kind++) {
+            bz_typed_entry_clear(&entries->kinds[kind], kind);
+        }
+        free(entries);
+    }
+    cork_hash_table_free(value->typed);
+    value->typed = NULL;
+}
+
+/* Returns root's cache entry for the given variable and type.  If it was filled
+ * in during an earlier generation, we free the stale result, and you have to
+ * fill it in again.  (We can't cache an unnamed variable, but its entry still
+ * holds on to the most recent result, so that the caller doesn't have to free
+ * it.) */
+static struct bz_typed_entry *
+bz_typed_entry_get(struct bz_value *root, const char *name,
+                   enum bz_typed_kind kind, unsigned int current)
+{
+    const struct bz_key  *key = (name == NULL)? NULL: bz_key_intern(name);
+    struct bz_typed_entries  *entries;
+    struct bz_typed_entry  *entry;
+    bool  is_new;
+    struct cork_hash_table_entry  *hentry;
+
+    if (CORK_UNLIKELY(root->typed == NULL)) {
+        root->typed = cork_pointer_hash_table_new(0, 0);
+        if (root->arena != NULL) {
+            bz_arena_add_cleanup(root->arena, root, bz_value_free_caches);
+        }
+    }
+
+    hentry = cork_hash_table_get_or_create(root->typed, (void *) key, &is_new);
+    if (is_new) {
+        entries = cork_new(struct bz_typed_entries);
+        memset(entries, 0, sizeof(struct bz_typed_entries));
+        hentry->value = entries;
+    } else {
+        entries = hentry->value;
+    }
+
+    entry = &entries->kinds[kind];
+    if (entry->filled && (key == NULL || entry->generation != current)) {
+        bz_typed_entry_clear(entry, kind);
+    }
+    return entry;
+}
+
+/* Call this just before storing a new result into entry.  (Parsing the result
+ * might have looked up the same variable recursively and filled in the entry
+ * already.) */
+static void
+bz_typed_entry_fill(struct bz_typed_entry *entry, enum bz_typed_kind kind,
+                    unsigned int current)
+{
+    bz_typed_entry_clear(entry, kind);
+    entry->filled = true;
+    entry->generation = current;
+}
+
 bool
 bz_value_get_bool(struct bz_value *root, const char *name, bool required)
 {
+    unsigned int  current = bz_stamp_load(&generation);
+    struct bz_typed_entry  *entry;
     struct bz_value  *value;
     const char  *content;
     size_t  i;
+
+    entry = bz_typed_entry_get(root, name, BZ_TYPED_BOOL, current);
+    if (entry->filled) {
+        return entry->_.b;
+    }
+
     xe_check(false, value = bz_value_get_nested(root, name));
     xi_check(false, bz_verify_exists(value, name, required));
-    xp_check(false, content = bz_scalar_value_get(value, root));
+    xp_check(false, content = bz_scalar_value_get_named(value, root, name));
     for (i = 0; bool_values[i].s != NULL; i++) {
         if (strcasecmp(content, bool_values[i].s) == 0) {
-            return bool_values[i].b;
+            bz_typed_entry_fill(entry, BZ_TYPED_BOOL, current);
+            entry->_.b = bool_values[i].b;
+            return entry->_.b;
         }
     }
     bz_bad_config
@@ -225,13 +717,21 @@ bz_value_get_bool(struct bz_value *root, const char *name, bool required)
 long
 bz_value_get_long(struct bz_value *root, const char *name, bool required)
 {
+    unsigned int  current = bz_stamp_load(&generation);
+    struct bz_typed_entry  *entry;
     struct bz_value  *value;
     const char  *content;
     long  result;
     char  *endptr = NULL;
+
+    entry = bz_typed_entry_get(root, name, BZ_TYPED_LONG, current);
+    if (entry->filled) {
+        return entry->_.l;
+    }
+
     xe_check(0, value = bz_value_get_nested(root, name));
     xi_check(0, bz_verify_exists(value, name, required));
-    xp_check(0, content = bz_scalar_value_get(value, root));
+    xp_check(0, content = bz_scalar_value_get_named(value, root, name));
     result = strtol(content, &endptr, 0);
     if (!isdigit(*content) || *endptr != '\0') {
         bz_bad_config
@@ -239,6 +739,8 @@ bz_value_get_long(struct bz_value *root, const char *name, bool required)
              content, (name == NULL)? "value": name);
         return 0;
     } else {
+        bz_typed_entry_fill(entry, BZ_TYPED_LONG, current);
+        entry->_.l = result;
         return result;
     }
 }
@@ -246,17 +748,25 @@ bz_value_get_long(struct bz_value *root, const char *name, bool required)
 struct cork_path *
 bz_value_get_path(struct bz_value *root, const char *name, bool required)
 {
+    unsigned int  current = bz_stamp_load(&generation);
+    struct bz_typed_entry  *entry;
     struct bz_value  *value;
     const char  *content;
+    struct cork_path  *path;
+
+    entry = bz_typed_entry_get(root, name, BZ_TYPED_PATH, current);
+    if (entry->filled) {
+        return entry->_.path;
+    }
+
     rpe_check(value = bz_value_get_nested(root, name));
     rpi_check(bz_verify_exists(value, name, required));
-    if (value->path != NULL) {
-        cork_path_free(value->path);
-    }
-    rpp_check(content = bz_scalar_value_get(value, root));
-    value->path = cork_path_new(root->base_path);
-    cork_path_append(value->path, content);
-    return value->path;
+    rpp_check(content = bz_scalar_value_get_named(value, root, name));
+    path = cork_path_new(root->base_path);
+    cork_path_append(path, content);
+    bz_typed_entry_fill(entry, BZ_TYPED_PATH, current);
+    entry->_.path = path;
+    return path;
 }
 
 const char *
@@ -265,22 +775,77 @@ bz_value_get_string(struct bz_value *root, const char *name, bool required)
     struct bz_value  *value;
     rpe_check(value = bz_value_get_nested(root, name));
     rpi_check(bz_verify_exists(value, name, required));
-    return bz_scalar_value_get(value, root);
+    return bz_scalar_value_get_named(value, root, name);
 }
 
 struct bz_version *
 bz_value_get_version(struct bz_value *root, const char *name, bool required)
 {
+    unsigned int  current = bz_stamp_load(&generation);
+    struct bz_typed_entry  *entry;
     struct bz_value  *value;
     const char  *content;
+    struct bz_version  *version;
+
+    entry = bz_typed_entry_get(root, name, BZ_TYPED_VERSION, current);
+    if (entry->filled) {
+        return entry->_.version;
+    }
+
     rpe_check(value = bz_value_get_nested(root, name));
     rpi_check(bz_verify_exists(value, name, required));
-    if (value->version != NULL) {
-        bz_version_free(value->version);
+    rpp_check(content = bz_scalar_value_get_named(value, root, name));
+    rpp_check(version = bz_version_from_string(content));
+    bz_typed_entry_fill(entry, BZ_TYPED_VERSION, current);
+    entry->_.version = version;
+    return version;
+}
+
+struct bz_value_parse_deps {
+    struct bz_value  *root;
+    struct bz_typed_entry  *entry;
+};
+
+static int
+bz_value_parse_dep(void *user_data, struct bz_value *dep_value)
+{
+    struct bz_value_parse_deps  *state = user_data;
+    const char  *dep_string;
+    struct bz_dependency  *dep;
+    rip_check(dep_string = bz_scalar_value_get(dep_value, state->root));
+    rip_check(dep = bz_dependency_from_string(dep_string));
+    cork_array_append(&state->entry->_.deps.array, dep);
+    return 0;
+}
+
+const struct bz_dependency_list *
+bz_value_get_dependencies(struct bz_value *root, const char *name,
+                          bool required)
+{
+    unsigned int  current = bz_stamp_load(&generation);
+    struct bz_typed_entry  *entry;
+    struct bz_value  *value;
+    struct bz_value_parse_deps  state;
+
+    entry = bz_typed_entry_get(root, name, BZ_TYPED_DEPENDENCIES, current);
+    if (entry->filled) {
+        return &entry->_.deps.list;
+    }
+
+    rpe_check(value = bz_value_get_nested(root, name));
+    rpi_check(bz_verify_exists(value, name, required));
+    bz_typed_entry_fill(entry, BZ_TYPED_DEPENDENCIES, current);
+    cork_array_init(&entry->_.deps.array);
+    state.root = root;
+    state.entry = entry;
+    if (CORK_UNLIKELY(bz_array_value_map_scalars
+                      (value, &state, bz_value_parse_dep) != 0)) {
+        bz_typed_entry_clear(entry, BZ_TYPED_DEPENDENCIES);
+        return NULL;
     }
-    rpp_check(content = bz_scalar_value_get(value, root));
-    rpp_check(value->version = bz_version_from_string(content));
-    return value->version;
+    entry->_.deps.list.count = cork_array_size(&entry->_.deps.array);
+    entry->_.deps.list.deps = cork_array_elements(&entry->_.deps.array);
+    return &entry->_.deps.list;
 }
 
 
@@ -292,21 +857,25 @@ struct bz_value *
 bz_scalar_value_new(void *user_data, cork_free_f free_user_data,
                     bz_scalar_value_get_f get)
 {
-    struct bz_value  *value = cork_new(struct bz_value);
-    value->kind = BZ_VALUE_SCALAR;
-    value->user_data = user_data;
-    value->free_user_data = free_user_data;
+    struct bz_value  *value = bz_value_new_
+        (bz_arena_current(), BZ_VALUE_SCALAR, user_data, free_user_data);
     value->_.scalar.get = get;
-    value->base_path = cork_strdup("");
-    value->path = NULL;
-    value->version = NULL;
     return value;
 }
 
 const char *
-bz_scalar_value_get(struct bz_value *value, struct bz_value *ctx)
+bz_scalar_value_get_named(struct bz_value *value, struct bz_value *ctx,
+                          const char *name)
 {
     if (CORK_LIKELY(value->kind == BZ_VALUE_SCALAR)) {
+        if (CORK_UNLIKELY(bz_profiling && name != NULL)) {
+            const char  *result;
+            struct bz_profile_frame  frame;
+            bz_profile_eval_begin(&frame, name);
+            result = value->_.scalar.get(value->user_data, ctx);
+            bz_profile_eval_end(&frame);
+            return result;
+        }
         return value->_.scalar.get(value->user_data, ctx);
     } else {
         bz_bad_config("Value must be a scalar");
@@ -314,6 +883,12 @@ bz_scalar_value_get(struct bz_value *value, struct bz_value *ctx)
     }
 }
 
+const char *
+bz_scalar_value_get(struct bz_value *value, struct bz_value *ctx)
+{
+    return bz_scalar_value_get_named(value, ctx, NULL);
+}
+
 
 /*-----------------------------------------------------------------------
  * Array values
@@ -324,15 +899,10 @@ bz_array_value_new(void *user_data, cork_free_f free_user_data,
                    bz_array_value_count_f count,
                    bz_array_value_get_f get)
 {
-    struct bz_value  *value = cork_new(struct bz_value);
-    value->kind = BZ_VALUE_ARRAY;
-    value->user_data = user_data;
-    value->free_user_data = free_user_data;
+    struct bz_value  *value = bz_value_new_
+        (bz_arena_current(), BZ_VALUE_ARRAY, user_data, free_user_data);
     value->_.array.count = count;
     value->_.array.get = get;
-    value->base_path = cork_strdup("");
-    value->path = NULL;
-    value->version = NULL;
     return value;
 }
 
@@ -415,21 +985,29 @@ bz_map__default_add(void *user_data, const char *key, struct bz_value *element,
     return -1;
 }
 
+static struct bz_value *
+bz_map_value_new_(struct bz_arena *arena,
+                  void *user_data, cork_free_f free_user_data,
+                  bz_map_value_get_f get,
+                  bz_map_value_add_f add)
+{
+    struct bz_value  *value = bz_value_new_
+        (arena, BZ_VALUE_MAP, user_data, free_user_data);
+    value->_.map.get = get;
+    value->_.map.get_segment = NULL;
+    value->_.map.get_key = NULL;
+    value->_.map.iterate = NULL;
+    value->_.map.add = (add == NULL)? bz_map__default_add: add;
+    return value;
+}
+
 struct bz_value *
 bz_map_value_new(void *user_data, cork_free_f free_user_data,
                  bz_map_value_get_f get,
                  bz_map_value_add_f add)
 {
-    struct bz_value  *value = cork_new(struct bz_value);
-    value->kind = BZ_VALUE_MAP;
-    value->user_data = user_data;
-    value->free_user_data = free_user_data;
-    value->_.map.get = get;
-    value->_.map.add = (add == NULL)? bz_map__default_add: add;
-    value->base_path = cork_strdup("");
-    value->path = NULL;
-    value->version = NULL;
-    return value;
+    return bz_map_value_new_
+        (bz_arena_current(), user_data, free_user_data, get, add);
 }
 
 struct bz_value *
@@ -444,6 +1022,48 @@ bz_map_value_get(struct bz_value *value, const char *key)
     }
 }
 
+static struct bz_value *
+bz_map_value_get_segment(struct bz_value *value,
+                         const struct bz_key_segment *segment)
+{
+    if (CORK_LIKELY(value->kind == BZ_VALUE_MAP)) {
+        if (value->_.map.get_segment != NULL) {
+            return value->_.map.get_segment(value->user_data, segment);
+        } else {
+            return value->_.map.get(value->user_data, segment->name);
+        }
+    } else {
+        bz_bad_config
+            ("Can't get %s from a %s",
+             segment->name, bz_value_kind_string(value->kind));
+        return NULL;
+    }
+}
+
+void
+bz_map_value_set_iterate(struct bz_value *value,
+                         bz_map_value_iterate_f iterate)
+{
+    value->_.map.iterate = iterate;
+}
+
+int
+bz_map_value_iterate(struct bz_value *value, void *user_data,
+                     bz_map_iterate_f iterate)
+{
+    if (CORK_UNLIKELY(value->kind != BZ_VALUE_MAP)) {
+        bz_bad_config
+            ("Can't list the contents of a %s",
+             bz_value_kind_string(value->kind));
+        return -1;
+    } else if (CORK_UNLIKELY(value->_.map.iterate == NULL)) {
+        bz_bad_config("Can't list the contents of this map");
+        return -1;
+    } else {
+        return value->_.map.iterate(value->user_data, user_data, iterate);
+    }
+}
+
 int
 bz_map_value_add(struct bz_value *value, const char *key,
                  struct bz_value *element, bool overwrite)
@@ -463,20 +1083,24 @@ bz_map_value_add(struct bz_value *value, const char *key,
  * Copied values
  */
 
-struct bz_value *
-bz_value_copy(struct bz_value *other)
+static struct bz_value *
+bz_value_copy_(struct bz_arena *arena, struct bz_value *other)
 {
-    struct bz_value  *value = cork_new(struct bz_value);
-    value->kind = other->kind;
-    value->base_path = cork_strdup(other->base_path);
-    value->user_data = other->user_data;
-    value->free_user_data = NULL;
+    struct bz_value  *value = bz_value_new_
+        (arena, other->kind, other->user_data, NULL);
+    if (other->base_path != default_base_path) {
+        value->base_path = bz_arena_strdup(arena, other->base_path);
+    }
     value->_ = other->_;
-    value->path = NULL;
-    value->version = NULL;
     return value;
 }
 
+struct bz_value *
+bz_value_copy(struct bz_value *other)
+{
+    return bz_value_copy_(bz_arena_current(), other);
+}
+
 
 /*-----------------------------------------------------------------------
  * Path values
@@ -524,9 +1148,11 @@ bz_string_value__free(void *user_data)
 struct bz_value *
 bz_string_value_new(const char *value)
 {
-    const char  *copy = cork_strdup(value);
+    struct bz_arena  *arena = bz_arena_current();
+    const char  *copy = bz_arena_strdup(arena, value);
     return bz_scalar_value_new
-        ((void *) copy, bz_string_value__free, bz_string_value__get);
+        ((void *) copy, (arena == NULL)? bz_string_value__free: NULL,
+         bz_string_value__get);
 }
 
 
@@ -535,6 +1161,7 @@ bz_string_value_new(const char *value)
  */
 
 struct bz_array {
+    struct bz_arena  *arena;
     cork_array(struct bz_value *)  elements;
     struct bz_value  *value;
 };
@@ -544,7 +1171,7 @@ bz_array__free(void *user_data)
 {
     struct bz_array  *array = user_data;
     cork_array_done(&array->elements);
-    free(array);
+    bz_arena_dealloc(array->arena, array);
 }
 
 static size_t
@@ -564,7 +1191,9 @@ bz_array__get(void *user_data, size_t index)
 struct bz_array *
 bz_array_new(void)
 {
-    struct bz_array  *array = cork_new(struct bz_array);
+    struct bz_arena  *arena = bz_arena_current();
+    struct bz_array  *array = bz_arena_alloc(arena, sizeof(struct bz_array));
+    array->arena = arena;
     cork_pointer_array_init(&array->elements, (cork_free_f) bz_value_free);
     array->value = bz_array_value_new
         (array, bz_array__free, bz_array__count, bz_array__get);
@@ -575,6 +1204,7 @@ void
 bz_array_append(struct bz_array *array, struct bz_value *value)
 {
     cork_array_append(&array->elements, value);
+    bz_new_generation();
 }
 
 struct bz_value *
@@ -588,7 +1218,9 @@ bz_array_as_value(struct bz_array *array)
  * Editable maps
  */
 
+/* If the map lives in an arena, so do its keys. */
 struct bz_map {
+    struct bz_arena  *arena;
     struct cork_hash_table  *table;
     struct bz_value  *value;
 };
@@ -598,7 +1230,7 @@ bz_map__free(void *user_data)
 {
     struct bz_map  *map = user_data;
     cork_hash_table_free(map->table);
-    free(map);
+    bz_arena_dealloc(map->arena, map);
 }
 
 static struct bz_value *
@@ -608,6 +1240,28 @@ bz_map__get(void *user_data, const char *key)
     return cork_hash_table_get(map->table, (void *) key);
 }
 
+static struct bz_value *
+bz_map__get_segment(void *user_data, const struct bz_key_segment *segment)
+{
+    struct bz_map  *map = user_data;
+    return cork_hash_table_get_hash
+        (map->table, segment->hash, (void *) segment->name);
+}
+
+static int
+bz_map__iterate(void *user_data, void *iterate_user_data,
+                bz_map_iterate_f iterate)
+{
+    struct bz_map  *map = user_data;
+    struct cork_hash_table_iterator  iter;
+    struct cork_hash_table_entry  *entry;
+    cork_hash_table_iterator_init(map->table, &iter);
+    while ((entry = cork_hash_table_iterator_next(&iter)) != NULL) {
+        rii_check(iterate(iterate_user_data, entry->key, entry->value));
+    }
+    return 0;
+}
+
 static int
 bz_map__add(void *user_data, const char *key, struct bz_value *value,
             bool overwrite)
@@ -618,7 +1272,7 @@ bz_map__add(void *user_data, const char *key, struct bz_value *value,
 
     entry = cork_hash_table_get_or_create(map->table, (void *) key, &is_new);
     if (is_new) {
-        entry->key = (void *) cork_strdup(key);
+        entry->key = (void *) bz_arena_strdup(map->arena, key);
         entry->value = value;
     } else {
         if (overwrite) {
@@ -631,148 +1285,457 @@ bz_map__add(void *user_data, const char *key, struct bz_value *value,
             return -1;
         }
     }
+    bz_key_changed(key);
     return 0;
 }
 
-struct bz_value *
-bz_map_new(void)
+static struct bz_value *
+bz_map_new_(struct bz_arena *arena)
 {
-    struct bz_map  *map = cork_new(struct bz_map);
+    struct bz_map  *map = bz_arena_alloc(arena, sizeof(struct bz_map));
+    map->arena = arena;
     map->table = cork_string_hash_table_new(0, 0);
-    cork_hash_table_set_free_key(map->table, (cork_free_f) cork_strfree);
+    if (arena == NULL) {
+        cork_hash_table_set_free_key(map->table, (cork_free_f) cork_strfree);
+    }
     cork_hash_table_set_free_value(map->table, (cork_free_f) bz_value_free);
-    map->value = bz_map_value_new
-        (map, bz_map__free, bz_map__get, bz_map__add);
+    map->value = bz_map_value_new_
+        (arena, map, bz_map__free, bz_map__get, bz_map__add);
+    map->value->_.map.get_segment = bz_map__get_segment;
+    map->value->_.map.iterate = bz_map__iterate;
     return map->value;
 }
 
+struct bz_value *
+bz_map_new(void)
+{
+    return bz_map_new_(bz_arena_current());
+}
+
 
 /*-----------------------------------------------------------------------
  * Union of maps
  */
 
+/* We cache the result of looking up each key in the union, along with the
+ * change stamp from when we looked it up.  If anyone adds that key to any map
+ * (including the ones in the union) after that, we look it up again. */
+
+struct bz_union_map_entry {
+    bool  valid;
+    struct bz_value  *value;
+    unsigned int  stamp;
+    unsigned int  layout;
+};
+
+/* The child maps that we create while looking up nested keys live in the same
+ * arena as the union itself, as do the cache's keys and entries. */
+
 struct bz_union_map {
+    struct bz_arena  *arena;
+    /* Only used to label the union in profiling reports */
+    const char  *name;
     struct cork_hash_table  *cache;
     cork_array(struct bz_value *)  maps;
     cork_array(struct bz_value *)  child_maps;
     struct bz_value  *value;
+    /* A frozen snapshot of every key in the union, or NULL.  The snapshot's keys
+     * are interned bz_keys, which we hash using the hash of their names, since
+     * their addresses don't make very good hashes. */
+    struct cork_hash_table  *frozen;
+    unsigned int  frozen_stamp;
+    unsigned int  frozen_layout;
 };
 
+static struct bz_union_map *
+bz_union_map_new_(struct bz_arena *arena);
+
+static void
+bz_union_map_add_(struct bz_union_map *map, struct bz_value *element);
+
 static void
 bz_union_map__free(void *user_data)
 {
     struct bz_union_map  *map = user_data;
+    bz_union_map_thaw(map);
     cork_hash_table_free(map->cache);
     cork_array_done(&map->maps);
     cork_array_done(&map->child_maps);
-    free(map);
+    bz_arena_dealloc(map->arena, map);
 }
 
-static struct bz_value *
-bz_union_map_find_key(struct bz_union_map *map, const char *key,
-                      struct cork_hash_table_entry *entry)
+/* Returns whether the union already contains element, or another copy of it.
+ * (The same map can show up in a union more than once; for instance, every
+ * package environment contains the global environment, both directly and via
+ * its repository environment.) */
+static bool
+bz_union_map_contains(struct bz_union_map *map, struct bz_value *element)
 {
-    struct bz_value  *value = NULL;
-    struct bz_union_map  *child_union_map;
-    struct bz_value  *child_union_value;
     size_t  i;
+    for (i = 0; i < cork_array_size(&map->maps); i++) {
+        struct bz_value  *existing = cork_array_at(&map->maps, i);
+        if (existing->user_data == element->user_data) {
+            return true;
+        }
+    }
+    return false;
+}
 
-    entry->key = (void *) cork_strdup(key);
+static int
+bz_union_map_find_key(struct bz_union_map *map,
+                      const struct bz_key_segment *segment,
+                      struct bz_value **dest)
+{
+    const char  *key = segment->name;
+    struct bz_value  *value;
+    struct bz_value  *first_map = NULL;
+    struct bz_union_map  *child_union_map = NULL;
+    struct bz_value  *child_union_value;
+    size_t  i;
 
     /* If any of the maps in the union have a (child) map as the value for key,
      * then we need to create a new union of all of those child maps, so that
-     * their keys are merged together. */
+     * their keys are merged together.  But if there's only one child map, we
+     * can use it directly, which lets every environment that's layered on top
+     * of the same map (like the global environment) share that map's lookup
+     * cache, instead of creating a union of its own. */
 
-    /* Find the first map that contains key. */
     for (i = 0; i < cork_array_size(&map->maps); i++) {
         struct bz_value  *element = cork_array_at(&map->maps, i);
-        rpe_check(value = bz_map_value_get(element, key));
-        if (value != NULL) {
-            /* If the value isn't a map, then we have the final result. */
-            if (value->kind == BZ_VALUE_SCALAR ||
-                value->kind == BZ_VALUE_ARRAY) {
-                entry->value = value;
-                return value;
+        rie_check(value = bz_map_value_get_segment(element, segment));
+        if (value == NULL) {
+            continue;
+        }
+
+        if (value->kind == BZ_VALUE_SCALAR || value->kind == BZ_VALUE_ARRAY) {
+            /* If the first value we find isn't a map, then we have the final
+             * result. */
+            if (first_map == NULL) {
+                *dest = value;
+                return 0;
             }
 
-            /* Otherwise, fall through to create the child map. */
-            break;
+            /* If it comes after a map, we have an inconsistency. */
+            bz_bad_config
+                ("%s is both a %s and a map",
+                 key, bz_value_kind_string(value->kind));
+            return -1;
+        }
+
+        if (first_map == NULL) {
+            first_map = value;
+        } else if (child_union_map == NULL) {
+            if (value->user_data != first_map->user_data) {
+                child_union_map = bz_union_map_new_(map->arena);
+                child_union_map->name = map->name;
+                bz_union_map_add_
+                    (child_union_map, bz_value_copy_(map->arena, first_map));
+                bz_union_map_add_
+                    (child_union_map, bz_value_copy_(map->arena, value));
+            }
+        } else if (!bz_union_map_contains(child_union_map, value)) {
+            bz_union_map_add_
+                (child_union_map, bz_value_copy_(map->arena, value));
         }
     }
 
     /* If we never found any values for this key, then that's also a final
      * result. */
-    if (value == NULL) {
-        return NULL;
+    if (first_map == NULL) {
+        *dest = NULL;
+        return 0;
     }
 
-    /* Otherwise we've found a child map.  Create a child union map containing
-     * it, and any other values that we find for this key. */
-    child_union_map = bz_union_map_new();
-    bz_union_map_add(child_union_map, bz_value_copy(value));
-    child_union_value = bz_union_map_as_value(child_union_map);
+    if (child_union_map != NULL) {
+        child_union_value = bz_union_map_as_value(child_union_map);
+    } else if (first_map->_.map.add == bz_map__default_add) {
+        /* The child map is already read-only. */
+        *dest = first_map;
+        return 0;
+    } else {
+        /* Otherwise make a read-only copy of it, since you shouldn't be able
+         * to add anything to the union. */
+        child_union_value = bz_value_copy_(map->arena, first_map);
+        child_union_value->_.map.add = bz_map__default_add;
+    }
     cork_array_append(&map->child_maps, child_union_value);
+    *dest = child_union_value;
+    return 0;
+}
 
-    for (i = i+1; i < cork_array_size(&map->maps); i++) {
-        struct bz_value  *element = cork_array_at(&map->maps, i);
-        rpe_check(value = bz_map_value_get(element, key));
-        if (value != NULL) {
-            if (value->kind == BZ_VALUE_MAP) {
-                bz_union_map_add(child_union_map, bz_value_copy(value));
-            } else {
-                /* If this value isn't a map, then we have an inconsistency. */
-                bz_bad_config
-                    ("%s is both a %s and a map",
-                     key, bz_value_kind_string(value->kind));
-                return NULL;
+static struct bz_value *
+bz_union_map__get_segment(void *user_data,
+                          const struct bz_key_segment *segment)
+{
+    struct bz_union_map  *map = user_data;
+    struct cork_hash_table_entry  *entry;
+    struct bz_union_map_entry  *cached;
+    bool  is_new;
+    unsigned int  stamp = bz_stamp_load(&change_counter);
+    unsigned int  layout = bz_stamp_load(&layout_counter);
+
+    entry = cork_hash_table_get_or_create_hash
+        (map->cache, segment->hash, (void *) segment->name, &is_new);
+    if (is_new) {
+        /* We haven't tried to retrieve this key yet. */
+        entry->key = (void *) bz_arena_strdup(map->arena, segment->name);
+        entry->value = cached = bz_arena_alloc
+            (map->arena, sizeof(struct bz_union_map_entry));
+    } else {
+        /* We've already seen this key, so return the cached result, unless the
+         * key or the layout of any union has changed since then. */
+        cached = entry->value;
+        if (CORK_LIKELY(cached->valid && cached->layout == layout &&
+                        !bz_bucket_changed_since
+                        (segment->bucket, cached->stamp))) {
+            if (CORK_UNLIKELY(bz_profiling)) {
+                bz_profile_union_lookup(map->name, BZ_PROFILE_CACHE_HIT);
             }
+            return cached->value;
         }
     }
 
-    entry->value = child_union_value;
-    return child_union_value;
+    if (CORK_UNLIKELY(bz_profiling)) {
+        bz_profile_union_lookup(map->name, BZ_PROFILE_CACHE_MISS);
+    }
+
+    /* Look in through each of the maps to see which ones define the key.  If
+     * there's an error, we'll try again the next time someone asks. */
+    cached->valid = false;
+    cached->value = NULL;
+    rpi_check(bz_union_map_find_key(map, segment, &cached->value));
+    cached->valid = true;
+    cached->stamp = stamp;
+    cached->layout = layout;
+    return cached->value;
 }
 
 static struct bz_value *
 bz_union_map__get(void *user_data, const char *key)
+{
+    struct bz_key_segment  segment;
+    bz_key_segment_init(&segment, key, strlen(key));
+    return bz_union_map__get_segment(user_data, &segment);
+}
+
+static int
+bz_union_map__iterate(void *user_data, void *iterate_user_data,
+                      bz_map_iterate_f iterate)
 {
     struct bz_union_map  *map = user_data;
-    struct cork_hash_table_entry  *entry;
-    bool  is_new;
+    size_t  i;
+    /* Keys that appear in more than one of the maps will be passed to the
+     * iterate function more than once. */
+    for (i = 0; i < cork_array_size(&map->maps); i++) {
+        struct bz_value  *element = cork_array_at(&map->maps, i);
+        rii_check(bz_map_value_iterate(element, iterate_user_data, iterate));
+    }
+    return 0;
+}
 
-    entry = cork_hash_table_get_or_create(map->cache, (void *) key, &is_new);
-    if (is_new) {
-        /* We haven't tried to retrieve this key yet.  Look in through each of
-         * the maps to see which ones define the key. */
-        return bz_union_map_find_key(map, key, entry);
-    } else {
-        /* We've already seen this key, so just returned the cached result. */
-        return entry->value;
+static struct bz_value *
+bz_union_map__get_key(void *user_data, const struct bz_key *key)
+{
+    struct bz_union_map  *map = user_data;
+    struct bz_value  *value;
+    size_t  i;
+
+    if (CORK_LIKELY(map->frozen == NULL)) {
+        return NULL;
     }
+
+    value = cork_hash_table_get_hash(map->frozen, key->hash, key);
+    if (value == NULL) {
+        return NULL;
+    }
+
+    /* If anything has changed that might affect this key's value, the snapshot
+     * is out of date. */
+    if (CORK_UNLIKELY
+        (bz_stamp_load(&layout_counter) != map->frozen_layout)) {
+        bz_union_map_thaw(map);
+        return NULL;
+    }
+    for (i = 0; i < key->count; i++) {
+        if (CORK_UNLIKELY(bz_bucket_changed_since
+                          (key->segments[i].bucket, map->frozen_stamp))) {
+            bz_union_map_thaw(map);
+            return NULL;
+        }
+    }
+    if (CORK_UNLIKELY(bz_profiling)) {
+        bz_profile_union_lookup(map->name, BZ_PROFILE_FROZEN_HIT);
+    }
+    return value;
 }
 
-struct bz_union_map *
-bz_union_map_new(void)
+static struct bz_union_map *
+bz_union_map_new_(struct bz_arena *arena)
 {
-    struct bz_union_map  *map = cork_new(struct bz_union_map);
+    struct bz_union_map  *map =
+        bz_arena_alloc(arena, sizeof(struct bz_union_map));
+    map->arena = arena;
+    map->name = NULL;
     map->cache = cork_string_hash_table_new(0, 0);
-    cork_hash_table_set_free_key(map->cache, (cork_free_f) cork_strfree);
+    if (arena == NULL) {
+        cork_hash_table_set_free_key(map->cache, (cork_free_f) cork_strfree);
+        cork_hash_table_set_free_value(map->cache, free);
+    }
     cork_pointer_array_init(&map->maps, (cork_free_f) bz_value_free);
     cork_pointer_array_init(&map->child_maps, (cork_free_f) bz_value_free);
-    map->value = bz_map_value_new
-        (map, bz_union_map__free, bz_union_map__get, NULL);
+    map->value = bz_map_value_new_
+        (arena, map, bz_union_map__free, bz_union_map__get, NULL);
+    map->value->_.map.get_segment = bz_union_map__get_segment;
+    map->value->_.map.get_key = bz_union_map__get_key;
+    map->value->_.map.iterate = bz_union_map__iterate;
+    map->frozen = NULL;
     return map;
 }
 
+struct bz_union_map *
+bz_union_map_new(void)
+{
+    return bz_union_map_new_(bz_arena_current());
+}
+
 void
-bz_union_map_add(struct bz_union_map *map, struct bz_value *element)
+bz_union_map_set_name(struct bz_union_map *map, const char *name)
+{
+    map->name = name;
+}
+
+/* The child maps that we create while looking up keys don't change the
+ * contents of the union, so they don't update the layout counter. */
+static void
+bz_union_map_add_(struct bz_union_map *map, struct bz_value *element)
 {
     assert(element->kind == BZ_VALUE_MAP);
     cork_array_append(&map->maps, element);
 }
 
+void
+bz_union_map_add(struct bz_union_map *map, struct bz_value *element)
+{
+    bz_union_map_add_(map, element);
+    cork_uint_atomic_add(&layout_counter, 1);
+    bz_new_generation();
+}
+
+void
+bz_union_map_insert(struct bz_union_map *map, size_t index,
+                    struct bz_value *element)
+{
+    struct bz_value  **elements;
+    size_t  count = cork_array_size(&map->maps);
+    assert(index <= count);
+    bz_union_map_add_(map, element);
+    elements = cork_array_elements(&map->maps);
+    memmove(&elements[index + 1], &elements[index],
+            (count - index) * sizeof(struct bz_value *));
+    elements[index] = element;
+    cork_uint_atomic_add(&layout_counter, 1);
+    bz_new_generation();
+}
+
 struct bz_value *
 bz_union_map_as_value(struct bz_union_map *map)
 {
     return map->value;
 }
+
+
+/*-----------------------------------------------------------------------
+ * Freezing a union of maps
+ */
+
+struct bz_union_map_freezer {
+    struct cork_hash_table  *frozen;
+    struct bz_value  *map;
+    struct cork_buffer  prefix;
+};
+
+static int
+bz_union_map_freeze_key(void *user_data, const char *key,
+                        struct bz_value *element)
+{
+    struct bz_union_map_freezer  *freezer = user_data;
+    size_t  prefix_size = freezer->prefix.size;
+    const struct bz_key  *full_key;
+    struct bz_value  *value;
+    bool  is_new;
+    struct cork_hash_table_entry  *entry;
+
+    if (prefix_size == 0) {
+        cork_buffer_set_string(&freezer->prefix, key);
+    } else {
+        cork_buffer_append_printf(&freezer->prefix, ".%s", key);
+    }
+    full_key = bz_key_intern(freezer->prefix.buf);
+    entry = cork_hash_table_get_or_create_hash
+        (freezer->frozen, full_key->hash, (void *) full_key, &is_new);
+    if (!is_new) {
+        /* An earlier map in the union already defined this key. */
+        cork_buffer_truncate(&freezer->prefix, prefix_size);
+        return 0;
+    }
+
+    /* Look up the key in the union to find out which of the maps' values wins
+     * (or to merge the child maps together, if that's what we find).  If
+     * there's an error, we leave the key out of the snapshot; looking it up
+     * later will report the same error. */
+    value = bz_map_value_get(freezer->map, key);
+    if (value == NULL) {
+        cork_error_clear();
+        cork_hash_table_delete_entry(freezer->frozen, entry);
+    } else {
+        entry->value = value;
+        if (value->kind == BZ_VALUE_MAP) {
+            struct bz_value  *parent = freezer->map;
+            freezer->map = value;
+            rii_check(bz_map_value_iterate
+                      (value, freezer, bz_union_map_freeze_key));
+            freezer->map = parent;
+        }
+    }
+    cork_buffer_truncate(&freezer->prefix, prefix_size);
+    return 0;
+}
+
+int
+bz_union_map_freeze(struct bz_union_map *map)
+{
+    int  rc;
+    struct bz_union_map_freezer  freezer;
+
+    bz_union_map_thaw(map);
+    freezer.frozen = cork_pointer_hash_table_new(0, 0);
+    freezer.map = map->value;
+    cork_buffer_init(&freezer.prefix);
+    /* If something changes while we're building the snapshot, we want to treat
+     * the snapshot as out of date, so grab the stamps first. */
+    map->frozen_stamp = bz_stamp_load(&change_counter);
+    map->frozen_layout = bz_stamp_load(&layout_counter);
+    rc = bz_map_value_iterate(map->value, &freezer, bz_union_map_freeze_key);
+    cork_buffer_done(&freezer.prefix);
+    if (CORK_UNLIKELY(rc != 0)) {
+        cork_hash_table_free(freezer.frozen);
+        return rc;
+    }
+    map->frozen = freezer.frozen;
+    return 0;
+}
+
+void
+bz_union_map_thaw(struct bz_union_map *map)
+{
+    if (map->frozen != NULL) {
+        cork_hash_table_free(map->frozen);
+        map->frozen = NULL;
+    }
+}
+
+bool
+bz_union_map_is_frozen(struct bz_union_map *map)
+{
+    return map->frozen != NULL;
+}
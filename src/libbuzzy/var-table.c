@@ -0,0 +1,395 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2015, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+/* Generated by make-var-table.py from the variable definitions in libbuzzy's
+ * source files.  Do not edit! */
+
+#include <string.h>
+
+#include <libcork/core.h>
+
+#include "buzzy/env.h"
+
+
+extern const struct bz_var_def  bz_var__arch;
+extern const struct bz_var_def  bz_var__autotools_configure_args;
+extern const struct bz_var_def  bz_var__autotools_configure_configure;
+extern const struct bz_var_def  bz_var__autotools_configure_configure_in;
+extern const struct bz_var_def  bz_var__bin_dir;
+extern const struct bz_var_def  bz_var__binary_package_dir;
+extern const struct bz_var_def  bz_var__build_dependencies;
+extern const struct bz_var_def  bz_var__build_dir;
+extern const struct bz_var_def  bz_var__builder;
+extern const struct bz_var_def  bz_var__cache_dir;
+extern const struct bz_var_def  bz_var__cmake_build_type;
+extern const struct bz_var_def  bz_var__cmake_cmakelists;
+extern const struct bz_var_def  bz_var__deb_arch;
+extern const struct bz_var_def  bz_var__deb_control_file;
+extern const struct bz_var_def  bz_var__deb_debian_dir;
+extern const struct bz_var_def  bz_var__deb_package_file;
+extern const struct bz_var_def  bz_var__deb_package_file_base;
+extern const struct bz_var_def  bz_var__deb_postinst_script;
+extern const struct bz_var_def  bz_var__deb_postrm_script;
+extern const struct bz_var_def  bz_var__deb_preinst_script;
+extern const struct bz_var_def  bz_var__deb_prerm_script;
+extern const struct bz_var_def  bz_var__deb_version;
+extern const struct bz_var_def  bz_var__dependencies;
+extern const struct bz_var_def  bz_var__doc_dir;
+extern const struct bz_var_def  bz_var__exec_prefix;
+extern const struct bz_var_def  bz_var__force;
+extern const struct bz_var_def  bz_var__homebrew_cellar;
+extern const struct bz_var_def  bz_var__homebrew_pkg_cellar;
+extern const struct bz_var_def  bz_var__homebrew_pkg_ver_cellar;
+extern const struct bz_var_def  bz_var__homebrew_prefix;
+extern const struct bz_var_def  bz_var__homebrew_staged_cellar;
+extern const struct bz_var_def  bz_var__lib_dir;
+extern const struct bz_var_def  bz_var__lib_dir_name;
+extern const struct bz_var_def  bz_var__libexec_dir;
+extern const struct bz_var_def  bz_var__license;
+extern const struct bz_var_def  bz_var__man_dir;
+extern const struct bz_var_def  bz_var__name;
+extern const struct bz_var_def  bz_var__native_cache;
+extern const struct bz_var_def  bz_var__native_name;
+extern const struct bz_var_def  bz_var__package_build_dir;
+extern const struct bz_var_def  bz_var__package_slug;
+extern const struct bz_var_def  bz_var__package_work_dir;
+extern const struct bz_var_def  bz_var__packager;
+extern const struct bz_var_def  bz_var__pacman_arch;
+extern const struct bz_var_def  bz_var__pacman_install;
+extern const struct bz_var_def  bz_var__pacman_install_base;
+extern const struct bz_var_def  bz_var__pacman_package_file;
+extern const struct bz_var_def  bz_var__pacman_package_file_base;
+extern const struct bz_var_def  bz_var__pacman_pkgbuild;
+extern const struct bz_var_def  bz_var__pacman_pkgext;
+extern const struct bz_var_def  bz_var__pacman_pkgrel;
+extern const struct bz_var_def  bz_var__pacman_version;
+extern const struct bz_var_def  bz_var__post_install_script;
+extern const struct bz_var_def  bz_var__post_remove_script;
+extern const struct bz_var_def  bz_var__pre_install_script;
+extern const struct bz_var_def  bz_var__pre_remove_script;
+extern const struct bz_var_def  bz_var__prefix;
+extern const struct bz_var_def  bz_var__relocatable;
+extern const struct bz_var_def  bz_var__repo_base_dir;
+extern const struct bz_var_def  bz_var__repo_config_dir;
+extern const struct bz_var_def  bz_var__repo_git_dir;
+extern const struct bz_var_def  bz_var__repo_links_yaml;
+extern const struct bz_var_def  bz_var__repo_package_yaml;
+extern const struct bz_var_def  bz_var__repo_repo_yaml;
+extern const struct bz_var_def  bz_var__repo_dir;
+extern const struct bz_var_def  bz_var__rpm_arch;
+extern const struct bz_var_def  bz_var__rpm_package_file;
+extern const struct bz_var_def  bz_var__rpm_package_file_base;
+extern const struct bz_var_def  bz_var__rpm_spec_file;
+extern const struct bz_var_def  bz_var__rpm_version;
+extern const struct bz_var_def  bz_var__rpm_version_r;
+extern const struct bz_var_def  bz_var__rpm_version_v;
+extern const struct bz_var_def  bz_var__sbin_dir;
+extern const struct bz_var_def  bz_var__share_dir;
+extern const struct bz_var_def  bz_var__source_dir;
+extern const struct bz_var_def  bz_var__staging_dir;
+extern const struct bz_var_def  bz_var__verbose;
+extern const struct bz_var_def  bz_var__version;
+extern const struct bz_var_def  bz_var__work_dir;
+
+static const struct bz_var_def  bz_var_prefix__autotools = {
+    { "autotools", "", "" }, NULL
+};
+static const struct bz_var_def  bz_var_prefix__autotools__configure = {
+    { "autotools.configure", "", "" }, NULL
+};
+static const struct bz_var_def  bz_var_prefix__cmake = {
+    { "cmake", "", "" }, NULL
+};
+static const struct bz_var_def  bz_var_prefix__deb = {
+    { "deb", "", "" }, NULL
+};
+static const struct bz_var_def  bz_var_prefix__homebrew = {
+    { "homebrew", "", "" }, NULL
+};
+static const struct bz_var_def  bz_var_prefix__pacman = {
+    { "pacman", "", "" }, NULL
+};
+static const struct bz_var_def  bz_var_prefix__repo = {
+    { "repo", "", "" }, NULL
+};
+static const struct bz_var_def  bz_var_prefix__rpm = {
+    { "rpm", "", "" }, NULL
+};
+
+#define BZ_VAR_DEF_COUNT  87
+#define BZ_VAR_SLOT_COUNT  128
+#define BZ_VAR_BUCKET_COUNT  32
+
+static const struct bz_var_def  *const defs[] = {
+    &bz_var__arch,
+    &bz_var_prefix__autotools,
+    &bz_var_prefix__autotools__configure,
+    &bz_var__autotools_configure_args,
+    &bz_var__autotools_configure_configure,
+    &bz_var__autotools_configure_configure_in,
+    &bz_var__bin_dir,
+    &bz_var__binary_package_dir,
+    &bz_var__build_dependencies,
+    &bz_var__build_dir,
+    &bz_var__builder,
+    &bz_var__cache_dir,
+    &bz_var_prefix__cmake,
+    &bz_var__cmake_build_type,
+    &bz_var__cmake_cmakelists,
+    &bz_var_prefix__deb,
+    &bz_var__deb_arch,
+    &bz_var__deb_control_file,
+    &bz_var__deb_debian_dir,
+    &bz_var__deb_package_file,
+    &bz_var__deb_package_file_base,
+    &bz_var__deb_postinst_script,
+    &bz_var__deb_postrm_script,
+    &bz_var__deb_preinst_script,
+    &bz_var__deb_prerm_script,
+    &bz_var__deb_version,
+    &bz_var__dependencies,
+    &bz_var__doc_dir,
+    &bz_var__exec_prefix,
+    &bz_var__force,
+    &bz_var_prefix__homebrew,
+    &bz_var__homebrew_cellar,
+    &bz_var__homebrew_pkg_cellar,
+    &bz_var__homebrew_pkg_ver_cellar,
+    &bz_var__homebrew_prefix,
+    &bz_var__homebrew_staged_cellar,
+    &bz_var__lib_dir,
+    &bz_var__lib_dir_name,
+    &bz_var__libexec_dir,
+    &bz_var__license,
+    &bz_var__man_dir,
+    &bz_var__name,
+    &bz_var__native_cache,
+    &bz_var__native_name,
+    &bz_var__package_build_dir,
+    &bz_var__package_slug,
+    &bz_var__package_work_dir,
+    &bz_var__packager,
+    &bz_var_prefix__pacman,
+    &bz_var__pacman_arch,
+    &bz_var__pacman_install,
+    &bz_var__pacman_install_base,
+    &bz_var__pacman_package_file,
+    &bz_var__pacman_package_file_base,
+    &bz_var__pacman_pkgbuild,
+    &bz_var__pacman_pkgext,
+    &bz_var__pacman_pkgrel,
+    &bz_var__pacman_version,
+    &bz_var__post_install_script,
+    &bz_var__post_remove_script,
+    &bz_var__pre_install_script,
+    &bz_var__pre_remove_script,
+    &bz_var__prefix,
+    &bz_var__relocatable,
+    &bz_var_prefix__repo,
+    &bz_var__repo_base_dir,
+    &bz_var__repo_config_dir,
+    &bz_var__repo_git_dir,
+    &bz_var__repo_links_yaml,
+    &bz_var__repo_package_yaml,
+    &bz_var__repo_repo_yaml,
+    &bz_var__repo_dir,
+    &bz_var_prefix__rpm,
+    &bz_var__rpm_arch,
+    &bz_var__rpm_package_file,
+    &bz_var__rpm_package_file_base,
+    &bz_var__rpm_spec_file,
+    &bz_var__rpm_version,
+    &bz_var__rpm_version_r,
+    &bz_var__rpm_version_v,
+    &bz_var__sbin_dir,
+    &bz_var__share_dir,
+    &bz_var__source_dir,
+    &bz_var__staging_dir,
+    &bz_var__verbose,
+    &bz_var__version,
+    &bz_var__work_dir,
+};
+
+static const uint16_t  displacements[] = {
+    5, 0, 5, 2, 2, 6, 1, 1,
+    6, 2, 11, 8, 5, 2, 2, 3,
+    1, 6, 2, 2, 3, 17, 4, 4,
+    2, 1, 7, 20, 3, 38, 7, 3,
+};
+
+static const struct bz_var_def  *const slots[] = {
+    NULL,
+    NULL,
+    &bz_var__deb_debian_dir,
+    NULL,
+    NULL,
+    &bz_var__rpm_package_file_base,
+    NULL,
+    &bz_var__license,
+    NULL,
+    NULL,
+    &bz_var__native_name,
+    NULL,
+    &bz_var_prefix__homebrew,
+    &bz_var__native_cache,
+    &bz_var__cmake_build_type,
+    &bz_var__homebrew_prefix,
+    &bz_var_prefix__autotools,
+    &bz_var__deb_prerm_script,
+    NULL,
+    &bz_var__package_slug,
+    &bz_var_prefix__rpm,
+    &bz_var__autotools_configure_configure,
+    &bz_var__force,
+    &bz_var__repo_git_dir,
+    NULL,
+    NULL,
+    NULL,
+    &bz_var__pacman_version,
+    NULL,
+    &bz_var__deb_control_file,
+    NULL,
+    &bz_var__arch,
+    &bz_var__autotools_configure_args,
+    &bz_var__deb_package_file,
+    &bz_var__package_work_dir,
+    &bz_var__lib_dir,
+    NULL,
+    &bz_var__deb_preinst_script,
+    NULL,
+    &bz_var__deb_package_file_base,
+    &bz_var__source_dir,
+    &bz_var__rpm_version_v,
+    &bz_var__rpm_package_file,
+    &bz_var__rpm_spec_file,
+    &bz_var__bin_dir,
+    &bz_var_prefix__cmake,
+    &bz_var__doc_dir,
+    &bz_var_prefix__deb,
+    &bz_var__verbose,
+    &bz_var__binary_package_dir,
+    &bz_var__prefix,
+    &bz_var__pacman_install_base,
+    NULL,
+    NULL,
+    &bz_var__repo_config_dir,
+    &bz_var__deb_postinst_script,
+    NULL,
+    NULL,
+    &bz_var__rpm_version,
+    NULL,
+    &bz_var__builder,
+    &bz_var__build_dir,
+    &bz_var__deb_version,
+    NULL,
+    &bz_var__version,
+    &bz_var__homebrew_pkg_ver_cellar,
+    &bz_var__pacman_pkgext,
+    NULL,
+    &bz_var__lib_dir_name,
+    &bz_var__sbin_dir,
+    &bz_var__homebrew_staged_cellar,
+    NULL,
+    &bz_var__rpm_arch,
+    NULL,
+    &bz_var__pre_remove_script,
+    &bz_var__repo_dir,
+    &bz_var__repo_repo_yaml,
+    &bz_var__repo_package_yaml,
+    &bz_var__work_dir,
+    &bz_var__libexec_dir,
+    &bz_var__pre_install_script,
+    &bz_var__cmake_cmakelists,
+    &bz_var__cache_dir,
+    &bz_var__rpm_version_r,
+    NULL,
+    &bz_var__autotools_configure_configure_in,
+    NULL,
+    &bz_var__relocatable,
+    &bz_var__pacman_package_file,
+    &bz_var__homebrew_pkg_cellar,
+    &bz_var__pacman_install,
+    &bz_var__homebrew_cellar,
+    &bz_var_prefix__pacman,
+    &bz_var__repo_base_dir,
+    &bz_var__deb_arch,
+    &bz_var__pacman_arch,
+    &bz_var__name,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    &bz_var_prefix__autotools__configure,
+    NULL,
+    &bz_var__post_remove_script,
+    &bz_var_prefix__repo,
+    &bz_var__package_build_dir,
+    &bz_var__share_dir,
+    &bz_var__build_dependencies,
+    &bz_var__post_install_script,
+    &bz_var__deb_postrm_script,
+    NULL,
+    &bz_var__repo_links_yaml,
+    &bz_var__pacman_package_file_base,
+    NULL,
+    &bz_var__pacman_pkgrel,
+    NULL,
+    NULL,
+    NULL,
+    &bz_var__man_dir,
+    &bz_var__exec_prefix,
+    &bz_var__staging_dir,
+    NULL,
+    &bz_var__pacman_pkgbuild,
+    NULL,
+    &bz_var__packager,
+    NULL,
+    &bz_var__dependencies,
+};
+
+static uint32_t
+var_hash(uint32_t seed, const char *name)
+{
+    uint32_t  h = UINT32_C(2166136261) ^ seed;
+    for (; *name != '\0'; name++) {
+        h ^= (uint8_t) *name;
+        h *= UINT32_C(16777619);
+    }
+    h ^= h >> 16;
+    h *= UINT32_C(0x7feb352d);
+    h ^= h >> 15;
+    return h;
+}
+
+const struct bz_var_def *
+bz_var_def_find(const char *name)
+{
+    uint32_t  bucket = var_hash(0, name) & (BZ_VAR_BUCKET_COUNT - 1);
+    uint32_t  slot =
+        var_hash(displacements[bucket], name) & (BZ_VAR_SLOT_COUNT - 1);
+    const struct bz_var_def  *def = slots[slot];
+    if (def != NULL && strcmp(def->doc.name, name) == 0) {
+        return def;
+    } else {
+        return NULL;
+    }
+}
+
+const struct bz_var_def *
+bz_var_def_get(size_t index)
+{
+    return defs[index];
+}
+
+size_t
+bz_var_def_count(void)
+{
+    return BZ_VAR_DEF_COUNT;
+}
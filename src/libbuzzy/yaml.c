@@ -7,13 +7,24 @@
  * ----------------------------------------------------------------------
  */
 
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
 #include <clogger.h>
 #include <libcork/core.h>
 #include <libcork/helpers/errors.h>
+#include <libcork/helpers/posix.h>
 #include <yaml.h>
 
+#include "buzzy/arena.h"
 #include "buzzy/env.h"
 #include "buzzy/error.h"
+#include "buzzy/mock.h"
 #include "buzzy/os.h"
 #include "buzzy/yaml.h"
 
@@ -289,19 +300,1114 @@ bz_yaml_value_new(yaml_document_t *doc)
     return result;
 }
 
-struct bz_value *
-bz_yaml_value_new_from_file(const char *path)
+
+/*-----------------------------------------------------------------------
+ * Compiled YAML files
+ */
+
+/* Running the YAML parser is by far the most expensive part of loading a YAML
+ * file, and the files that we load on every run (buzzy.yaml, repo.yaml,
+ * package.yaml) rarely change.  So whenever we parse one of them, we save a
+ * compiled copy of it in the cache directory.  The next time we load the file,
+ * if it hasn't changed, we map the compiled copy into memory and build the
+ * values directly from it, without running the parser at all.
+ *
+ * A compiled file starts with a header describing the source file that it was
+ * compiled from, followed by the source file's path, a preorder list of nodes,
+ * and a pool of NUL-terminated strings.  Everything is in the native byte
+ * order, since the cache never leaves the current machine.
+ *
+ * The YAML parser reads files directly, and not via the mockable wrappers in
+ * buzzy/os.h, so the cache does too. */
+
+#define BZ_YAML_CACHE_MAGIC  "buzzy yaml 1\n"
+
+struct bz_yaml_cache_header {
+    char  magic[16];
+    uint64_t  size;
+    int64_t  mtime_sec;
+    int64_t  mtime_nsec;
+    cork_big_hash  hash;
+    uint32_t  path_length;
+    uint32_t  node_count;
+    uint32_t  strings_size;
+};
+
+/* Literals don't contain any variable references, so we can use their content
+ * as-is; templates have to be compiled into an interpolated value.  Arrays and
+ * maps are followed by their elements; each element of a map is a literal
+ * (its key) followed by the key's value. */
+enum bz_yaml_cache_kind {
+    BZ_YAML_CACHE_LITERAL,
+    BZ_YAML_CACHE_TEMPLATE,
+    BZ_YAML_CACHE_ARRAY,
+    BZ_YAML_CACHE_MAP
+};
+
+struct bz_yaml_cache_node {
+    uint32_t  kind;
+    /* A string offset for scalars, and an element count for arrays and maps */
+    uint32_t  arg;
+};
+
+#define bz_yaml_cache_align(size)  (((size) + 7) & ~((size_t) 7))
+
+static int
+bz_yaml_file_stamp(const char *path_string, struct bz_file_stamp *stamp)
 {
-    yaml_document_t  doc;
-    clog_debug("Load YAML file %s", path);
-    rpi_check(bz_load_yaml_file(&doc, path));
-    return bz_yaml_value_new(&doc);
+    int  rc;
+    struct cork_path  *path = cork_path_new(path_string);
+    rc = bz_real__file_stamp(path, stamp);
+    cork_path_free(path);
+    return rc;
+}
+
+static int
+bz_yaml_map_file(const char *path_string, const char **buf, size_t *size)
+{
+    int  rc;
+    struct cork_path  *path = cork_path_new(path_string);
+    rc = bz_real__map_file(path, buf, size);
+    cork_path_free(path);
+    return rc;
+}
+
+static bool  cache_dir_overridden = false;
+static const char  *cache_dir_override = NULL;
+
+static void
+bz_yaml_cache_dir_free(void)
+{
+    if (cache_dir_override != NULL) {
+        cork_strfree(cache_dir_override);
+        cache_dir_override = NULL;
+    }
+}
+
+void
+bz_yaml_set_cache_dir(const char *dir)
+{
+    if (!cache_dir_overridden) {
+        cork_cleanup_at_exit(0, bz_yaml_cache_dir_free);
+        cache_dir_overridden = true;
+    }
+    bz_yaml_cache_dir_free();
+    cache_dir_override = (dir == NULL)? NULL: cork_strdup(dir);
+}
+
+/* Fills in dest with the directory that holds our compiled YAML files, or
+ * returns false if the cache is turned off.  We need the cache while we're
+ * loading the configuration files that could override cache_dir, so it can't
+ * be controlled by a Buzzy variable.  Instead it lives in buzzy/yaml within the
+ * user's cache directory, unless you choose some other directory (or turn it
+ * off) via bz_yaml_set_cache_dir or $BUZZY_YAML_CACHE_DIR.  If we can't create
+ * the default directory, we quietly do without the cache. */
+static bool
+bz_yaml_cache_dir(struct cork_buffer *dest)
+{
+    const char  *env_dir;
+    struct cork_path  *path;
+    struct cork_file  *file;
+
+    if (cache_dir_overridden) {
+        if (cache_dir_override == NULL) {
+            return false;
+        }
+        cork_buffer_set_string(dest, cache_dir_override);
+        return true;
+    }
+
+    env_dir = getenv("BUZZY_YAML_CACHE_DIR");
+    if (env_dir != NULL) {
+        if (*env_dir == '\0') {
+            return false;
+        }
+        cork_buffer_set_string(dest, env_dir);
+        return true;
+    }
+
+    path = cork_path_user_cache_path();
+    if (CORK_UNLIKELY(path == NULL)) {
+        clog_debug("Cannot find cache directory for compiled YAML files: %s",
+                   cork_error_message());
+        cork_error_clear();
+        return false;
+    }
+    cork_path_append(path, "buzzy/yaml");
+    cork_buffer_set_string(dest, cork_path_get(path));
+    file = bz_real__create_dir(path, 0750);
+    if (CORK_UNLIKELY(file == NULL)) {
+        clog_debug("Cannot create %s: %s",
+                   (char *) dest->buf, cork_error_message());
+        cork_error_clear();
+        return false;
+    }
+    cork_file_free(file);
+    return true;
+}
+
+/* Each source file's compiled copy is named after a hash of its path. */
+static void
+bz_yaml_cache_path(struct cork_buffer *dest, const char *dir, const char *path)
+{
+    cork_big_hash  seed = CORK_BIG_HASH_INIT();
+    cork_big_hash  hash = cork_big_hash_buffer(seed, path, strlen(path));
+    cork_buffer_printf
+        (dest, "%s/%016" PRIx64 "%016" PRIx64, dir,
+         cork_u128_be64(hash.u128, 0), cork_u128_be64(hash.u128, 1));
+}
+
+/* A compiled file that stays mapped into memory until its arena is freed */
+struct bz_yaml_mapping {
+    const char  *buf;
+    size_t  size;
+};
+
+static void
+bz_yaml_mapping__free(void *user_data)
+{
+    struct bz_yaml_mapping  *mapping = user_data;
+    bz_real__unmap_file(mapping->buf, mapping->size);
+}
+
+
+/* The source file that we're loading, which stays mapped into memory while we
+ * load it. */
+struct bz_yaml_source {
+    const char  *path;
+    struct bz_file_stamp  stamp;
+    const char  *buf;
+    size_t  size;
+    cork_big_hash  hash;
+};
+
+/* Returns false if we can't use the cache for this file (most likely because
+ * it doesn't exist); the caller should parse it as usual to report the error. */
+static bool
+bz_yaml_source_open(struct bz_yaml_source *source, const char *path)
+{
+    cork_big_hash  seed = CORK_BIG_HASH_INIT();
+    source->path = path;
+    if (bz_yaml_file_stamp(path, &source->stamp) != 0) {
+        cork_error_clear();
+        return false;
+    }
+    if (!source->stamp.exists) {
+        return false;
+    }
+    if (bz_yaml_map_file(path, &source->buf, &source->size) != 0) {
+        cork_error_clear();
+        return false;
+    }
+    source->hash = cork_big_hash_buffer(seed, source->buf, source->size);
+    return true;
+}
+
+static void
+bz_yaml_source_done(struct bz_yaml_source *source)
+{
+    bz_real__unmap_file(source->buf, source->size);
+}
+
+
+/* Loading compiled files */
+
+struct bz_yaml_cache_reader {
+    const struct bz_yaml_cache_node  *nodes;
+    uint32_t  node_count;
+    uint32_t  next;
+    const char  *strings;
+    uint32_t  strings_size;
+    /* Whether literals can point directly into the compiled file.  We can only
+     * do that if the values live in an arena, since the arena is what keeps
+     * the compiled file mapped into memory. */
+    bool  zero_copy;
+};
+
+static const char *
+bz_yaml_cache_literal__get(void *user_data, struct bz_value *ctx)
+{
+    const char  *content = user_data;
+    return content;
+}
+
+static const struct bz_yaml_cache_node *
+bz_yaml_cache_read_next(struct bz_yaml_cache_reader *reader)
+{
+    if (CORK_UNLIKELY(reader->next >= reader->node_count)) {
+        bz_bad_config("Compiled YAML file is truncated");
+        return NULL;
+    }
+    return &reader->nodes[reader->next++];
+}
+
+static const char *
+bz_yaml_cache_read_string(struct bz_yaml_cache_reader *reader,
+                          const struct bz_yaml_cache_node *node)
+{
+    /* We've already verified that the string pool ends with a NUL, so every
+     * offset within the pool points at a valid string. */
+    if (CORK_UNLIKELY(node->arg >= reader->strings_size)) {
+        bz_bad_config("Compiled YAML file has a bad string offset");
+        return NULL;
+    }
+    return reader->strings + node->arg;
+}
+
+static struct bz_value *
+bz_yaml_cache_read_node(struct bz_yaml_cache_reader *reader);
+
+static struct bz_value *
+bz_yaml_cache_read_array(struct bz_yaml_cache_reader *reader, uint32_t count)
+{
+    uint32_t  i;
+    struct bz_array  *array;
+
+    array = bz_array_new();
+    for (i = 0; i < count; i++) {
+        struct bz_value  *element;
+        ep_check(element = bz_yaml_cache_read_node(reader));
+        bz_array_append(array, element);
+    }
+    return bz_array_as_value(array);
+
+error:
+    bz_value_free(bz_array_as_value(array));
+    return NULL;
+}
+
+static struct bz_value *
+bz_yaml_cache_read_map(struct bz_yaml_cache_reader *reader, uint32_t count)
+{
+    uint32_t  i;
+    struct bz_value  *map;
+
+    map = bz_map_new();
+    for (i = 0; i < count; i++) {
+        const struct bz_yaml_cache_node  *key_node;
+        const char  *key;
+        struct bz_value  *value;
+
+        ep_check(key_node = bz_yaml_cache_read_next(reader));
+        if (CORK_UNLIKELY(key_node->kind != BZ_YAML_CACHE_LITERAL)) {
+            bz_bad_config("Mapping key must be a string");
+            goto error;
+        }
+        ep_check(key = bz_yaml_cache_read_string(reader, key_node));
+        ep_check(value = bz_yaml_cache_read_node(reader));
+        ei_check(bz_map_value_add(map, key, value, false));
+    }
+    return map;
+
+error:
+    bz_value_free(map);
+    return NULL;
+}
+
+static struct bz_value *
+bz_yaml_cache_read_node(struct bz_yaml_cache_reader *reader)
+{
+    const struct bz_yaml_cache_node  *node;
+    const char  *content;
+
+    rpp_check(node = bz_yaml_cache_read_next(reader));
+    switch (node->kind) {
+        case BZ_YAML_CACHE_LITERAL:
+            rpp_check(content = bz_yaml_cache_read_string(reader, node));
+            if (reader->zero_copy) {
+                return bz_scalar_value_new
+                    ((void *) content, NULL, bz_yaml_cache_literal__get);
+            }
+            return bz_string_value_new(content);
+
+        case BZ_YAML_CACHE_TEMPLATE:
+            rpp_check(content = bz_yaml_cache_read_string(reader, node));
+            return bz_interpolated_value_new(content);
+
+        case BZ_YAML_CACHE_ARRAY:
+            return bz_yaml_cache_read_array(reader, node->arg);
+
+        case BZ_YAML_CACHE_MAP:
+            return bz_yaml_cache_read_map(reader, node->arg);
+
+        default:
+            bz_bad_config("Compiled YAML file has a bad node");
+            return NULL;
+    }
+}
+
+/* Returns NULL if there isn't an up-to-date compiled copy of the source file,
+ * in which case the caller should parse the source file itself. */
+static struct bz_value *
+bz_yaml_cache_load(struct bz_yaml_source *source, const char *cache_path)
+{
+    struct bz_arena  *arena = bz_arena_current();
+    struct bz_file_stamp  stamp;
+    struct bz_yaml_cache_header  header;
+    struct bz_yaml_cache_reader  reader;
+    struct bz_value  *result;
+    size_t  path_length = strlen(source->path);
+    size_t  nodes_offset;
+    const char  *buf;
+    size_t  size;
+
+    if (bz_yaml_file_stamp(cache_path, &stamp) != 0) {
+        cork_error_clear();
+        return NULL;
+    }
+    if (!stamp.exists) {
+        clog_debug("No compiled copy of %s", source->path);
+        return NULL;
+    }
+    if (bz_yaml_map_file(cache_path, &buf, &size) != 0) {
+        cork_error_clear();
+        return NULL;
+    }
+
+    nodes_offset = bz_yaml_cache_align(sizeof(header) + path_length);
+    if (size < nodes_offset) {
+        goto out_of_date;
+    }
+    memcpy(&header, buf, sizeof(header));
+    if (memcmp(header.magic, BZ_YAML_CACHE_MAGIC,
+               sizeof(BZ_YAML_CACHE_MAGIC)) != 0 ||
+        header.size != source->size ||
+        header.mtime_sec != source->stamp.mtime_sec ||
+        header.mtime_nsec != source->stamp.mtime_nsec ||
+        !cork_big_hash_equal(header.hash, source->hash) ||
+        header.path_length != path_length ||
+        memcmp(buf + sizeof(header), source->path, path_length) != 0 ||
+        size != nodes_offset +
+                (size_t) header.node_count * sizeof(struct bz_yaml_cache_node) +
+                header.strings_size ||
+        (header.strings_size > 0 && buf[size - 1] != '\0')) {
+        goto out_of_date;
+    }
+
+    reader.nodes = (const struct bz_yaml_cache_node *) (buf + nodes_offset);
+    reader.node_count = header.node_count;
+    reader.next = 0;
+    reader.strings = buf + size - header.strings_size;
+    reader.strings_size = header.strings_size;
+    reader.zero_copy = (arena != NULL);
+    clog_debug("Load compiled copy of %s from %s", source->path, cache_path);
+    result = bz_yaml_cache_read_node(&reader);
+    if (CORK_UNLIKELY(result == NULL || reader.next != reader.node_count)) {
+        clog_debug("Compiled copy %s is corrupt", cache_path);
+        if (result != NULL) {
+            bz_value_free(result);
+        }
+        cork_error_clear();
+        bz_real__unmap_file(buf, size);
+        return NULL;
+    }
+
+    if (reader.zero_copy) {
+        struct bz_yaml_mapping  *mapping =
+            bz_arena_alloc(arena, sizeof(struct bz_yaml_mapping));
+        mapping->buf = buf;
+        mapping->size = size;
+        bz_arena_add_cleanup(arena, mapping, bz_yaml_mapping__free);
+    } else {
+        bz_real__unmap_file(buf, size);
+    }
+    return result;
+
+out_of_date:
+    clog_debug("Compiled copy %s is out of date", cache_path);
+    bz_real__unmap_file(buf, size);
+    return NULL;
+}
+
+
+/* Saving compiled files */
+
+/* We compile a file while we're parsing it, so we don't know how many elements
+ * an array or map has until we reach its end; we fill in the count then. */
+struct bz_yaml_compiler {
+    struct cork_buffer  nodes;
+    struct cork_buffer  strings;
+    uint32_t  node_count;
+};
+
+static void
+bz_yaml_compiler_init(struct bz_yaml_compiler *compiler)
+{
+    cork_buffer_init(&compiler->nodes);
+    cork_buffer_init(&compiler->strings);
+    compiler->node_count = 0;
+}
+
+static void
+bz_yaml_compiler_done(struct bz_yaml_compiler *compiler)
+{
+    cork_buffer_done(&compiler->nodes);
+    cork_buffer_done(&compiler->strings);
+}
+
+static void
+bz_yaml_compile_add_node(struct bz_yaml_compiler *compiler,
+                         enum bz_yaml_cache_kind kind, size_t arg)
+{
+    struct bz_yaml_cache_node  node;
+    node.kind = kind;
+    node.arg = arg;
+    cork_buffer_append(&compiler->nodes, &node, sizeof(node));
+    compiler->node_count++;
+}
+
+static void
+bz_yaml_compile_set_count(struct bz_yaml_compiler *compiler, uint32_t index,
+                          size_t count)
+{
+    struct bz_yaml_cache_node  *nodes = compiler->nodes.buf;
+    nodes[index].arg = count;
+}
+
+static void
+bz_yaml_compile_string(struct bz_yaml_compiler *compiler,
+                       enum bz_yaml_cache_kind kind, const char *content)
+{
+    bz_yaml_compile_add_node(compiler, kind, compiler->strings.size);
+    cork_buffer_append(&compiler->strings, content, strlen(content) + 1);
+}
+
+/* Files are keyed by a hash of their source path, so the cache would grow
+ * without bound as the user builds in different directories.  Whenever we save
+ * a new compiled file, we make sure that there aren't more than this many, and
+ * remove the ones that were saved least recently if there are. */
+#define BZ_YAML_CACHE_MAX_FILES  256
+
+struct bz_yaml_cache_entry {
+    const char  *path;
+    int64_t  mtime_sec;
+    int64_t  mtime_nsec;
+};
+
+struct bz_yaml_cache_walker {
+    struct cork_dir_walker  parent;
+    cork_array(struct bz_yaml_cache_entry)  entries;
+};
+
+static int
+bz_yaml_cache_walker__file(struct cork_dir_walker *vwalker,
+                           const char *full_path, const char *rel_path,
+                           const char *base_name)
+{
+    struct bz_yaml_cache_walker  *walker =
+        cork_container_of(vwalker, struct bz_yaml_cache_walker, parent);
+    struct bz_file_stamp  stamp;
+    struct bz_yaml_cache_entry  *entry;
+
+    /* Skip anything that isn't a compiled file, including the temporary files
+     * that another process might be writing right now. */
+    if (strchr(rel_path, '/') != NULL || strchr(base_name, '.') != NULL) {
+        return 0;
+    }
+    if (bz_yaml_file_stamp(full_path, &stamp) != 0) {
+        /* Another process might have just removed it. */
+        cork_error_clear();
+        return 0;
+    }
+    entry = cork_array_append_get(&walker->entries);
+    entry->path = cork_strdup(full_path);
+    entry->mtime_sec = stamp.mtime_sec;
+    entry->mtime_nsec = stamp.mtime_nsec;
+    return 0;
+}
+
+static int
+bz_yaml_cache_walker__directory(struct cork_dir_walker *walker,
+                                const char *full_path, const char *rel_path,
+                                const char *base_name)
+{
+    return 0;
+}
+
+static int
+bz_yaml_cache_entry_cmp(const void *vp1, const void *vp2)
+{
+    const struct bz_yaml_cache_entry  *e1 = vp1;
+    const struct bz_yaml_cache_entry  *e2 = vp2;
+    if (e1->mtime_sec != e2->mtime_sec) {
+        return (e1->mtime_sec < e2->mtime_sec)? -1: 1;
+    }
+    if (e1->mtime_nsec != e2->mtime_nsec) {
+        return (e1->mtime_nsec < e2->mtime_nsec)? -1: 1;
+    }
+    return 0;
+}
+
+static int
+bz_yaml_cache_prune(const char *dir)
+{
+    int  rc;
+    size_t  i;
+    size_t  count;
+    struct bz_yaml_cache_walker  walker;
+
+    walker.parent.enter_directory = bz_yaml_cache_walker__directory;
+    walker.parent.file = bz_yaml_cache_walker__file;
+    walker.parent.leave_directory = bz_yaml_cache_walker__directory;
+    cork_array_init(&walker.entries);
+    rc = bz_real__walk_directory(dir, &walker.parent);
+
+    count = cork_array_size(&walker.entries);
+    if (rc == 0 && count > BZ_YAML_CACHE_MAX_FILES) {
+        qsort(cork_array_elements(&walker.entries), count,
+              sizeof(struct bz_yaml_cache_entry), bz_yaml_cache_entry_cmp);
+        for (i = 0; i < count - BZ_YAML_CACHE_MAX_FILES; i++) {
+            struct bz_yaml_cache_entry  *entry =
+                &cork_array_at(&walker.entries, i);
+            clog_debug("Remove compiled YAML file %s", entry->path);
+            /* Another process might have removed it already. */
+            unlink(entry->path);
+        }
+    }
+
+    for (i = 0; i < count; i++) {
+        cork_strfree(cork_array_at(&walker.entries, i).path);
+    }
+    cork_array_done(&walker.entries);
+    return rc;
+}
+
+static int
+bz_yaml_cache_save(struct bz_yaml_source *source,
+                   struct bz_yaml_compiler *compiler,
+                   const char *dir, const char *cache_path)
+{
+    static const char  padding[8] = { 0 };
+    struct bz_yaml_cache_header  header;
+    struct cork_buffer  buf = CORK_BUFFER_INIT();
+    struct cork_buffer  temp_path = CORK_BUFFER_INIT();
+    struct cork_file  *file;
+    int  fd;
+    ssize_t  bytes_written;
+    size_t  path_length = strlen(source->path);
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, BZ_YAML_CACHE_MAGIC, sizeof(BZ_YAML_CACHE_MAGIC));
+    header.size = source->size;
+    header.mtime_sec = source->stamp.mtime_sec;
+    header.mtime_nsec = source->stamp.mtime_nsec;
+    header.hash = source->hash;
+    header.path_length = path_length;
+    header.node_count = compiler->node_count;
+    header.strings_size = compiler->strings.size;
+
+    cork_buffer_append(&buf, &header, sizeof(header));
+    cork_buffer_append(&buf, source->path, path_length);
+    cork_buffer_append
+        (&buf, padding, bz_yaml_cache_align(buf.size) - buf.size);
+    cork_buffer_append_copy(&buf, &compiler->nodes);
+    cork_buffer_append_copy(&buf, &compiler->strings);
+
+    /* Another process (or thread) might have the existing compiled copy mapped
+     * into memory, so we can't overwrite it in place.  Instead we write the new
+     * copy to a uniquely named temporary file and move it into place. */
+    cork_buffer_printf(&temp_path, "%s.XXXXXX", cache_path);
+    ep_check(file = bz_real__create_dir(cork_path_new(dir), 0750));
+    cork_file_free(file);
+    ei_check_posix(fd = mkstemp(temp_path.buf));
+    bytes_written = write(fd, buf.buf, buf.size);
+    if (CORK_UNLIKELY(bytes_written == -1)) {
+        cork_system_error_set();
+        goto error_open;
+    } else if (CORK_UNLIKELY((size_t) bytes_written != buf.size)) {
+        cork_error_set_printf
+            (ENOSPC, "Cannot write %zu bytes to %s",
+             buf.size, (char *) temp_path.buf);
+        goto error_open;
+    }
+    if (CORK_UNLIKELY(fchmod(fd, 0640) != 0)) {
+        cork_system_error_set();
+        goto error_open;
+    }
+    if (CORK_UNLIKELY(close(fd) != 0)) {
+        cork_system_error_set();
+        unlink(temp_path.buf);
+        goto error;
+    }
+    if (CORK_UNLIKELY(rename(temp_path.buf, cache_path) != 0)) {
+        cork_system_error_set();
+        unlink(temp_path.buf);
+        goto error;
+    }
+
+    cork_buffer_done(&buf);
+    cork_buffer_done(&temp_path);
+    return bz_yaml_cache_prune(dir);
+
+error_open:
+    close(fd);
+    unlink(temp_path.buf);
+
+error:
+    cork_buffer_done(&buf);
+    cork_buffer_done(&temp_path);
+    return -1;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Streaming YAML values
+ */
+
+/* Rather than having libyaml build a complete YAML document, and then copying
+ * each of its nodes into a new value, we build values directly from the
+ * parser's event stream.  Each map or array that we're in the middle of has a
+ * frame on the builder's stack; we add it to its parent once we reach its end.
+ * If we're saving a compiled copy of the file, we compile each event as we see
+ * it, too.
+ *
+ * Like the values that we build from a YAML document, we ignore any tags in the
+ * file.  (The !git and !git-env tags only appear in links.yaml files, which
+ * bz_repo_parse_yaml_links parses into a YAML document so that
+ * bz_yaml_repo_new can look at each link's tag.) */
+
+struct bz_yaml_frame {
+    /* Exactly one of these is non-NULL */
+    struct bz_value  *map;
+    struct bz_array  *array;
+    /* The key whose value we're waiting for, if this is a map */
+    const char  *key;
+    size_t  count;
+    /* Where this frame's node is in the compiled copy */
+    uint32_t  compiled_node;
+};
+
+/* Aliases are the only place where the event stream isn't a simple tree: they
+ * refer back to an earlier node that has an anchor.  We keep a copy of the
+ * events that make up each anchored node, and replay them for each alias. */
+struct bz_yaml_event {
+    yaml_event_type_t  type;
+    const char  *content;
+};
+
+struct bz_yaml_anchor {
+    const char  *name;
+    cork_array(struct bz_yaml_event)  events;
+    /* How many of the anchored node's maps and arrays are still open */
+    size_t  depth;
+    bool  recording;
+};
+
+struct bz_yaml_builder {
+    cork_array(struct bz_yaml_frame)  stack;
+    cork_array(struct bz_yaml_anchor *)  anchors;
+    struct bz_value  *root;
+    struct bz_yaml_compiler  *compiler;
+};
+
+static void
+bz_yaml_builder_init(struct bz_yaml_builder *builder,
+                     struct bz_yaml_compiler *compiler)
+{
+    cork_array_init(&builder->stack);
+    cork_array_init(&builder->anchors);
+    builder->root = NULL;
+    builder->compiler = compiler;
+}
+
+static void
+bz_yaml_anchor_free(struct bz_yaml_anchor *anchor)
+{
+    size_t  i;
+    for (i = 0; i < cork_array_size(&anchor->events); i++) {
+        struct bz_yaml_event  *event = &cork_array_at(&anchor->events, i);
+        if (event->content != NULL) {
+            cork_strfree(event->content);
+        }
+    }
+    cork_array_done(&anchor->events);
+    cork_strfree(anchor->name);
+    free(anchor);
+}
+
+/* Frees anything that's still on the stack, which hasn't been added to its
+ * parent yet.  The caller takes control of the root value. */
+static void
+bz_yaml_builder_done(struct bz_yaml_builder *builder)
+{
+    size_t  i;
+    for (i = 0; i < cork_array_size(&builder->stack); i++) {
+        struct bz_yaml_frame  *frame = &cork_array_at(&builder->stack, i);
+        if (frame->key != NULL) {
+            cork_strfree(frame->key);
+        }
+        if (frame->map != NULL) {
+            bz_value_free(frame->map);
+        } else {
+            bz_value_free(bz_array_as_value(frame->array));
+        }
+    }
+    cork_array_done(&builder->stack);
+
+    for (i = 0; i < cork_array_size(&builder->anchors); i++) {
+        bz_yaml_anchor_free(cork_array_at(&builder->anchors, i));
+    }
+    cork_array_done(&builder->anchors);
+}
+
+static struct bz_yaml_frame *
+bz_yaml_builder_top(struct bz_yaml_builder *builder)
+{
+    size_t  size = cork_array_size(&builder->stack);
+    return (size == 0)? NULL: &cork_array_at(&builder->stack, size - 1);
+}
+
+/* Adds a complete value to the map or array that contains it. */
+static int
+bz_yaml_builder_add(struct bz_yaml_builder *builder, struct bz_value *value)
+{
+    int  rc;
+    struct bz_yaml_frame  *parent = bz_yaml_builder_top(builder);
+
+    if (parent == NULL) {
+        builder->root = value;
+        return 0;
+    }
+
+    parent->count++;
+    if (parent->array != NULL) {
+        bz_array_append(parent->array, value);
+        return 0;
+    }
+
+    rc = bz_map_value_add(parent->map, parent->key, value, false);
+    cork_strfree(parent->key);
+    parent->key = NULL;
+    return rc;
+}
+
+static int
+bz_yaml_builder_scalar(struct bz_yaml_builder *builder, const char *content)
+{
+    struct bz_yaml_frame  *parent = bz_yaml_builder_top(builder);
+    struct bz_yaml_compiler  *compiler = builder->compiler;
+    struct bz_value  *value;
+
+    if (parent != NULL && parent->map != NULL && parent->key == NULL) {
+        parent->key = cork_strdup(content);
+        if (compiler != NULL) {
+            bz_yaml_compile_string(compiler, BZ_YAML_CACHE_LITERAL, content);
+        }
+        return 0;
+    }
+
+    if (compiler != NULL) {
+        bz_yaml_compile_string
+            (compiler,
+             (strchr(content, '$') == NULL)?
+                 BZ_YAML_CACHE_LITERAL: BZ_YAML_CACHE_TEMPLATE,
+             content);
+    }
+    rip_check(value = bz_interpolated_value_new(content));
+    return bz_yaml_builder_add(builder, value);
+}
+
+static int
+bz_yaml_builder_start(struct bz_yaml_builder *builder, bool is_map)
+{
+    struct bz_yaml_frame  *parent = bz_yaml_builder_top(builder);
+    struct bz_yaml_compiler  *compiler = builder->compiler;
+    struct bz_yaml_frame  *frame;
+
+    if (CORK_UNLIKELY(parent != NULL && parent->map != NULL &&
+                      parent->key == NULL)) {
+        bz_bad_config("Mapping key must be a string");
+        return -1;
+    }
+
+    frame = cork_array_append_get(&builder->stack);
+    frame->map = is_map? bz_map_new(): NULL;
+    frame->array = is_map? NULL: bz_array_new();
+    frame->key = NULL;
+    frame->count = 0;
+    frame->compiled_node = 0;
+    if (compiler != NULL) {
+        frame->compiled_node = compiler->node_count;
+        bz_yaml_compile_add_node
+            (compiler, is_map? BZ_YAML_CACHE_MAP: BZ_YAML_CACHE_ARRAY, 0);
+    }
+    return 0;
+}
+
+static int
+bz_yaml_builder_end(struct bz_yaml_builder *builder)
+{
+    struct bz_yaml_frame  frame = *bz_yaml_builder_top(builder);
+    builder->stack.size--;
+    if (builder->compiler != NULL) {
+        bz_yaml_compile_set_count
+            (builder->compiler, frame.compiled_node, frame.count);
+    }
+    if (frame.map != NULL) {
+        return bz_yaml_builder_add(builder, frame.map);
+    } else {
+        return bz_yaml_builder_add(builder, bz_array_as_value(frame.array));
+    }
+}
+
+static int
+bz_yaml_builder_event(struct bz_yaml_builder *builder,
+                      yaml_event_type_t type, const char *content)
+{
+    size_t  i;
+
+    /* Record the event in any anchored nodes that it belongs to. */
+    for (i = 0; i < cork_array_size(&builder->anchors); i++) {
+        struct bz_yaml_anchor  *anchor = cork_array_at(&builder->anchors, i);
+        if (anchor->recording) {
+            struct bz_yaml_event  *event =
+                cork_array_append_get(&anchor->events);
+            event->type = type;
+            event->content = (content == NULL)? NULL: cork_strdup(content);
+            if (type == YAML_SEQUENCE_START_EVENT ||
+                type == YAML_MAPPING_START_EVENT) {
+                anchor->depth++;
+            } else if (type == YAML_SEQUENCE_END_EVENT ||
+                       type == YAML_MAPPING_END_EVENT) {
+                anchor->depth--;
+            }
+            anchor->recording = (anchor->depth > 0);
+        }
+    }
+
+    switch (type) {
+        case YAML_SCALAR_EVENT:
+            return bz_yaml_builder_scalar(builder, content);
+        case YAML_SEQUENCE_START_EVENT:
+            return bz_yaml_builder_start(builder, false);
+        case YAML_MAPPING_START_EVENT:
+            return bz_yaml_builder_start(builder, true);
+        case YAML_SEQUENCE_END_EVENT:
+        case YAML_MAPPING_END_EVENT:
+            return bz_yaml_builder_end(builder);
+        default:
+            cork_unreachable();
+    }
+}
+
+static void
+bz_yaml_builder_anchor(struct bz_yaml_builder *builder,
+                       const yaml_char_t *name)
+{
+    struct bz_yaml_anchor  *anchor;
+    if (name == NULL) {
+        return;
+    }
+    anchor = cork_new(struct bz_yaml_anchor);
+    anchor->name = cork_strdup((const char *) name);
+    cork_array_init(&anchor->events);
+    anchor->depth = 0;
+    anchor->recording = true;
+    cork_array_append(&builder->anchors, anchor);
+}
+
+static int
+bz_yaml_builder_alias(struct bz_yaml_builder *builder, const yaml_char_t *name)
+{
+    size_t  i;
+    size_t  j;
+
+    /* A later anchor with the same name hides any earlier ones. */
+    for (i = cork_array_size(&builder->anchors); i > 0; i--) {
+        struct bz_yaml_anchor  *anchor =
+            cork_array_at(&builder->anchors, i - 1);
+        if (strcmp(anchor->name, (const char *) name) == 0) {
+            if (CORK_UNLIKELY(anchor->recording)) {
+                bz_bad_config("Alias *%s refers to itself", anchor->name);
+                return -1;
+            }
+            for (j = 0; j < cork_array_size(&anchor->events); j++) {
+                struct bz_yaml_event  *event =
+                    &cork_array_at(&anchor->events, j);
+                rii_check(bz_yaml_builder_event
+                          (builder, event->type, event->content));
+            }
+            return 0;
+        }
+    }
+
+    bz_bad_config("Undefined alias *%s", (const char *) name);
+    return -1;
+}
+
+/* Builds a value from the first document that the parser produces.  name is
+ * only used in error messages. */
+static struct bz_value *
+bz_yaml_value_new_from_parser(yaml_parser_t *parser, const char *name,
+                              struct bz_yaml_compiler *compiler)
+{
+    struct bz_yaml_builder  builder;
+    struct bz_value  *result;
+    yaml_event_t  event;
+    bool  done = false;
+    int  rc = 0;
+
+    bz_yaml_builder_init(&builder, compiler);
+    while (!done && rc == 0) {
+        if (CORK_UNLIKELY(yaml_parser_parse(parser, &event) == 0)) {
+            bz_bad_config("Error reading %s: %s", name, parser->problem);
+            goto error;
+        }
+
+        switch (event.type) {
+            case YAML_SCALAR_EVENT:
+                bz_yaml_builder_anchor(&builder, event.data.scalar.anchor);
+                rc = bz_yaml_builder_event
+                    (&builder, event.type,
+                     (const char *) event.data.scalar.value);
+                break;
+            case YAML_SEQUENCE_START_EVENT:
+                bz_yaml_builder_anchor
+                    (&builder, event.data.sequence_start.anchor);
+                rc = bz_yaml_builder_event(&builder, event.type, NULL);
+                break;
+            case YAML_MAPPING_START_EVENT:
+                bz_yaml_builder_anchor
+                    (&builder, event.data.mapping_start.anchor);
+                rc = bz_yaml_builder_event(&builder, event.type, NULL);
+                break;
+            case YAML_SEQUENCE_END_EVENT:
+            case YAML_MAPPING_END_EVENT:
+                rc = bz_yaml_builder_event(&builder, event.type, NULL);
+                break;
+            case YAML_ALIAS_EVENT:
+                rc = bz_yaml_builder_alias(&builder, event.data.alias.anchor);
+                break;
+            case YAML_DOCUMENT_END_EVENT:
+            case YAML_STREAM_END_EVENT:
+                done = true;
+                break;
+            default:
+                break;
+        }
+        yaml_event_delete(&event);
+    }
+    if (CORK_UNLIKELY(rc != 0)) {
+        goto error;
+    }
+
+    if (builder.root == NULL) {
+        /* An empty file is treated just like an empty map. */
+        builder.root = bz_map_new();
+        if (compiler != NULL) {
+            bz_yaml_compile_add_node(compiler, BZ_YAML_CACHE_MAP, 0);
+        }
+    }
+    result = builder.root;
+    bz_yaml_builder_done(&builder);
+    return result;
+
+error:
+    bz_yaml_builder_done(&builder);
+    if (builder.root != NULL) {
+        bz_value_free(builder.root);
+    }
+    return NULL;
 }
 
 struct bz_value *
 bz_yaml_value_new_from_string(const char *content)
 {
-    yaml_document_t  doc;
-    rpi_check(bz_load_yaml_string(&doc, content));
-    return bz_yaml_value_new(&doc);
+    yaml_parser_t  parser;
+    struct bz_value  *result;
+
+    if (CORK_UNLIKELY(yaml_parser_initialize(&parser) == 0)) {
+        bz_bad_config("Error reading YAML");
+        return NULL;
+    }
+
+    yaml_parser_set_input_string
+        (&parser, (const unsigned char *) content, strlen(content));
+    result = bz_yaml_value_new_from_parser(&parser, "YAML", NULL);
+    yaml_parser_delete(&parser);
+    return result;
+}
+
+/* Parses a source file that's already mapped into memory, and saves a compiled
+ * copy of it. */
+static struct bz_value *
+bz_yaml_source_parse(struct bz_yaml_source *source,
+                     const char *dir, const char *cache_path)
+{
+    yaml_parser_t  parser;
+    struct bz_yaml_compiler  compiler;
+    struct bz_value  *result;
+
+    if (CORK_UNLIKELY(yaml_parser_initialize(&parser) == 0)) {
+        bz_bad_config("Error reading %s", source->path);
+        return NULL;
+    }
+
+    bz_yaml_compiler_init(&compiler);
+    yaml_parser_set_input_string
+        (&parser, (const unsigned char *) source->buf, source->size);
+    result = bz_yaml_value_new_from_parser(&parser, source->path, &compiler);
+    yaml_parser_delete(&parser);
+
+    if (result != NULL &&
+        bz_yaml_cache_save(source, &compiler, dir, cache_path) != 0) {
+        /* The cache is only an optimization, so this isn't worth bothering
+         * anyone about. */
+        clog_debug("Cannot save compiled copy of %s: %s",
+                   source->path, cork_error_message());
+        cork_error_clear();
+    }
+    bz_yaml_compiler_done(&compiler);
+    return result;
+}
+
+static struct bz_value *
+bz_yaml_file_parse(const char *path)
+{
+    FILE  *file;
+    yaml_parser_t  parser;
+    struct bz_value  *result;
+
+    file = fopen(path, "r");
+    if (CORK_UNLIKELY(file == NULL)) {
+        cork_system_error_set();
+        return NULL;
+    }
+
+    if (CORK_UNLIKELY(yaml_parser_initialize(&parser) == 0)) {
+        fclose(file);
+        bz_bad_config("Error reading %s", path);
+        return NULL;
+    }
+
+    yaml_parser_set_input_file(&parser, file);
+    result = bz_yaml_value_new_from_parser(&parser, path, NULL);
+    yaml_parser_delete(&parser);
+    fclose(file);
+    return result;
+}
+
+struct bz_value *
+bz_yaml_value_new_from_file(const char *path)
+{
+    struct bz_yaml_source  source;
+    struct cork_buffer  dir = CORK_BUFFER_INIT();
+    struct cork_buffer  cache_path = CORK_BUFFER_INIT();
+    struct bz_value  *result;
+
+    clog_debug("Load YAML file %s", path);
+    if (bz_yaml_cache_dir(&dir) && bz_yaml_source_open(&source, path)) {
+        bz_yaml_cache_path(&cache_path, dir.buf, path);
+        result = bz_yaml_cache_load(&source, cache_path.buf);
+        if (result == NULL) {
+            result = bz_yaml_source_parse(&source, dir.buf, cache_path.buf);
+        }
+        bz_yaml_source_done(&source);
+    } else {
+        result = bz_yaml_file_parse(path);
+    }
+
+    cork_buffer_done(&dir);
+    cork_buffer_done(&cache_path);
+    return result;
 }
@@ -0,0 +1,224 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2015, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+/* Compares the cost of resolving a tree of native dependencies when we check
+ * each candidate native package name with its own apt-cache process (the old
+ * approach) versus checking all of a dependency's candidates with a single
+ * apt-cache process.
+ *
+ * All of the apt-cache calls are mocked, so the "mocked" wall time only covers
+ * our own in-process overhead.  To give an idea of what the forks cost on a
+ * real machine, we also time a real fork/exec of `true`, and use that to
+ * estimate the total. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include <libcork/core.h>
+#include <libcork/os.h>
+
+#include "buzzy/mock.h"
+#include "buzzy/native.h"
+#include "buzzy/package.h"
+#include "buzzy/version.h"
+#include "buzzy/distro/debian.h"
+
+#define PACKAGE_COUNT  60
+#define FORK_SAMPLES  20
+
+static const char  *patterns[] = { "%s-dev", "lib%s-dev", "%s", "lib%s" };
+#define PATTERN_COUNT  (sizeof(patterns) / sizeof(patterns[0]))
+
+#define check(call) \
+    do { \
+        call; \
+        if (cork_error_occurred()) { \
+            fprintf(stderr, "%s\n", cork_error_message()); \
+            exit(EXIT_FAILURE); \
+        } \
+    } while (0)
+
+static double
+now(void)
+{
+    struct timeval  tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static size_t
+count_forks(void)
+{
+    size_t  count = 0;
+    const char  *curr = bz_mocked_commands_run();
+    while ((curr = strstr(curr, "$ apt-cache ")) != NULL) {
+        count++;
+        curr++;
+    }
+    return count;
+}
+
+/* Each synthetic package is available under exactly one of the candidate
+ * names, cycling through the patterns so that some packages are found
+ * immediately and some are only found at the end. */
+static void
+candidate_name(struct cork_buffer *dest, size_t package, size_t pattern)
+{
+    struct cork_buffer  name = CORK_BUFFER_INIT();
+    cork_buffer_printf(&name, "bench%02zu", package);
+    cork_buffer_printf(dest, patterns[pattern], (char *) name.buf);
+    cork_buffer_done(&name);
+}
+
+static void
+mock_packages(void)
+{
+    size_t  i;
+    size_t  j;
+    struct cork_buffer  cmd = CORK_BUFFER_INIT();
+    struct cork_buffer  batch = CORK_BUFFER_INIT();
+    struct cork_buffer  batch_out = CORK_BUFFER_INIT();
+    struct cork_buffer  name = CORK_BUFFER_INIT();
+    struct cork_buffer  out = CORK_BUFFER_INIT();
+
+    bz_start_mocks();
+    for (i = 0; i < PACKAGE_COUNT; i++) {
+        size_t  available = i % PATTERN_COUNT;
+        cork_buffer_set_string(&batch, "apt-cache show --no-all-versions");
+        cork_buffer_clear(&batch_out);
+        for (j = 0; j < PATTERN_COUNT; j++) {
+            candidate_name(&name, i, j);
+            cork_buffer_printf
+                (&cmd, "apt-cache show --no-all-versions %s",
+                 (char *) name.buf);
+            cork_buffer_append_printf(&batch, " %s", (char *) name.buf);
+            if (j == available) {
+                cork_buffer_printf
+                    (&out, "Package: %s\nVersion: 1.%zu\n\n",
+                     (char *) name.buf, i);
+                cork_buffer_append_copy(&batch_out, &out);
+                bz_mock_subprocess(cmd.buf, out.buf, NULL, 0);
+            } else {
+                bz_mock_subprocess
+                    (cmd.buf, NULL, "E: No packages found\n", 100);
+            }
+        }
+        bz_mock_subprocess(batch.buf, batch_out.buf, NULL, 0);
+    }
+
+    cork_buffer_done(&cmd);
+    cork_buffer_done(&batch);
+    cork_buffer_done(&batch_out);
+    cork_buffer_done(&name);
+    cork_buffer_done(&out);
+}
+
+/* The old approach: one apt-cache call per candidate, stopping at the first
+ * one that's available. */
+static void
+resolve_one_at_a_time(void)
+{
+    size_t  i;
+    size_t  j;
+    struct cork_buffer  name = CORK_BUFFER_INIT();
+    for (i = 0; i < PACKAGE_COUNT; i++) {
+        for (j = 0; j < PATTERN_COUNT; j++) {
+            struct bz_version  *version;
+            candidate_name(&name, i, j);
+            check(version = bz_apt_native_version_available(name.buf));
+            if (version != NULL) {
+                bz_version_free(version);
+                break;
+            }
+        }
+    }
+    cork_buffer_done(&name);
+}
+
+/* The new approach: let the apt native package database check all of the
+ * candidates for each dependency at once. */
+static void
+resolve_batched(void)
+{
+    size_t  i;
+    struct bz_pdb  *pdb;
+    struct cork_buffer  name = CORK_BUFFER_INIT();
+    check(pdb = bz_apt_native_pdb());
+    for (i = 0; i < PACKAGE_COUNT; i++) {
+        struct bz_dependency  *dep;
+        struct bz_package  *package;
+        cork_buffer_printf(&name, "bench%02zu", i);
+        check(dep = bz_dependency_from_string(name.buf));
+        check(package = bz_pdb_satisfy_dependency(pdb, dep, NULL));
+        if (package == NULL) {
+            fprintf(stderr, "Couldn't resolve %s\n", (char *) name.buf);
+            exit(EXIT_FAILURE);
+        }
+        bz_dependency_free(dep);
+    }
+    bz_pdb_free(pdb);
+    cork_buffer_done(&name);
+}
+
+/* Measures the cost of a real fork/exec, so that we can estimate how long
+ * each approach would take against a real apt-cache. */
+static double
+fork_cost(void)
+{
+    size_t  i;
+    double  start = now();
+    for (i = 0; i < FORK_SAMPLES; i++) {
+        int  exit_code;
+        struct cork_exec  *exec = cork_exec_new("true");
+        cork_exec_add_param(exec, "true");
+        check(bz_real__exec(exec, NULL, NULL, &exit_code));
+    }
+    return (now() - start) / FORK_SAMPLES;
+}
+
+static void
+report(const char *name, size_t forks, double elapsed, double per_fork)
+{
+    printf("%-16s %6zu forks  %9.3f ms mocked  %9.3f ms estimated\n",
+           name, forks, elapsed * 1000.0,
+           (elapsed + forks * per_fork) * 1000.0);
+}
+
+int
+main(int argc, char **argv)
+{
+    double  start;
+    double  per_fork;
+    double  before_elapsed;
+    double  after_elapsed;
+    size_t  before_forks;
+    size_t  after_forks;
+
+    per_fork = fork_cost();
+    printf("Resolving %d native dependencies (fork/exec costs %.3f ms)\n",
+           PACKAGE_COUNT, per_fork * 1000.0);
+
+    mock_packages();
+    start = now();
+    resolve_one_at_a_time();
+    before_elapsed = now() - start;
+    before_forks = count_forks();
+
+    mock_packages();
+    start = now();
+    resolve_batched();
+    after_elapsed = now() - start;
+    after_forks = count_forks();
+
+    report("one at a time", before_forks, before_elapsed, per_fork);
+    report("batched", after_forks, after_elapsed, per_fork);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,306 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2015, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+/* Measures how much memory it takes to load a large graph of repositories, and
+ * how long it takes to tear it down again.
+ *
+ * We create a temporary directory containing lots of local repositories, each
+ * with a repo.yaml and a package.yaml file, and link each repository to a
+ * parent repository, so that the repositories form a tree.  We then load every
+ * repository (which creates each repository's default package), look up a
+ * handful of variables in each package's environment (including one that's
+ * only defined by its parent repository), and then free everything.
+ *
+ * We count every allocation that goes through libcork's allocator (which is
+ * every allocation that Buzzy makes itself), and report the process's peak
+ * RSS. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+
+#include <libcork/core.h>
+#include <libcork/ds.h>
+#include <libcork/os.h>
+
+#include "buzzy/env.h"
+#include "buzzy/os.h"
+#include "buzzy/package.h"
+#include "buzzy/repo.h"
+#include "buzzy/value.h"
+
+#define REPO_COUNT  1000
+#define SETTING_COUNT  20
+
+#define check(call) \
+    do { \
+        call; \
+        if (cork_error_occurred()) { \
+            fprintf(stderr, "%s\n", cork_error_message()); \
+            exit(EXIT_FAILURE); \
+        } \
+    } while (0)
+
+static double
+now(void)
+{
+    struct timeval  tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static size_t
+peak_rss_kb(void)
+{
+    struct rusage  usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Counting allocations
+ */
+
+static size_t  allocation_count = 0;
+
+static void *
+counting_malloc(const struct cork_alloc *alloc, size_t size)
+{
+    allocation_count++;
+    return cork_alloc_malloc(alloc->parent, size);
+}
+
+static void *
+counting_xmalloc(const struct cork_alloc *alloc, size_t size)
+{
+    allocation_count++;
+    return cork_alloc_xmalloc(alloc->parent, size);
+}
+
+static void *
+counting_calloc(const struct cork_alloc *alloc, size_t count, size_t size)
+{
+    allocation_count++;
+    return cork_alloc_calloc(alloc->parent, count, size);
+}
+
+static void *
+counting_xcalloc(const struct cork_alloc *alloc, size_t count, size_t size)
+{
+    allocation_count++;
+    return cork_alloc_xcalloc(alloc->parent, count, size);
+}
+
+static void *
+counting_realloc(const struct cork_alloc *alloc, void *ptr,
+                 size_t old_size, size_t new_size)
+{
+    allocation_count++;
+    return cork_alloc_realloc(alloc->parent, ptr, old_size, new_size);
+}
+
+static void *
+counting_xrealloc(const struct cork_alloc *alloc, void *ptr,
+                  size_t old_size, size_t new_size)
+{
+    allocation_count++;
+    return cork_alloc_xrealloc(alloc->parent, ptr, old_size, new_size);
+}
+
+static void
+counting_free(const struct cork_alloc *alloc, void *ptr, size_t size)
+{
+    cork_alloc_free(alloc->parent, ptr, size);
+}
+
+/* We can't use cork_alloc_new_alloc, since libcork frees those allocators
+ * before it calls the rest of its cleanup functions at exit. */
+static struct cork_alloc  counting_allocator = {
+    NULL,
+    NULL,
+    NULL,
+    counting_calloc,
+    counting_malloc,
+    counting_realloc,
+    counting_xcalloc,
+    counting_xmalloc,
+    counting_xrealloc,
+    counting_free
+};
+
+static void
+install_counting_allocator(void)
+{
+    counting_allocator.parent = cork_current_allocator();
+    cork_set_allocator(&counting_allocator);
+}
+
+
+/*-----------------------------------------------------------------------
+ * Synthetic repositories
+ */
+
+static size_t
+parent_index(size_t i)
+{
+    return (i - 1) / 2;
+}
+
+static void
+write_file(const char *path, struct cork_buffer *content)
+{
+    check(bz_create_file(path, content, 0644));
+}
+
+static void
+create_repo_files(const char *root, size_t i)
+{
+    size_t  j;
+    struct cork_buffer  path = CORK_BUFFER_INIT();
+    struct cork_buffer  content = CORK_BUFFER_INIT();
+
+    cork_buffer_printf(&path, "%s/repo%zu/.buzzy", root, i);
+    check(bz_create_directory(path.buf, 0755));
+
+    cork_buffer_printf(&path, "%s/repo%zu/.buzzy/repo.yaml", root, i);
+    cork_buffer_printf(&content, "bench:\n");
+    cork_buffer_append_printf(&content, "  repo%zu:\n", i);
+    cork_buffer_append_printf(&content, "    marker: repo%zu\n", i);
+    cork_buffer_append_printf(&content, "  flags: [-O2, -g, -Wall, -Werror]\n");
+    cork_buffer_append_printf(&content, "  settings:\n");
+    for (j = 0; j < SETTING_COUNT; j++) {
+        cork_buffer_append_printf
+            (&content, "    key%zu: \"${name}-%zu-%zu\"\n", j, i, j);
+    }
+    write_file(path.buf, &content);
+
+    cork_buffer_printf(&path, "%s/repo%zu/.buzzy/package.yaml", root, i);
+    cork_buffer_printf(&content, "name: pkg%zu\n", i);
+    cork_buffer_append_printf(&content, "version: 1.%zu\n", i);
+    if (i > 0) {
+        cork_buffer_append_printf
+            (&content, "dependencies:\n  - pkg%zu >= 1.0\n", parent_index(i));
+    }
+    cork_buffer_append_printf(&content, "autotools:\n");
+    cork_buffer_append_printf(&content, "  configure:\n");
+    cork_buffer_append_printf
+        (&content, "    args: \"--prefix=${prefix} --with-pkg%zu\"\n", i);
+    cork_buffer_append_printf(&content, "license: BSD\n");
+    cork_buffer_append_printf(&content, "builder: noop\n");
+    cork_buffer_append_printf(&content, "packager: noop\n");
+    write_file(path.buf, &content);
+
+    cork_buffer_done(&path);
+    cork_buffer_done(&content);
+}
+
+static const char  *names[] = {
+    "name",
+    "version",
+    "license",
+    "bench.settings.key7",
+    "autotools.configure.args",
+    "prefix"
+};
+#define NAME_COUNT  (sizeof(names) / sizeof(names[0]))
+
+static void
+look_up_variables(size_t i, struct bz_repo *repo)
+{
+    size_t  j;
+    struct cork_buffer  name = CORK_BUFFER_INIT();
+    struct bz_package  *package = bz_repo_default_package(repo);
+    struct bz_env  *env = bz_package_env(package);
+
+    for (j = 0; j < NAME_COUNT; j++) {
+        check(bz_env_get_string(env, names[j], true));
+    }
+
+    /* A variable that's only defined by the parent repository */
+    if (i > 0) {
+        cork_buffer_printf(&name, "bench.repo%zu.marker", parent_index(i));
+        check(bz_env_get_string(env, name.buf, true));
+    }
+    cork_buffer_done(&name);
+}
+
+
+int
+main(int argc, char **argv)
+{
+    size_t  i;
+    char  root[] = "/tmp/buzzy-bench-XXXXXX";
+    struct cork_buffer  path = CORK_BUFFER_INIT();
+    struct cork_file  *root_file;
+    struct bz_repo  *repos[REPO_COUNT];
+    size_t  rss_before;
+    size_t  rss_after;
+    size_t  load_allocations;
+    double  start;
+    double  load_elapsed;
+    double  free_elapsed;
+
+    install_counting_allocator();
+    if (mkdtemp(root) == NULL) {
+        perror("mkdtemp");
+        return EXIT_FAILURE;
+    }
+    for (i = 0; i < REPO_COUNT; i++) {
+        create_repo_files(root, i);
+    }
+
+    printf("Loading %d repositories\n", REPO_COUNT);
+    rss_before = peak_rss_kb();
+    allocation_count = 0;
+    start = now();
+    for (i = 0; i < REPO_COUNT; i++) {
+        cork_buffer_printf(&path, "%s/repo%zu", root, i);
+        check(repos[i] = bz_local_filesystem_repo_new(path.buf));
+        if (i > 0) {
+            bz_repo_add_link(repos[i], repos[parent_index(i)]);
+        }
+    }
+    for (i = 0; i < REPO_COUNT; i++) {
+        check(bz_repo_load(repos[i]));
+    }
+    for (i = 0; i < REPO_COUNT; i++) {
+        look_up_variables(i, repos[i]);
+    }
+    load_elapsed = now() - start;
+    load_allocations = allocation_count;
+    rss_after = peak_rss_kb();
+
+    /* Packages don't own their environments, so we have to free them
+     * ourselves. */
+    start = now();
+    for (i = 0; i < REPO_COUNT; i++) {
+        bz_env_free(bz_package_env(bz_repo_default_package(repos[i])));
+    }
+    bz_pdb_registry_clear();
+    for (i = 0; i < REPO_COUNT; i++) {
+        bz_repo_free(repos[i]);
+    }
+    free_elapsed = now() - start;
+
+    printf("%-16s %9.3f ms  %9zu allocations  %7zu allocations/repo\n",
+           "load", load_elapsed * 1000.0,
+           load_allocations, load_allocations / REPO_COUNT);
+    printf("%-16s %9.3f ms\n", "free", free_elapsed * 1000.0);
+    printf("%-16s %9zu KB  (%zu KB while loading)\n",
+           "peak RSS", rss_after, rss_after - rss_before);
+
+    root_file = cork_file_new(root);
+    check(cork_file_remove(root_file, CORK_FILE_RECURSIVE));
+    cork_file_free(root_file);
+    cork_buffer_done(&path);
+    return EXIT_SUCCESS;
+}
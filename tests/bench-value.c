@@ -0,0 +1,231 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2015, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+/* Compares the cost of looking up variables in a package environment when we
+ * pass in each variable name as a string (which we have to intern, and so
+ * split and hash, on every lookup) versus passing in keys that were interned
+ * once up front, and versus looking up those keys after freezing the
+ * environment into a flat snapshot.
+ *
+ * The environment is layered the same way that a real package's is: the
+ * package's own overrides, on top of a repository environment with some
+ * overrides of its own, on top of the global defaults.  The variable names are
+ * a mix of top-level and nested names, some of which are only defined in the
+ * lower layers, and some of which aren't defined anywhere.
+ *
+ * We also measure how much heap each additional package environment costs,
+ * when we create lots of them on top of the same repository and global
+ * environments, and look up the same variables in each one. */
+
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include <libcork/core.h>
+
+#include "buzzy/env.h"
+#include "buzzy/value.h"
+#include "buzzy/version.h"
+
+#define ITERATION_COUNT  200000
+#define PACKAGE_COUNT  500
+
+static const char  *names[] = {
+    "name",
+    "version",
+    "prefix",
+    "package_work_dir",
+    "staging_dir",
+    "verbose",
+    "cmake.build_type",
+    "deb.arch",
+    "autotools.configure.args",
+    "homebrew.prefix",
+    "bench.nested.deeply.value",
+    "bench.nested.missing"
+};
+#define NAME_COUNT  (sizeof(names) / sizeof(names[0]))
+
+#define check(call) \
+    do { \
+        call; \
+        if (cork_error_occurred()) { \
+            fprintf(stderr, "%s\n", cork_error_message()); \
+            exit(EXIT_FAILURE); \
+        } \
+    } while (0)
+
+static double
+now(void)
+{
+    struct timeval  tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static struct bz_env *
+repo_env_new(void)
+{
+    struct bz_env  *env = bz_repo_env_new_empty();
+    bz_env_add_override
+        (env, "cmake.build_type", bz_string_value_new("RelWithDebInfo"));
+    bz_env_add_override(env, "deb.arch", bz_string_value_new("amd64"));
+    bz_env_add_override
+        (env, "bench.nested.deeply.value", bz_string_value_new("repo"));
+    return env;
+}
+
+static struct bz_env *
+package_env_new(struct bz_env *repo_env)
+{
+    struct bz_version  *version;
+    struct bz_env  *env;
+    check(version = bz_version_from_string("1.0~rc.1"));
+    check(env = bz_package_env_new(repo_env, "bench", version));
+    bz_env_add_override
+        (env, "autotools.configure.args", bz_string_value_new("--quiet"));
+    bz_env_add_override
+        (env, "bench.nested.deeply.value", bz_string_value_new("package"));
+    return env;
+}
+
+/* Returns how many of the lookups found something, so that the compiler can't
+ * optimize the lookups away, and so that we can make sure that both approaches
+ * agree. */
+
+static size_t
+lookup_strings(struct bz_value *value)
+{
+    size_t  i;
+    size_t  j;
+    size_t  found = 0;
+    for (i = 0; i < ITERATION_COUNT; i++) {
+        for (j = 0; j < NAME_COUNT; j++) {
+            struct bz_value  *result;
+            check(result = bz_value_get_nested(value, names[j]));
+            found += (result != NULL);
+        }
+    }
+    return found;
+}
+
+static size_t
+lookup_keys(struct bz_value *value)
+{
+    size_t  i;
+    size_t  j;
+    size_t  found = 0;
+    const struct bz_key  *keys[NAME_COUNT];
+    for (j = 0; j < NAME_COUNT; j++) {
+        keys[j] = bz_key_intern(names[j]);
+    }
+    for (i = 0; i < ITERATION_COUNT; i++) {
+        for (j = 0; j < NAME_COUNT; j++) {
+            struct bz_value  *result;
+            check(result = bz_value_get_key(value, keys[j]));
+            found += (result != NULL);
+        }
+    }
+    return found;
+}
+
+static size_t
+heap_in_use(void)
+{
+    struct mallinfo2  info = mallinfo2();
+    return info.uordblks;
+}
+
+/* Creates lots of package environments, and looks up every variable in each
+ * one. */
+static void
+many_package_envs(struct bz_env *repo_env)
+{
+    size_t  i;
+    size_t  j;
+    size_t  heap_before;
+    size_t  heap_after;
+    double  start;
+    double  elapsed;
+    struct bz_env  *envs[PACKAGE_COUNT];
+
+    heap_before = heap_in_use();
+    start = now();
+    for (i = 0; i < PACKAGE_COUNT; i++) {
+        struct bz_value  *value;
+        envs[i] = package_env_new(repo_env);
+        value = bz_env_as_value(envs[i]);
+        for (j = 0; j < NAME_COUNT; j++) {
+            check(bz_value_get_nested(value, names[j]));
+        }
+    }
+    elapsed = now() - start;
+    heap_after = heap_in_use();
+    printf("%-16s %9d envs   %9.3f ms  %7zu bytes/env\n",
+           "package envs", PACKAGE_COUNT, elapsed * 1000.0,
+           (heap_after - heap_before) / PACKAGE_COUNT);
+
+    for (i = 0; i < PACKAGE_COUNT; i++) {
+        bz_env_free(envs[i]);
+    }
+}
+
+static void
+report(const char *name, size_t found, double elapsed)
+{
+    printf("%-16s %9zu found  %9.3f ms  %7.1f ns/lookup\n",
+           name, found, elapsed * 1000.0,
+           elapsed * 1e9 / (ITERATION_COUNT * NAME_COUNT));
+}
+
+int
+main(int argc, char **argv)
+{
+    double  start;
+    double  strings_elapsed;
+    double  keys_elapsed;
+    double  frozen_elapsed;
+    size_t  strings_found;
+    size_t  keys_found;
+    size_t  frozen_found;
+    struct bz_env  *repo_env;
+    struct bz_env  *package_env;
+    struct bz_value  *value;
+
+    repo_env = repo_env_new();
+    package_env = package_env_new(repo_env);
+    value = bz_env_as_value(package_env);
+    printf("Looking up %zu variables %d times\n",
+           NAME_COUNT, ITERATION_COUNT);
+
+    start = now();
+    strings_found = lookup_strings(value);
+    strings_elapsed = now() - start;
+
+    start = now();
+    keys_found = lookup_keys(value);
+    keys_elapsed = now() - start;
+
+    check(bz_env_freeze(package_env));
+    start = now();
+    frozen_found = lookup_keys(value);
+    frozen_elapsed = now() - start;
+
+    report("strings", strings_found, strings_elapsed);
+    report("interned keys", keys_found, keys_elapsed);
+    report("frozen", frozen_found, frozen_elapsed);
+
+    bz_env_free(package_env);
+    many_package_envs(repo_env);
+    bz_env_free(repo_env);
+    return (strings_found == keys_found && keys_found == frozen_found)?
+        EXIT_SUCCESS: EXIT_FAILURE;
+}
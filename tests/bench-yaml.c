@@ -0,0 +1,214 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2015, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+/* Measures how quickly we can parse a large repository configuration file.
+ * We generate a synthetic repo.yaml in memory, with thousands of native.* and
+ * preinstalled.* entries for several distributions, using a mix of plain,
+ * single-quoted, and double-quoted scalars.  We then time three layers of
+ * parsing it: just scanning libyaml's tokens (which is all reader and
+ * scanner), loading a full libyaml document, and building a buzzy value
+ * straight from the parser's event stream.
+ *
+ * libyaml uses SSE2 or AVX2 to skip over runs of plain ASCII characters when
+ * the CPU supports them.  Run this with YAML_SIMD=none (or YAML_SIMD=sse2) in
+ * the environment to compare against the portable code. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include <libcork/core.h>
+#include <libcork/ds.h>
+#include <yaml.h>
+
+#include "buzzy/value.h"
+#include "buzzy/yaml.h"
+
+#define ITERATION_COUNT  20
+#define PACKAGE_COUNT  5000
+
+static const char  *distros[] = {
+    "arch",
+    "debian",
+    "homebrew",
+    "redhat"
+};
+#define DISTRO_COUNT  (sizeof(distros) / sizeof(distros[0]))
+
+#define check(call) \
+    do { \
+        call; \
+        if (cork_error_occurred()) { \
+            fprintf(stderr, "%s\n", cork_error_message()); \
+            exit(EXIT_FAILURE); \
+        } \
+    } while (0)
+
+static double
+now(void)
+{
+    struct timeval  tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static void
+generate_repo_yaml(struct cork_buffer *dest)
+{
+    size_t  i;
+    size_t  j;
+
+    cork_buffer_append_string(dest, "# Synthetic repository configuration\n");
+    cork_buffer_append_string(dest, "native:\n");
+    for (i = 0; i < PACKAGE_COUNT; i++) {
+        cork_buffer_append_printf
+            (dest, "  libbench-component-%04zu: libbench-component-%04zu\n",
+             i, i);
+    }
+    for (j = 0; j < DISTRO_COUNT; j++) {
+        cork_buffer_append_printf(dest, "  %s:\n", distros[j]);
+        for (i = 0; i < PACKAGE_COUNT; i++) {
+            switch (i % 3) {
+                case 0:
+                    cork_buffer_append_printf
+                        (dest, "    libbench-component-%04zu: "
+                         "lib%s-bench-component%04zu-dev\n",
+                         i, distros[j], i);
+                    break;
+                case 1:
+                    cork_buffer_append_printf
+                        (dest, "    libbench-component-%04zu: "
+                         "'%s-bench-component-%04zu'\n",
+                         i, distros[j], i);
+                    break;
+                default:
+                    cork_buffer_append_printf
+                        (dest, "    libbench-component-%04zu: "
+                         "\"${native.%s.prefix}bench-component-%04zu\"\n",
+                         i, distros[j], i);
+                    break;
+            }
+        }
+    }
+
+    cork_buffer_append_string(dest, "preinstalled:\n");
+    for (j = 0; j < DISTRO_COUNT; j++) {
+        cork_buffer_append_printf(dest, "  %s:\n", distros[j]);
+        for (i = 0; i < PACKAGE_COUNT; i++) {
+            cork_buffer_append_printf
+                (dest, "    libbench-component-%04zu: %zu.%zu.%zu-%zu\n",
+                 i, i % 7, i % 13, i % 101, j + 1);
+        }
+    }
+}
+
+/* Each of these returns some count from what it parsed, so that the compiler
+ * can't optimize the parsing away, and so that we can see that the result
+ * doesn't depend on which SIMD implementation we used. */
+
+static size_t
+scan_tokens(const char *content, size_t size)
+{
+    yaml_parser_t  parser;
+    yaml_token_t  token;
+    size_t  count = 0;
+    int  done = 0;
+
+    yaml_parser_initialize(&parser);
+    yaml_parser_set_input_string
+        (&parser, (const unsigned char *) content, size);
+    while (!done) {
+        if (!yaml_parser_scan(&parser, &token)) {
+            fprintf(stderr, "Error scanning YAML: %s\n", parser.problem);
+            exit(EXIT_FAILURE);
+        }
+        if (token.type == YAML_SCALAR_TOKEN) {
+            count += token.data.scalar.length;
+        }
+        done = (token.type == YAML_STREAM_END_TOKEN);
+        yaml_token_delete(&token);
+    }
+    yaml_parser_delete(&parser);
+    return count;
+}
+
+static size_t
+load_document(const char *content)
+{
+    yaml_document_t  doc;
+    size_t  count;
+    check(bz_load_yaml_string(&doc, content));
+    count = doc.nodes.top - doc.nodes.start;
+    yaml_document_delete(&doc);
+    return count;
+}
+
+static size_t
+build_value(const char *content)
+{
+    struct bz_value  *value;
+    struct bz_value  *entry;
+    char  name[64];
+    size_t  j;
+    size_t  count = 0;
+    check(value = bz_yaml_value_new_from_string(content));
+    for (j = 0; j < DISTRO_COUNT; j++) {
+        snprintf(name, sizeof(name),
+                 "preinstalled.%s.libbench-component-%04d",
+                 distros[j], PACKAGE_COUNT - 1);
+        check(entry = bz_value_get_nested(value, name));
+        count += (entry != NULL);
+    }
+    bz_value_free(value);
+    return count;
+}
+
+static void
+report(const char *name, size_t result, double elapsed, size_t size)
+{
+    printf("%-16s %9zu result %9.3f ms  %7.1f MB/s\n",
+           name, result, elapsed * 1000.0 / ITERATION_COUNT,
+           size * ITERATION_COUNT / elapsed / 1e6);
+}
+
+int
+main(int argc, char **argv)
+{
+    struct cork_buffer  buf = CORK_BUFFER_INIT();
+    const char  *simd = getenv("YAML_SIMD");
+    size_t  i;
+    size_t  result;
+    double  start;
+
+    generate_repo_yaml(&buf);
+    printf("Parsing %zu bytes of YAML %d times (YAML_SIMD=%s)\n",
+           buf.size, ITERATION_COUNT, (simd == NULL)? "default": simd);
+
+    start = now();
+    for (i = 0, result = 0; i < ITERATION_COUNT; i++) {
+        result = scan_tokens(buf.buf, buf.size);
+    }
+    report("scan tokens", result, now() - start, buf.size);
+
+    start = now();
+    for (i = 0, result = 0; i < ITERATION_COUNT; i++) {
+        result = load_document(buf.buf);
+    }
+    report("load document", result, now() - start, buf.size);
+
+    start = now();
+    for (i = 0, result = 0; i < ITERATION_COUNT; i++) {
+        result = build_value(buf.buf);
+    }
+    report("build value", result, now() - start, buf.size);
+
+    cork_buffer_done(&buf);
+    return EXIT_SUCCESS;
+}
@@ -10,6 +10,7 @@ Start with reproducible directory names.
   $ unset XDG_CACHE_DIRS
   $ unset XDG_DATA_HOME
   $ unset XDG_DATA_DIRS
+  $ export BUZZY_YAML_CACHE_DIR=$PWD/yaml-cache
 
 
 The baseline default value, which is precompiled.
@@ -1,3 +1,13 @@
+Reproducible directory names.
+
+  $ export HOME=/home/test
+  $ export XDG_RUNTIME_DIR=/run/users/test
+  $ unset XDG_CACHE_HOME
+  $ unset XDG_CACHE_DIRS
+  $ unset XDG_DATA_HOME
+  $ unset XDG_DATA_DIRS
+  $ export BUZZY_YAML_CACHE_DIR=$PWD/yaml-cache
+
 Create a bunch of fake repositories to test whether we can detect all of the
 builders that we know about.
 
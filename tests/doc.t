@@ -6,6 +6,7 @@ Reproducible directory names.
   $ unset XDG_CACHE_DIRS
   $ unset XDG_DATA_HOME
   $ unset XDG_DATA_DIRS
+  $ export BUZZY_YAML_CACHE_DIR=$PWD/yaml-cache
 
 Print out the documentation for a handful of global variables.
 
@@ -17,7 +18,7 @@ Print out the documentation for a handful of global variables.
   cache_dir
     A directory for user-specific nonessential data files
   
-    On POSIX systems, this defaults to the value of the $XDG_CACHE_HOME environment variable, or $HOME/.cache if that's not defined.  Note that this is not a Buzzy-specific directory; this should refer to the root of the current user's cache directory.
+    On POSIX systems, this defaults to the value of the $XDG_CACHE_HOME environment variable, or $HOME/.cache if that's not defined.  Note that this is not a Buzzy-specific directory; this should refer to the root of the current user's cache directory.  Buzzy saves compiled copies of the YAML files that it reads in the buzzy/yaml subdirectory of the default cache directory.  It needs those before it reads any configuration files, so setting this variable won't move them; set the $BUZZY_YAML_CACHE_DIR environment variable to use a different directory, or to an empty string to turn off the YAML cache.
   
     Current value: /home/test/.cache
 
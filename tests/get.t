@@ -0,0 +1,68 @@
+Make sure that we can print out the values of several variables at once.
+
+Start with reproducible directory names.
+
+  $ TESTDIR="$PWD"
+  $ export HOME=/home/test
+  $ export XDG_RUNTIME_DIR=/run/users/test
+  $ unset XDG_CACHE_HOME
+  $ unset XDG_CACHE_DIRS
+  $ unset XDG_DATA_HOME
+  $ unset XDG_DATA_DIRS
+  $ export BUZZY_YAML_CACHE_DIR=$PWD/yaml-cache
+
+  $ mkdir config
+  $ cat > config/buzzy.yaml <<EOF
+  > work_dir: /home/override
+  > test:
+  >   a: "it's"
+  >   b: two
+  >   nested:
+  >     c: three-\${test.b}
+  > EOF
+  $ export XDG_CONFIG_HOME=$TESTDIR/config
+
+
+A single variable prints just its value.
+
+  $ buzzy get work_dir
+  /home/override
+  $ buzzy get test.nested.c
+  three-two
+
+
+Several variables, or globs, print each value on its own line, or as shell
+assignments, or as a JSON object.
+
+  $ buzzy get work_dir 'test.*'
+  /home/override
+  it's
+  two
+  three-two
+
+  $ buzzy get --shell 'test.*' work_dir test.b
+  test_a='it'\''s'
+  test_b='two'
+  test_nested_c='three-two'
+  work_dir='/home/override'
+
+  $ buzzy get --json 'test.*'
+  {
+    "test.a": "it's",
+    "test.b": "two",
+    "test.nested.c": "three-two"
+  }
+
+  $ buzzy get --json 'nothing.*'
+  {}
+
+
+Errors.
+
+  $ buzzy get missing
+  No variable named missing
+  [1]
+
+  $ buzzy get test
+  Cannot print non-scalar variable test
+  [1]
@@ -20,6 +20,7 @@
 #include "buzzy/mock.h"
 #include "buzzy/os.h"
 #include "buzzy/package.h"
+#include "buzzy/value.h"
 #include "buzzy/version.h"
 
 #if !defined(PRINT_EXPECTED_FAILURES)
@@ -81,6 +82,8 @@ initialize_tests(void)
     cork_env_remove(NULL, "XDG_CACHE_DIRS");
     cork_env_remove(NULL, "XDG_DATA_HOME");
     cork_env_remove(NULL, "XDG_DATA_DIRS");
+    /* Test cases that need the compiled YAML cache turn it on themselves. */
+    bz_yaml_set_cache_dir(NULL);
     clog_set_default_format("[%L] %m");
     if (clog_setup_logging() != 0) {
         fprintf(stderr, "%s\n", cork_error_message());
@@ -95,7 +98,6 @@ reset_everything(void)
 {
     bz_global_env_reset();
     bz_mocked_actions_clear();
-    fail_if_error(bz_load_variable_definitions());
     bz_pdb_registry_clear();
 }
 
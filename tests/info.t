@@ -7,6 +7,7 @@ Reproducible directory names.
   $ unset XDG_CACHE_DIRS
   $ unset XDG_DATA_HOME
   $ unset XDG_DATA_DIRS
+  $ export BUZZY_YAML_CACHE_DIR=$PWD/yaml-cache
 
 Prepare a handful of repository directories, and then verify the output when we
 run "buzzy info" in each of them.
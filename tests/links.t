@@ -7,6 +7,7 @@ Test repositories that are linked together.
   $ unset XDG_CACHE_DIRS
   $ unset XDG_DATA_HOME
   $ unset XDG_DATA_DIRS
+  $ export BUZZY_YAML_CACHE_DIR=$PWD/yaml-cache
 
 
 Create a couple of filesystem repositories, with one linked to the other.
@@ -48,3 +49,63 @@ Create a couple of filesystem repositories, with one linked to the other.
   
     Current value: goodbye world
   $ cd ..
+
+
+Link to a graph of git repositories, using local bare repositories as the
+remotes.  We clone every repository at one level of the graph before looking at
+the next level, but two links to the same repository still share one clone, and
+variables are still layered in the order that the links appear.
+
+  $ REPOS="$PWD"
+  $ export XDG_CACHE_HOME="$REPOS/cache"
+  $ export GIT_AUTHOR_NAME=test GIT_AUTHOR_EMAIL=test@example.com
+  $ export GIT_COMMITTER_NAME=test GIT_COMMITTER_EMAIL=test@example.com
+  $ git_link () {
+  >   echo "- !git"
+  >   echo "  url: file://$REPOS/origins/$1.git"
+  >   echo "  commit: master"
+  > }
+  $ make_origin () {
+  >   name=$1
+  >   shift
+  >   git init -q --bare -b master origins/$name.git
+  >   git clone -q origins/$name.git work/$name 2>/dev/null
+  >   mkdir -p work/$name/.buzzy
+  >   echo "shared: from $name" > work/$name/.buzzy/repo.yaml
+  >   echo "$name: $name" >> work/$name/.buzzy/repo.yaml
+  >   if [ $# -gt 0 ]; then
+  >     for link in "$@"; do git_link $link; done \
+  >       > work/$name/.buzzy/links.yaml
+  >   fi
+  >   git -C work/$name add .buzzy
+  >   git -C work/$name commit -q -m "$name"
+  >   git -C work/$name push -q origin master
+  > }
+  $ make_origin c
+  $ make_origin a c
+  $ make_origin b c
+
+  $ mkdir -p graph-repo/.buzzy
+  $ (git_link a; git_link b) > graph-repo/.buzzy/links.yaml
+
+  $ cd graph-repo
+  $ buzzy update -j 4
+  [1] Clone file://*/origins/a.git (master) (glob)
+  [2] Clone file://*/origins/b.git (master) (glob)
+  [3] Clone file://*/origins/c.git (master) (glob)
+  [4] Update file://*/origins/a.git (master) (glob)
+  [5] Update file://*/origins/b.git (master) (glob)
+  [6] Update file://*/origins/c.git (master) (glob)
+  $ ls $XDG_CACHE_HOME/buzzy/repos
+  a-* (glob)
+  b-* (glob)
+  c-* (glob)
+  $ buzzy doc shared
+  No documentation for shared
+  
+    Current value: from a
+  $ buzzy doc c
+  No documentation for c
+  
+    Current value: c
+  $ cd ..
@@ -218,6 +218,168 @@ START_TEST(test_arch_nonexistent_native_package_01)
 END_TEST
 
 
+/*-----------------------------------------------------------------------
+ * pacman databases
+ */
+
+static void
+mock_pacman_local(void)
+{
+    bz_mock_file_contents
+        ("/var/lib/pacman/local/jansson-2.4-1/desc",
+         "%NAME%\n"
+         "jansson\n"
+         "\n"
+         "%VERSION%\n"
+         "2.4-1\n"
+         "\n"
+         "%DESC%\n"
+         "C library for encoding and decoding JSON\n");
+    /* These should be ignored */
+    bz_mock_file_contents
+        ("/var/lib/pacman/local/jansson-2.4-1/files",
+         "%NAME%\n"
+         "libignored\n"
+         "\n"
+         "%VERSION%\n"
+         "1.0-1\n");
+    bz_mock_file_contents("/var/lib/pacman/local/ALPM_DB_VERSION", "9\n");
+}
+
+static void
+mock_pacman_sync(void)
+{
+    bz_mock_file_contents
+        ("/etc/pacman.conf",
+         "[options]\n"
+         "Architecture = auto\n"
+         "\n"
+         "[core]\n"
+         "Include = /etc/pacman.d/mirrorlist\n"
+         "\n"
+         "  [extra]\n"
+         "Include = /etc/pacman.d/mirrorlist\n"
+         "\n"
+         "[missing]\n"
+         "Include = /etc/pacman.d/mirrorlist\n");
+    bz_mock_file_contents("/var/lib/pacman/sync/core.db", "core");
+    bz_mock_file_contents("/var/lib/pacman/sync/extra.db", "extra");
+    bz_mock_subprocess
+        ("tar -xOf /var/lib/pacman/sync/core.db --wildcards */desc",
+         "%FILENAME%\n"
+         "jansson-2.5-1-x86_64.pkg.tar.xz\n"
+         "\n"
+         "%NAME%\n"
+         "jansson\n"
+         "\n"
+         "%VERSION%\n"
+         "2.5-1\n"
+         "\n"
+         "%NAME%\n"
+         "libfoo\n"
+         "\n"
+         "%VERSION%\n"
+         "1.0-1\n",
+         NULL, 0);
+    bz_mock_subprocess
+        ("tar -xOf /var/lib/pacman/sync/extra.db --wildcards */desc",
+         "%NAME%\n"
+         "jansson\n"
+         "\n"
+         "%VERSION%\n"
+         "2.6-1\n"
+         "\n"
+         "%NAME%\n"
+         "libbar\n"
+         "\n"
+         "%VERSION%\n"
+         "2.0-1\n",
+         NULL, 0);
+}
+
+START_TEST(test_pacman_local_01)
+{
+    DESCRIBE_TEST;
+    struct bz_version  *version;
+    /* Read installed versions from pacman's local database rather than
+     * running pacman. */
+    reset_everything();
+    bz_start_mocks();
+    mock_pacman_local();
+
+    fail_if_error(version = bz_arch_native_version_installed("jansson"));
+    test_and_free_version(version, "2.4");
+    fail_if_error(version = bz_arch_native_version_installed("libignored"));
+    fail_unless(version == NULL, "Unexpected version");
+    fail_unless(strstr(bz_mocked_commands_run(), "pacman") == NULL,
+                "Shouldn't run pacman");
+
+    /* Installing a package should be picked up by the next query. */
+    bz_mock_file_contents
+        ("/var/lib/pacman/local/libfoo-1.0-1/desc",
+         "%NAME%\n"
+         "libfoo\n"
+         "\n"
+         "%VERSION%\n"
+         "1.0-1\n");
+    fail_if_error(version = bz_arch_native_version_installed("libfoo"));
+    test_and_free_version(version, "1.0");
+}
+END_TEST
+
+START_TEST(test_pacman_sync_01)
+{
+    DESCRIBE_TEST;
+    struct bz_version  *version;
+    /* Read available versions from pacman's sync databases, preferring the
+     * first repository that contains each package. */
+    reset_everything();
+    bz_start_mocks();
+    mock_pacman_sync();
+
+    fail_if_error(version = bz_arch_native_version_available("jansson"));
+    test_and_free_version(version, "2.5");
+    fail_if_error(version = bz_arch_native_version_available("libfoo"));
+    test_and_free_version(version, "1.0");
+    fail_if_error(version = bz_arch_native_version_available("libbar"));
+    test_and_free_version(version, "2.0");
+    fail_if_error(version = bz_arch_native_version_available("libbaz"));
+    fail_unless(version == NULL, "Unexpected version");
+
+    fail_unless(strstr(bz_mocked_commands_run(), "pacman -S") == NULL,
+                "Shouldn't run pacman");
+    fail_unless(strstr(bz_mocked_commands_run(),
+                       "$ cat > /home/test/.cache/buzzy/pacman-sync.index")
+                != NULL, "Should save pacman sync index");
+}
+END_TEST
+
+START_TEST(test_pacman_sync_02)
+{
+    DESCRIBE_TEST;
+    struct bz_version  *version;
+    /* Reuse the saved index until one of the sync databases changes. */
+    reset_everything();
+    bz_start_mocks();
+    mock_pacman_sync();
+    fail_if_error(version = bz_arch_native_version_available("jansson"));
+    test_and_free_version(version, "2.5");
+
+    /* If we rebuilt the index, this would be an error. */
+    bz_mock_subprocess
+        ("tar -xOf /var/lib/pacman/sync/core.db --wildcards */desc",
+         NULL, "tar: Error opening archive\n", 2);
+    fail_if_error(version = bz_arch_native_version_available("libbar"));
+    test_and_free_version(version, "2.0");
+
+    /* But once the database changes, we have to rebuild it. */
+    bz_mock_file_contents("/var/lib/pacman/sync/core.db", "core, updated");
+    fail_unless_error(version = bz_arch_native_version_available("libbar"),
+                      "Should rebuild pacman sync index");
+}
+END_TEST
+
+
 /*-----------------------------------------------------------------------
  * Native package database
  */
@@ -768,6 +930,9 @@ test_suite()
     tcase_add_test(tc_arch, test_arch_uninstalled_native_package_01);
     tcase_add_test(tc_arch, test_arch_installed_native_package_01);
     tcase_add_test(tc_arch, test_arch_nonexistent_native_package_01);
+    tcase_add_test(tc_arch, test_pacman_local_01);
+    tcase_add_test(tc_arch, test_pacman_sync_01);
+    tcase_add_test(tc_arch, test_pacman_sync_02);
     suite_add_tcase(s, tc_arch);
 
     TCase  *tc_arch_pdb = tcase_create("arch-pdb");
@@ -7,6 +7,7 @@
  * ----------------------------------------------------------------------
  */
 
+#include <stdarg.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -70,6 +71,37 @@ mock_installed_package(const char *package, const char *installed_version)
     cork_buffer_done(&buf2);
 }
 
+/* Mocks the single apt-cache query that the native package database uses to
+ * check all of the candidate native names for a Buzzy package.  The varargs
+ * are pairs of native package names and versions, and should list the
+ * candidates that are available. */
+CORK_ATTR_SENTINEL
+static void
+mock_available_candidates(const char *package, ...)
+{
+    va_list  args;
+    const char  *native_package;
+    struct cork_buffer  buf1 = CORK_BUFFER_INIT();
+    struct cork_buffer  buf2 = CORK_BUFFER_INIT();
+    cork_buffer_printf
+        (&buf1, "apt-cache show --no-all-versions %s-dev lib%s-dev %s lib%s",
+         package, package, package, package);
+    va_start(args, package);
+    while ((native_package = va_arg(args, const char *)) != NULL) {
+        const char  *version = va_arg(args, const char *);
+        cork_buffer_append_printf
+            (&buf2, "Package: %s\nVersion: %s\n\n", native_package, version);
+    }
+    va_end(args);
+    if (buf2.size == 0) {
+        bz_mock_subprocess(buf1.buf, NULL, "E: No packages found\n", 100);
+    } else {
+        bz_mock_subprocess(buf1.buf, buf2.buf, NULL, 0);
+    }
+    cork_buffer_done(&buf1);
+    cork_buffer_done(&buf2);
+}
+
 static void
 mock_uninstalled_package(const char *package)
 {
@@ -275,6 +307,396 @@ START_TEST(test_apt_nonexistent_native_package_01)
 }
 END_TEST
 
+static void
+mock_apt_lists(void)
+{
+    bz_mock_subprocess("dpkg --print-architecture", "amd64\n", NULL, 0);
+    bz_mock_file_contents
+        ("/var/lib/apt/lists/example.org_main_Packages",
+         "Package: jansson\n"
+         "Architecture: amd64\n"
+         "Version: 2.4-1\n"
+         "Description: C library for encoding and decoding JSON\n"
+         " A multi-line description\n"
+         "\n"
+         "Package: libfoo\n"
+         "Version: 2.0\n"
+         "\n"
+         "Package: libbar\n"
+         "Version: 1:1.0\n"
+         "\n"
+         "Package: libbaz\n"
+         "Version: 3.0\n");
+    bz_mock_file_contents
+        ("/var/lib/apt/lists/example.org_updates_Packages",
+         "Package: jansson\n"
+         "Version: 2.5-1\n"
+         "\n"
+         "Package: libfoo\n"
+         "Version: 1.9\n"
+         "\n"
+         "Package: libbar\n"
+         "Version: 2.0\n"
+         "\n"
+         "Package: libbaz\n"
+         "Version: 3.0~rc1\n");
+    /* These should be ignored */
+    bz_mock_file_contents
+        ("/var/lib/apt/lists/example.org_main_Release",
+         "Package: libignored\n"
+         "Version: 1.0\n");
+    bz_mock_file_contents
+        ("/var/lib/apt/lists/partial/example.org_main_Packages",
+         "Package: libignored\n"
+         "Version: 1.0\n");
+}
+
+START_TEST(test_apt_lists_01)
+{
+    DESCRIBE_TEST;
+    struct bz_version  *version;
+    const char  *names[] = { "jansson", "libignored", "libbar" };
+    struct bz_version  *versions[3];
+    /* Read available versions from apt's package lists rather than running
+     * apt-cache, choosing the newest version from any of the lists. */
+    reset_everything();
+    bz_start_mocks();
+    mock_apt_lists();
+    mock_unavailable_package("libignored");
+
+    fail_if_error(version = bz_apt_native_version_available("jansson"));
+    test_and_free_version(version, "2.5");
+    fail_if_error(version = bz_apt_native_version_available("libfoo"));
+    test_and_free_version(version, "2.0");
+    fail_if_error(version = bz_apt_native_version_available("libbar"));
+    test_and_free_version(version, ":1:1.0");
+    fail_if_error(version = bz_apt_native_version_available("libbaz"));
+    test_and_free_version(version, "3.0");
+    fail_if_error(version = bz_apt_native_version_available("libignored"));
+    fail_unless(version == NULL, "Unexpected version");
+
+    fail_if_error(bz_apt_native_version_available_many(3, names, versions));
+    test_and_free_version(versions[0], "2.5");
+    fail_unless(versions[1] == NULL, "Unexpected version");
+    test_and_free_version(versions[2], ":1:1.0");
+
+    /* We should only ask apt-cache about the package that isn't in any of
+     * the lists. */
+    fail_unless(strstr(bz_mocked_commands_run(),
+                       "$ apt-cache show --no-all-versions libignored\n")
+                != NULL, "Should ask apt-cache about unindexed packages");
+    fail_unless(strstr(bz_mocked_commands_run(), "apt-cache show "
+                       "--no-all-versions jansson") == NULL,
+                "Shouldn't ask apt-cache about indexed packages");
+    fail_unless(strstr(bz_mocked_commands_run(),
+                       "$ cat > /home/test/.cache/buzzy/apt-packages.index")
+                != NULL, "Should save apt package index");
+}
+END_TEST
+
+START_TEST(test_apt_lists_02)
+{
+    DESCRIBE_TEST;
+    struct bz_version  *version;
+    struct cork_buffer  saved = CORK_BUFFER_INIT();
+    struct cork_buffer  tampered = CORK_BUFFER_INIT();
+    char  *jansson;
+    /* Make sure that we reuse the saved index, but only while the package
+     * lists haven't changed. */
+    reset_everything();
+    bz_start_mocks();
+    mock_apt_lists();
+    fail_if_error(version = bz_apt_native_version_available("jansson"));
+    test_and_free_version(version, "2.5");
+
+    /* Edit the saved index so that we can tell when we're using it. */
+    fail_if_error(bz_load_file
+                  ("/home/test/.cache/buzzy/apt-packages.index", &saved));
+    jansson = strstr(saved.buf, "\njansson 2.5-1\n");
+    fail_if(jansson == NULL, "Missing index entry for jansson");
+    cork_buffer_append(&tampered, saved.buf, jansson - (char *) saved.buf);
+    cork_buffer_append_string(&tampered, "\njansson 2.6-1\n");
+    cork_buffer_append_string(&tampered, jansson + 15);
+    bz_mock_file_contents
+        ("/home/test/.cache/buzzy/apt-packages.index", tampered.buf);
+    bz_apt_native_lists_invalidate();
+    fail_if_error(version = bz_apt_native_version_available("jansson"));
+    test_and_free_version(version, "2.6");
+
+    /* A truncated index should be ignored. */
+    cork_buffer_truncate(&tampered, tampered.size - 15);
+    bz_mock_file_contents
+        ("/home/test/.cache/buzzy/apt-packages.index", tampered.buf);
+    bz_apt_native_lists_invalidate();
+    fail_if_error(version = bz_apt_native_version_available("jansson"));
+    test_and_free_version(version, "2.5");
+
+    /* So should one that's cut off in the middle of its header... */
+    cork_buffer_clear(&saved);
+    fail_if_error(bz_load_file
+                  ("/home/test/.cache/buzzy/apt-packages.index", &saved));
+    jansson = strstr(saved.buf, "entries ");
+    fail_if(jansson == NULL, "Missing entry count");
+    cork_buffer_set(&tampered, saved.buf, jansson + 9 - (char *) saved.buf);
+    bz_mock_file_contents
+        ("/home/test/.cache/buzzy/apt-packages.index", tampered.buf);
+    bz_apt_native_lists_invalidate();
+    fail_if_error(version = bz_apt_native_version_available("jansson"));
+    test_and_free_version(version, "2.5");
+
+    /* ...or one with a malformed entry. */
+    cork_buffer_clear(&saved);
+    fail_if_error(bz_load_file
+                  ("/home/test/.cache/buzzy/apt-packages.index", &saved));
+    jansson = strstr(saved.buf, "\njansson 2.5-1\n");
+    fail_if(jansson == NULL, "Missing index entry for jansson");
+    cork_buffer_set(&tampered, saved.buf, jansson - (char *) saved.buf);
+    cork_buffer_append_string(&tampered, "\njansson-2.6-1\n");
+    cork_buffer_append_string(&tampered, jansson + 15);
+    bz_mock_file_contents
+        ("/home/test/.cache/buzzy/apt-packages.index", tampered.buf);
+    bz_apt_native_lists_invalidate();
+    fail_if_error(version = bz_apt_native_version_available("jansson"));
+    test_and_free_version(version, "2.5");
+
+    /* Changing a package list should cause us to rebuild the index. */
+    bz_mock_file_contents
+        ("/home/test/.cache/buzzy/apt-packages.index", tampered.buf);
+    bz_mock_file_contents
+        ("/var/lib/apt/lists/example.org_updates_Packages",
+         "Package: jansson\n"
+         "Version: 2.7-1\n");
+    fail_if_error(version = bz_apt_native_version_available("jansson"));
+    test_and_free_version(version, "2.7");
+    fail_if_error(version = bz_apt_native_version_available("libbaz"));
+    test_and_free_version(version, "3.0");
+
+    cork_buffer_done(&saved);
+    cork_buffer_done(&tampered);
+}
+END_TEST
+
+START_TEST(test_apt_lists_03)
+{
+    DESCRIBE_TEST;
+    struct bz_version  *version;
+    const char  *names[] = { "jansson", "libfoo" };
+    struct bz_version  *versions[2];
+    /* If any of the package lists are compressed, we can't use the index,
+     * even for the packages in the uncompressed lists. */
+    reset_everything();
+    bz_start_mocks();
+    mock_apt_lists();
+    bz_mock_file_contents
+        ("/var/lib/apt/lists/example.org_backports_Packages.lz4",
+         "not really lz4");
+    mock_available_package("jansson", "2.8-1");
+    mock_available_package("libfoo", "2.0");
+    bz_mock_subprocess
+        ("apt-cache show --no-all-versions jansson libfoo",
+         "Package: jansson\n"
+         "Version: 2.8-1\n"
+         "\n"
+         "Package: libfoo\n"
+         "Version: 2.0\n",
+         NULL, 0);
+
+    fail_if_error(version = bz_apt_native_version_available("jansson"));
+    test_and_free_version(version, "2.8");
+    fail_if_error(bz_apt_native_version_available_many(2, names, versions));
+    test_and_free_version(versions[0], "2.8");
+    test_and_free_version(versions[1], "2.0");
+    verify_commands_run
+        ("$ apt-cache show --no-all-versions jansson\n"
+         "$ apt-cache show --no-all-versions jansson libfoo\n");
+}
+END_TEST
+
+START_TEST(test_apt_lists_04)
+{
+    DESCRIBE_TEST;
+    struct bz_version  *version;
+    /* Only use the packages from the lists that apt would install for the
+     * native architecture. */
+    reset_everything();
+    bz_start_mocks();
+    bz_mock_subprocess("dpkg --print-architecture", "amd64\n", NULL, 0);
+    bz_mock_file_contents
+        ("/var/lib/apt/lists/example.org_main_binary-amd64_Packages",
+         "Package: jansson\n"
+         "Architecture: amd64\n"
+         "Version: 2.4-1\n"
+         "\n"
+         "Package: jansson-doc\n"
+         "Architecture: all\n"
+         "Version: 2.4-1\n");
+    bz_mock_file_contents
+        ("/var/lib/apt/lists/example.org_main_binary-i386_Packages",
+         "Package: jansson\n"
+         "Architecture: i386\n"
+         "Version: 2.5-1\n"
+         "\n"
+         "Package: jansson-doc\n"
+         "Architecture: all\n"
+         "Version: 2.4-1\n"
+         "\n"
+         "Package: libi386only\n"
+         "Architecture: i386\n"
+         "Version: 1.0\n");
+    mock_unavailable_package("libi386only");
+
+    fail_if_error(version = bz_apt_native_version_available("jansson"));
+    test_and_free_version(version, "2.4");
+    fail_if_error(version = bz_apt_native_version_available("jansson-doc"));
+    test_and_free_version(version, "2.4");
+    fail_if_error(version = bz_apt_native_version_available("libi386only"));
+    fail_unless(version == NULL, "Unexpected version");
+    fail_unless(strstr(bz_mocked_commands_run(),
+                       "arch amd64\n"
+                       "entries 2\n"
+                       "jansson 2.4-1\n"
+                       "jansson-doc 2.4-1\n")
+                != NULL, "Should only index native packages");
+}
+END_TEST
+
+START_TEST(test_apt_lists_05)
+{
+    DESCRIBE_TEST;
+    struct bz_version  *version;
+    /* apt preferences can pin a package to an older version, so we can't use
+     * the index if there are any. */
+    reset_everything();
+    bz_start_mocks();
+    mock_apt_lists();
+    bz_mock_file_contents
+        ("/etc/apt/preferences.d/jansson",
+         "Package: jansson\n"
+         "Pin: version 2.4*\n"
+         "Pin-Priority: 1001\n");
+    mock_available_package("jansson", "2.4-1");
+
+    fail_if_error(version = bz_apt_native_version_available("jansson"));
+    test_and_free_version(version, "2.4");
+    verify_commands_run("$ apt-cache show --no-all-versions jansson\n");
+}
+END_TEST
+
+START_TEST(test_dpkg_status_01)
+{
+    DESCRIBE_TEST;
+    struct bz_version  *version;
+    /* Read installed versions from the dpkg status database rather than
+     * running dpkg-query. */
+    reset_everything();
+    bz_start_mocks();
+    bz_mock_file_contents("/var/lib/dpkg/status",
+        "Package: jansson\n"
+        "Status: install ok installed\n"
+        "Priority: optional\n"
+        "Version: 2.4\n"
+        "Description: C library for encoding and decoding JSON\n"
+        " A multi-line description\n"
+        " Version: 0.0 (not a field)\n"
+        "\n"
+        "Package: libfoo\n"
+        "Status: deinstall ok config-files\n"
+        "Version: 1.0\n"
+        "\n"
+        "Package: libbar\n"
+        "Status: install ok half-installed\n"
+        "Version: 1.0\n"
+        "\n"
+        "Package: libc6\n"
+        "Status: deinstall ok not-installed\n"
+        "Architecture: i386\n"
+        "\n"
+        "Package: libc6\n"
+        "Status: install ok installed\n"
+        "Architecture: amd64\n"
+        "Version: 1:2.19-1\n"
+    );
+
+    fail_if_error(version = bz_deb_native_version_installed("jansson"));
+    test_and_free_version(version, "2.4");
+    fail_if_error(version = bz_deb_native_version_installed("libc6"));
+    test_and_free_version(version, ":1:2.19");
+    fail_if_error(version = bz_deb_native_version_installed("libfoo"));
+    fail_unless(version == NULL, "Unexpected version");
+    fail_if_error(version = bz_deb_native_version_installed("libbar"));
+    fail_unless(version == NULL, "Unexpected version");
+    fail_if_error(version = bz_deb_native_version_installed("libbaz"));
+    fail_unless(version == NULL, "Unexpected version");
+    verify_commands_run("");
+}
+END_TEST
+
+START_TEST(test_dpkg_status_02)
+{
+    DESCRIBE_TEST;
+    struct bz_version  *version;
+    /* Make sure that we notice when the status database changes. */
+    reset_everything();
+    bz_start_mocks();
+    bz_mock_file_contents("/var/lib/dpkg/status",
+        "Package: jansson\n"
+        "Status: install ok installed\n"
+        "Version: 2.4\n"
+    );
+    fail_if_error(version = bz_deb_native_version_installed("jansson"));
+    test_and_free_version(version, "2.4");
+
+    bz_mock_file_contents("/var/lib/dpkg/status",
+        "Package: jansson\n"
+        "Status: install ok installed\n"
+        "Version: 2.5\n"
+    );
+    fail_if_error(version = bz_deb_native_version_installed("jansson"));
+    test_and_free_version(version, "2.5");
+
+    bz_mock_file_contents("/var/lib/dpkg/status",
+        "Package: jansson\n"
+        "Status: deinstall ok config-files\n"
+        "Version: 2.5\n"
+    );
+    bz_deb_native_status_invalidate();
+    fail_if_error(version = bz_deb_native_version_installed("jansson"));
+    fail_unless(version == NULL, "Unexpected version");
+    verify_commands_run("");
+}
+END_TEST
+
+START_TEST(test_apt_available_many_01)
+{
+    DESCRIBE_TEST;
+    const char  *names[] = { "jansson-dev", "libjansson-dev", "jansson" };
+    struct bz_version  *versions[3];
+    /* Look up several packages with a single apt-cache query, some of which
+     * aren't available. */
+    reset_everything();
+    bz_start_mocks();
+    bz_mock_subprocess
+        ("apt-cache show --no-all-versions jansson-dev libjansson-dev jansson",
+         "Package: libjansson-dev\n"
+         "Version: 2.5-1\n"
+         "Description: C library for encoding and decoding JSON\n"
+         "\n"
+         "Package: jansson\n"
+         "Version: 2.4\n"
+         "\n",
+         "N: Unable to locate package jansson-dev\n", 0);
+
+    fail_if_error(bz_apt_native_version_available_many(3, names, versions));
+    fail_unless(versions[0] == NULL, "Unexpected version");
+    test_and_free_version(versions[1], "2.5");
+    test_and_free_version(versions[2], "2.4");
+    verify_commands_run(
+        "$ apt-cache show --no-all-versions"
+        " jansson-dev libjansson-dev jansson\n"
+    );
+}
+END_TEST
+
 
 /*-----------------------------------------------------------------------
  * Native package database
@@ -317,10 +739,7 @@ START_TEST(test_apt_pdb_uninstalled_native_package_01)
     /* A package that is available in the native package database, but has not
      * yet been installed. */
     bz_start_mocks();
-    mock_unavailable_package("jansson-dev");
-    mock_unavailable_package("libjansson-dev");
-    mock_unavailable_package("libjansson");
-    mock_available_package("jansson", "2.4");
+    mock_available_candidates("jansson", "jansson", "2.4", NULL);
     mock_uninstalled_package("jansson");
     mock_package_installation("jansson", "2.4");
 
@@ -348,9 +767,7 @@ START_TEST(test_apt_pdb_uninstalled_native_package_02)
     /* Test that if we try to install the same dependency twice, the second
      * attempt is a no-op. */
     bz_start_mocks();
-    mock_unavailable_package("jansson-dev");
-    mock_unavailable_package("libjansson-dev");
-    mock_available_package("jansson", "2.4");
+    mock_available_candidates("jansson", "jansson", "2.4", NULL);
     mock_uninstalled_package("jansson");
     mock_package_installation("jansson", "2.4");
 
@@ -374,9 +791,7 @@ START_TEST(test_apt_pdb_installed_native_package_01)
     /* A package that is available in the native package database, and has been
      * installed. */
     bz_start_mocks();
-    mock_unavailable_package("jansson-dev");
-    mock_unavailable_package("libjansson-dev");
-    mock_available_package("jansson", "2.4");
+    mock_available_candidates("jansson", "jansson", "2.4", NULL);
     mock_installed_package("jansson", "2.4");
 
     fail_if_error(pdb = bz_apt_native_pdb());
@@ -395,10 +810,7 @@ START_TEST(test_apt_pdb_nonexistent_native_package_01)
 
     /* A package that isn't available in the native package database. */
     bz_start_mocks();
-    mock_unavailable_package("jansson-dev");
-    mock_unavailable_package("libjansson-dev");
-    mock_unavailable_package("jansson");
-    mock_unavailable_package("libjansson");
+    mock_available_candidates("jansson", NULL);
 
     fail_if_error(pdb = bz_apt_native_pdb());
 
@@ -409,6 +821,43 @@ START_TEST(test_apt_pdb_nonexistent_native_package_01)
 }
 END_TEST
 
+START_TEST(test_apt_pdb_candidate_order_01)
+{
+    DESCRIBE_TEST;
+    struct bz_pdb  *pdb;
+
+    /* If more than one candidate native package is available, we should choose
+     * the first one in pattern order, and only query apt-cache once. */
+    reset_everything();
+    bz_start_mocks();
+    mock_available_candidates
+        ("jansson", "jansson", "2.4", "libjansson-dev", "2.4", NULL);
+    mock_uninstalled_package("libjansson-dev");
+    mock_package_installation("libjansson-dev", "2.4");
+
+    fail_if_error(pdb = bz_apt_native_pdb());
+
+    test_apt_pdb_dep(pdb, "jansson",
+        "[1] Install native Debian package libjansson-dev 2.4\n"
+    );
+
+    test_apt_pdb_dep(pdb, "jansson >= 2.4",
+        "[1] Install native Debian package libjansson-dev 2.4\n"
+    );
+
+    verify_commands_run(
+        "$ apt-cache show --no-all-versions"
+        " jansson-dev libjansson-dev jansson libjansson\n"
+        "$ dpkg-query -W -f ${Status}\\n${Version} libjansson-dev\n"
+        "$ sudo apt-get install -y libjansson-dev\n"
+        "$ dpkg-query -W -f ${Status}\\n${Version} libjansson-dev\n"
+        "$ sudo apt-get install -y libjansson-dev\n"
+    );
+
+    bz_pdb_free(pdb);
+}
+END_TEST
+
 START_TEST(test_apt_pdb_uninstalled_override_package_01)
 {
     DESCRIBE_TEST;
@@ -650,9 +1099,9 @@ START_TEST(test_deb_create_package_deps_01)
     fail_if_error(env = bz_package_env_new(NULL, "jansson", version));
     deps = bz_array_new();
     bz_array_append(deps, bz_string_value_new("libfoo"));
-    mock_available_package("libfoo-dev", "2.0");
+    mock_available_candidates("libfoo", "libfoo-dev", "2.0", NULL);
     bz_array_append(deps, bz_string_value_new("libbar >= 2.5~alpha.1"));
-    mock_available_package("libbar-dev", "2.5~alpha.3");
+    mock_available_candidates("libbar", "libbar-dev", "2.5~alpha.3", NULL);
     fail_if_error(bz_env_add_override
                   (env, "dependencies", bz_array_as_value(deps)));
     test_create_package(env, false,
@@ -665,8 +1114,10 @@ START_TEST(test_deb_create_package_deps_01)
         "$ mkdir -p /tmp/staging/DEBIAN\n"
         "$ mkdir -p /home/test/.cache/buzzy/build/jansson-buzzy/pkg\n"
         "$ mkdir -p .\n"
-        "$ apt-cache show --no-all-versions libfoo-dev\n"
-        "$ apt-cache show --no-all-versions libbar-dev\n"
+        "$ apt-cache show --no-all-versions"
+        " libfoo-dev liblibfoo-dev libfoo liblibfoo\n"
+        "$ apt-cache show --no-all-versions"
+        " libbar-dev liblibbar-dev libbar liblibbar\n"
         "$ cat > /tmp/staging/DEBIAN/control <<EOF\n"
         "Package: jansson\n"
         "Description: jansson\n"
@@ -850,6 +1301,14 @@ test_suite()
     tcase_add_test(tc_deb, test_apt_installed_native_package_01);
     tcase_add_test(tc_deb, test_apt_installed_native_epoch_package_01);
     tcase_add_test(tc_deb, test_apt_nonexistent_native_package_01);
+    tcase_add_test(tc_deb, test_apt_available_many_01);
+    tcase_add_test(tc_deb, test_dpkg_status_01);
+    tcase_add_test(tc_deb, test_dpkg_status_02);
+    tcase_add_test(tc_deb, test_apt_lists_01);
+    tcase_add_test(tc_deb, test_apt_lists_02);
+    tcase_add_test(tc_deb, test_apt_lists_03);
+    tcase_add_test(tc_deb, test_apt_lists_04);
+    tcase_add_test(tc_deb, test_apt_lists_05);
     suite_add_tcase(s, tc_deb);
 
     TCase  *tc_apt_pdb = tcase_create("apt-pdb");
@@ -857,6 +1316,7 @@ test_suite()
     tcase_add_test(tc_apt_pdb, test_apt_pdb_uninstalled_native_package_02);
     tcase_add_test(tc_apt_pdb, test_apt_pdb_installed_native_package_01);
     tcase_add_test(tc_apt_pdb, test_apt_pdb_nonexistent_native_package_01);
+    tcase_add_test(tc_apt_pdb, test_apt_pdb_candidate_order_01);
     tcase_add_test(tc_apt_pdb, test_apt_pdb_uninstalled_override_package_01);
     tcase_add_test(tc_apt_pdb, test_apt_pdb_uninstalled_override_package_02);
     tcase_add_test(tc_apt_pdb, test_apt_pdb_preinstalled_package_01);
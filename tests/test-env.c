@@ -10,13 +10,22 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include <check.h>
+#include <yaml.h>
 
+#include "buzzy/arena.h"
 #include "buzzy/env.h"
+#include "buzzy/profile.h"
 #include "buzzy/value.h"
+#include "buzzy/version.h"
 
 #include "helpers.h"
+#include "yaml_private.h"
 
 
 /*-----------------------------------------------------------------------
@@ -81,6 +90,8 @@ START_TEST(test_interpolated_values)
     test_good_interpolated_value("${nested.var}", NULL);
     test_good_interpolated_value("embedded $$ dollar sign",
                                  "embedded $ dollar sign");
+    test_good_interpolated_value("$$", "$");
+    test_good_interpolated_value("$$$$ and $$", "$$ and $");
     test_bad_interpolated_value("${unclosed");
     test_bad_interpolated_value("${invalid char");
 }
@@ -135,6 +146,38 @@ START_TEST(test_map_01)
 }
 END_TEST
 
+START_TEST(test_map_keys_01)
+{
+    DESCRIBE_TEST;
+    struct bz_value  *map = bz_map_new();
+    struct bz_union_map  *umap = bz_union_map_new();
+    const struct bz_key  *key;
+    const struct bz_key  *missing;
+    struct bz_value  *value;
+
+    /* Interning the same name twice gives you the same key, and you can use
+     * an interned key to look up nested values in any kind of map. */
+    key = bz_key_intern("a.b.c");
+    fail_unless(key == bz_key_intern("a.b.c"), "Keys should be interned");
+    fail_unless_streq("Key name", "a.b.c", bz_key_name(key));
+    missing = bz_key_intern("a.missing.c");
+    fail_if_error(bz_value_set_nested
+                  (map, "a.b.c", bz_string_value_new("hello"), true));
+    bz_union_map_add(umap, map);
+
+    fail_if_error(value = bz_value_get_key(map, key));
+    fail_unless_streq("Nested value", "hello",
+                      bz_scalar_value_get(value, NULL));
+    fail_if_error(value = bz_value_get_key
+                  (bz_union_map_as_value(umap), key));
+    fail_unless_streq("Nested value", "hello",
+                      bz_scalar_value_get(value, NULL));
+    fail_if_error(value = bz_value_get_key(map, missing));
+    fail_unless(value == NULL, "Shouldn't find a.missing.c");
+    bz_value_free(bz_union_map_as_value(umap));
+}
+END_TEST
+
 
 /*-----------------------------------------------------------------------
  * Environments
@@ -299,15 +342,333 @@ START_TEST(test_env_01)
     map_add_interpolated(map1, "b", "${a} world");
     map_add_interpolated(map1, "c", "${a} ${b}");
     map_add_interpolated(map1, "d", "${missing}");
+    map_add_interpolated(map1, "e", "$${a}=${a}$$");
+    fail_if_error(bz_value_set_nested
+                  (map1, "nested.var", bz_string_value_new("nested"), true));
+    map_add_interpolated(map1, "f", "[${nested.var}]");
     test_env(env, "a", "hello");
     test_env(env, "b", "hello world");
     test_env(env, "c", "hello hello world");
     test_env_error(env, "d");
+    test_env(env, "e", "${a}=hello$");
+    test_env(env, "f", "[nested]");
+
+    bz_env_free(env);
+}
+END_TEST
+
+
+START_TEST(test_env_memoized_01)
+{
+    DESCRIBE_TEST;
+    struct bz_env  *env = bz_env_new("test");
+    struct bz_value  *map1 = bz_map_new();
+    size_t  start;
+    size_t  i;
+
+    /* Interpolated values should only render their templates again when one
+     * of the variables that they read has changed. */
+    bz_env_add_set(env, map1);
+    map_add_string(map1, "cache_dir", "/cache");
+    map_add_interpolated(map1, "work_dir", "${cache_dir}/work");
+    map_add_interpolated(map1, "package_work_dir", "${work_dir}/pkg");
+    map_add_interpolated(map1, "staging_dir", "${package_work_dir}/stage");
+    map_add_string(map1, "name", "test");
+
+    start = bz_interpolated_value_render_count();
+    for (i = 0; i < 100; i++) {
+        test_env(env, "staging_dir", "/cache/work/pkg/stage");
+        test_env(env, "work_dir", "/cache/work");
+    }
+    fail_unless_equal("Render count", "%zu",
+                      (size_t) 3, bz_interpolated_value_render_count() - start);
+
+    /* Changing a variable that none of them read doesn't cause a render. */
+    env_add_string(env, "name", "other");
+    test_env(env, "staging_dir", "/cache/work/pkg/stage");
+    fail_unless_equal("Render count", "%zu",
+                      (size_t) 3, bz_interpolated_value_render_count() - start);
+
+    /* Overriding the bottom of the chain renders everything again. */
+    env_add_string(env, "cache_dir", "/var/cache");
+    test_env(env, "staging_dir", "/var/cache/work/pkg/stage");
+    fail_unless_equal("Render count", "%zu",
+                      (size_t) 6, bz_interpolated_value_render_count() - start);
+
+    /* Overriding the middle of the chain only renders what depends on it. */
+    env_add_string(env, "package_work_dir", "/pkg");
+    test_env(env, "staging_dir", "/pkg/stage");
+    test_env(env, "work_dir", "/var/cache/work");
+    fail_unless_equal("Render count", "%zu",
+                      (size_t) 7, bz_interpolated_value_render_count() - start);
 
     bz_env_free(env);
 }
 END_TEST
 
+START_TEST(test_env_memoized_02)
+{
+    DESCRIBE_TEST;
+    struct bz_env  *env = bz_env_new("test");
+    struct bz_value  *map1 = bz_map_new();
+    struct bz_value  *map2 = bz_map_new();
+    struct bz_value  *map3 = bz_map_new();
+    struct bz_value  *map4 = bz_map_new();
+
+    /* Adding a set to an environment can change the value of variables that
+     * we've already read, even though none of the keys in any set change. */
+    map_add_string(map1, "a", "1");
+    map_add_interpolated(map1, "b", "${a}-${c}");
+    map_add_string(map2, "c", "x");
+    map_add_string(map3, "c", "y");
+    map_add_string(map4, "d", "4");
+
+    bz_env_add_set(env, map1);
+    bz_env_add_backup_set(env, map2);
+    test_env(env, "c", "x");
+    test_env(env, "b", "1-x");
+    test_env_missing(env, "d");
+
+    bz_env_add_set(env, map3);
+    test_env(env, "c", "y");
+    test_env(env, "b", "1-y");
+
+    bz_env_add_backup_set(env, map4);
+    test_env(env, "d", "4");
+
+    bz_env_free(env);
+}
+END_TEST
+
+START_TEST(test_env_frozen_01)
+{
+    DESCRIBE_TEST;
+    struct bz_env  *env = bz_env_new("test");
+    struct bz_env  *outer = bz_env_new("outer");
+    struct bz_value  *map1 = bz_map_new();
+    struct bz_value  *map2 = bz_map_new();
+    struct bz_value  *nested;
+
+    /* A frozen environment should give the same results as an unfrozen one,
+     * including for nested variables that are merged from several sets. */
+    bz_env_add_set(env, map1);
+    bz_env_add_backup_set(env, map2);
+    map_add_string(map1, "a", "1");
+    map_add_interpolated(map1, "c", "${a}-${nested.b}");
+    map_add_string(map2, "a", "0");
+    map_add_string(map2, "d", "4");
+    nested = bz_map_new();
+    map_add_string(nested, "b", "2");
+    fail_if_error(bz_map_value_add(map1, "nested", nested, false));
+    nested = bz_map_new();
+    map_add_string(nested, "e", "5");
+    fail_if_error(bz_map_value_add(map2, "nested", nested, false));
+
+    fail_if_error(bz_env_freeze(env));
+    fail_unless(bz_env_is_frozen(env), "Environment should be frozen");
+    test_env(env, "a", "1");
+    test_env(env, "c", "1-2");
+    test_env(env, "d", "4");
+    test_env(env, "nested.b", "2");
+    test_env(env, "nested.e", "5");
+    test_env_missing(env, "nested.f");
+    test_env_missing(env, "f");
+    fail_unless(bz_env_is_frozen(env), "Environment should still be frozen");
+
+    /* Changing one of the sets directly thaws the environment the next time we
+     * look up something that depends on the change. */
+    map_add_string(map1, "a", "3");
+    test_env(env, "c", "3-2");
+    test_env(env, "a", "3");
+    fail_if(bz_env_is_frozen(env), "Environment should be thawed");
+
+    /* Changing the environment itself thaws it right away. */
+    fail_if_error(bz_env_freeze(env));
+    env_add_string(env, "d", "new");
+    fail_if(bz_env_is_frozen(env), "Environment should be thawed");
+    test_env(env, "d", "new");
+
+    /* As does changing an environment that the frozen one is layered on top
+     * of. */
+    bz_env_add_set(outer, bz_value_copy(bz_env_as_value(env)));
+    fail_if_error(bz_env_freeze(outer));
+    test_env(outer, "nested.e", "5");
+    env_add_string(env, "nested.e", "6");
+    test_env(outer, "nested.e", "6");
+    fail_if(bz_env_is_frozen(outer), "Environment should be thawed");
+
+    bz_env_free(outer);
+    bz_env_free(env);
+}
+END_TEST
+
+START_TEST(test_env_typed_01)
+{
+    DESCRIBE_TEST;
+    struct bz_env  *env = bz_env_new("test");
+    struct bz_value  *value;
+    struct bz_array  *array;
+    struct cork_path  *path;
+    struct bz_version  *version;
+    const struct bz_dependency_list  *deps;
+
+    env_add_string(env, "verbose", "yes");
+    env_add_string(env, "jobs", "4");
+    env_add_string(env, "dir", "/tmp");
+    fail_if_error(value = bz_interpolated_value_new("${dir}/build"));
+    bz_env_add_override(env, "build_dir", value);
+    env_add_string(env, "version", "1.0");
+    array = bz_array_new();
+    bz_array_append(array, bz_string_value_new("a >= 1.0"));
+    bz_array_append(array, bz_string_value_new("b"));
+    bz_env_add_override(env, "dependencies", bz_array_as_value(array));
+
+    /* Looking up a typed variable twice gives us the cached result. */
+    fail_unless(bz_env_get_bool(env, "verbose", true), "Expected true");
+    fail_unless(bz_env_get_bool(env, "verbose", true), "Expected true");
+    fail_unless(bz_env_get_long(env, "jobs", true) == 4, "Expected 4");
+    fail_if_error(path = bz_env_get_path(env, "build_dir", true));
+    fail_unless_streq("Path", "/tmp/build", cork_path_get(path));
+    fail_unless(bz_env_get_path(env, "build_dir", true) == path,
+                "Expected cached path");
+    fail_if_error(version = bz_env_get_version(env, "version", true));
+    fail_unless(bz_env_get_version(env, "version", true) == version,
+                "Expected cached version");
+    fail_if_error(deps = bz_env_get_dependencies(env, "dependencies", true));
+    fail_unless(deps->count == 2, "Expected 2 dependencies");
+    fail_unless_streq("Dependency", "a >= 1.0",
+                      bz_dependency_to_string(deps->deps[0]));
+    fail_unless_streq("Dependency", "b",
+                      bz_dependency_to_string(deps->deps[1]));
+
+    /* Changing any variable invalidates the cached results, including the ones
+     * that depend on the changed variable indirectly. */
+    env_add_string(env, "verbose", "no");
+    env_add_string(env, "jobs", "8");
+    env_add_string(env, "dir", "/var");
+    env_add_string(env, "version", "2.0");
+    fail_if(bz_env_get_bool(env, "verbose", true), "Expected false");
+    fail_unless(bz_env_get_long(env, "jobs", true) == 8, "Expected 8");
+    fail_if_error(path = bz_env_get_path(env, "build_dir", true));
+    fail_unless_streq("Path", "/var/build", cork_path_get(path));
+    fail_if_error(version = bz_env_get_version(env, "version", true));
+    fail_unless_streq("Version", "2.0", bz_version_to_string(version));
+
+    /* As does adding to an array. */
+    bz_array_append(array, bz_string_value_new("c"));
+    fail_if_error(deps = bz_env_get_dependencies(env, "dependencies", true));
+    fail_unless(deps->count == 3, "Expected 3 dependencies");
+
+    /* We don't cache errors or missing values. */
+    env_add_string(env, "verbose", "maybe");
+    fail_unless_error(bz_env_get_bool(env, "verbose", true));
+    fail_unless_error(bz_env_get_bool(env, "verbose", true));
+    fail_unless_error(bz_env_get_bool(env, "missing", true));
+    env_add_string(env, "missing", "1");
+    fail_unless(bz_env_get_bool(env, "missing", true), "Expected true");
+
+    bz_env_free(env);
+}
+END_TEST
+
+static void
+test_profile_contains(struct cork_buffer *report, const char *expected)
+{
+    fail_unless(strstr(report->buf, expected) != NULL,
+                "Missing %s in profile:\n%s", expected, (char *) report->buf);
+}
+
+static int
+test_env_get_many__each(void *user_data, const char *name, const char *value)
+{
+    struct cork_buffer  *buf = user_data;
+    cork_buffer_append_printf(buf, "%s=%s\n", name, value);
+    return 0;
+}
+
+static void
+test_env_get_many(struct bz_env *env, size_t count, const char **patterns,
+                  const char *expected)
+{
+    struct cork_buffer  actual = CORK_BUFFER_INIT();
+    cork_buffer_set(&actual, "", 0);
+    fail_if_error(bz_env_get_many
+                  (env, count, patterns, &actual, test_env_get_many__each));
+    fail_unless_streq("Environment variable values", expected, actual.buf);
+    cork_buffer_done(&actual);
+}
+
+static void
+test_env_get_many_error(struct bz_env *env, size_t count, const char **patterns)
+{
+    struct cork_buffer  actual = CORK_BUFFER_INIT();
+    fail_unless_error(bz_env_get_many
+                      (env, count, patterns, &actual, test_env_get_many__each));
+    cork_buffer_done(&actual);
+}
+
+START_TEST(test_env_get_many_01)
+{
+    DESCRIBE_TEST;
+    struct bz_env  *env;
+    struct bz_value  *value;
+    struct cork_buffer  report = CORK_BUFFER_INIT();
+    const char  *patterns1[] = { "nested.*", "a", "nested.c", "arch" };
+    const char  *patterns2[] = { "a", "missing" };
+    const char  *patterns3[] = { "nested" };
+    const char  *patterns4[] = { "missing.*", "nothing*" };
+    const char  *patterns5[] = { "arch" };
+
+    bz_global_env_reset();
+    bz_start_mocks();
+    bz_mock_subprocess("uname -m", "x86_64\n", NULL, 0);
+    env = bz_package_env_new_empty(NULL, "test");
+    env_add_string(env, "a", "1");
+    env_add_string(env, "nested.b", "2");
+    fail_if_error(value = bz_interpolated_value_new("${arch}-${a}"));
+    bz_env_add_override(env, "nested.c", value);
+    fail_if_error(value = bz_interpolated_value_new("${arch}"));
+    bz_env_add_override(env, "nested.deeper.d", value);
+
+    /* Each variable is only reported once, even if several patterns match it,
+     * and we only shell out to find the architecture once. */
+    bz_profile_start();
+    test_env_get_many
+        (env, 4, patterns1,
+         "nested.b=2\n"
+         "nested.c=x86_64-1\n"
+         "nested.deeper.d=x86_64\n"
+         "a=1\n"
+         "arch=x86_64\n");
+    bz_profile_stop();
+    bz_profile_report_json(&report);
+    test_profile_contains
+        (&report, "{\"command\": \"uname -m\", \"variable\": \"arch\", "
+         "\"runs\": 1,");
+    fail_unless(bz_env_is_frozen(env), "Environment should be frozen");
+
+    test_env_get_many_error(env, 2, patterns2);
+    test_env_get_many_error(env, 1, patterns3);
+    test_env_get_many(env, 2, patterns4, "");
+    bz_env_free(env);
+
+    /* If a subprocess fails, we remember the error, and don't run it again. */
+    bz_global_env_reset();
+    bz_mock_subprocess("uname -m", NULL, NULL, 1);
+    env = bz_package_env_new_empty(NULL, "test");
+    cork_buffer_clear(&report);
+    bz_profile_start();
+    test_env_get_many_error(env, 1, patterns5);
+    test_env_get_many_error(env, 1, patterns5);
+    bz_profile_stop();
+    bz_profile_report_json(&report);
+    test_profile_contains(&report, "\"runs\": 1,");
+
+    cork_buffer_done(&report);
+    bz_env_free(env);
+}
+END_TEST
+
 
 static void
 test_env_path(struct bz_env *env, const char *key, const char *expected)
@@ -376,6 +737,366 @@ START_TEST(test_env_yaml_01)
 }
 END_TEST
 
+static const char  YAML_02[] =
+    "base: &base\n"
+    "  name: shared\n"
+    "  list: &list [x, y]\n"
+    "copy: *base\n"
+    "scalar: &scalar ${base.name} value\n"
+    "again: *scalar\n"
+    "items: *list\n"
+    "---\n"
+    "ignored: true\n"
+    ;
+
+START_TEST(test_env_yaml_02)
+{
+    DESCRIBE_TEST;
+    struct bz_env  *env = bz_env_new("test");
+    struct bz_value  *value;
+
+    /* Aliases get their own copy of the anchored node. */
+    fail_if_error(value = bz_yaml_value_new_from_string(YAML_02));
+    bz_env_add_set(env, value);
+    test_env(env, "copy.name", "shared");
+    test_env(env, "again", "shared value");
+    fail_if_error(value = bz_env_get_value(env, "items"));
+    fail_unless_equal("Array elements", "%zu",
+                      (size_t) 2, bz_array_value_count(value));
+    fail_if_error(value = bz_env_get_value(env, "copy.list"));
+    fail_unless_equal("Array elements", "%zu",
+                      (size_t) 2, bz_array_value_count(value));
+    /* Only the first document counts. */
+    test_env_missing(env, "ignored");
+    bz_env_free(env);
+
+    /* An empty file is an empty map. */
+    fail_if_error(value = bz_yaml_value_new_from_string(""));
+    fail_unless(bz_value_kind(value) == BZ_VALUE_MAP, "Expected a map");
+    bz_value_free(value);
+
+    fail_unless_error(bz_yaml_value_new_from_string("a: [1, 2"));
+    fail_unless_error(bz_yaml_value_new_from_string("{[a]: b}"));
+    fail_unless_error(bz_yaml_value_new_from_string("a: *missing\n"));
+    fail_unless_error(bz_yaml_value_new_from_string("a: b\na: c\n"));
+}
+END_TEST
+
+static void
+write_test_file(const char *path, const char *content)
+{
+    FILE  *file = fopen(path, "w");
+    fail_if(file == NULL, "Cannot create %s", path);
+    fputs(content, file);
+    fclose(file);
+}
+
+static void
+test_yaml_file(const char *path, const char *key, const char *expected)
+{
+    struct bz_env  *env = bz_env_new("test");
+    struct bz_arena  *saved;
+    struct bz_value  *value;
+
+    saved = bz_arena_set_current(bz_env_arena(env));
+    value = bz_yaml_value_new_from_file(path);
+    bz_arena_set_current(saved);
+    fail_unless(value != NULL, "Unexpected error: %s", cork_error_message());
+    bz_env_add_set(env, value);
+    test_env(env, key, expected);
+    test_env(env, "b", "${a}");
+    test_env(env, "c.d", "nested");
+    bz_env_free(env);
+}
+
+START_TEST(test_env_yaml_cache_01)
+{
+    DESCRIBE_TEST;
+    struct stat  info;
+    struct timespec  times[2];
+
+    bz_yaml_set_cache_dir("yaml-cache");
+    unlink("yaml-cache.yaml");
+
+    /* The first load compiles the file; the second uses the compiled copy. */
+    write_test_file("yaml-cache.yaml",
+                    "a: first\n"
+                    "b: $${a}\n"
+                    "c: {d: nested}\n"
+                    "e: ${a} again\n");
+    test_yaml_file("yaml-cache.yaml", "e", "first again");
+    fail_unless(stat("yaml-cache", &info) == 0 && S_ISDIR(info.st_mode),
+                "Compiled YAML files should be saved");
+    test_yaml_file("yaml-cache.yaml", "e", "first again");
+
+    /* A change that keeps the file's size and modification time is still
+     * caught by the content hash. */
+    fail_unless(stat("yaml-cache.yaml", &info) == 0, "Cannot stat file");
+    write_test_file("yaml-cache.yaml",
+                    "a: other\n"
+                    "b: $${a}\n"
+                    "c: {d: nested}\n"
+                    "e: ${a} again\n");
+#if defined(__APPLE__)
+    times[0] = info.st_atimespec;
+    times[1] = info.st_mtimespec;
+#else
+    times[0] = info.st_atim;
+    times[1] = info.st_mtim;
+#endif
+    fail_unless(utimensat(AT_FDCWD, "yaml-cache.yaml", times, 0) == 0,
+                "Cannot reset modification time");
+    test_yaml_file("yaml-cache.yaml", "e", "other again");
+    test_yaml_file("yaml-cache.yaml", "a", "other");
+
+    /* Without an arena, the values can't point into the compiled copy. */
+    {
+        struct bz_value  *value;
+        fail_if_error(value = bz_yaml_value_new_from_file("yaml-cache.yaml"));
+        fail_unless_streq("Uncached values", "other",
+                          bz_value_get_string(value, "a", true));
+        bz_value_free(value);
+    }
+
+    bz_yaml_set_cache_dir(NULL);
+    test_yaml_file("yaml-cache.yaml", "a", "other");
+}
+END_TEST
+
+START_TEST(test_env_yaml_cache_02)
+{
+    DESCRIBE_TEST;
+    size_t  i;
+    size_t  count = 0;
+    char  path[32];
+    DIR  *dir;
+    struct dirent  *entry;
+
+    /* The cache only keeps the most recently saved 256 files, and doesn't
+     * leave any temporary files behind. */
+    bz_yaml_set_cache_dir("yaml-cache-prune");
+    for (i = 0; i < 300; i++) {
+        snprintf(path, sizeof(path), "yaml-prune-%zu.yaml", i);
+        write_test_file(path,
+                        "a: value\n"
+                        "b: $${a}\n"
+                        "c: {d: nested}\n");
+        test_yaml_file(path, "a", "value");
+        unlink(path);
+    }
+    bz_yaml_set_cache_dir(NULL);
+
+    dir = opendir("yaml-cache-prune");
+    fail_if(dir == NULL, "Cannot open cache directory");
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] != '.') {
+            fail_unless(strchr(entry->d_name, '.') == NULL,
+                        "Unexpected file %s in cache", entry->d_name);
+            count++;
+        }
+    }
+    closedir(dir);
+    fail_unless_equal("Cached files", "%zu", (size_t) 256, count);
+}
+END_TEST
+
+
+/*-----------------------------------------------------------------------
+ * libyaml's SIMD scanning
+ */
+
+/* Every SIMD implementation of yaml_ascii_span and yaml_text_span must give
+ * exactly the same answers as the portable one.  We try every possible octet
+ * at every position of runs whose lengths straddle the 16- and 32-byte
+ * chunks that the SSE2 and AVX2 versions work with. */
+
+static const size_t  simd_lengths[] = {
+    0, 1, 15, 16, 17, 31, 32, 33, 47, 48, 49, 63, 64, 65
+};
+#define SIMD_LENGTH_COUNT  (sizeof(simd_lengths) / sizeof(simd_lengths[0]))
+
+/* These are the stop characters that the scanner uses. */
+static const char  *simd_stops[] = {
+    "", "'", "\"\\", ":,?[]{}"
+};
+#define SIMD_STOPS_COUNT  (sizeof(simd_stops) / sizeof(simd_stops[0]))
+
+static void
+test_simd_spans(int level)
+{
+    yaml_char_t  buf[80];
+    size_t  i;
+    size_t  j;
+    size_t  pos;
+    unsigned int  octet;
+
+    if (yaml_simd_set_level(level) != level) {
+        fprintf(stderr, "Skipping SIMD level %d\n", level);
+        return;
+    }
+
+    for (i = 0; i < SIMD_LENGTH_COUNT; i++) {
+        size_t  length = simd_lengths[i];
+        for (pos = 0; pos < length; pos++) {
+            for (octet = 0; octet < 256; octet++) {
+                size_t  expected;
+                size_t  actual;
+
+                /* Start one byte in, so that the loads aren't aligned. */
+                memset(buf, 'a', sizeof(buf));
+                buf[pos + 1] = octet;
+
+                yaml_simd_set_level(YAML_SIMD_NONE);
+                expected = yaml_ascii_span(buf + 1, length);
+                yaml_simd_set_level(level);
+                actual = yaml_ascii_span(buf + 1, length);
+                fail_unless(expected == actual,
+                            "yaml_ascii_span at level %d with 0x%02x at "
+                            "%zu of %zu (expected %zu, got %zu)",
+                            level, octet, pos, length, expected, actual);
+
+                for (j = 0; j < SIMD_STOPS_COUNT; j++) {
+                    yaml_simd_set_level(YAML_SIMD_NONE);
+                    expected = yaml_text_span
+                        (buf + 1, length, simd_stops[j]);
+                    yaml_simd_set_level(level);
+                    actual = yaml_text_span(buf + 1, length, simd_stops[j]);
+                    fail_unless(expected == actual,
+                                "yaml_text_span(\"%s\") at level %d with "
+                                "0x%02x at %zu of %zu "
+                                "(expected %zu, got %zu)",
+                                simd_stops[j], level, octet, pos, length,
+                                expected, actual);
+                }
+            }
+        }
+    }
+}
+
+START_TEST(test_yaml_simd_spans_01)
+{
+    DESCRIBE_TEST;
+    test_simd_spans(YAML_SIMD_SSE2);
+    test_simd_spans(YAML_SIMD_AVX2);
+    yaml_simd_set_level(YAML_SIMD_AVX2);
+}
+END_TEST
+
+/* Renders every event (or the error) that libyaml produces for a document,
+ * including where it thinks each event starts and ends. */
+static void
+yaml_event_dump(struct cork_buffer *dest, const char *content)
+{
+    yaml_parser_t  parser;
+    yaml_event_t  event;
+    bool  done = false;
+
+    yaml_parser_initialize(&parser);
+    yaml_parser_set_input_string
+        (&parser, (const unsigned char *) content, strlen(content));
+    while (!done) {
+        if (!yaml_parser_parse(&parser, &event)) {
+            cork_buffer_append_printf
+                (dest, "error %s at %zu:%zu\n",
+                 parser.problem, parser.problem_mark.line,
+                 parser.problem_mark.column);
+            break;
+        }
+        cork_buffer_append_printf
+            (dest, "%d %zu:%zu-%zu:%zu",
+             (int) event.type,
+             event.start_mark.line, event.start_mark.column,
+             event.end_mark.line, event.end_mark.column);
+        switch (event.type) {
+            case YAML_SCALAR_EVENT:
+                cork_buffer_append_printf
+                    (dest, " %d [%s] &%s !%s",
+                     (int) event.data.scalar.style,
+                     (char *) event.data.scalar.value,
+                     (char *) event.data.scalar.anchor,
+                     (char *) event.data.scalar.tag);
+                break;
+            case YAML_ALIAS_EVENT:
+                cork_buffer_append_printf
+                    (dest, " *%s", (char *) event.data.alias.anchor);
+                break;
+            case YAML_SEQUENCE_START_EVENT:
+                cork_buffer_append_printf
+                    (dest, " &%s", (char *) event.data.sequence_start.anchor);
+                break;
+            case YAML_MAPPING_START_EVENT:
+                cork_buffer_append_printf
+                    (dest, " &%s", (char *) event.data.mapping_start.anchor);
+                break;
+            default:
+                break;
+        }
+        cork_buffer_append(dest, "\n", 1);
+        done = (event.type == YAML_STREAM_END_EVENT);
+        yaml_event_delete(&event);
+    }
+    yaml_parser_delete(&parser);
+}
+
+static const char  *simd_documents[] = {
+    YAML_01,
+    YAML_02,
+    "",
+    "a: [1, 2",
+    "{[a]: b}",
+    "a: *missing\n",
+    "a: b\na: c\n",
+    "a: first\n"
+    "b: $${a}\n"
+    "c: {d: nested}\n"
+    "e: ${a} again\n",
+    "name: test\n"
+    "nested:\n"
+    "  a: ${nested.b} value\n"
+    "  b: test\n"
+    "  dir: /usr/${name}\n"
+    "list: [a, b, c]\n",
+    /* Some longer runs, so that the SIMD code gets a chance to run, and some
+     * non-ASCII characters in the middle of them. */
+    "plain: a plain scalar that's long enough to span several chunks\n"
+    "single: 'a single-quoted scalar, with an '' escaped quote at 33'\n"
+    "double: \"a double-quoted scalar, with an \\\" escaped quote \\t\"\n"
+    "flow: {key: value, another-key-that-is-very-long: [a, b, c]}\n"
+    "unicode: caf\xc3\xa9 na\xc3\xafve r\xc3\xa9sum\xc3\xa9 \xe2\x98\x83"
+    " and then some more plain ASCII text\n"
+    "? complex key with a rather long plain scalar in it\n"
+    ": value\n"
+    "tabs:\t\"tab\tseparated\tvalues\"\n"
+    "bad: \"\x01\"\n",
+};
+#define SIMD_DOCUMENT_COUNT \
+    (sizeof(simd_documents) / sizeof(simd_documents[0]))
+
+START_TEST(test_yaml_simd_events_01)
+{
+    DESCRIBE_TEST;
+    size_t  i;
+    int  best = yaml_simd_set_level(YAML_SIMD_AVX2);
+    struct cork_buffer  expected = CORK_BUFFER_INIT();
+    struct cork_buffer  actual = CORK_BUFFER_INIT();
+
+    /* Parse each document with and without SIMD, and make sure that we get
+     * the same events. */
+    for (i = 0; i < SIMD_DOCUMENT_COUNT; i++) {
+        cork_buffer_clear(&expected);
+        cork_buffer_clear(&actual);
+        yaml_simd_set_level(YAML_SIMD_NONE);
+        yaml_event_dump(&expected, simd_documents[i]);
+        yaml_simd_set_level(best);
+        yaml_event_dump(&actual, simd_documents[i]);
+        fail_unless_streq("Event streams", expected.buf, actual.buf);
+    }
+
+    cork_buffer_done(&expected);
+    cork_buffer_done(&actual);
+}
+END_TEST
+
 
 static void
 value_global_default(const char *key, const char *template_value)
@@ -453,6 +1174,120 @@ START_TEST(test_package_env_03)
 }
 END_TEST
 
+START_TEST(test_package_env_04)
+{
+    DESCRIBE_TEST;
+    struct bz_env  *repo_env;
+    struct bz_env  *env1;
+    struct bz_env  *env2;
+    struct bz_value  *value1;
+    struct bz_value  *value2;
+    bz_global_env_reset();
+    value_global_default("nested.a", "${nested.b} value");
+    value_global_default("nested.b", "test");
+    repo_env = bz_repo_env_new_empty();
+    env1 = bz_package_env_new_empty(repo_env, "test1");
+    env2 = bz_package_env_new_empty(repo_env, "test2");
+
+    /* Package environments share the global environment's maps, instead of
+     * each creating their own union of them... */
+    fail_if_error(value1 = bz_env_get_value(env1, "nested"));
+    fail_if_error(value2 = bz_env_get_value(env2, "nested"));
+    fail_unless(value1 == value2, "Package environments should share maps");
+    test_env(env1, "nested.a", "test value");
+    test_env(env2, "nested.a", "test value");
+
+    /* ...but overrides are still private to each environment. */
+    env_add_string(env1, "nested.b", "overridden");
+    test_env(env1, "nested.a", "overridden value");
+    test_env(env2, "nested.a", "test value");
+    fail_if_error(value1 = bz_env_get_value(env1, "nested"));
+    fail_unless(value1 != value2, "Overridden map shouldn't be shared");
+    fail_unless_error(bz_map_value_add
+                      (value2, "c", bz_string_value_new("c"), true),
+                      "Shouldn't be able to add to a shared map");
+
+    bz_env_free(env1);
+    bz_env_free(env2);
+    bz_env_free(repo_env);
+}
+END_TEST
+
+START_TEST(test_package_env_05)
+{
+    DESCRIBE_TEST;
+    struct bz_env  *repo_env;
+    struct bz_env  *env;
+    struct bz_arena  *saved;
+    struct bz_value  *value;
+    struct cork_path  *path;
+    size_t  empty_size;
+    bz_global_env_reset();
+    repo_env = bz_repo_env_new_empty();
+    env = bz_package_env_new_empty(repo_env, "test");
+    empty_size = bz_arena_size(bz_env_arena(env));
+
+    /* Anything created while an environment's arena is current belongs to the
+     * environment, and is freed along with it. */
+    saved = bz_arena_set_current(bz_env_arena(env));
+    fail_if_error(value = bz_yaml_value_new_from_string
+                  ("name: test\n"
+                   "nested:\n"
+                   "  a: ${nested.b} value\n"
+                   "  b: test\n"
+                   "  dir: /usr/${name}\n"
+                   "list: [a, b, c]\n"));
+    bz_env_add_set(env, value);
+    env_add_string(env, "nested.c.d", "deep");
+    fail_unless(bz_arena_set_current(saved) == bz_env_arena(env),
+                "Environment's arena should have been current");
+    fail_unless(bz_arena_current() == saved, "Arena should be restored");
+    fail_unless(bz_arena_size(bz_env_arena(env)) > empty_size,
+                "Values should be allocated in the environment's arena");
+
+    test_env(env, "nested.a", "test value");
+    test_env(env, "nested.c.d", "deep");
+    fail_if_error(path = bz_env_get_path(env, "nested.dir", true));
+    fail_unless_streq("Paths", "/usr/test", cork_path_get(path));
+    fail_if_error(value = bz_env_get_value(env, "list"));
+    fail_unless_equal("Array elements", "%zu",
+                      (size_t) 3, bz_array_value_count(value));
+
+    bz_env_free(env);
+    bz_env_free(repo_env);
+}
+END_TEST
+
+START_TEST(test_package_env_06)
+{
+    DESCRIBE_TEST;
+    struct bz_env  *repo_env;
+    struct bz_env  *env1;
+    struct bz_env  *env2;
+    bz_global_env_reset();
+    value_global_default("a", "${b} value");
+    value_global_default("b", "old");
+    repo_env = bz_repo_env_new_empty();
+    env1 = bz_package_env_new_empty(repo_env, "test1");
+    test_env(env1, "a", "old value");
+
+    /* Existing environments keep using the global environment that they were
+     * created with, even after it's been replaced. */
+    bz_global_env_reset();
+    value_global_default("b", "new");
+    env2 = bz_package_env_new_empty(NULL, "test2");
+    test_env(env1, "a", "old value");
+    test_env(repo_env, "b", "old");
+    test_env(env2, "b", "new");
+    test_env_missing(env2, "a");
+
+    bz_env_free(env1);
+    bz_env_free(repo_env);
+    test_env(env2, "b", "new");
+    bz_env_free(env2);
+}
+END_TEST
+
 
 /*-----------------------------------------------------------------------
  * Built-in variables
@@ -463,13 +1298,112 @@ START_TEST(test_builtin_vars_01)
     DESCRIBE_TEST;
     struct bz_env  *env;
     bz_global_env_reset();
-    fail_if_error(bz_load_variable_definitions());
     env = bz_global_env();
     test_env(env, "cache_dir", "/home/test/.cache");
     test_env(env, "work_dir", "/home/test/.cache/buzzy");
 }
 END_TEST
 
+START_TEST(test_builtin_vars_02)
+{
+    DESCRIBE_TEST;
+    struct bz_env  *env;
+    struct bz_value  *value;
+    const struct bz_var_doc  *doc;
+    size_t  i;
+    bz_global_env_reset();
+    env = bz_global_env();
+
+    /* Every built-in variable can be found in the generated table. */
+    for (i = 0; i < bz_var_def_count(); i++) {
+        const struct bz_var_def  *def = bz_var_def_get(i);
+        fail_unless(bz_var_def_find(def->doc.name) == def,
+                    "Cannot find %s in variable table", def->doc.name);
+    }
+    fail_unless(bz_var_def_find("missing") == NULL,
+                "Unexpected variable definition");
+
+    fail_if_error(doc = bz_env_get_global_default("work_dir", true));
+    fail_unless_streq("Variable name", "work_dir", doc->name);
+    fail_unless_streq("Variable description",
+                      "A directory for Buzzy's intermediate build products",
+                      doc->short_desc);
+    /* Prefixes of built-in variables aren't variables themselves. */
+    fail_unless_error(bz_env_get_global_default("cmake", true));
+
+    /* We can define new defaults next to the built-in ones, but can't redefine
+     * a built-in variable. */
+    value_global_default("cmake.generator", "Ninja");
+    fail_if_error(value = bz_string_value_new("Debug"));
+    fail_unless_error(bz_env_set_global_default
+                      ("cmake.build_type", value, NULL, NULL));
+
+    test_env(env, "cmake.build_type", "RelWithDebInfo");
+    test_env(env, "cmake.generator", "Ninja");
+    test_env(env, "work_dir", "/home/test/.cache/buzzy");
+    test_env_missing(env, "cmake.missing");
+
+    /* Freezing the global environment constructs every default. */
+    fail_if_error(bz_env_freeze(env));
+    test_env(env, "cmake.build_type", "RelWithDebInfo");
+    test_env(env, "cmake.generator", "Ninja");
+    test_env(env, "binary_package_dir", "/home/test/.cache/buzzy/packages");
+    test_env(env, "repo_dir", "/home/test/.cache/buzzy/repos");
+    fail_unless(bz_env_is_frozen(env), "Global environment should be frozen");
+}
+END_TEST
+
+
+/*-----------------------------------------------------------------------
+ * Profiling
+ */
+
+
+START_TEST(test_profile_01)
+{
+    DESCRIBE_TEST;
+    struct bz_env  *env;
+    struct bz_value  *value;
+    struct cork_buffer  report = CORK_BUFFER_INIT();
+    bz_global_env_reset();
+    bz_start_mocks();
+    bz_mock_subprocess("uname -m", "x86_64\n", NULL, 0);
+    env = bz_package_env_new_empty(NULL, "test");
+    fail_if_error(value = bz_interpolated_value_new("${b}/${arch}"));
+    bz_env_add_override(env, "a", value);
+    fail_if_error(value = bz_interpolated_value_new("${c}"));
+    bz_env_add_override(env, "b", value);
+    env_add_string(env, "c", "value");
+
+    bz_profile_start();
+    test_env(env, "a", "value/x86_64");
+    test_env(env, "a", "value/x86_64");
+    bz_profile_stop();
+    /* We don't record anything once profiling is stopped. */
+    test_env(env, "a", "value/x86_64");
+
+    bz_profile_report_json(&report);
+    test_profile_contains
+        (&report, "{\"name\": \"a\", \"evaluations\": 2, \"renders\": 1, "
+         "\"cached_renders\": 1,");
+    test_profile_contains
+        (&report, "{\"name\": \"c\", \"evaluations\": 1, \"renders\": 0, "
+         "\"cached_renders\": 0,");
+    test_profile_contains
+        (&report, "{\"command\": \"uname -m\", \"variable\": \"arch\", "
+         "\"runs\": 1,");
+    test_profile_contains(&report, "[\"a\", \"b\", \"c\"]");
+    test_profile_contains(&report, "{\"name\": \"test\", \"hits\": ");
+
+    cork_buffer_clear(&report);
+    bz_profile_report(&report);
+    test_profile_contains(&report, "3: a -> b -> c\n");
+
+    cork_buffer_done(&report);
+    bz_env_free(env);
+}
+END_TEST
+
 
 /*-----------------------------------------------------------------------
  * Testing harness
@@ -487,8 +1421,14 @@ test_suite()
 
     TCase  *tc_map = tcase_create("map");
     tcase_add_test(tc_map, test_map_01);
+    tcase_add_test(tc_map, test_map_keys_01);
     suite_add_tcase(s, tc_map);
 
+    TCase  *tc_yaml = tcase_create("yaml");
+    tcase_add_test(tc_yaml, test_yaml_simd_spans_01);
+    tcase_add_test(tc_yaml, test_yaml_simd_events_01);
+    suite_add_tcase(s, tc_yaml);
+
     TCase  *tc_env = tcase_create("env");
     tcase_add_test(tc_env, test_env_override_00);
     tcase_add_test(tc_env, test_env_override_01);
@@ -497,19 +1437,35 @@ test_suite()
     tcase_add_test(tc_env, test_env_override_04);
     tcase_add_test(tc_env, test_env_override_05);
     tcase_add_test(tc_env, test_env_01);
+    tcase_add_test(tc_env, test_env_memoized_01);
+    tcase_add_test(tc_env, test_env_memoized_02);
+    tcase_add_test(tc_env, test_env_frozen_01);
+    tcase_add_test(tc_env, test_env_get_many_01);
+    tcase_add_test(tc_env, test_env_typed_01);
     tcase_add_test(tc_env, test_env_path_01);
     tcase_add_test(tc_env, test_env_yaml_01);
+    tcase_add_test(tc_env, test_env_yaml_02);
+    tcase_add_test(tc_env, test_env_yaml_cache_01);
+    tcase_add_test(tc_env, test_env_yaml_cache_02);
     tcase_add_test(tc_env, test_global_env_01);
     tcase_add_test(tc_env, test_global_env_02);
     tcase_add_test(tc_env, test_package_env_01);
     tcase_add_test(tc_env, test_package_env_02);
     tcase_add_test(tc_env, test_package_env_03);
+    tcase_add_test(tc_env, test_package_env_04);
+    tcase_add_test(tc_env, test_package_env_05);
+    tcase_add_test(tc_env, test_package_env_06);
     suite_add_tcase(s, tc_env);
 
     TCase  *tc_builtin_vars = tcase_create("builtin-vars");
     tcase_add_test(tc_builtin_vars, test_builtin_vars_01);
+    tcase_add_test(tc_builtin_vars, test_builtin_vars_02);
     suite_add_tcase(s, tc_builtin_vars);
 
+    TCase  *tc_profile = tcase_create("profile");
+    tcase_add_test(tc_profile, test_profile_01);
+    suite_add_tcase(s, tc_profile);
+
     return s;
 }
 
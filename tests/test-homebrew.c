@@ -268,6 +268,43 @@ START_TEST(test_homebrew_pdb_nonexistent_native_package_01)
 }
 END_TEST
 
+START_TEST(test_homebrew_pdb_candidate_probes_01)
+{
+    DESCRIBE_TEST;
+    struct bz_pdb  *pdb;
+
+    /* A package that is only available under the last of the candidate native
+     * package names.  We probe the candidates together, but still have to
+     * prefer the earlier candidates, and shouldn't probe any candidate a
+     * second time. */
+    bz_start_mocks();
+    mock_package("jansson", NULL, NULL, false);
+    mock_package("libjansson", "2.4", NULL, false);
+    mock_package_installation("libjansson", "2.4");
+
+    fail_if_error(pdb = bz_homebrew_native_pdb());
+
+    test_homebrew_pdb_dep(pdb, "jansson",
+        "[1] Install native Homebrew package libjansson 2.4\n"
+    );
+
+    test_homebrew_pdb_dep(pdb, "jansson >= 2.4",
+        "[1] Install native Homebrew package libjansson 2.4\n"
+    );
+
+    verify_commands_run(
+        "$ brew info jansson\n"
+        "$ brew info libjansson\n"
+        "$ brew info libjansson\n"
+        "$ brew install libjansson\n"
+        "$ brew info libjansson\n"
+        "$ brew install libjansson\n"
+    );
+
+    bz_pdb_free(pdb);
+}
+END_TEST
+
 START_TEST(test_homebrew_pdb_uninstalled_override_package_01)
 {
     DESCRIBE_TEST;
@@ -484,6 +521,8 @@ test_suite()
                    test_homebrew_pdb_installed_native_package_01);
     tcase_add_test(tc_homebrew_pdb,
                    test_homebrew_pdb_nonexistent_native_package_01);
+    tcase_add_test(tc_homebrew_pdb,
+                   test_homebrew_pdb_candidate_probes_01);
     tcase_add_test(tc_homebrew_pdb,
                    test_homebrew_pdb_uninstalled_override_package_01);
     tcase_add_test(tc_homebrew_pdb,
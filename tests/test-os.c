@@ -108,6 +108,44 @@ START_TEST(test_create_file_01)
 }
 END_TEST
 
+START_TEST(test_first_output_01)
+{
+    DESCRIBE_TEST;
+    size_t  i;
+    struct cork_exec  *execs[4];
+    struct cork_buffer  outs[4];
+    bool  finished[4];
+    bool  successful[4];
+    const char  *scripts[4] = {
+        "sleep 0.2; exit 1",
+        "echo second",
+        "exec sleep 30",
+        "echo fourth"
+    };
+
+    /* Run the real subprocesses in parallel.  Once the first one fails, we know
+     * that the second one is the first to succeed, so we shouldn't wait for the
+     * third one, and shouldn't start the fourth one at all. */
+    for (i = 0; i < 4; i++) {
+        execs[i] = cork_exec_new("sh");
+        cork_exec_add_param(execs[i], "sh");
+        cork_exec_add_param(execs[i], "-c");
+        cork_exec_add_param(execs[i], scripts[i]);
+        cork_buffer_init(&outs[i]);
+    }
+    fail_if_error(bz_subprocess_get_first_output
+                  (4, execs, 3, outs, finished, successful));
+    fail_unless(finished[0] && !successful[0], "First command should fail");
+    fail_unless(finished[1] && successful[1], "Second command should succeed");
+    fail_if(finished[2], "Third command should have been aborted");
+    fail_if(finished[3], "Fourth command should not have run");
+    fail_unless_streq("stdout", "second\n", outs[1].buf);
+    for (i = 0; i < 4; i++) {
+        cork_buffer_done(&outs[i]);
+    }
+}
+END_TEST
+
 
 /*-----------------------------------------------------------------------
  * Testing harness
@@ -122,6 +160,7 @@ test_suite()
     tcase_add_test(tc_run, test_run_mocked_01);
     tcase_add_test(tc_run, test_run_01);
     tcase_add_test(tc_run, test_create_file_01);
+    tcase_add_test(tc_run, test_first_output_01);
     suite_add_tcase(s, tc_run);
 
     return s;
@@ -0,0 +1,369 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2015, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <check.h>
+
+#include "buzzy/env.h"
+#include "buzzy/error.h"
+#include "buzzy/package.h"
+#include "buzzy/value.h"
+#include "buzzy/version.h"
+
+#include "helpers.h"
+
+
+/*-----------------------------------------------------------------------
+ * Helper functions
+ */
+
+/* Each test package has a packager that logs an action for each step, and a
+ * builder that never needs to do anything. */
+
+struct test_package {
+    const char  *name;
+    unsigned int  package_delay_ms;
+    bool  package_fails;
+};
+
+static cork_array(struct bz_env *)  envs;
+static struct cork_buffer  installed = CORK_BUFFER_INIT();
+
+static int
+test_step_not_needed(void *user_data, bool *is_needed)
+{
+    *is_needed = false;
+    return 0;
+}
+
+static int
+test_step_needed(void *user_data, bool *is_needed)
+{
+    *is_needed = true;
+    return 0;
+}
+
+static int
+test_step_nothing(void *user_data)
+{
+    return 0;
+}
+
+static int
+test_package__package(void *user_data)
+{
+    struct test_package  *test = user_data;
+    bz_log_action("Package %s", test->name);
+    usleep(test->package_delay_ms * 1000);
+    if (test->package_fails) {
+        bz_subprocess_error("Packaging %s failed", test->name);
+        return -1;
+    }
+    return 0;
+}
+
+static int
+test_package__install(void *user_data)
+{
+    struct test_package  *test = user_data;
+    bz_log_action("Install %s", test->name);
+    cork_buffer_append_printf(&installed, "%s ", test->name);
+    return 0;
+}
+
+static void
+test_package__free(void *user_data)
+{
+    struct test_package  *test = user_data;
+    cork_strfree(test->name);
+    free(test);
+}
+
+/* Creates a new package, and registers a package database that provides it.
+ * The dependency lists are NULL-terminated lists of package names. */
+static void
+add_test_package(const char *name, unsigned int package_delay_ms,
+                 bool package_fails, ...)
+{
+    va_list  args;
+    struct bz_version  *version;
+    struct bz_env  *env;
+    struct bz_array  *deps;
+    struct bz_array  *build_deps;
+    struct bz_builder  *builder;
+    struct bz_packager  *packager;
+    struct bz_package  *package;
+    struct test_package  *test;
+    const char  *dep;
+
+    fail_if_error(version = bz_version_from_string("1.0"));
+    fail_if_error(env = bz_package_env_new
+                  (NULL, name, bz_version_copy(version)));
+    cork_array_append(&envs, env);
+
+    va_start(args, package_fails);
+    deps = bz_array_new();
+    while ((dep = va_arg(args, const char *)) != NULL) {
+        bz_array_append(deps, bz_string_value_new(dep));
+    }
+    build_deps = bz_array_new();
+    while ((dep = va_arg(args, const char *)) != NULL) {
+        bz_array_append(build_deps, bz_string_value_new(dep));
+    }
+    va_end(args);
+    fail_if_error(bz_env_add_override
+                  (env, "dependencies", bz_array_as_value(deps)));
+    fail_if_error(bz_env_add_override
+                  (env, "build_dependencies", bz_array_as_value(build_deps)));
+
+    test = cork_new(struct test_package);
+    test->name = cork_strdup(name);
+    test->package_delay_ms = package_delay_ms;
+    test->package_fails = package_fails;
+    builder = bz_builder_new
+        (env, "test", NULL, NULL,
+         test_step_not_needed, test_step_nothing,
+         test_step_not_needed, test_step_nothing,
+         test_step_not_needed, test_step_nothing);
+    packager = bz_packager_new
+        (env, "test", test, test_package__free,
+         test_step_needed, test_package__package,
+         test_step_needed, test_package__install,
+         test_step_not_needed, test_step_nothing);
+    package = bz_package_new(name, version, env, builder, packager);
+    bz_version_free(version);
+    bz_pdb_register(bz_single_package_pdb_new(name, package));
+}
+
+static void
+start_test_packages(void)
+{
+    reset_everything();
+    cork_array_init(&envs);
+    cork_buffer_clear(&installed);
+}
+
+static void
+free_test_packages(void)
+{
+    size_t  i;
+    bz_pdb_registry_clear();
+    for (i = 0; i < cork_array_size(&envs); i++) {
+        bz_env_free(cork_array_at(&envs, i));
+    }
+    cork_array_done(&envs);
+}
+
+static struct bz_package *
+satisfy(const char *dep_string)
+{
+    struct bz_package  *package;
+    fail_if_error(package = bz_satisfy_dependency_string(dep_string, NULL));
+    return package;
+}
+
+static double
+now(void)
+{
+    struct timeval  tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Dependency graphs
+ */
+
+START_TEST(test_dep_graph_order_01)
+{
+    DESCRIBE_TEST;
+    struct bz_dep_graph  *graph;
+
+    /* With a single job, we should install each package's dependencies before
+     * the package itself, and only install each package once. */
+    start_test_packages();
+    bz_start_mocks();
+    add_test_package("a", 0, false, "b", "c", NULL, "d", NULL);
+    add_test_package("b", 0, false, "d", NULL, NULL);
+    add_test_package("c", 0, false, NULL, NULL);
+    add_test_package("d", 0, false, NULL, NULL);
+
+    graph = bz_dep_graph_new();
+    fail_if_error(bz_dep_graph_add(graph, satisfy("a")));
+    fail_unless_equal("Graph size", "%zu",
+                      (size_t) 4, bz_dep_graph_count(graph));
+    fail_if_error(bz_dep_graph_install(graph, 1));
+    test_actions(
+        "[1] Package d\n"
+        "[2] Install d\n"
+        "[3] Package b\n"
+        "[4] Install b\n"
+        "[5] Package c\n"
+        "[6] Install c\n"
+        "[7] Package a\n"
+        "[8] Install a\n"
+    );
+    fail_unless_streq("Installed packages", "d b c a ", installed.buf);
+
+    bz_dep_graph_free(graph);
+    free_test_packages();
+}
+END_TEST
+
+START_TEST(test_dep_graph_deps_01)
+{
+    DESCRIBE_TEST;
+    struct bz_dep_graph  *graph;
+
+    /* We can install everything that a package depends on, without installing
+     * the package itself. */
+    start_test_packages();
+    bz_start_mocks();
+    add_test_package("a", 0, false, "b", NULL, "c", NULL);
+    add_test_package("b", 0, false, NULL, NULL);
+    add_test_package("c", 0, false, NULL, NULL);
+
+    graph = bz_dep_graph_new();
+    fail_if_error(bz_dep_graph_add_deps(graph, satisfy("a")));
+    fail_unless_equal("Graph size", "%zu",
+                      (size_t) 2, bz_dep_graph_count(graph));
+    fail_if_error(bz_dep_graph_install(graph, 1));
+    fail_unless_streq("Installed packages", "b c ", installed.buf);
+
+    bz_dep_graph_free(graph);
+    free_test_packages();
+}
+END_TEST
+
+START_TEST(test_dep_graph_circular_01)
+{
+    DESCRIBE_TEST;
+    struct bz_dep_graph  *graph;
+
+    /* Circular dependencies are an error. */
+    start_test_packages();
+    bz_start_mocks();
+    add_test_package("a", 0, false, "b", NULL, NULL);
+    add_test_package("b", 0, false, NULL, "a", NULL);
+
+    graph = bz_dep_graph_new();
+    fail_unless_error(bz_dep_graph_add(graph, satisfy("a")),
+                      "Shouldn't be able to add circular dependencies");
+    bz_dep_graph_free(graph);
+    free_test_packages();
+}
+END_TEST
+
+START_TEST(test_dep_graph_parallel_01)
+{
+    DESCRIBE_TEST;
+    struct bz_dep_graph  *graph;
+    double  start;
+    double  elapsed;
+
+    /* With several jobs, we should package independent packages at the same
+     * time, each in its own child process, but still install a package's
+     * dependencies before the package itself. */
+    start_test_packages();
+    add_test_package("a", 0, false, "b", "c", NULL, "d", NULL);
+    add_test_package("b", 300, false, NULL, NULL);
+    add_test_package("c", 300, false, NULL, NULL);
+    add_test_package("d", 300, false, NULL, NULL);
+
+    graph = bz_dep_graph_new();
+    fail_if_error(bz_dep_graph_add(graph, satisfy("a")));
+    start = now();
+    fail_if_error(bz_dep_graph_install(graph, 3));
+    elapsed = now() - start;
+    fail_unless(elapsed < 0.8,
+                "Packages weren't built in parallel (took %.3fs)", elapsed);
+    fail_unless_equal("Installed packages", "%zu",
+                      (size_t) 8, installed.size);
+    fail_unless_streq("Last installed package", "a ",
+                      (char *) installed.buf + 6);
+
+    bz_dep_graph_free(graph);
+    free_test_packages();
+}
+END_TEST
+
+START_TEST(test_dep_graph_parallel_failure_01)
+{
+    DESCRIBE_TEST;
+    struct bz_dep_graph  *graph;
+    double  start;
+    double  elapsed;
+
+    /* If we can't package one of the dependencies, we shouldn't install
+     * anything else, but we should wait for any other packages that were
+     * already being built before returning the error. */
+    start_test_packages();
+    add_test_package("a", 0, false, "b", "c", NULL, NULL);
+    add_test_package("b", 0, true, NULL, NULL);
+    add_test_package("c", 200, false, NULL, NULL);
+
+    graph = bz_dep_graph_new();
+    fail_if_error(bz_dep_graph_add(graph, satisfy("a")));
+    start = now();
+    fail_unless_error(bz_dep_graph_install(graph, 2),
+                      "Shouldn't be able to install a");
+    elapsed = now() - start;
+    fail_unless(elapsed >= 0.2,
+                "Didn't wait for the other packages (took %.3fs)", elapsed);
+    fail_unless_equal("Installed packages", "%zu",
+                      (size_t) 0, installed.size);
+
+    bz_dep_graph_free(graph);
+    free_test_packages();
+}
+END_TEST
+
+
+/*-----------------------------------------------------------------------
+ * Testing harness
+ */
+
+Suite *
+test_suite()
+{
+    Suite  *s = suite_create("package");
+
+    TCase  *tc_dep_graph = tcase_create("dep-graph");
+    tcase_add_test(tc_dep_graph, test_dep_graph_order_01);
+    tcase_add_test(tc_dep_graph, test_dep_graph_deps_01);
+    tcase_add_test(tc_dep_graph, test_dep_graph_circular_01);
+    tcase_add_test(tc_dep_graph, test_dep_graph_parallel_01);
+    tcase_add_test(tc_dep_graph, test_dep_graph_parallel_failure_01);
+    suite_add_tcase(s, tc_dep_graph);
+
+    return s;
+}
+
+
+int
+main(int argc, const char **argv)
+{
+    int  number_failed;
+    Suite  *suite = test_suite();
+    SRunner  *runner = srunner_create(suite);
+
+    initialize_tests();
+    srunner_run_all(runner, CK_NORMAL);
+    number_failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return (number_failed == 0)? EXIT_SUCCESS: EXIT_FAILURE;
+}
@@ -37,7 +37,7 @@ START_TEST(test_repo_01)
     bz_mock_file_exists("/a/b/.git", false);
     fail_if_error(repo = bz_local_filesystem_repo_find("/a/b/c"));
     fail_if(repo == NULL, "Cannot create repo");
-    fail_if_error(bz_repo_registry_load_all());
+    fail_if_error(bz_repo_registry_load_all(1));
     test_actions(
         "Nothing to do!\n"
     );
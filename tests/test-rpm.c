@@ -7,6 +7,7 @@
  * ----------------------------------------------------------------------
  */
 
+#include <stdarg.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -48,6 +49,48 @@ mock_unavailable_package(const char *package)
     cork_buffer_done(&buf2);
 }
 
+/* Mocks a single yum query for all of the candidate native package names for
+ * package.  The varargs are (native package, version) pairs for each of the
+ * candidates that are available. */
+CORK_ATTR_SENTINEL
+static void
+mock_available_candidates(const char *package, ...)
+{
+    va_list  args;
+    const char  *native_package;
+    bool  found = false;
+    struct cork_buffer  buf1 = CORK_BUFFER_INIT();
+    struct cork_buffer  buf2 = CORK_BUFFER_INIT();
+    cork_buffer_printf
+        (&buf1, "sudo yum info -C %s-devel lib%s-devel %s lib%s",
+         package, package, package, package);
+    cork_buffer_set_string
+        (&buf2, "Loaded plugins: fastestmirror\nAvailable Packages\n");
+    va_start(args, package);
+    while ((native_package = va_arg(args, const char *)) != NULL) {
+        const char  *version = va_arg(args, const char *);
+        found = true;
+        cork_buffer_append_printf
+            (&buf2,
+             "Name        : %s\n"
+             "Arch        : x86_64\n"
+             "Version     : %s\n"
+             "Release     : 1\n"
+             "Summary     : %s\n"
+             "\n",
+             native_package, version, native_package);
+    }
+    va_end(args);
+    if (!found) {
+        bz_mock_subprocess
+            (buf1.buf, NULL, "Error: No matching Packages to list\n", 1);
+    } else {
+        bz_mock_subprocess(buf1.buf, buf2.buf, NULL, 0);
+    }
+    cork_buffer_done(&buf1);
+    cork_buffer_done(&buf2);
+}
+
 static void
 mock_installed_package(const char *package, const char *installed_version)
 {
@@ -249,6 +292,68 @@ START_TEST(test_yum_nonexistent_native_package_01)
 }
 END_TEST
 
+START_TEST(test_yum_available_many_01)
+{
+    DESCRIBE_TEST;
+    const char  *names[] = { "jansson", "libfoo", "libbar" };
+    struct bz_version  *versions[3];
+    /* Look up several packages with a single yum query.  If a package is both
+     * installed and available, we should use the available version. */
+    reset_everything();
+    bz_start_mocks();
+    bz_mock_subprocess
+        ("sudo yum info -C jansson libfoo libbar",
+         "Loaded plugins: fastestmirror\n"
+         "Installed Packages\n"
+         "Name        : jansson\n"
+         "Arch        : x86_64\n"
+         "Version     : 2.4\n"
+         "Release     : 1\n"
+         "\n"
+         "Available Packages\n"
+         "Name        : jansson\n"
+         "Arch        : x86_64\n"
+         "Version     : 2.5\n"
+         "Release     : 1\n"
+         "Description : C library for encoding and decoding JSON\n"
+         "            : (Name : not a field)\n"
+         "\n"
+         "Name        : libbar\n"
+         "Arch        : x86_64\n"
+         "Version     : 1.0\n"
+         "Release     : 1\n",
+         NULL, 0);
+
+    fail_if_error(bz_yum_native_version_available_many(3, names, versions));
+    test_and_free_version(versions[0], "2.5");
+    fail_unless(versions[1] == NULL, "Unexpected version");
+    test_and_free_version(versions[2], "1.0");
+}
+END_TEST
+
+START_TEST(test_rpm_installed_many_01)
+{
+    DESCRIBE_TEST;
+    const char  *names[] = { "jansson", "libfoo", "libbar" };
+    struct bz_version  *versions[3];
+    /* Check whether several packages are installed with a single rpm query. */
+    reset_everything();
+    bz_start_mocks();
+    bz_mock_subprocess
+        ("rpm --qf %{NAME} %{V}-%{R}\\n -q jansson libfoo libbar",
+         "jansson 2.4-1\n"
+         "package libfoo is not installed\n"
+         "libbar 1.0-1\n"
+         "libbar 0.9-1\n",
+         NULL, 1);
+
+    fail_if_error(bz_rpm_native_version_installed_many(3, names, versions));
+    test_and_free_version(versions[0], "2.4");
+    fail_unless(versions[1] == NULL, "Unexpected version");
+    test_and_free_version(versions[2], "1.0");
+}
+END_TEST
+
 
 /*-----------------------------------------------------------------------
  * Native package database
@@ -291,10 +396,7 @@ START_TEST(test_yum_pdb_uninstalled_native_package_01)
     /* A package that is available in the native package database, but has not
      * yet been installed. */
     bz_start_mocks();
-    mock_unavailable_package("jansson-devel");
-    mock_unavailable_package("libjansson-devel");
-    mock_unavailable_package("libjansson");
-    mock_available_package("jansson", "2.4");
+    mock_available_candidates("jansson", "jansson", "2.4", NULL);
     mock_uninstalled_package("jansson");
     mock_package_installation("jansson", "2.4");
 
@@ -322,9 +424,7 @@ START_TEST(test_yum_pdb_uninstalled_native_package_02)
     /* Test that if we try to install the same dependency twice, the second
      * attempt is a no-op. */
     bz_start_mocks();
-    mock_unavailable_package("jansson-devel");
-    mock_unavailable_package("libjansson-devel");
-    mock_available_package("jansson", "2.4");
+    mock_available_candidates("jansson", "jansson", "2.4", NULL);
     mock_uninstalled_package("jansson");
     mock_package_installation("jansson", "2.4");
 
@@ -348,9 +448,7 @@ START_TEST(test_yum_pdb_installed_native_package_01)
     /* A package that is available in the native package database, and has been
      * installed. */
     bz_start_mocks();
-    mock_unavailable_package("jansson-devel");
-    mock_unavailable_package("libjansson-devel");
-    mock_available_package("jansson", "2.4");
+    mock_available_candidates("jansson", "jansson", "2.4", NULL);
     mock_installed_package("jansson", "2.4");
 
     fail_if_error(pdb = bz_yum_native_pdb());
@@ -369,10 +467,7 @@ START_TEST(test_yum_pdb_nonexistent_native_package_01)
 
     /* A package that isn't available in the native package database. */
     bz_start_mocks();
-    mock_unavailable_package("jansson-devel");
-    mock_unavailable_package("libjansson-devel");
-    mock_unavailable_package("jansson");
-    mock_unavailable_package("libjansson");
+    mock_available_candidates("jansson", NULL);
 
     fail_if_error(pdb = bz_yum_native_pdb());
 
@@ -472,6 +567,397 @@ START_TEST(test_yum_pdb_preinstalled_package_01)
 }
 END_TEST
 
+static size_t
+count_commands(const char *prefix)
+{
+    size_t  count = 0;
+    const char  *curr = bz_mocked_commands_run();
+    while ((curr = strstr(curr, prefix)) != NULL) {
+        count++;
+        curr++;
+    }
+    return count;
+}
+
+static void
+test_yum_pdb_saved_lookups(size_t expected_yum_count)
+{
+    struct bz_pdb  *pdb;
+    struct bz_dependency  *dep;
+    struct bz_package  *package;
+
+    fail_if_error(pdb = bz_yum_native_pdb());
+    fail_if_error(dep = bz_dependency_from_string("jansson"));
+    fail_if_error(package = bz_pdb_satisfy_dependency(pdb, dep, NULL));
+    fail_if(package == NULL, "Should be able to satisfy jansson");
+    fail_unless_streq("Package name", "jansson", bz_package_name(package));
+    bz_dependency_free(dep);
+    test_yum_pdb_unknown_dep(pdb, "libfoo");
+    bz_pdb_free(pdb);
+
+    fail_unless(count_commands("$ sudo yum info ") == expected_yum_count,
+                "Expected %zu yum queries, got %zu", expected_yum_count,
+                count_commands("$ sudo yum info "));
+}
+
+START_TEST(test_yum_pdb_saved_lookups_01)
+{
+    DESCRIBE_TEST;
+    const char  *repomd = "/var/cache/yum/x86_64/7/base/repodata/repomd.xml";
+
+    /* We should save the results of our yum queries, and reuse them in later
+     * runs until yum's repository metadata changes. */
+    reset_everything();
+    bz_start_mocks();
+    bz_mock_file_contents(repomd, "base");
+    mock_available_candidates("jansson", "jansson", "2.4", NULL);
+    mock_available_candidates("libfoo", NULL);
+
+    test_yum_pdb_saved_lookups(2);
+    /* A later run should answer both queries from the saved results. */
+    test_yum_pdb_saved_lookups(2);
+
+    /* Updating the repository metadata should make us query yum again. */
+    bz_mock_file_contents(repomd, "base, updated");
+    test_yum_pdb_saved_lookups(4);
+    test_yum_pdb_saved_lookups(4);
+}
+END_TEST
+
+START_TEST(test_yum_pdb_saved_lookups_02)
+{
+    DESCRIBE_TEST;
+    /* If we can't find yum's repository metadata, we can't tell when it
+     * changes, so we shouldn't save anything. */
+    reset_everything();
+    bz_start_mocks();
+    mock_available_candidates("jansson", "jansson", "2.4", NULL);
+    mock_available_candidates("libfoo", NULL);
+    test_yum_pdb_saved_lookups(2);
+    test_yum_pdb_saved_lookups(4);
+    fail_if(strstr(bz_mocked_commands_run(), "native-rpm.cache") != NULL,
+            "Shouldn't save native package lookups");
+}
+END_TEST
+
+START_TEST(test_yum_pdb_saved_lookups_03)
+{
+    DESCRIBE_TEST;
+    /* We should never save anything if native_cache is false. */
+    reset_everything();
+    bz_start_mocks();
+    bz_env_add_override
+        (bz_global_env(), "native_cache", bz_string_value_new("false"));
+    bz_mock_file_contents
+        ("/var/cache/yum/x86_64/7/base/repodata/repomd.xml", "base");
+    mock_available_candidates("jansson", "jansson", "2.4", NULL);
+    mock_available_candidates("libfoo", NULL);
+    test_yum_pdb_saved_lookups(2);
+    test_yum_pdb_saved_lookups(4);
+    fail_if(strstr(bz_mocked_commands_run(), "native-rpm.cache") != NULL,
+            "Shouldn't save native package lookups");
+}
+END_TEST
+
+START_TEST(test_yum_pdb_batched_deps_01)
+{
+    DESCRIBE_TEST;
+    struct bz_version  *version;
+    struct bz_array  *deps;
+    struct bz_env  *env;
+    struct bz_package  *package;
+    struct bz_pdb  *pdb;
+
+    /* When we satisfy all of a package's dependencies, we should look up all
+     * of their candidate native package names with a single yum query, and
+     * check whether they're installed with a single rpm query. */
+    reset_everything();
+    bz_start_mocks();
+    bz_mock_subprocess
+        ("sudo yum info -C"
+         " jansson-devel libjansson-devel jansson libjansson"
+         " libfoo-devel liblibfoo-devel libfoo liblibfoo",
+         "Available Packages\n"
+         "Name        : jansson\n"
+         "Version     : 2.4\n"
+         "Release     : 1\n"
+         "\n"
+         "Name        : libfoo-devel\n"
+         "Version     : 2.0\n"
+         "Release     : 1\n",
+         NULL, 0);
+    bz_mock_subprocess
+        ("rpm --qf %{NAME} %{V}-%{R}\\n -q jansson libfoo-devel",
+         "jansson 2.4-1\n"
+         "package libfoo-devel is not installed\n",
+         NULL, 1);
+    mock_package_installation("libfoo-devel", "2.0");
+
+    fail_if_error(pdb = bz_yum_native_pdb());
+    bz_pdb_register(pdb);
+
+    fail_if_error(version = bz_version_from_string("1.0"));
+    fail_if_error(env = bz_package_env_new
+                  (NULL, "test", bz_version_copy(version)));
+    deps = bz_array_new();
+    bz_array_append(deps, bz_string_value_new("jansson"));
+    bz_array_append(deps, bz_string_value_new("libfoo >= 2.0"));
+    fail_if_error(bz_env_add_override
+                  (env, "dependencies", bz_array_as_value(deps)));
+    package = bz_package_new
+        ("test", version, env, bz_noop_builder_new(env),
+         bz_noop_packager_new(env));
+
+    fail_if_error(bz_package_install_deps(package));
+    test_actions("[1] Install native RPM package libfoo-devel 2.0\n");
+    verify_commands_run(
+        "$ sudo yum info -C"
+            " jansson-devel libjansson-devel jansson libjansson"
+            " libfoo-devel liblibfoo-devel libfoo liblibfoo\n"
+        "$ rpm --qf %{NAME} %{V}-%{R}\\n -q jansson libfoo-devel\n"
+        "$ sudo yum install -y libfoo-devel\n"
+    );
+
+    bz_package_free(package);
+    bz_version_free(version);
+    bz_env_free(env);
+}
+END_TEST
+
+
+static int
+test_step_needed(void *user_data, bool *is_needed)
+{
+    *is_needed = true;
+    return 0;
+}
+
+static int
+test_step_not_needed(void *user_data, bool *is_needed)
+{
+    *is_needed = false;
+    return 0;
+}
+
+static int
+test_step_nothing(void *user_data)
+{
+    return 0;
+}
+
+START_TEST(test_yum_pdb_batched_deps_02)
+{
+    DESCRIBE_TEST;
+    struct bz_version  *version;
+    struct bz_array  *deps;
+    struct bz_env  *env;
+    struct bz_env  *libbar_env;
+    struct bz_package  *package;
+    struct bz_package  *libbar;
+    struct bz_pdb  *pdb;
+
+    /* A dependency that an earlier package database can satisfy should never
+     * make it into the batched yum query. */
+    reset_everything();
+    bz_start_mocks();
+    mock_available_candidates("jansson", "jansson", "2.4", NULL);
+    mock_installed_package("jansson", "2.4");
+
+    fail_if_error(version = bz_version_from_string("1.0"));
+    fail_if_error(libbar_env = bz_package_env_new
+                  (NULL, "libbar", bz_version_copy(version)));
+    libbar = bz_package_new
+        ("libbar", bz_version_copy(version), libbar_env,
+         bz_noop_builder_new(libbar_env),
+         bz_packager_new
+         (libbar_env, "test", NULL, NULL,
+          test_step_not_needed, test_step_nothing,
+          test_step_not_needed, test_step_nothing,
+          test_step_not_needed, test_step_nothing));
+    bz_pdb_register(bz_single_package_pdb_new("libbar", libbar));
+    fail_if_error(pdb = bz_yum_native_pdb());
+    bz_pdb_register(pdb);
+
+    fail_if_error(env = bz_package_env_new
+                  (NULL, "test", bz_version_copy(version)));
+    deps = bz_array_new();
+    bz_array_append(deps, bz_string_value_new("jansson"));
+    bz_array_append(deps, bz_string_value_new("libbar"));
+    fail_if_error(bz_env_add_override
+                  (env, "dependencies", bz_array_as_value(deps)));
+    package = bz_package_new
+        ("test", version, env, bz_noop_builder_new(env),
+         bz_noop_packager_new(env));
+
+    fail_if_error(bz_package_install_deps(package));
+    verify_commands_run(
+        "$ sudo yum info -C"
+            " jansson-devel libjansson-devel jansson libjansson\n"
+        "$ rpm --qf %{V}-%{R}\\n -q jansson\n"
+    );
+
+    bz_package_free(package);
+    bz_version_free(version);
+    bz_env_free(env);
+    bz_pdb_registry_clear();
+    bz_env_free(libbar_env);
+}
+END_TEST
+
+START_TEST(test_yum_pdb_installed_changed_01)
+{
+    DESCRIBE_TEST;
+    struct bz_version  *version;
+    struct bz_array  *deps;
+    struct bz_env  *env;
+    struct bz_package  *package;
+    struct bz_package  *libbaz;
+    struct bz_packager  *packager;
+    struct bz_pdb  *pdb;
+
+    /* Installing a source package might change which native packages are
+     * installed, so the next time we need to know, we should ask rpm about
+     * all of them again. */
+    reset_everything();
+    bz_start_mocks();
+    bz_mock_subprocess
+        ("sudo yum info -C"
+         " jansson-devel libjansson-devel jansson libjansson"
+         " libfoo-devel liblibfoo-devel libfoo liblibfoo",
+         "Available Packages\n"
+         "Name        : jansson\n"
+         "Version     : 2.4\n"
+         "Release     : 1\n"
+         "\n"
+         "Name        : libfoo-devel\n"
+         "Version     : 2.0\n"
+         "Release     : 1\n",
+         NULL, 0);
+    bz_mock_subprocess
+        ("rpm --qf %{NAME} %{V}-%{R}\\n -q jansson libfoo-devel",
+         "jansson 2.4-1\n"
+         "libfoo-devel 2.0-1\n",
+         NULL, 0);
+    mock_available_candidates("libbaz", "libbaz", "1.0", NULL);
+    bz_mock_subprocess
+        ("rpm --qf %{NAME} %{V}-%{R}\\n -q libbaz jansson libfoo-devel",
+         "libbaz 1.0-1\n"
+         "jansson 2.4-1\n"
+         "libfoo-devel 2.0-1\n",
+         NULL, 0);
+
+    fail_if_error(pdb = bz_yum_native_pdb());
+    bz_pdb_register(pdb);
+
+    fail_if_error(version = bz_version_from_string("1.0"));
+    fail_if_error(env = bz_package_env_new
+                  (NULL, "test", bz_version_copy(version)));
+    deps = bz_array_new();
+    bz_array_append(deps, bz_string_value_new("jansson"));
+    bz_array_append(deps, bz_string_value_new("libfoo"));
+    fail_if_error(bz_env_add_override
+                  (env, "dependencies", bz_array_as_value(deps)));
+    package = bz_package_new
+        ("test", version, env, bz_noop_builder_new(env),
+         bz_noop_packager_new(env));
+    fail_if_error(bz_package_install_deps(package));
+
+    packager = bz_packager_new
+        (env, "test", NULL, NULL,
+         test_step_needed, test_step_nothing,
+         test_step_needed, test_step_nothing,
+         test_step_needed, test_step_nothing);
+    fail_if_error(bz_packager_install(packager));
+
+    fail_if_error(libbaz = bz_satisfy_dependency_string("libbaz", NULL));
+    fail_if_error(bz_package_install(libbaz));
+    test_actions("Nothing to do!\n");
+    verify_commands_run(
+        "$ sudo yum info -C"
+            " jansson-devel libjansson-devel jansson libjansson"
+            " libfoo-devel liblibfoo-devel libfoo liblibfoo\n"
+        "$ rpm --qf %{NAME} %{V}-%{R}\\n -q jansson libfoo-devel\n"
+        "$ sudo yum info -C libbaz-devel liblibbaz-devel libbaz liblibbaz\n"
+        "$ rpm --qf %{NAME} %{V}-%{R}\\n -q libbaz jansson libfoo-devel\n"
+    );
+
+    bz_packager_free(packager);
+    bz_package_free(package);
+    bz_version_free(version);
+    bz_env_free(env);
+}
+END_TEST
+
+
+START_TEST(test_yum_pdb_single_transaction_01)
+{
+    DESCRIBE_TEST;
+    struct bz_version  *version;
+    struct bz_array  *deps;
+    struct bz_env  *env;
+    struct bz_package  *package;
+    struct bz_pdb  *pdb;
+
+    /* When several of a package's dependencies are native packages that
+     * aren't installed yet, we should install all of them with a single yum
+     * transaction, but still log an action for each one. */
+    reset_everything();
+    bz_start_mocks();
+    bz_mock_subprocess
+        ("sudo yum info -C"
+         " libfoo-devel liblibfoo-devel libfoo liblibfoo"
+         " libbar-devel liblibbar-devel libbar liblibbar",
+         "Available Packages\n"
+         "Name        : libfoo-devel\n"
+         "Version     : 2.0\n"
+         "Release     : 1\n"
+         "\n"
+         "Name        : libbar-devel\n"
+         "Version     : 1.5\n"
+         "Release     : 1\n",
+         NULL, 0);
+    bz_mock_subprocess
+        ("rpm --qf %{NAME} %{V}-%{R}\\n -q libfoo-devel libbar-devel",
+         "package libfoo-devel is not installed\n"
+         "package libbar-devel is not installed\n",
+         NULL, 1);
+    bz_mock_subprocess("sudo yum install -y libfoo-devel libbar-devel",
+                       NULL, NULL, 0);
+
+    fail_if_error(pdb = bz_yum_native_pdb());
+    bz_pdb_register(pdb);
+
+    fail_if_error(version = bz_version_from_string("1.0"));
+    fail_if_error(env = bz_package_env_new
+                  (NULL, "test", bz_version_copy(version)));
+    deps = bz_array_new();
+    bz_array_append(deps, bz_string_value_new("libfoo"));
+    bz_array_append(deps, bz_string_value_new("libbar"));
+    fail_if_error(bz_env_add_override
+                  (env, "dependencies", bz_array_as_value(deps)));
+    package = bz_package_new
+        ("test", version, env, bz_noop_builder_new(env),
+         bz_noop_packager_new(env));
+
+    fail_if_error(bz_package_install_deps(package));
+    test_actions(
+        "[1] Install native RPM package libfoo-devel 2.0\n"
+        "[2] Install native RPM package libbar-devel 1.5\n"
+    );
+    verify_commands_run(
+        "$ sudo yum info -C"
+            " libfoo-devel liblibfoo-devel libfoo liblibfoo"
+            " libbar-devel liblibbar-devel libbar liblibbar\n"
+        "$ rpm --qf %{NAME} %{V}-%{R}\\n -q libfoo-devel libbar-devel\n"
+        "$ sudo yum install -y libfoo-devel libbar-devel\n"
+    );
+
+    bz_package_free(package);
+    bz_version_free(version);
+    bz_env_free(env);
+}
+END_TEST
+
 
 /*-----------------------------------------------------------------------
  * Building RPM packages
@@ -515,10 +1001,7 @@ test_create_package(struct bz_env *env, bool force,
     fail_if_error(pdb = bz_yum_native_pdb());
     bz_pdb_register(pdb);
 
-    mock_unavailable_package("librpm-build");
-    mock_unavailable_package("librpm-build-devel");
-    mock_unavailable_package("rpm-build-devel");
-    mock_available_package("rpm-build", "4.8.0");
+    mock_available_candidates("rpm-build", "rpm-build", "4.8.0", NULL);
     mock_installed_package("rpm-build", "4.8.0");
     bz_mock_file_exists(cork_path_get(staging_dir), true);
     bz_env_add_override(env, "binary_package_dir",
@@ -550,9 +1033,8 @@ START_TEST(test_rpm_create_package_01)
     verify_commands_run(
         "$ uname -m\n"
         "$ [ -f ./jansson-2.4-1.x86_64.rpm ]\n"
-        "$ sudo yum info -C rpm-build-devel\n"
-        "$ sudo yum info -C librpm-build-devel\n"
-        "$ sudo yum info -C rpm-build\n"
+        "$ sudo yum info -C"
+            " rpm-build-devel librpm-build-devel rpm-build librpm-build\n"
         "$ rpm --qf %{V}-%{R}\\n -q rpm-build\n"
         "$ [ -f /tmp/staging ]\n"
         "$ mkdir -p /home/test/.cache/buzzy/build/jansson-buzzy/pkg\n"
@@ -621,9 +1103,8 @@ START_TEST(test_rpm_create_package_license_01)
     verify_commands_run(
         "$ uname -m\n"
         "$ [ -f ./jansson-2.4-1.x86_64.rpm ]\n"
-        "$ sudo yum info -C rpm-build-devel\n"
-        "$ sudo yum info -C librpm-build-devel\n"
-        "$ sudo yum info -C rpm-build\n"
+        "$ sudo yum info -C"
+            " rpm-build-devel librpm-build-devel rpm-build librpm-build\n"
         "$ rpm --qf %{V}-%{R}\\n -q rpm-build\n"
         "$ [ -f /tmp/staging ]\n"
         "$ mkdir -p /home/test/.cache/buzzy/build/jansson-buzzy/pkg\n"
@@ -692,9 +1173,8 @@ START_TEST(test_rpm_create_package_relocatable_01)
     verify_commands_run(
         "$ uname -m\n"
         "$ [ -f ./jansson-2.4-1.x86_64.rpm ]\n"
-        "$ sudo yum info -C rpm-build-devel\n"
-        "$ sudo yum info -C librpm-build-devel\n"
-        "$ sudo yum info -C rpm-build\n"
+        "$ sudo yum info -C"
+            " rpm-build-devel librpm-build-devel rpm-build librpm-build\n"
         "$ rpm --qf %{V}-%{R}\\n -q rpm-build\n"
         "$ [ -f /tmp/staging ]\n"
         "$ mkdir -p /home/test/.cache/buzzy/build/jansson-buzzy/pkg\n"
@@ -759,9 +1239,9 @@ START_TEST(test_rpm_create_package_deps_01)
     fail_if_error(env = bz_package_env_new(NULL, "jansson", version));
     deps = bz_array_new();
     bz_array_append(deps, bz_string_value_new("libfoo"));
-    mock_available_package("libfoo-devel", "2.0");
+    mock_available_candidates("libfoo", "libfoo-devel", "2.0", NULL);
     bz_array_append(deps, bz_string_value_new("libbar >= 2.5~alpha.1"));
-    mock_available_package("libbar-devel", "2.5");
+    mock_available_candidates("libbar", "libbar-devel", "2.5", NULL);
     fail_if_error(bz_env_add_override
                   (env, "dependencies", bz_array_as_value(deps)));
     test_create_package(env, false,
@@ -770,15 +1250,14 @@ START_TEST(test_rpm_create_package_deps_01)
     verify_commands_run(
         "$ uname -m\n"
         "$ [ -f ./jansson-2.4-1.x86_64.rpm ]\n"
-        "$ sudo yum info -C rpm-build-devel\n"
-        "$ sudo yum info -C librpm-build-devel\n"
-        "$ sudo yum info -C rpm-build\n"
+        "$ sudo yum info -C"
+            " rpm-build-devel librpm-build-devel rpm-build librpm-build\n"
         "$ rpm --qf %{V}-%{R}\\n -q rpm-build\n"
         "$ [ -f /tmp/staging ]\n"
         "$ mkdir -p /home/test/.cache/buzzy/build/jansson-buzzy/pkg\n"
         "$ mkdir -p .\n"
-        "$ sudo yum info -C libfoo-devel\n"
-        "$ sudo yum info -C libbar-devel\n"
+        "$ sudo yum info -C libfoo-devel liblibfoo-devel libfoo liblibfoo\n"
+        "$ sudo yum info -C libbar-devel liblibbar-devel libbar liblibbar\n"
         "$ cat > /home/test/.cache/buzzy/build/jansson-buzzy/pkg/jansson.spec"
             " <<EOF\n"
         "Summary: jansson\n"
@@ -864,9 +1343,8 @@ START_TEST(test_rpm_create_package_with_scripts_01)
     verify_commands_run(
         "$ uname -m\n"
         "$ [ -f ./jansson-2.4-1.x86_64.rpm ]\n"
-        "$ sudo yum info -C rpm-build-devel\n"
-        "$ sudo yum info -C librpm-build-devel\n"
-        "$ sudo yum info -C rpm-build\n"
+        "$ sudo yum info -C"
+            " rpm-build-devel librpm-build-devel rpm-build librpm-build\n"
         "$ rpm --qf %{V}-%{R}\\n -q rpm-build\n"
         "$ [ -f /tmp/staging ]\n"
         "$ mkdir -p /home/test/.cache/buzzy/build/jansson-buzzy/pkg\n"
@@ -959,9 +1437,8 @@ START_TEST(test_rpm_create_existing_package_02)
         "[1] Package jansson 2.4 (RPM)\n"
     );
     verify_commands_run(
-        "$ sudo yum info -C rpm-build-devel\n"
-        "$ sudo yum info -C librpm-build-devel\n"
-        "$ sudo yum info -C rpm-build\n"
+        "$ sudo yum info -C"
+            " rpm-build-devel librpm-build-devel rpm-build librpm-build\n"
         "$ rpm --qf %{V}-%{R}\\n -q rpm-build\n"
         "$ uname -m\n"
         "$ [ -f /tmp/staging ]\n"
@@ -1027,6 +1504,8 @@ test_suite()
     tcase_add_test(tc_rpm, test_yum_uninstalled_native_package_01);
     tcase_add_test(tc_rpm, test_yum_installed_native_package_01);
     tcase_add_test(tc_rpm, test_yum_nonexistent_native_package_01);
+    tcase_add_test(tc_rpm, test_yum_available_many_01);
+    tcase_add_test(tc_rpm, test_rpm_installed_many_01);
     suite_add_tcase(s, tc_rpm);
 
     TCase  *tc_yum_pdb = tcase_create("yum-pdb");
@@ -1037,6 +1516,13 @@ test_suite()
     tcase_add_test(tc_yum_pdb, test_yum_pdb_uninstalled_override_package_01);
     tcase_add_test(tc_yum_pdb, test_yum_pdb_uninstalled_override_package_02);
     tcase_add_test(tc_yum_pdb, test_yum_pdb_preinstalled_package_01);
+    tcase_add_test(tc_yum_pdb, test_yum_pdb_saved_lookups_01);
+    tcase_add_test(tc_yum_pdb, test_yum_pdb_saved_lookups_02);
+    tcase_add_test(tc_yum_pdb, test_yum_pdb_saved_lookups_03);
+    tcase_add_test(tc_yum_pdb, test_yum_pdb_batched_deps_01);
+    tcase_add_test(tc_yum_pdb, test_yum_pdb_batched_deps_02);
+    tcase_add_test(tc_yum_pdb, test_yum_pdb_installed_changed_01);
+    tcase_add_test(tc_yum_pdb, test_yum_pdb_single_transaction_01);
     suite_add_tcase(s, tc_yum_pdb);
 
     TCase  *tc_rpm_package = tcase_create("rpm-package");
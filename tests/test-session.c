@@ -0,0 +1,303 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2015, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <check.h>
+#include <libcork/threads.h>
+#include <libcork/helpers/errors.h>
+
+#include "buzzy/env.h"
+#include "buzzy/error.h"
+#include "buzzy/mock.h"
+#include "buzzy/os.h"
+#include "buzzy/package.h"
+#include "buzzy/session.h"
+#include "buzzy/value.h"
+#include "buzzy/version.h"
+
+#include "helpers.h"
+
+
+/*-----------------------------------------------------------------------
+ * Helper functions
+ */
+
+/* Creates a new package that doesn't need to be built or packaged, and
+ * registers a package database in the current session that provides it.  The
+ * dependency list is a NULL-terminated list of dependency strings.  Package
+ * environments aren't owned by their packages, so we return the environment,
+ * which the caller must free after the package's session. */
+static struct bz_env *
+add_test_package(const char *name, const char *version_string, ...)
+{
+    va_list  args;
+    struct bz_version  *version;
+    struct bz_env  *env;
+    struct bz_array  *deps;
+    struct bz_package  *package;
+    const char  *dep;
+
+    fail_if_error(version = bz_version_from_string(version_string));
+    fail_if_error(env = bz_package_env_new
+                  (NULL, name, bz_version_copy(version)));
+
+    va_start(args, version_string);
+    deps = bz_array_new();
+    while ((dep = va_arg(args, const char *)) != NULL) {
+        bz_array_append(deps, bz_string_value_new(dep));
+    }
+    va_end(args);
+    fail_if_error(bz_env_add_override
+                  (env, "dependencies", bz_array_as_value(deps)));
+
+    package = bz_package_new
+        (name, version, env,
+         bz_noop_builder_new(env), bz_noop_packager_new(env));
+    bz_version_free(version);
+    bz_pdb_register(bz_single_package_pdb_new(name, package));
+    return env;
+}
+
+/* A small dependency graph: a depends on b and c, both of which depend on d. */
+
+#define TEST_PACKAGE_COUNT  4
+
+static void
+add_test_packages(struct bz_env **envs)
+{
+    envs[0] = add_test_package("a", "1.0", "b >= 1.0", "c", NULL);
+    envs[1] = add_test_package("b", "1.2", "d >= 2.0", NULL);
+    envs[2] = add_test_package("c", "1.0", "d", NULL);
+    envs[3] = add_test_package("d", "2.1", NULL);
+}
+
+static void
+free_test_envs(struct bz_env **envs)
+{
+    size_t  i;
+    for (i = 0; i < TEST_PACKAGE_COUNT; i++) {
+        bz_env_free(envs[i]);
+    }
+}
+
+/* Resolves the test dependency graph, checking that we find the packages that
+ * we expect. */
+static int
+resolve_test_packages(void)
+{
+    struct bz_package  *a;
+    struct bz_package  *b;
+    struct bz_package_list  *deps;
+
+    rip_check(a = bz_satisfy_dependency_string("a >= 1.0", NULL));
+    rip_check(deps = bz_package_deps(a));
+    if (bz_package_list_count(deps) != 2) {
+        cork_error_set_printf
+            (ENOENT, "Expected 2 dependencies for a, got %zu",
+             bz_package_list_count(deps));
+        return -1;
+    }
+
+    b = bz_package_list_get(deps, 0);
+    if (strcmp(bz_package_name(b), "b") != 0) {
+        cork_error_set_printf
+            (ENOENT, "Expected first dependency to be b, got %s",
+             bz_package_name(b));
+        return -1;
+    }
+    rip_check(deps = bz_package_deps(b));
+    if (bz_package_list_count(deps) != 1) {
+        cork_error_set_printf
+            (ENOENT, "Expected 1 dependency for b, got %zu",
+             bz_package_list_count(deps));
+        return -1;
+    }
+
+    /* And some that we can't satisfy. */
+    if (bz_satisfy_dependency_string("d >= 3.0", NULL) != NULL) {
+        cork_error_set_printf(ENOENT, "Shouldn't be able to satisfy d >= 3.0");
+        return -1;
+    }
+    cork_error_clear();
+    return 0;
+}
+
+#define THREAD_COUNT  8
+#define ITERATION_COUNT  200
+
+/* Resolves the test dependency graph over and over in the current session. */
+static int
+resolve_repeatedly(void *user_data)
+{
+    size_t  i;
+    for (i = 0; i < ITERATION_COUNT; i++) {
+        rii_check(resolve_test_packages());
+    }
+    return 0;
+}
+
+/* Creates a separate session for the current thread, and resolves the test
+ * dependency graph over and over in it. */
+static int
+resolve_repeatedly_in_new_session(void *user_data)
+{
+    int  rc;
+    struct bz_env  *envs[TEST_PACKAGE_COUNT];
+    struct bz_session  *session = bz_session_new();
+    bz_session_set_current(session);
+    add_test_packages(envs);
+    rc = resolve_repeatedly(user_data);
+    bz_session_set_current(NULL);
+    bz_session_free(session);
+    free_test_envs(envs);
+    return rc;
+}
+
+static void
+run_threads(cork_run_f run)
+{
+    size_t  i;
+    struct cork_thread  *threads[THREAD_COUNT];
+    for (i = 0; i < THREAD_COUNT; i++) {
+        fail_if_error(threads[i] = cork_thread_new
+                      ("resolve", NULL, NULL, run));
+    }
+    for (i = 0; i < THREAD_COUNT; i++) {
+        fail_if_error(cork_thread_start(threads[i]));
+    }
+    for (i = 0; i < THREAD_COUNT; i++) {
+        fail_if_error(cork_thread_join(threads[i]));
+    }
+}
+
+
+/*-----------------------------------------------------------------------
+ * Sessions
+ */
+
+START_TEST(test_session_independent_01)
+{
+    DESCRIBE_TEST;
+    struct bz_env  *envs[TEST_PACKAGE_COUNT];
+    struct bz_session  *session;
+
+    /* Package databases registered in one session aren't visible in any
+     * other. */
+    reset_everything();
+    session = bz_session_new();
+    fail_unless(bz_session_set_current(session) == bz_session_default(),
+                "Default session should be current");
+    fail_unless(bz_session_current() == session,
+                "New session should be current");
+    add_test_packages(envs);
+    fail_if_error(resolve_test_packages());
+
+    fail_unless(bz_session_set_current(NULL) == session,
+                "New session should have been current");
+    fail_unless_error(bz_satisfy_dependency_string("a", NULL),
+                      "Shouldn't be able to satisfy a in default session");
+    fail_unless(bz_global_env() != NULL, "Should have a global env");
+
+    bz_session_free(session);
+    free_test_envs(envs);
+}
+END_TEST
+
+START_TEST(test_session_shared_threads_01)
+{
+    DESCRIBE_TEST;
+    struct bz_env  *envs[TEST_PACKAGE_COUNT];
+
+    /* Several threads can resolve dependencies in the same session at the
+     * same time. */
+    reset_everything();
+    add_test_packages(envs);
+    run_threads(resolve_repeatedly);
+    bz_pdb_registry_clear();
+    free_test_envs(envs);
+}
+END_TEST
+
+START_TEST(test_session_separate_threads_01)
+{
+    DESCRIBE_TEST;
+
+    /* Or each thread can have a session of its own. */
+    reset_everything();
+    run_threads(resolve_repeatedly_in_new_session);
+}
+END_TEST
+
+START_TEST(test_session_mocks_01)
+{
+    DESCRIBE_TEST;
+    struct bz_session  *session;
+    struct cork_buffer  buf = CORK_BUFFER_INIT();
+
+    /* Each session has its own mocks. */
+    reset_everything();
+    bz_start_mocks();
+    bz_mock_file_contents("/home/test/file", "default\n");
+
+    session = bz_session_new();
+    bz_session_set_current(session);
+    bz_start_mocks();
+    bz_mock_file_contents("/home/test/file", "new session\n");
+    fail_if_error(bz_load_file("/home/test/file", &buf));
+    fail_unless_streq("File contents", "new session\n", buf.buf);
+
+    bz_session_set_current(NULL);
+    bz_session_free(session);
+    cork_buffer_clear(&buf);
+    fail_if_error(bz_load_file("/home/test/file", &buf));
+    fail_unless_streq("File contents", "default\n", buf.buf);
+    cork_buffer_done(&buf);
+}
+END_TEST
+
+
+/*-----------------------------------------------------------------------
+ * Testing harness
+ */
+
+Suite *
+test_suite()
+{
+    Suite  *s = suite_create("session");
+
+    TCase  *tc_session = tcase_create("session");
+    tcase_add_test(tc_session, test_session_independent_01);
+    tcase_add_test(tc_session, test_session_shared_threads_01);
+    tcase_add_test(tc_session, test_session_separate_threads_01);
+    tcase_add_test(tc_session, test_session_mocks_01);
+    suite_add_tcase(s, tc_session);
+
+    return s;
+}
+
+
+int
+main(int argc, const char **argv)
+{
+    int  number_failed;
+    Suite  *suite = test_suite();
+    SRunner  *runner = srunner_create(suite);
+
+    initialize_tests();
+    srunner_run_all(runner, CK_NORMAL);
+    number_failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return (number_failed == 0)? EXIT_SUCCESS: EXIT_FAILURE;
+}
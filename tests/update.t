@@ -6,6 +6,7 @@ Reproducible directory names.
   $ unset XDG_CACHE_DIRS
   $ unset XDG_DATA_HOME
   $ unset XDG_DATA_DIRS
+  $ export BUZZY_YAML_CACHE_DIR=$PWD/yaml-cache
 
 Prepare a handful of repository directories, and then verify the output when we
 run "buzzy update" in each of them.
@@ -21,3 +22,64 @@ run "buzzy update" in each of them.
   $ buzzy update
   Nothing to do!
   $ cd ..
+
+Link to some git repositories, using local bare repositories as the remotes so
+that we don't need network access.  With several jobs, we update the
+repositories at the same time, but still print out what we did in order.
+
+  $ REPOS="$PWD"
+  $ export XDG_CACHE_HOME="$REPOS/cache"
+  $ export GIT_AUTHOR_NAME=test GIT_AUTHOR_EMAIL=test@example.com
+  $ export GIT_COMMITTER_NAME=test GIT_COMMITTER_EMAIL=test@example.com
+  $ for name in one two three; do
+  >   git init -q --bare -b master origins/$name.git
+  >   git clone -q origins/$name.git work/$name 2>/dev/null
+  >   echo "$name 1" > work/$name/version
+  >   git -C work/$name add version
+  >   git -C work/$name commit -q -m "$name 1"
+  >   git -C work/$name push -q origin master
+  > done
+
+  $ mkdir -p repo2/.buzzy
+  $ for name in one two three; do
+  >   echo "- !git"
+  >   echo "  url: file://$REPOS/origins/$name.git"
+  >   echo "  commit: master"
+  > done > repo2/.buzzy/links.yaml
+
+  $ cd repo2
+  $ buzzy update -j 3
+  [1] Clone file://*/origins/one.git (master) (glob)
+  [2] Clone file://*/origins/two.git (master) (glob)
+  [3] Clone file://*/origins/three.git (master) (glob)
+  [4] Update file://*/origins/one.git (master) (glob)
+  [5] Update file://*/origins/two.git (master) (glob)
+  [6] Update file://*/origins/three.git (master) (glob)
+  $ cd ..
+
+  $ echo "two 2" > work/two/version
+  $ git -C work/two commit -q -a -m "two 2"
+  $ git -C work/two push -q origin master
+  $ cd repo2
+  $ buzzy update --jobs 2
+  [1] Update file://*/origins/one.git (master) (glob)
+  [2] Update file://*/origins/two.git (master) (glob)
+  [3] Update file://*/origins/three.git (master) (glob)
+  $ cat ../cache/buzzy/repos/two-*/version
+  two 2
+  $ cd ..
+
+If any of the updates fail, we still update the rest, and then report all of
+the failures together.
+
+  $ mv origins/one.git origins/one-moved.git
+  $ mv origins/three.git origins/three-moved.git
+  $ cd repo2
+  $ buzzy update -j 3 2> /dev/null
+  [1] Update file://*/origins/one.git (master) (glob)
+  [2] Update file://*/origins/two.git (master) (glob)
+  [3] Update file://*/origins/three.git (master) (glob)
+  [1]
+  $ buzzy update -j 3 2>&1 > /dev/null | tail -n 1
+  Couldn't update file://*/origins/one.git (master), file://*/origins/three.git (master) (glob)
+  $ cd ..